@@ -30,6 +30,8 @@ yum -y install \
     libtiff-devel \
     libxml2-devel \
     libzip-devel \
+    libzstd-devel \
+    lz4-devel \
     minizip-devel \
     proj-devel \
     sqlite-devel
@@ -56,6 +56,10 @@ public:
     void stop() const;
     void dump() const;
 
+    // records an event timed elsewhere, such as on another thread (the
+    // caller must serialize the calls)
+    void add(double millis) const;
+
     // clock_t start = timerStart();
     // <spin cycles>
     // uint32_t millis = timerStop(start);
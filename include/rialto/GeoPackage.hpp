@@ -38,6 +38,9 @@
 
 #include <rialto/Event.hpp>
 
+#include <map>
+#include <memory>
+
 
 namespace pdal
 {
@@ -51,6 +54,7 @@ class SQLite;
 class GpkgMatrixSet;
 class GpkgTile;
 class GpkgDimension;
+class TileMath;
 
 class PDAL_DLL GeoPackage
 {
@@ -69,12 +73,50 @@ public:
     // get info about a specific tile matrix set (including its dimensions)
     void readMatrixSet(std::string const& name, GpkgMatrixSet& info) const;
 
+    // as above, but only read from the db the first time: kept until the
+    // matrix set is changed through this connection, or it is closed
+    const GpkgMatrixSet& getMatrixSet(std::string const& name) const;
+    const TileMath& getTileMath(std::string const& name) const;
+
     // get list of names all the matrix sets ("files") in the db
     void readMatrixSetNames(std::vector<std::string>&) const;
 
     // get list of all the matrix sets ("files") in the db
     void readMatrixSets(std::vector<GpkgMatrixSet>&) const;
 
+    // get a tile, with its points, by where it is in the matrix; returns
+    // false if there is no such tile
+    bool readTile(std::string const& name, uint32_t level, uint32_t column, uint32_t row,
+                  GpkgTile& tileInfo) const;
+
+    // as above, for the tiles at the positions of the given ones, in one
+    // query; those not in the table are left out, and the rest come in no
+    // particular order
+    void readTilesAt(std::string const& name, const std::vector<GpkgTile>& positions,
+                     std::vector<GpkgTile>& tiles) const;
+
+    // used largely for gathering statistics
+    void getCountsAtLevel(std::string const& name, uint32_t level, uint32_t& numTiles, uint32_t& numPoints) const;
+
+    // the table beside a tile table with the least and greatest value of
+    // each dimension, by position, over the points of each tile; tables
+    // written before it have none
+    static std::string statsTableName(const std::string& tileTableName)
+    {
+        return tileTableName + "_stats";
+    }
+    static std::string statsExtensionName() { return "rialto_tile_stats"; }
+
+    // whether the tile set has its stats table, looked for once, as with
+    // the matrix set
+    bool hasTileStats(std::string const& name) const;
+
+    // whether the tile set has a row for each tile the decimation left with
+    // no points of its own, so that its mask can be followed; tables
+    // written before it only have the tiles with points
+    bool hasEmptyTiles(std::string const& name) const;
+    static std::string emptyTilesExtensionName() { return "rialto_empty_tiles"; }
+
     virtual void dumpStats() const;
 
     bool doesTableExist(std::string const& name) const;
@@ -93,6 +135,10 @@ protected:
 
     void verifyTableExists(std::string const& name) const;
 
+    // call after changing a matrix set, or all of them
+    void clearMatrixSetCache(std::string const& name);
+    void clearMatrixSetCache();
+
     LogPtr log() const { return m_log; }
 
     std::unique_ptr<SQLite> m_sqlite;
@@ -101,6 +147,13 @@ private:
     std::string m_connection;
     LogPtr m_log;
 
+    void queryMatrixSet(std::string const& name, GpkgMatrixSet& info) const;
+    bool queryExtension(std::string const& name, std::string const& extension) const;
+
+    struct CachedMatrixSet;
+    mutable std::map<std::string, std::shared_ptr<const CachedMatrixSet>> m_matrixSets;
+    mutable uint32_t m_matrixSetCacheHits;
+
     Event e_readMatrixSet;
     Event e_srsQueries;
 
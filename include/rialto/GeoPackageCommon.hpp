@@ -35,11 +35,125 @@
 #pragma once
 
 #include <pdal/pdal.hpp>
+#include <limits>
+#include <memory>
 
 namespace rialto
 {
     using namespace pdal;
 
+class TileMath;
+
+
+// how the points of a tile are laid out in its blob
+enum GpkgEncoding
+{
+    GpkgEncodingPacked,    // point by point
+    GpkgEncodingColumnar,  // dimension by dimension: see ColumnarCodec
+};
+
+
+// how a tile's blob is compressed, once its points are laid out
+enum GpkgCompression
+{
+    GpkgCompressionNone,
+    GpkgCompressionLazPerf, // of the points, so only for packed tiles
+    GpkgCompressionZstd,
+    GpkgCompressionLz4
+};
+
+
+// A compression, and its level where it has one, as named in the tile
+// table: "none", "lazperf", "lz4", "zstd" or "zstd:<level>".
+class GpkgCodec
+{
+public:
+    GpkgCodec(GpkgCompression compression=GpkgCompressionNone, int level=0);
+
+    // throws if the name is unknown, or the codec isn't built in
+    static GpkgCodec parse(const std::string& name);
+
+    // a codec per level, as a comma-separated list: the last one goes for
+    // all the deeper levels too
+    static std::vector<GpkgCodec> parseList(const std::string& names);
+    static std::string toList(const std::vector<GpkgCodec>& codecs);
+
+    std::string getName() const;
+    GpkgCompression getCompression() const { return m_compression; }
+    int getLevel() const { return m_level; }
+
+    // works on the bytes of the blob, whatever the encoding
+    bool isByteCodec() const
+    {
+        return m_compression == GpkgCompressionZstd || m_compression == GpkgCompressionLz4;
+    }
+
+private:
+    GpkgCompression m_compression;
+    int m_level;
+};
+
+
+// How the points are stored in the tiles of a matrix set: their layout,
+// how each level's tiles are compressed, and whether X, Y and Z are
+// quantized.
+//
+// Quantized X and Y are stored as 32-bit integers, counting steps of their
+// scale up from the lower-left corner of the tile, and Z likewise from the
+// Z offset. A dim is quantized only if it is a double and its scale isn't
+// 0. Quantizing X and Y needs the tile matrix, for the tile corners.
+class GpkgTileFormat
+{
+public:
+    GpkgTileFormat(GpkgEncoding encoding=GpkgEncodingPacked);
+
+    // the gpkg_extensions rows holding the codecs and the scales
+    static std::string codecsExtensionName() { return "rialto_tile_codecs"; }
+    static std::string quantizationExtensionName() { return "rialto_quantized_xyz"; }
+
+    // by default LazPerf for packed tiles, if built with it, else none;
+    // throws if a codec doesn't suit the encoding
+    void setCodecs(const std::vector<GpkgCodec>& codecs);
+    const std::vector<GpkgCodec>& getCodecs() const { return m_codecs; }
+    const GpkgCodec& getCodec(uint32_t level) const
+    {
+        return m_codecs[level < m_codecs.size() ? level : m_codecs.size() - 1];
+    }
+
+    void setQuantization(double scaleX, double scaleY, double scaleZ, double offsetZ);
+    void setTileMatrix(double minx, double miny, double maxx, double maxy,
+                       uint32_t numColsAtL0, uint32_t numRowsAtL0);
+
+    GpkgEncoding getEncoding() const { return m_encoding; }
+    bool isQuantized() const { return m_scaleX != 0.0 || m_scaleY != 0.0 || m_scaleZ != 0.0; }
+    double getScaleX() const { return m_scaleX; }
+    double getScaleY() const { return m_scaleY; }
+    double getScaleZ() const { return m_scaleZ; }
+    double getOffsetZ() const { return m_offsetZ; }
+
+    // the dims as stored in the tiles, with the quantized ones as Signed32
+    DimTypeList getStoredDims(const DimTypeList& dims) const;
+
+    // turns points of the given tile packed per the dims into points
+    // packed per the stored dims, in place, and back again
+    void quantize(const DimTypeList& dims, uint32_t numPoints,
+                  uint32_t level, uint32_t column, uint32_t row,
+                  std::vector<char>& buf) const;
+    void dequantize(const DimTypeList& dims, uint32_t numPoints,
+                    uint32_t level, uint32_t column, uint32_t row,
+                    std::vector<char>& buf) const;
+
+private:
+    double getScale(const DimType& dim) const;
+    void getOrigin(uint32_t level, uint32_t column, uint32_t row,
+                   double& x, double& y) const;
+
+    GpkgEncoding m_encoding;
+    std::vector<GpkgCodec> m_codecs; // by level, the last for the rest
+    double m_scaleX, m_scaleY, m_scaleZ, m_offsetZ;
+    std::shared_ptr<const TileMath> m_tileMath; // made once, shared by the copies
+};
+
 
 class GpkgDimension
 {
@@ -133,8 +247,15 @@ public:
     uint32_t getNumColsAtL0() const { return m_numColsAtL0; }
     uint32_t getNumRowsAtL0() const { return m_numRowsAtL0; }
 
+    // kept in gpkg_extensions, not set(); the tile matrix of the format
+    // comes from this matrix set
+    GpkgTileFormat getTileFormat() const;
+    void setTileFormat(const GpkgTileFormat& format) { m_tileFormat = format; }
+    GpkgEncoding getEncoding() const { return m_tileFormat.getEncoding(); }
+
     // helpers
     uint32_t getBytesPerPoint() const; // helper method
+    DimTypeList getDimTypes() const; // in order of position, as in the tiles
 
 private:
     std::string m_datetime;
@@ -155,16 +276,26 @@ private:
     uint32_t m_numRowsAtL0;
     std::string m_description;
     std::string m_lasMetadata;
+    GpkgTileFormat m_tileFormat;
 };
 
 
 class GpkgTile
 {
 public:
-    GpkgTile() {}
+    GpkgTile() : m_blobRef(0), m_blobRefSize(0) {}
+
+    GpkgTile(PointView* view, uint32_t level, uint32_t column, uint32_t row, uint32_t mask,
+             const GpkgTileFormat& format=GpkgTileFormat());
 
-    GpkgTile(PointView* view, uint32_t level, uint32_t column, uint32_t row, uint32_t mask);
+    // for points already packed per the dims: takes the bytes out of
+    // packedPoints, leaving it empty
+    GpkgTile(const DimTypeList& dims, std::vector<char>& packedPoints,
+             uint32_t numPoints,
+             uint32_t level, uint32_t column, uint32_t row, uint32_t mask,
+             const GpkgTileFormat& format=GpkgTileFormat());
 
+    // copies the blob
     void set(uint32_t level,
             uint32_t column,
             uint32_t row,
@@ -172,27 +303,79 @@ public:
             uint32_t mask,
             const std::vector<char>& blob);
 
+    // does not copy the blob: the caller must keep the bytes alive for as
+    // long as the tile's blob is used
+    void set(uint32_t level,
+            uint32_t column,
+            uint32_t row,
+            uint32_t numPoints,
+            uint32_t mask,
+            const char* blob,
+            size_t blobSize);
+
     uint32_t getLevel() const { return m_level; }
     uint32_t getColumn() const { return m_column; }
     uint32_t getRow() const { return m_row; }
     uint32_t getNumPoints() const { return m_numPoints; }
     uint32_t getMask() const { return m_mask; }
+    void setMask(uint32_t mask) { m_mask = mask; }
 
+    // only valid for tiles that own their blob
     const std::vector<char>& getBlob() const { return m_blob; }
-    
+
+    // valid for all tiles
+    const char* getBlobData() const { return m_blobRef ? m_blobRef : m_blob.data(); }
+    size_t getBlobSize() const { return m_blobRef ? m_blobRefSize : m_blob.size(); }
+
     // does an append to the PV (does not start at index 0)
-    static void exportToPV(size_t numPoints, PointViewPtr view,
-                           const std::vector<char>& src);
+    void exportToPV(PointViewPtr view, const GpkgTileFormat& format=GpkgTileFormat()) const
+    {
+        exportToPV(view, format, view->dimTypes());
+    }
+
+    // as above, for a view with only some of the tile's dims: tileDims are
+    // all of them, as the tile was written with
+    void exportToPV(PointViewPtr view, const GpkgTileFormat& format,
+                    const DimTypeList& tileDims) const;
+
+    // as above, for points already decoded, packed per srcDims, which must
+    // include all of the view's dims
+    static void exportToPV(PointViewPtr view, const DimTypeList& srcDims,
+                           const char* src, size_t srcSize, uint32_t numPoints);
+
+    // the points, packed per the dims
+    void decode(const DimTypeList& dims, std::vector<char>& packedPoints,
+                const GpkgTileFormat& format=GpkgTileFormat()) const;
+
+    // as above, packed per just the wanted dims, which must all be among
+    // tileDims, the dims the tile was written with
+    void decode(const DimTypeList& tileDims, const DimTypeList& wanted,
+                std::vector<char>& packedPoints, const GpkgTileFormat& format) const;
+
+    // repacks points, packed per the dims, per just the wanted ones, in place
+    static void selectDims(const DimTypeList& dims, const DimTypeList& wanted,
+                           uint32_t numPoints, std::vector<char>& packedPoints);
+
+    // the least and greatest value of each dim over the points, in the
+    // order of the dims the tile was made with; empty for a tile read back
+    const std::vector<double>& getMinimums() const { return m_minimums; }
+    const std::vector<double>& getMaximums() const { return m_maximums; }
 
 private:
-    static void importFromPV(const PointView& view,
-                             std::vector<char>& dest);
-    static void compressPatch(const PointView& view,
+    void encode(const DimTypeList& dims, const GpkgTileFormat& format);
+    void uncompress(const DimTypeList& dims, const GpkgTileFormat& format,
+                    std::vector<char>& buf, const char*& src, size_t& srcSize) const;
+    bool usesLazPerf(const GpkgTileFormat& format) const;
+    void decodeColumns(const DimTypeList& tileDims, const DimTypeList& wanted,
+                       const GpkgTileFormat& format,
+                       const char* src, size_t srcSize,
+                       std::vector<char>& packedPoints) const;
+    static void compressPatch(const DimTypeList& dims, uint32_t numPoints,
                               const std::vector<char>& inBuf,
                               std::vector<unsigned char>& outBuf);
     static void decompressPatch(size_t numPoints, PointViewPtr view,
-                                const std::vector<unsigned char>& inBuf,
-                                std::vector<char>& outBuf);
+                                const DimTypeList& tileDims,
+                                const char* inBuf, size_t inBufSize);
 
     uint32_t m_level;
     uint32_t m_column;
@@ -200,6 +383,84 @@ private:
     uint32_t m_numPoints;
     uint32_t m_mask;
     std::vector<char> m_blob;
+    const char* m_blobRef; // if set, the blob is not ours
+    size_t m_blobRefSize;
+    std::vector<double> m_minimums;
+    std::vector<double> m_maximums;
+};
+
+
+// What to read of a box for a view of it, rather than a whole level: the
+// tiles are split, the coarsest first, until their points would go over
+// the budget, or they are all as fine as the gsd. With a center, a tile
+// counts as finer the further it is from it, so the detail falls off
+// towards the edges of the box. Zero for no budget, or no gsd.
+struct GpkgLod
+{
+    GpkgLod() :
+        pointBudget(0),
+        gsd(0.0),
+        hasCenter(false),
+        centerX(0.0),
+        centerY(0.0)
+    {}
+
+    bool isSet() const { return pointBudget != 0 || gsd > 0.0; }
+
+    uint64_t pointBudget;
+    double gsd; // the spacing of the points, in the units of the tile matrix
+    bool hasCenter;
+    double centerX;
+    double centerY;
+};
+
+
+// The range a dimension's values must fall in, edges included, for a point
+// to be read. Written as for filters.range, e.g. "Z[100:200],Intensity[:50]";
+// a missing bound is open.
+struct GpkgDimLimit
+{
+    GpkgDimLimit() :
+        minimum(-std::numeric_limits<double>::infinity()),
+        maximum(std::numeric_limits<double>::infinity())
+    {}
+
+    bool contains(double value) const
+    {
+        return value >= minimum && value <= maximum;
+    }
+
+    // throws if the text is not a list of limits
+    static std::vector<GpkgDimLimit> parseList(const std::string& text);
+
+    std::string name;
+    double minimum;
+    double maximum;
+};
+
+
+// What a box holds, at a level, found without reading the points where
+// it can be: a tile wholly inside the box is counted by its num_points,
+// and its ranges taken from the stats table, and only the tiles across
+// the edges are decoded. If approximate, those are not decoded either, but
+// counted by how much of their area is in the box, with the ranges of the
+// whole tile. A tile without stats is decoded for its ranges.
+struct GpkgSummary
+{
+    GpkgSummary() :
+        numPoints(0),
+        numTilesCounted(0),
+        numTilesDecoded(0),
+        exact(true)
+    {}
+
+    uint64_t numPoints;
+    std::vector<std::string> names; // of the dims, by position
+    std::vector<double> minimums; // of each dim, as names; inf if no points
+    std::vector<double> maximums;
+    uint32_t numTilesCounted; // from the index and stats alone
+    uint32_t numTilesDecoded;
+    bool exact;
 };
 
 
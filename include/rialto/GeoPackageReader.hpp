@@ -37,8 +37,11 @@
 #include <pdal/pdal.hpp>
 
 #include <rialto/GeoPackage.hpp>
+#include <rialto/GeoPackageCommon.hpp>
 #include <rialto/Event.hpp>
 
+#include <functional>
+
 
 namespace pdal
 {
@@ -49,10 +52,7 @@ namespace rialto
 {
 
 class SQLite;
-class GpkgMatrixSet;
-class GpkgTile;
-class GpkgDimension;
-
+class SQLiteCursor;
 
 class PDAL_DLL GeoPackageReader : public GeoPackage
 {
@@ -67,15 +67,13 @@ public:
 
     // get info about a tile
     void readTile(std::string const& name, uint32_t tileId, bool withPoints, GpkgTile& tileInfo) const;
+    using GeoPackage::readTile;
 
     // use with caution for levels greater than 16 or so
     // DANGER: this assumes only one tile set per database, use only for testing
     // yes this returns the tile ids (table's PK)
     void readTileIdsAtLevel(std::string const& name, uint32_t level, std::vector<uint32_t>& tileIds) const;
 
-    // used largely for gathering statistics
-    void getCountsAtLevel(std::string const& name, uint32_t level, uint32_t& numTiles, uint32_t& numPoints) const;
-   
     // query for id of the tile at (level,col,row)
     // returns -1 if not found
     uint32_t queryForTileId(std::string const& name,
@@ -92,22 +90,109 @@ public:
                          std::vector<uint32_t>& ids) const;
 
      // combines query-for-tile-ids with query-for-tile-info
+     //
+     // the tiles are streamed from the db: each call to next() pulls one
+     // more row, so only the current tile is held in memory; the tile from
+     // step() does not own its blob, which is only valid until next()
+     //
+     // without the points, the tiles come back with empty blobs, and only
+     // the tile index is read
+     //
+     // the tiles are found by walking down the tree from level 0, following
+     // the child masks, so empty parts of a sparse tile set cost nothing;
+     // with finest, a branch that ends above the level gives its last tile
      void queryForTiles_begin(std::string const& name,
                              double minx, double miny,
                              double maxx, double maxy,
-                             uint32_t level);
+                             uint32_t level,
+                             bool withPoints=true,
+                             bool finest=false);
+
+     // as queryForTiles_begin, for the tiles to view the box with, from
+     // any level up to the given one (see GpkgLod)
+     void queryForTilesLod_begin(std::string const& name,
+                                 double minx, double miny,
+                                 double maxx, double maxy,
+                                 uint32_t level,
+                                 const GpkgLod& lod,
+                                 bool withPoints=true);
+
+     // the tile queries begun after this skip the tiles with no points
+     // inside all of the limits, as told by the tile set's stats table;
+     // tables without one, and the points of the tiles kept, are not
+     // checked; throws if a limit names a dimension not in the tile set
+     void setDimLimits(std::string const& name, const std::vector<GpkgDimLimit>& limits);
+
+     // the count and ranges of the points in the box (see GpkgSummary);
+     // ends any tile query
+     void querySummary(std::string const& name,
+                       double minx, double miny,
+                       double maxx, double maxy,
+                       uint32_t level, bool approximate,
+                       GpkgSummary& summary);
+
      bool queryForTiles_step(GpkgTile& tileInfo);
      bool queryForTiles_next();
 
      virtual void childDumpStats() const;
 
      // fills in the dimensions of an otherwise empty layout with
-     // the dimension information from the tile set
-     static void setupLayout(const GpkgMatrixSet& tileTableInfo, PointLayoutPtr layout);
+     // the dimension information from the tile set: all of them, or just
+     // the named ones
+     static void setupLayout(const GpkgMatrixSet& tileTableInfo, PointLayoutPtr layout,
+                             const std::vector<std::string>& names=std::vector<std::string>());
 
 private:
+    // a block of tiles at a level, inclusive
+    struct TileRange
+    {
+        uint32_t level;
+        uint32_t minCol, maxCol;
+        uint32_t minRow, maxRow;
+    };
+
+    void planTileQuery(std::string const& name,
+                       double minx, double miny,
+                       double maxx, double maxy,
+                       uint32_t level, bool finest,
+                       std::vector<TileRange>& ranges) const;
+    void planTileQuery(std::string const& name, const TileMath&,
+                       double minx, double miny,
+                       double maxx, double maxy,
+                       uint32_t level, bool finest,
+                       uint32_t tileLevel, uint32_t column, uint32_t row,
+                       uint32_t mask, std::vector<TileRange>& ranges) const;
+    void planLodQuery(std::string const& name,
+                      double minx, double miny,
+                      double maxx, double maxy,
+                      uint32_t level, const GpkgLod& lod);
+    static TileRange getTileRange(const TileMath&,
+                                  double minx, double miny,
+                                  double maxx, double maxy,
+                                  uint32_t level);
+    void readTileIndex(std::string const& name, const TileRange&,
+                       std::vector<GpkgTile>& tiles) const;
+    uint32_t queryChildMask(std::string const& name,
+                            uint32_t level, uint32_t column, uint32_t row) const;
+    void readTiles(std::string const& name, const TileRange&,
+                   const std::function<bool (uint32_t, uint32_t)>& wanted,
+                   std::vector<GpkgTile>& tiles) const;
+    bool openTileRanges();
+    void readTileStats(std::string const& name, const TileRange&, size_t numDims,
+                       std::map<std::pair<uint32_t, uint32_t>, std::vector<double>>& stats) const;
+
     int m_srid;
 
+    // the live tile query, if any
+    std::unique_ptr<SQLiteCursor> m_tileCursor;
+    bool m_tileCursorWithPoints;
+    std::string m_tileQueryName;
+    std::vector<TileRange> m_tileRanges; // of the live tile query
+    std::string m_limitsName; // the tile set the limits are for
+    std::vector<std::pair<uint32_t, GpkgDimLimit>> m_limits; // by position
+    size_t m_nextTileRange;
+    mutable uint32_t m_numTileIndexLookups;
+
     mutable Event e_tilesRead;
     mutable Event e_tileTablesRead;
     mutable Event e_queries;
@@ -79,10 +79,22 @@ public:
     // returns id of new tile
     void writeTile(const std::string& tileTableName, const GpkgTile& data);
 
+    // writes many tiles with one statement; the blobs are bound in place,
+    // not copied
+    void writeTiles(const std::string& tileTableName,
+                    const std::vector<GpkgTile>& tiles);
+
+    // replaces the points and masks of tiles already in the table
+    void updateTiles(const std::string& tileTableName,
+                     const std::vector<GpkgTile>& tiles);
+
     virtual void childDumpStats() const;
 
 private:
     void createTableGpkgPctile(const std::string& table_name);
+    void createTableTileStats(const GpkgMatrixSet&);
+    void writeTileStats(const std::string& tileTableName,
+                        const GpkgTile* tiles, size_t numTiles);
 
     void writeDimensions(const GpkgMatrixSet&);
     void writeMetadata(const GpkgMatrixSet&);
@@ -36,14 +36,17 @@
 
 #include <pdal/Reader.hpp>
 
+#include <rialto/GeoPackageCommon.hpp>
+
+#include <memory>
 
 namespace rialto
 {
     using namespace pdal;
 
-class GpkgTile;
-class GpkgMatrixSet;
 class GeoPackageReader;
+class QueryRegion;
+class TileCache;
 class TileMath;
 
 class PDAL_DLL RialtoReader : public Reader
@@ -60,6 +63,13 @@ public:
 
     const GpkgMatrixSet& getMatrixSet() const { return *m_matrixSet; }
     const GeoPackageReader& getGeoPackageReader() const { return *m_gpkg; }
+
+    // a tile for a decoding thread: its blob, or its points if cached
+    struct TileJob
+    {
+        GpkgTile tile;
+        std::shared_ptr<const std::vector<char>> points;
+    };
     
 private:
     void processOptions(const Options& options);
@@ -68,8 +78,22 @@ private:
     void ready(PointTableRef table);
     
     point_count_t read(PointViewPtr view, point_count_t /*not used*/);
-    void doQuery(const TileMath&, const GpkgTile&, PointViewPtr,
-                 double qMinX, double qMinY, double qMaxX, double qMaxY);
+    void doQuery(const TileMath&, const GpkgTile&, const char* points, PointViewPtr,
+                 point_count_t maxPoints);
+    std::shared_ptr<const std::vector<char>> getCachedPoints(const GpkgTile&);
+    void exportTile(const GpkgTile&, const char* points, PointViewPtr) const;
+    bool tileInsideQuery(const TileMath&, const GpkgTile&) const;
+    bool tileOutsideRegion(const TileMath&, const GpkgTile&) const;
+    void decodeTile(const GpkgTile&, const char* points, const DimTypeList&,
+                    std::vector<char>& packed) const;
+    void filterPoints(const DimTypeList&, uint32_t numPoints,
+                      std::vector<char>& packed) const;
+    static void appendPoints(PointViewPtr, const DimTypeList&,
+                             const std::vector<char>& packed,
+                             point_count_t maxPoints);
+    void beginTileQuery(bool withPoints);
+    void readParallel(const TileMath&, PointViewPtr, point_count_t end);
+    void sortUniformly(std::vector<GpkgTile>&) const;
     void setQueryParams();
 
     GeoPackageReader* m_gpkg;
@@ -78,6 +102,16 @@ private:
 
     uint32_t m_queryLevel;
     BOX3D m_queryBox;
+    std::unique_ptr<QueryRegion> m_region; // in the box, if set
+    GpkgLod m_lod;
+    bool m_uniformOrder; // of the tiles read
+    std::vector<GpkgDimLimit> m_limits; // on the points read
+    std::vector<std::string> m_dimensionNames; // to read, or empty for all
+    DimTypeList m_tileDims; // all of them, as in the tiles
+    GpkgTileFormat m_tileFormat;
+    uint32_t m_numThreads; // for decoding the tiles
+    uint64_t m_cacheSize; // bytes
+    std::shared_ptr<TileCache> m_cache;
 
     RialtoReader& operator=(const RialtoReader&); // not implemented
     RialtoReader(const RialtoReader&); // not implemented
@@ -36,6 +36,9 @@
 
 #include <pdal/Writer.hpp>
 
+#include <rialto/Event.hpp>
+#include <rialto/GeoPackageCommon.hpp>
+
 
 extern "C" int32_t RialtoWriter_ExitFunc();
 extern "C" PF_ExitFunc RialtoWriter_InitPlugin();
@@ -45,13 +48,20 @@ namespace rialto
 {
     using namespace pdal;
 
+    class ExternalTileSet;
     class GeoPackageWriter;
+    class GpkgTile;
     class WritableTileSet;
 
 class PDAL_DLL RialtoWriter : public Writer
 {
 public:
-    RialtoWriter()
+    RialtoWriter() :
+        m_gpkg(NULL),
+        m_externalSet(NULL),
+        e_encode("encode"),
+        e_encodeWait("encodeWait"),
+        e_tilesWritten("tilesWritten")
     {}
 
     static void * create();
@@ -61,17 +71,25 @@ public:
     Options getDefaultOptions();
 
     void ready(PointTableRef table);
+    bool processOne(PointRef& point);
     void write(const PointViewPtr viewPtr);
     void done(PointTableRef table);
 
+    // timings of the encoding and writing of the tiles, if enabled
+    void dumpStats() const;
+
 private:
     void startWrite(PointTableRef table, const SpatialReference& srs);
     void writeAllTiles(WritableTileSet& tileSet);
-    void writeTile(PointView*,
-                   uint32_t level, uint32_t col, uint32_t row,
-                   uint32_t mask);
+    ExternalTileSet* createExternalSet(uint64_t maxMemory);
+    void writeExternal();
+    void addExternalTile(GpkgTile& tile);
+    void writeTiles(std::vector<GpkgTile>& tiles);
+    void mergeTiles(std::vector<GpkgTile>& tiles, std::vector<GpkgTile>& updates);
+    void startAppend();
     void initStats(PointLayoutPtr layout);
     void collectStats(PointView* pv);
+    void collectStats(const PointRef& point);
     void updateDimensionStats(PointLayoutPtr layout);
     void processOptions(const Options& options);
 
@@ -83,6 +101,32 @@ private:
     GeoPackageWriter* m_gpkg;
     uint32_t m_maxLevel;
     double m_tms_minx, m_tms_miny, m_tms_maxx, m_tms_maxy;
+    uint32_t m_batchSize; // tiles per transaction, or 0 for all in one
+    uint32_t m_numThreads; // for building the tile tree, and encoding the tiles
+    std::string m_builder; // "tree" or "morton"
+    uint64_t m_maxMemory; // bytes, or 0 to build the tiles all in memory
+    // bytes (the stream_memory option, in MB, default 1024), for the
+    // external build when streaming or appending without max_memory
+    uint64_t m_streamMemory;
+    // the points come in Morton order of their tiles at the max level, so
+    // the external build writes each subtree out as soon as the points have
+    // gone past it; otherwise, no tile is built until all the points are in
+    bool m_sorted;
+    std::string m_tempDir; // for the external build's files
+    ExternalTileSet* m_externalSet; // if building externally, or streaming
+    std::vector<GpkgTile> m_externalBatch; // its tiles, not yet written
+    DimTypeList m_dimTypes;
+    std::vector<char> m_packedPoint;
+    bool m_written; // by the in-memory build
+    bool m_append; // to the table, if it already exists
+    bool m_appending;
+    uint64_t m_firstSeq; // the number of points already in the table
+    bool m_ordered; // write the encoded tiles in the order they were built
+    GpkgTileFormat m_tileFormat; // when appending, the table's own
+
+    Event e_encode; // summed over the encoding threads
+    Event e_encodeWait; // for the writer, waiting on the encoders
+    Event e_tilesWritten;
     
     std::map<uint32_t,double> m_mins;
     std::map<uint32_t,double> m_means;
@@ -0,0 +1,608 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "ColumnarCodec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace rialto
+{
+
+
+namespace
+{
+
+enum Codec
+{
+    CodecRaw=0, CodecBitpack=1, CodecDelta=2, CodecXor=3,
+};
+
+static const size_t prefixSize = 3; // version, number of columns
+static const size_t columnHeaderSize = 5; // codec, number of bytes
+
+
+// the low width bytes of v, least significant first, whatever the host
+void putLittle(char* p, uint64_t v, size_t width)
+{
+    for (size_t i=0; i<width; i++)
+    {
+        p[i] = (char)(v >> (8 * i));
+    }
+}
+
+
+uint64_t getLittle(const char* p, size_t width)
+{
+    uint64_t v = 0;
+    for (size_t i=0; i<width; i++)
+    {
+        v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    }
+    return v;
+}
+
+
+template<typename T>
+void put(std::vector<char>& buf, T value)
+{
+    const size_t start = buf.size();
+    buf.resize(start + sizeof(T));
+    putLittle(buf.data() + start, value, sizeof(T));
+}
+
+
+template<typename T>
+T get(const char* p)
+{
+    return (T)getLittle(p, sizeof(T));
+}
+
+
+template<typename T>
+uint64_t getHostAs(const char* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+
+template<typename T>
+void putHostAs(char* p, uint64_t value)
+{
+    const T v = (T)value;
+    std::memcpy(p, &v, sizeof(T));
+}
+
+
+// a value of the packed points, which are in the host's order
+uint64_t getHost(const char* p, size_t width)
+{
+    switch (width)
+    {
+        case 1:
+            return getHostAs<uint8_t>(p);
+        case 2:
+            return getHostAs<uint16_t>(p);
+        case 4:
+            return getHostAs<uint32_t>(p);
+        default:
+            return getHostAs<uint64_t>(p);
+    }
+}
+
+
+void putHost(char* p, uint64_t v, size_t width)
+{
+    switch (width)
+    {
+        case 1:
+            putHostAs<uint8_t>(p, v);
+            break;
+        case 2:
+            putHostAs<uint16_t>(p, v);
+            break;
+        case 4:
+            putHostAs<uint32_t>(p, v);
+            break;
+        default:
+            putHostAs<uint64_t>(p, v);
+    }
+}
+
+
+uint32_t bitsNeeded(uint64_t v)
+{
+    uint32_t bits = 0;
+    while (v)
+    {
+        ++bits;
+        v >>= 1;
+    }
+    return bits;
+}
+
+
+uint64_t zigzag(uint64_t v)
+{
+    return (v << 1) ^ (uint64_t)((int64_t)v >> 63);
+}
+
+
+uint64_t unzigzag(uint64_t v)
+{
+    return (v >> 1) ^ (0 - (v & 1));
+}
+
+
+class BitWriter
+{
+public:
+    BitWriter(std::vector<char>& buf) :
+        m_buf(buf),
+        m_acc(0),
+        m_numBits(0)
+    {}
+
+    // v must fit in the given number of bits
+    void put(uint64_t v, uint32_t bits)
+    {
+        if (bits > 32)
+        {
+            put32(v & 0xffffffff, 32);
+            v >>= 32;
+            bits -= 32;
+        }
+        put32(v, bits);
+    }
+
+    void flush()
+    {
+        if (m_numBits)
+        {
+            m_buf.push_back((char)(m_acc & 0xff));
+        }
+        m_acc = 0;
+        m_numBits = 0;
+    }
+
+private:
+    void put32(uint64_t v, uint32_t bits)
+    {
+        m_acc |= v << m_numBits;
+        m_numBits += bits;
+        while (m_numBits >= 8)
+        {
+            m_buf.push_back((char)(m_acc & 0xff));
+            m_acc >>= 8;
+            m_numBits -= 8;
+        }
+    }
+
+    std::vector<char>& m_buf;
+    uint64_t m_acc;
+    uint32_t m_numBits;
+};
+
+
+class BitReader
+{
+public:
+    BitReader(const char* data, size_t size) :
+        m_data(reinterpret_cast<const unsigned char*>(data)),
+        m_size(size),
+        m_idx(0),
+        m_acc(0),
+        m_numBits(0)
+    {}
+
+    uint64_t get(uint32_t bits)
+    {
+        if (bits > 32)
+        {
+            const uint64_t lo = get32(32);
+            return lo | (get32(bits - 32) << 32);
+        }
+        return get32(bits);
+    }
+
+private:
+    uint64_t get32(uint32_t bits)
+    {
+        while (m_numBits < bits)
+        {
+            if (m_idx >= m_size)
+            {
+                throw pdal_error("columnar tile data is truncated");
+            }
+            m_acc |= (uint64_t)m_data[m_idx++] << m_numBits;
+            m_numBits += 8;
+        }
+
+        const uint64_t v = m_acc & ((1ull << bits) - 1);
+        m_acc >>= bits;
+        m_numBits -= bits;
+        return v;
+    }
+
+    const unsigned char* m_data;
+    const size_t m_size;
+    size_t m_idx;
+    uint64_t m_acc;
+    uint32_t m_numBits;
+};
+
+
+// the values are the keys described in the header: unsigned, in the low
+// width bytes
+void encodeRaw(const std::vector<uint64_t>& values, size_t width,
+               std::vector<char>& out)
+{
+    const size_t start = out.size();
+    out.resize(start + values.size() * width);
+    char* p = out.data() + start;
+    for (uint64_t v: values)
+    {
+        putLittle(p, v, width);
+        p += width;
+    }
+}
+
+
+void encodeBitpack(const std::vector<uint64_t>& values,
+                   std::vector<char>& out)
+{
+    uint64_t min = values[0];
+    uint64_t max = values[0];
+    for (uint64_t v: values)
+    {
+        min = std::min(min, v);
+        max = std::max(max, v);
+    }
+    const uint32_t bits = bitsNeeded(max - min);
+
+    put<uint64_t>(out, min);
+    put<uint8_t>(out, bits);
+
+    BitWriter w(out);
+    for (uint64_t v: values)
+    {
+        w.put(v - min, bits);
+    }
+    w.flush();
+}
+
+
+void encodeDelta(const std::vector<uint64_t>& values, std::vector<char>& out)
+{
+    uint64_t max = 0;
+    for (size_t i=1; i<values.size(); i++)
+    {
+        max = std::max(max, zigzag(values[i] - values[i-1]));
+    }
+    const uint32_t bits = bitsNeeded(max);
+
+    put<uint64_t>(out, values[0]);
+    put<uint8_t>(out, bits);
+
+    BitWriter w(out);
+    for (size_t i=1; i<values.size(); i++)
+    {
+        w.put(zigzag(values[i] - values[i-1]), bits);
+    }
+    w.flush();
+}
+
+
+// first a nibble per value, the number of its leading zero bytes, and then
+// the remaining bytes of each
+void encodeXor(const std::vector<uint64_t>& values, size_t width,
+               std::vector<char>& out)
+{
+    const size_t n = values.size();
+    const size_t nibblesStart = out.size();
+    out.resize(nibblesStart + (n + 1) / 2, 0);
+
+    uint64_t prev = 0;
+    for (size_t i=0; i<n; i++)
+    {
+        const uint64_t x = values[i] ^ prev;
+        prev = values[i];
+
+        const size_t numBytes = (bitsNeeded(x) + 7) / 8;
+        out[nibblesStart + i/2] |= (char)((width - numBytes) << (4 * (i & 1)));
+
+        const size_t end = out.size();
+        out.resize(end + numBytes);
+        putLittle(out.data() + end, x, numBytes);
+    }
+}
+
+
+void decodeColumn(uint8_t codec, const char* p, size_t size, size_t width,
+                  uint32_t numPoints, std::vector<uint64_t>& values)
+{
+    values.resize(numPoints);
+    if (numPoints == 0)
+    {
+        return;
+    }
+
+    switch (codec)
+    {
+        case CodecRaw:
+        {
+            if (size != numPoints * width)
+            {
+                throw pdal_error("columnar tile column has the wrong size");
+            }
+            for (uint32_t i=0; i<numPoints; i++)
+            {
+                values[i] = getLittle(p, width);
+                p += width;
+            }
+            break;
+        }
+        case CodecBitpack:
+        case CodecDelta:
+        {
+            if (size < 9)
+            {
+                throw pdal_error("columnar tile data is truncated");
+            }
+            const uint64_t first = get<uint64_t>(p);
+            const uint32_t bits = get<uint8_t>(p + 8);
+            if (bits > 64)
+            {
+                throw pdal_error("columnar tile column is corrupt");
+            }
+            BitReader r(p + 9, size - 9);
+            if (codec == CodecBitpack)
+            {
+                for (uint32_t i=0; i<numPoints; i++)
+                {
+                    values[i] = first + r.get(bits);
+                }
+            }
+            else
+            {
+                values[0] = first;
+                for (uint32_t i=1; i<numPoints; i++)
+                {
+                    values[i] = values[i-1] + unzigzag(r.get(bits));
+                }
+            }
+            break;
+        }
+        case CodecXor:
+        {
+            const size_t nibblesSize = (numPoints + 1) / 2;
+            if (size < nibblesSize)
+            {
+                throw pdal_error("columnar tile data is truncated");
+            }
+            const char* q = p + nibblesSize;
+            const char* end = p + size;
+
+            uint64_t prev = 0;
+            for (uint32_t i=0; i<numPoints; i++)
+            {
+                const size_t zeros = (p[i/2] >> (4 * (i & 1))) & 0xf;
+                if (zeros > width)
+                {
+                    throw pdal_error("columnar tile column is corrupt");
+                }
+                const size_t numBytes = width - zeros;
+                if (q + numBytes > end)
+                {
+                    throw pdal_error("columnar tile data is truncated");
+                }
+                const uint64_t x = getLittle(q, numBytes);
+                q += numBytes;
+
+                prev ^= x;
+                values[i] = prev;
+            }
+            break;
+        }
+        default:
+            throw pdal_error("columnar tile column has an unknown codec");
+    }
+}
+
+
+uint64_t signBit(const DimType& dim)
+{
+    const Dimension::Type::Enum type = dim.m_type;
+    if (Dimension::base(type) != Dimension::BaseType::Signed)
+    {
+        return 0;
+    }
+    return 1ull << (8 * Dimension::size(type) - 1);
+}
+
+} // anonymous namespace
+
+
+size_t ColumnarCodec::maxEncodedSize(const DimTypeList& dims, uint32_t numPoints)
+{
+    size_t size = prefixSize + dims.size() * columnHeaderSize;
+    for (const DimType& dim: dims)
+    {
+        size += (size_t)numPoints * Dimension::size(dim.m_type);
+    }
+    return size;
+}
+
+
+void ColumnarCodec::encode(const DimTypeList& dims, uint32_t numPoints,
+                           const char* packed, std::vector<char>& blob)
+{
+    size_t pointSize = 0;
+    for (const DimType& dim: dims)
+    {
+        pointSize += Dimension::size(dim.m_type);
+    }
+
+    blob.clear();
+    put<uint8_t>(blob, version);
+    put<uint16_t>(blob, dims.size());
+    blob.resize(prefixSize + dims.size() * columnHeaderSize);
+
+    std::vector<uint64_t> values(numPoints);
+    std::vector<char> best, candidate;
+
+    size_t offset = 0;
+    for (size_t d=0; d<dims.size(); d++)
+    {
+        const size_t width = Dimension::size(dims[d].m_type);
+        const uint64_t flip = signBit(dims[d]);
+
+        const char* p = packed + offset;
+        for (uint32_t i=0; i<numPoints; i++)
+        {
+            values[i] = getHost(p, width) ^ flip;
+            p += pointSize;
+        }
+        offset += width;
+
+        uint8_t codec = CodecRaw;
+        best.clear();
+        encodeRaw(values, width, best);
+
+        if (numPoints > 1)
+        {
+            for (uint8_t c: { CodecBitpack, CodecDelta, CodecXor })
+            {
+                candidate.clear();
+                if (c == CodecBitpack) encodeBitpack(values, candidate);
+                if (c == CodecDelta) encodeDelta(values, candidate);
+                if (c == CodecXor) encodeXor(values, width, candidate);
+
+                if (candidate.size() < best.size())
+                {
+                    best.swap(candidate);
+                    codec = c;
+                }
+            }
+        }
+
+        char* h = blob.data() + prefixSize + d * columnHeaderSize;
+        const uint32_t size = best.size();
+        h[0] = codec;
+        putLittle(h + 1, size, sizeof(size));
+
+        blob.insert(blob.end(), best.begin(), best.end());
+    }
+}
+
+
+void ColumnarCodec::decode(const DimTypeList& dims, const DimTypeList& wanted,
+                           uint32_t numPoints, const char* blob, size_t blobSize,
+                           std::vector<char>& packed)
+{
+    if (blobSize < prefixSize)
+    {
+        throw pdal_error("columnar tile data is truncated");
+    }
+    if (get<uint8_t>(blob) != version)
+    {
+        throw pdal_error("columnar tile data has an unsupported version");
+    }
+    if (get<uint16_t>(blob + 1) != dims.size())
+    {
+        throw pdal_error("columnar tile data does not match the dimensions");
+    }
+
+    const size_t headerSize = prefixSize + dims.size() * columnHeaderSize;
+    if (blobSize < headerSize)
+    {
+        throw pdal_error("columnar tile data is truncated");
+    }
+
+    // where each column starts
+    std::vector<size_t> starts(dims.size() + 1);
+    starts[0] = headerSize;
+    for (size_t d=0; d<dims.size(); d++)
+    {
+        const char* h = blob + prefixSize + d * columnHeaderSize;
+        starts[d+1] = starts[d] + get<uint32_t>(h + 1);
+    }
+    if (starts[dims.size()] != blobSize)
+    {
+        throw pdal_error("columnar tile data is truncated");
+    }
+
+    size_t pointSize = 0;
+    for (const DimType& dim: wanted)
+    {
+        pointSize += Dimension::size(dim.m_type);
+    }
+    packed.resize(numPoints * pointSize);
+
+    std::vector<uint64_t> values;
+
+    size_t offset = 0;
+    for (const DimType& dim: wanted)
+    {
+        size_t d = 0;
+        while (d < dims.size() && dims[d].m_id != dim.m_id)
+        {
+            ++d;
+        }
+        if (d == dims.size() || dims[d].m_type != dim.m_type)
+        {
+            throw pdal_error("dimension " + Dimension::name(dim.m_id) +
+                             " is not in the columnar tile data");
+        }
+
+        const size_t width = Dimension::size(dim.m_type);
+        const uint8_t codec = blob[prefixSize + d * columnHeaderSize];
+        decodeColumn(codec, blob + starts[d], starts[d+1] - starts[d],
+                     width, numPoints, values);
+
+        const uint64_t flip = signBit(dim);
+        char* q = packed.data() + offset;
+        for (uint32_t i=0; i<numPoints; i++)
+        {
+            putHost(q, values[i] ^ flip, width);
+            q += pointSize;
+        }
+        offset += width;
+    }
+}
+
+
+} // namespace rialto
@@ -0,0 +1,86 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#pragma once
+
+#include <pdal/pdal.hpp>
+
+namespace rialto
+{
+    using namespace pdal;
+
+
+// The columnar tile encoding: the points of a tile stored dimension by
+// dimension, each column compressed on its own, so that a reader can
+// decode just the dimensions it needs.
+//
+// Blob layout (little-endian):
+//   uint8   version
+//   uint16  number of columns, which must match the dimension set
+//   per column:  uint8 codec, uint32 number of bytes
+//   the columns, in order
+//
+// Each column is stored with whichever of these is smallest for it: raw
+// values; frame-of-reference bitpacking (the min, then each value less the
+// min, in as few bits as the range needs); delta bitpacking (the first
+// value, then the zigzagged differences between neighbours); or xor (each
+// value xor'd with the one before, keeping just the nonzero low bytes).
+// Values are handled as unsigned integers of the dimension's size, with
+// the sign bit flipped for signed types so that their order is kept.
+class ColumnarCodec
+{
+public:
+    static const uint8_t version = 1;
+
+    // the gpkg_extensions row marking a table as using this encoding, whose
+    // definition is the version
+    static std::string extensionName() { return "rialto_columnar_tiles"; }
+
+    // the most bytes encode() can give for the points: every column raw
+    static size_t maxEncodedSize(const DimTypeList& dims, uint32_t numPoints);
+
+    // packed holds numPoints points, packed per dims
+    static void encode(const DimTypeList& dims, uint32_t numPoints,
+                       const char* packed, std::vector<char>& blob);
+
+    // decodes only the columns of the wanted dims, into points packed per
+    // wanted; the wanted dims must all be in dims, the dims the blob was
+    // encoded with, but can be in any order
+    static void decode(const DimTypeList& dims, const DimTypeList& wanted,
+                       uint32_t numPoints, const char* blob, size_t blobSize,
+                       std::vector<char>& packed);
+};
+
+
+} // namespace rialto
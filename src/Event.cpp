@@ -104,6 +104,15 @@ void Event::stop() const
 }
 
 
+void Event::add(double millis) const
+{
+    if (!m_enabled) return;
+
+    ++m_count;
+    m_millis += millis;
+}
+
+
 void Event::dump() const
 {
     if (!m_enabled) return;
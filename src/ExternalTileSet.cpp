@@ -0,0 +1,699 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "ExternalTileSet.hpp"
+#include "TileMath.hpp"
+#include "WritableTileCommon.hpp"
+#include <rialto/GeoPackageCommon.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+namespace rialto
+{
+
+
+namespace
+{
+
+// a temporary file, closed (but not removed) when we're done with it
+class SpillFile
+{
+public:
+    SpillFile(const std::string& path, const char* mode) :
+        m_path(path)
+    {
+        m_fp = std::fopen(path.c_str(), mode);
+        if (!m_fp)
+        {
+            throw pdal_error("ExternalTileSet: unable to open temporary file " + path);
+        }
+    }
+
+    ~SpillFile()
+    {
+        std::fclose(m_fp);
+    }
+
+    void write(const char* buf, size_t numBytes)
+    {
+        if (std::fwrite(buf, 1, numBytes, m_fp) != numBytes)
+        {
+            throw pdal_error("ExternalTileSet: unable to write temporary file " + m_path);
+        }
+    }
+
+    void read(char* buf, size_t numBytes)
+    {
+        if (std::fread(buf, 1, numBytes, m_fp) != numBytes)
+        {
+            throw pdal_error("ExternalTileSet: unable to read temporary file " + m_path);
+        }
+    }
+
+private:
+    std::string m_path;
+    std::FILE* m_fp;
+};
+
+
+// a record is the point's key (of its tile at the max level), its sequence
+// number, and then the packed point
+uint64_t recordKey(const char* record)
+{
+    uint64_t key;
+    std::memcpy(&key, record, sizeof(key));
+    return key;
+}
+
+uint64_t recordSeq(const char* record)
+{
+    uint64_t seq;
+    std::memcpy(&seq, record + sizeof(uint64_t), sizeof(seq));
+    return seq;
+}
+
+const size_t recordHeaderSize = 2 * sizeof(uint64_t);
+
+
+// Where the points are first split up. Deep enough that the data is spread
+// over a few buckets, and shallow enough that there aren't too many files.
+const uint32_t topSplitLevel = 4;
+
+// how many tiles to go down each time a bucket has to be split again
+const uint32_t resplitDepth = 4;
+
+// How far above the max level the points in order are split. Only one
+// bucket is held at a time, so they can be small, and the points kept for
+// the levels above the split are still only one in 4^5.
+const uint32_t sortedSplitDepth = 4;
+
+// records read from a spill file at a time, when splitting it again
+const size_t readChunkSize = 4096;
+
+// what emitLevels needs beside the records: each point's key and index,
+// twice over for the radix sort
+const size_t emitBytesPerPoint = 2 * sizeof(KeyedPoint);
+
+} // anonymous namespace
+
+
+// The points of one subtree, from its top level down to its bottom: the
+// max level, or, for the points kept for the levels above another split,
+// the level just above it, whose children are given by their keys. Each
+// point goes in the bucket of its tile at the split level, and a point
+// that also survives the decimation just above the split is kept aside, in
+// a bucket of its own, for the levels from the top down to the split. All
+// of them count against the memory budget, and all are spilled alike.
+class ExternalTileSet::Partition
+{
+public:
+    Partition(ExternalTileSet& tileSet, uint32_t topLevel, uint32_t splitLevel,
+              uint32_t bottomLevel, const std::vector<uint64_t>& bottomChildKeys) :
+        m_tileSet(tileSet),
+        m_topLevel(topLevel),
+        m_splitLevel(splitLevel),
+        m_bottomLevel(bottomLevel),
+        m_bottomChildKeys(bottomChildKeys),
+        m_shift(2 * (tileSet.m_maxLevel - splitLevel)),
+        m_upperSkip(splitLevel > topLevel ? ((uint64_t)1) << (m_shift + 2) : 0),
+        m_bufferedBytes(0),
+        m_spilled(false),
+        m_current(NULL),
+        m_currentKey(0)
+    {
+        assert(topLevel <= splitLevel);
+        assert(splitLevel <= bottomLevel);
+        assert(bottomLevel <= tileSet.m_maxLevel);
+
+        // the tiles above the children are there even with no points
+        const uint32_t childShift = 2 * (bottomLevel + 1 - splitLevel);
+        for (uint64_t key: bottomChildKeys)
+        {
+            m_buckets[key >> childShift];
+        }
+    }
+
+    ~Partition()
+    {
+        for (auto& it: m_buckets)
+        {
+            removeFile(it.second);
+        }
+        removeFile(m_upper);
+    }
+
+    void add(const char* record)
+    {
+        const size_t recordSize = m_tileSet.m_recordSize;
+        const uint64_t key = recordKey(record);
+
+        Bucket& bucket = m_buckets[key >> m_shift];
+        bucket.records.insert(bucket.records.end(), record, record + recordSize);
+        ++bucket.numPoints;
+        bucket.minKey = std::min(bucket.minKey, key);
+        bucket.maxKey = std::max(bucket.maxKey, key);
+        m_bufferedBytes += recordSize;
+
+        if (m_splitLevel > m_topLevel && recordSeq(record) % m_upperSkip == 0)
+        {
+            m_upper.records.insert(m_upper.records.end(), record, record + recordSize);
+            ++m_upper.numPoints;
+            m_upper.minKey = std::min(m_upper.minKey, key);
+            m_upper.maxKey = std::max(m_upper.maxKey, key);
+            m_bufferedBytes += recordSize;
+        }
+
+        if (m_bufferedBytes > m_tileSet.m_maxMemory)
+        {
+            spill();
+        }
+    }
+
+    // For points in order: builds the bucket the points have been going
+    // into, once they move on to another, as no more will come to it.
+    void moveTo(uint64_t key, TileSink& sink)
+    {
+        Bucket& bucket = m_buckets[key >> m_shift];
+        if (&bucket == m_current)
+        {
+            return;
+        }
+        if (bucket.built)
+        {
+            throw pdal_error("ExternalTileSet: the points are not in Morton order, "
+                             "as one falls in a subtree already built");
+        }
+
+        if (m_current)
+        {
+            makeRoom(m_current->numPoints);
+            const uint64_t heldBytes = m_current->records.size();
+            processBucket(*m_current, m_currentKey, sink);
+            removeFile(*m_current);
+            m_current->built = true;
+            m_bufferedBytes -= heldBytes;
+        }
+        m_current = &bucket;
+        m_currentKey = key >> m_shift;
+    }
+
+    void finish(TileSink& sink)
+    {
+        // Once we've gone to disk, go all the way, so that only one bucket
+        // at a time is in memory. Likewise if the biggest one can't be
+        // built beside all the rest.
+        uint64_t maxPoints = m_upper.numPoints;
+        for (auto& it: m_buckets)
+        {
+            if (!it.second.built)
+            {
+                maxPoints = std::max(maxPoints, it.second.numPoints);
+            }
+        }
+        if (m_spilled)
+        {
+            spill();
+        }
+        else
+        {
+            makeRoom(maxPoints);
+        }
+
+        if (m_splitLevel > m_topLevel)
+        {
+            std::vector<uint64_t> bucketKeys;
+            for (auto& it: m_buckets)
+            {
+                bucketKeys.push_back(it.first);
+            }
+
+            // These are a quarter as many as in the buckets at most, and
+            // far fewer when the split is well above the max level, but
+            // may still be too many: then they are split up in turn, as a
+            // subtree that ends just above this split.
+            if (fits(m_upper.numPoints))
+            {
+                std::vector<char> records;
+                load(m_upper, records);
+                m_tileSet.emitLevels(records.data(), m_upper.numPoints,
+                                     m_topLevel, m_splitLevel - 1, bucketKeys, sink);
+            }
+            else
+            {
+                const uint32_t level = commonLevel(m_upper, m_topLevel, m_splitLevel - 1);
+                Partition upper(m_tileSet, m_topLevel,
+                                std::min(m_splitLevel - 1, level + resplitDepth),
+                                m_splitLevel - 1, bucketKeys);
+                feed(m_upper, upper);
+                upper.finish(sink);
+            }
+            removeFile(m_upper);
+        }
+
+        for (auto& it: m_buckets)
+        {
+            if (!it.second.built)
+            {
+                processBucket(it.second, it.first, sink);
+                removeFile(it.second);
+            }
+        }
+    }
+
+private:
+    struct Bucket
+    {
+        Bucket() :
+            numPoints(0),
+            numSpilled(0),
+            minKey((std::numeric_limits<uint64_t>::max)()),
+            maxKey(0),
+            built(false)
+        {}
+
+        std::vector<char> records; // the ones not yet spilled
+        std::string path;
+        uint64_t numPoints;
+        uint64_t numSpilled;
+        uint64_t minKey;
+        uint64_t maxKey;
+        bool built; // its subtree, with its points gone
+    };
+
+    // whether the points can be read in and built into tiles
+    bool fits(uint64_t numPoints) const
+    {
+        return numPoints * (m_tileSet.m_recordSize + emitBytesPerPoint) <=
+            m_tileSet.m_maxMemory;
+    }
+
+    // spills everything, unless there's room to build a bucket of the
+    // points beside all that is held
+    void makeRoom(uint64_t numPoints)
+    {
+        if (m_bufferedBytes + numPoints * emitBytesPerPoint > m_tileSet.m_maxMemory)
+        {
+            spill();
+        }
+    }
+
+    void spill()
+    {
+        for (auto& it: m_buckets)
+        {
+            spill(it.second);
+        }
+        spill(m_upper);
+
+        m_bufferedBytes = 0;
+        m_spilled = true;
+    }
+
+    void spill(Bucket& bucket)
+    {
+        if (bucket.records.empty())
+        {
+            return;
+        }
+
+        if (bucket.path.empty())
+        {
+            bucket.path = m_tileSet.makeTempPath();
+        }
+        SpillFile file(bucket.path, "ab");
+        file.write(bucket.records.data(), bucket.records.size());
+
+        bucket.numSpilled += bucket.records.size() / m_tileSet.m_recordSize;
+        std::vector<char>().swap(bucket.records);
+    }
+
+    // all of the bucket's records, in sequence order: the spilled ones
+    // come first
+    void load(Bucket& bucket, std::vector<char>& records)
+    {
+        const size_t recordSize = m_tileSet.m_recordSize;
+
+        records.clear();
+        if (!bucket.numSpilled)
+        {
+            records.swap(bucket.records);
+            return;
+        }
+
+        records.resize(bucket.numSpilled * recordSize);
+        {
+            SpillFile file(bucket.path, "rb");
+            file.read(records.data(), records.size());
+        }
+        records.insert(records.end(), bucket.records.begin(), bucket.records.end());
+        std::vector<char>().swap(bucket.records);
+    }
+
+    // gives the bucket's records to another partition, a chunk at a time
+    void feed(Bucket& bucket, Partition& to)
+    {
+        const size_t recordSize = m_tileSet.m_recordSize;
+
+        if (bucket.numSpilled)
+        {
+            SpillFile file(bucket.path, "rb");
+            std::vector<char> chunk(readChunkSize * recordSize);
+            for (uint64_t done = 0; done < bucket.numSpilled; )
+            {
+                const size_t n = std::min<uint64_t>(readChunkSize, bucket.numSpilled - done);
+                file.read(chunk.data(), n * recordSize);
+                for (size_t i=0; i<n; i++)
+                {
+                    to.add(chunk.data() + i * recordSize);
+                }
+                done += n;
+            }
+        }
+        for (size_t i=0; i<bucket.records.size(); i+=recordSize)
+        {
+            to.add(bucket.records.data() + i);
+        }
+        std::vector<char>().swap(bucket.records);
+    }
+
+    // the deepest level, from the given one down to the last, with one
+    // tile that holds all of the bucket's points
+    uint32_t commonLevel(const Bucket& bucket, uint32_t level, uint32_t lastLevel) const
+    {
+        const uint32_t maxLevel = m_tileSet.m_maxLevel;
+        while (level < lastLevel)
+        {
+            const uint32_t shift = 2 * (maxLevel - level - 1);
+            if ((bucket.minKey >> shift) != (bucket.maxKey >> shift))
+            {
+                break;
+            }
+            ++level;
+        }
+        return level;
+    }
+
+    // the keys of the children of the bottom level under a bucket's tile
+    std::vector<uint64_t> childKeysUnder(uint64_t bucketKey) const
+    {
+        const uint32_t shift = 2 * (m_bottomLevel + 1 - m_splitLevel);
+        auto begin = std::lower_bound(m_bottomChildKeys.begin(), m_bottomChildKeys.end(),
+                                      bucketKey << shift);
+        auto end = std::lower_bound(begin, m_bottomChildKeys.end(),
+                                    (bucketKey + 1) << shift);
+        return std::vector<uint64_t>(begin, end);
+    }
+
+    // A bucket that fits in memory is read back in and its subtree built
+    // outright. Otherwise, its points are split up again below the
+    // deepest tile that holds all of them. That can't be done for a
+    // bucket of just one tile at the bottom level, which must all be in
+    // memory at once.
+    void processBucket(Bucket& bucket, uint64_t bucketKey, TileSink& sink)
+    {
+        if (fits(bucket.numPoints))
+        {
+            std::vector<char> records;
+            load(bucket, records);
+            m_tileSet.emitLevels(records.data(), bucket.numPoints,
+                                 m_splitLevel, m_bottomLevel, childKeysUnder(bucketKey), sink);
+            return;
+        }
+
+        if (m_splitLevel == m_bottomLevel)
+        {
+            std::ostringstream oss;
+            oss << "ExternalTileSet: a tile at level " << m_bottomLevel << " has "
+                << bucket.numPoints << " points, which is more than the memory budget of "
+                << m_tileSet.m_maxMemory << " bytes allows; raise the budget"
+                << " or the max level";
+            throw pdal_error(oss.str());
+        }
+
+        const uint32_t level = commonLevel(bucket, m_splitLevel, m_bottomLevel);
+        Partition child(m_tileSet, m_splitLevel,
+                        std::min(m_bottomLevel, level + resplitDepth),
+                        m_bottomLevel, childKeysUnder(bucketKey));
+        feed(bucket, child);
+        child.finish(sink);
+    }
+
+    void removeFile(Bucket& bucket)
+    {
+        if (!bucket.path.empty())
+        {
+            std::remove(bucket.path.c_str());
+            bucket.path.clear();
+        }
+    }
+
+    ExternalTileSet& m_tileSet;
+    const uint32_t m_topLevel;
+    const uint32_t m_splitLevel;
+    const uint32_t m_bottomLevel;
+    const std::vector<uint64_t> m_bottomChildKeys; // sorted; none at the max level
+    const uint32_t m_shift; // from a point's key to its bucket's
+    const uint64_t m_upperSkip;
+    std::map<uint64_t, Bucket> m_buckets;
+    Bucket m_upper; // for the levels above the split
+    uint64_t m_bufferedBytes;
+    bool m_spilled;
+    Bucket* m_current; // the one the points in order are going into
+    uint64_t m_currentKey;
+};
+
+
+ExternalTileSet::ExternalTileSet(
+        uint32_t maxLevel,
+        double minx, double miny,
+        double maxx, double maxy,
+        uint32_t numColsAtL0, uint32_t numRowsAtL0,
+        const DimTypeList& dims,
+        uint64_t maxMemory,
+        const std::string& tempDir,
+        LogPtr log) :
+    m_maxLevel(maxLevel),
+    m_dims(dims),
+    m_pointSize(0),
+    m_maxMemory(maxMemory),
+    m_tempDir(tempDir),
+    m_log(log),
+    m_numPoints(0),
+    m_nextSeq(0)
+{
+    m_tmm = std::unique_ptr<TileMath>(new TileMath(minx, miny, maxx, maxy, numColsAtL0, numRowsAtL0));
+
+    m_keyBits = m_tmm->getMortonKeyBits(m_maxLevel);
+    if (m_keyBits > 64)
+    {
+        throw pdal_error("ExternalTileSet: max level too large for Morton keys");
+    }
+
+    for (const DimType& dt: m_dims)
+    {
+        m_pointSize += Dimension::size(dt.m_type);
+    }
+    m_recordSize = recordHeaderSize + m_pointSize;
+    m_record.resize(m_recordSize);
+
+    m_root = std::unique_ptr<Partition>(
+        new Partition(*this, 0, std::min(m_maxLevel, topSplitLevel),
+                      m_maxLevel, std::vector<uint64_t>()));
+}
+
+
+ExternalTileSet::~ExternalTileSet()
+{
+}
+
+
+void ExternalTileSet::setSortedSink(TileSink sink)
+{
+    if (m_numPoints)
+    {
+        throw pdal_error("ExternalTileSet: points already added");
+    }
+
+    m_sortedSink = sink;
+
+    const uint32_t splitLevel = std::max(std::min(m_maxLevel, topSplitLevel),
+        m_maxLevel > sortedSplitDepth ? m_maxLevel - sortedSplitDepth : 0);
+    m_root = std::unique_ptr<Partition>(
+        new Partition(*this, 0, splitLevel, m_maxLevel, std::vector<uint64_t>()));
+}
+
+
+void ExternalTileSet::add(double x, double y, const char* packedPoint)
+{
+    assert(m_root);
+    assert(m_tmm->matrixContains(x,y));
+
+    uint32_t c, r;
+    m_tmm->getTileOfPoint(x, y, m_maxLevel, c, r);
+    // guard against rounding at the far edges
+    c = std::min(c, m_tmm->numColsAtLevel(m_maxLevel) - 1);
+    r = std::min(r, m_tmm->numRowsAtLevel(m_maxLevel) - 1);
+
+    const uint64_t key = m_tmm->getMortonKey(c, r, m_maxLevel);
+    const uint64_t seq = m_nextSeq++;
+    ++m_numPoints;
+
+    char* p = m_record.data();
+    std::memcpy(p, &key, sizeof(key));
+    std::memcpy(p + sizeof(key), &seq, sizeof(seq));
+    std::memcpy(p + recordHeaderSize, packedPoint, m_pointSize);
+
+    if (m_sortedSink)
+    {
+        m_root->moveTo(key, m_sortedSink);
+    }
+    m_root->add(p);
+}
+
+
+void ExternalTileSet::finish(TileSink sink)
+{
+    if (!m_root)
+    {
+        throw pdal_error("ExternalTileSet: already finished");
+    }
+
+    m_root->finish(sink);
+    m_root.reset();
+}
+
+
+// Builds the tiles from fromLevel to toLevel, bottom up, from the given
+// records, which must be in sequence order. Each tile gets the records
+// that fall in it and survive the decimation at its level, as in
+// WritableTile::addHere. childKeys are the keys of the tiles at the level
+// below toLevel, sorted, from which the masks at toLevel are made; they're
+// not needed at the max level.
+void ExternalTileSet::emitLevels(const char* records, size_t numRecords,
+                                 uint32_t fromLevel, uint32_t toLevel,
+                                 std::vector<uint64_t> childKeys,
+                                 TileSink& sink)
+{
+    std::vector<KeyedPoint> points;
+    std::vector<KeyedTile> tiles;
+    std::vector<char> data;
+
+    for (uint32_t level = toLevel + 1; level-- > fromLevel; )
+    {
+        const uint32_t shift = 2 * (m_maxLevel - level);
+        const uint64_t skip = ((uint64_t)1) << shift;
+
+        // the points at this level, by tile, and in order within each tile
+        points.clear();
+        for (size_t i=0; i<numRecords; i++)
+        {
+            const char* record = records + i * m_recordSize;
+            if (recordSeq(record) % skip == 0)
+            {
+                KeyedPoint p = { recordKey(record) >> shift, (uint32_t)i };
+                points.push_back(p);
+            }
+        }
+        radixSort(points, m_keyBits - shift);
+
+        // the tiles at this level: at the max level, the ones with points,
+        // and above it, the parents of the ones below
+        if (level == m_maxLevel)
+        {
+            tiles.clear();
+            for (const KeyedPoint& p: points)
+            {
+                if (tiles.empty() || tiles.back().key != p.key)
+                {
+                    KeyedTile tile = { p.key, 0, 0, 0 };
+                    tiles.push_back(tile);
+                }
+            }
+        }
+        else
+        {
+            getParentTiles(childKeys, tiles);
+        }
+
+        size_t i = 0;
+        for (const KeyedTile& tile: tiles)
+        {
+            const uint64_t key = tile.key;
+            size_t j = i;
+            while (j < points.size() && points[j].key == key)
+            {
+                ++j;
+            }
+            const uint32_t numPoints = j - i;
+            data.resize(numPoints * m_pointSize);
+            char* p = data.data();
+            for (; i<j; i++)
+            {
+                std::memcpy(p, records + points[i].idx * m_recordSize + recordHeaderSize,
+                            m_pointSize);
+                p += m_pointSize;
+            }
+
+            uint32_t col, row;
+            m_tmm->getTileOfMortonKey(key, level, col, row);
+            GpkgTile out(m_dims, data, numPoints, level, col, row, tile.mask, m_tileFormat);
+            sink(out);
+        }
+        assert(i == points.size());
+
+        childKeys.clear();
+        for (const KeyedTile& tile: tiles)
+        {
+            childKeys.push_back(tile.key);
+        }
+    }
+}
+
+
+std::string ExternalTileSet::makeTempPath() const
+{
+    namespace bfs = boost::filesystem;
+
+    const bfs::path dir = m_tempDir.empty() ?
+        bfs::temp_directory_path() : bfs::path(m_tempDir);
+    return (dir / bfs::unique_path("rialto-%%%%-%%%%-%%%%-%%%%.tmp")).string();
+}
+
+} // namespace rialto
@@ -0,0 +1,145 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#pragma once
+
+#include <pdal/pdal.hpp>
+#include <rialto/GeoPackageCommon.hpp>
+
+#include <functional>
+#include <memory>
+
+namespace rialto
+{
+    using namespace pdal;
+
+
+class GpkgTile;
+class TileMath;
+
+// Builds the same tiles as WritableTileSet::buildMorton, for inputs too big
+// to hold in memory.
+//
+// The points are given one at a time, already packed, and are sorted into
+// buckets by their tile at some split level, with the few needed for the
+// levels above the split set aside in a bucket of their own; when the
+// buckets hold more than the memory budget, they are appended to temporary
+// files. Then the subtrees are built one at a time, each from its own
+// bucket, and each tile is handed off as soon as it is finished. A bucket
+// which is itself too big is split again, further down, and so are the
+// points set aside for the levels above, down to the split.
+//
+// A single tile at the max level can't be split, so the budget must hold
+// all of its points, along with about 32 bytes a point to sort them;
+// finish() throws if it doesn't.
+//
+// If the points come in Morton order of their tiles, the subtree under
+// each bucket is built as soon as the points move on past it, rather than
+// in finish(): the tiles come out while the points are still being added,
+// and only the current bucket is held.
+class ExternalTileSet
+{
+public:
+    typedef std::function<void(GpkgTile&)> TileSink;
+
+    // maxMemory is in bytes; tempDir may be empty, for the system default
+    ExternalTileSet(uint32_t maxLevel,
+                    double minx, double miny,
+                    double maxx, double maxy,
+                    uint32_t numColsAtL0, uint32_t numRowsAtL0,
+                    const DimTypeList& dims,
+                    uint64_t maxMemory,
+                    const std::string& tempDir,
+                    LogPtr log);
+    ~ExternalTileSet();
+
+    // Numbers the points from seq on, rather than from 0, for adding to a
+    // tile set that already has seq points: the decimation carries on
+    // from where it left off. Call before adding any points.
+    void setFirstSeq(uint64_t seq) { m_nextSeq = seq; }
+
+    // of the tiles given to the sink
+    void setTileFormat(const GpkgTileFormat& format) { m_tileFormat = format; }
+
+    // For points added in Morton order of their tiles at the max level
+    // (see TileMath::getMortonKey): the tiles of each finished subtree are
+    // given to the sink from add(), and the rest to the one given to
+    // finish(). add() throws if a point comes back to a subtree already
+    // built. Call before adding any points.
+    void setSortedSink(TileSink sink);
+
+    // the point's fields must be packed per the dims
+    void add(double x, double y, const char* packedPoint);
+
+    // Builds the tiles, giving each one with points at or below it to the
+    // sink, even if it has none of its own. The tiles come out subtree by
+    // subtree, not in any particular order. Can only be called once, after
+    // all the points have been added.
+    void finish(TileSink sink);
+
+    point_count_t getNumPoints() const { return m_numPoints; }
+    uint32_t getMaxLevel() const { return m_maxLevel; }
+
+    LogPtr log() { return m_log; }
+
+private:
+    class Partition;
+
+    void emitLevels(const char* records, size_t numRecords,
+                    uint32_t fromLevel, uint32_t toLevel,
+                    std::vector<uint64_t> childKeys,
+                    TileSink& sink);
+    std::string makeTempPath() const;
+
+    uint32_t m_maxLevel;
+    std::unique_ptr<TileMath> m_tmm;
+    DimTypeList m_dims;
+    size_t m_pointSize;
+    size_t m_recordSize; // key, sequence number, and the packed point
+    uint32_t m_keyBits;
+    uint64_t m_maxMemory;
+    std::string m_tempDir;
+    LogPtr m_log;
+    point_count_t m_numPoints;
+    uint64_t m_nextSeq;
+    GpkgTileFormat m_tileFormat;
+    TileSink m_sortedSink; // if the points are in order
+    std::vector<char> m_record;
+    std::unique_ptr<Partition> m_root;
+
+    ExternalTileSet& operator=(const ExternalTileSet&); // not implemented
+    ExternalTileSet(const ExternalTileSet&); // not implemented
+};
+
+} // namespace rialto
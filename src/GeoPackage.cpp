@@ -35,20 +35,28 @@
 #include <rialto/GeoPackage.hpp>
 
 #include <rialto/GeoPackageCommon.hpp>
-#include <rialto/GeoPackageManager.hpp>
+#include "ColumnarCodec.hpp"
 #include "SQLiteCommon.hpp"
+#include "TileMath.hpp"
+
+#include <sstream>
 
 namespace rialto
 {
 
-static double doubleFromString(const std::string& str)
+struct GeoPackage::CachedMatrixSet
 {
-    return strtod(str.c_str(), NULL);
-}
+    GpkgMatrixSet info;
+    std::unique_ptr<TileMath> tmm;
+    bool hasEmptyTiles;
+    bool hasTileStats;
+};
+
 
 GeoPackage::GeoPackage(const std::string& connection, LogPtr log) :
     m_connection(connection),
     m_log(log),
+    m_matrixSetCacheHits(0),
     e_readMatrixSet("readMatrixSet"),
     e_srsQueries("srsQueries")
 
@@ -78,18 +86,10 @@ void GeoPackage::internalOpen(bool writable)
     {
         throw pdal_error("GeoPackage: does not exist");
     }
-    else if (writable && fileExists)
-    {
-        FileUtils::deleteFile(m_connection);
-        GeoPackageManager db(m_connection, log());
-        db.open();
-        db.close();
-        if (!FileUtils::fileExists(m_connection))
-        {
-            throw pdal_error("GeoPackage: unable to initialize empty file");
-        }
-    }
 
+    // an existing file is opened as is, so that tile sets can be added to
+    // it, or appended to; a missing one is created by the connect, and
+    // given its tables by GeoPackageManager::open()
     m_sqlite = std::unique_ptr<SQLite>(new SQLite(m_connection, m_log));
     m_sqlite->connect(writable);
 }
@@ -104,6 +104,8 @@ void GeoPackage::internalClose()
         throw pdal_error("GeoPackage: invalid state (session does exist)");
     }
 
+    clearMatrixSetCache();
+
     m_sqlite.reset();
 }
 
@@ -119,11 +121,10 @@ uint32_t GeoPackage::querySrsId(const std::string& wkt) const
 
     // TODO: how better to look up SRS than text match of WKT?
 
-    std::ostringstream oss;
-    oss << "SELECT srs_id FROM gpkg_spatial_ref_sys"
-        << " WHERE definition='" << wkt << "'";
+    const std::string sql("SELECT srs_id FROM gpkg_spatial_ref_sys"
+                          " WHERE definition=?");
 
-    m_sqlite->query(oss.str());
+    m_sqlite->query(sql, row{column(wkt)});
 
     e_srsQueries.stop();
 
@@ -134,7 +135,7 @@ uint32_t GeoPackage::querySrsId(const std::string& wkt) const
     }
 
     // take the first one, ignore any others
-    const uint32_t srs_id = boost::lexical_cast<uint32_t>(r->at(0).data);
+    const uint32_t srs_id = r->at(0).getUInt32();
 
     return srs_id;
 }
@@ -144,13 +145,12 @@ std::string GeoPackage::querySrsWkt(uint32_t srs_id) const
 {
     e_srsQueries.start();
 
-    std::ostringstream oss;
-    oss << "SELECT definition "
-        << "FROM gpkg_spatial_ref_sys WHERE srs_id=" << srs_id;
+    const std::string sql("SELECT definition "
+                          "FROM gpkg_spatial_ref_sys WHERE srs_id=?");
 
     log()->get(LogLevel::Debug) << "SELECT for tile set" << std::endl;
 
-    m_sqlite->query(oss.str());
+    m_sqlite->query(sql, row{column(srs_id)});
 
     // should get exactly one row back
     const row* r = m_sqlite->get();
@@ -190,7 +190,200 @@ void GeoPackage::commitTransaction()
 }
 
 
+bool GeoPackage::readTile(std::string const& name,
+                          uint32_t level, uint32_t column, uint32_t row,
+                          GpkgTile& info) const
+{
+    if (!m_sqlite)
+    {
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
+    }
+
+    std::ostringstream oss;
+    oss << "SELECT num_points,child_mask,tile_data"
+        << " FROM '" << name << "'"
+        << " WHERE zoom_level=? AND tile_column=? AND tile_row=?";
+
+    m_sqlite->query(oss.str(), rialto::row{rialto::column(level), rialto::column(column),
+                                           rialto::column(row)});
+
+    const rialto::row* r = m_sqlite->get();
+    if (!r)
+    {
+        return false;
+    }
+
+    const uint32_t numPoints = r->at(0).getUInt32();
+    const uint32_t mask = r->at(1).getUInt32();
+    const char* data = reinterpret_cast<const char*>(r->at(2).getBlobData());
+    const std::vector<char> v(data, data + r->at(2).blobLen);
+    info.set(level, column, row, numPoints, mask, v);
+
+    assert(!m_sqlite->next());
+    return true;
+}
+
+
+void GeoPackage::readTilesAt(std::string const& name,
+                             const std::vector<GpkgTile>& positions,
+                             std::vector<GpkgTile>& tiles) const
+{
+    if (!m_sqlite)
+    {
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
+    }
+
+    tiles.clear();
+    if (positions.empty())
+    {
+        return;
+    }
+
+    // the positions go in a table of this connection's own, to join with
+    m_sqlite->execute("CREATE TEMP TABLE IF NOT EXISTS rialto_positions("
+                      "zoom_level INTEGER NOT NULL,"
+                      "tile_column INTEGER NOT NULL,"
+                      "tile_row INTEGER NOT NULL)");
+    m_sqlite->execute("DELETE FROM temp.rialto_positions");
+
+    records rs;
+    for (const GpkgTile& tile: positions)
+    {
+        rs.push_back(row{column(tile.getLevel()), column(tile.getColumn()),
+                         column(tile.getRow())});
+    }
+    m_sqlite->insert("INSERT INTO temp.rialto_positions VALUES (?, ?, ?)", rs);
+
+    std::ostringstream oss;
+    oss << "SELECT t.zoom_level,t.tile_column,t.tile_row,"
+        << "t.num_points,t.child_mask,t.tile_data"
+        << " FROM temp.rialto_positions p JOIN '" << name << "' t"
+        << " ON t.zoom_level=p.zoom_level"
+        << " AND t.tile_column=p.tile_column AND t.tile_row=p.tile_row";
+
+    m_sqlite->query(oss.str());
+
+    do {
+        const row* r = m_sqlite->get();
+        if (!r) break;
+
+        const char* data = reinterpret_cast<const char*>(r->at(5).getBlobData());
+        const std::vector<char> v(data, data + r->at(5).blobLen);
+        tiles.push_back(GpkgTile());
+        tiles.back().set(r->at(0).getUInt32(), r->at(1).getUInt32(), r->at(2).getUInt32(),
+                         r->at(3).getUInt32(), r->at(4).getUInt32(), v);
+    } while (m_sqlite->next());
+
+    m_sqlite->execute("DELETE FROM temp.rialto_positions");
+}
+
+
+void GeoPackage::getCountsAtLevel(std::string const& name, uint32_t level,
+                                  uint32_t& numTiles, uint32_t& numPoints) const
+{
+    if (!m_sqlite)
+    {
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
+    }
+
+    std::ostringstream oss;
+    oss << "SELECT count(num_points),sum(num_points) FROM '" << name << "'"
+        << " WHERE zoom_level=?";
+
+    log()->get(LogLevel::Debug) << "SELECT for tile ids at level: " << level << std::endl;
+
+    m_sqlite->query(oss.str(), row{column(level)});
+
+    numTiles = 0;
+    numPoints = 0;
+    
+    do {
+        const row* r = m_sqlite->get();
+        if (!r) break;
+
+        numTiles += r->at(0).getUInt32();
+        numPoints += r->at(1).getUInt32();
+        
+        //log()->get(LogLevel::Debug) << "  got tile id=" << id << std::endl;
+    } while (m_sqlite->next());
+}
+
+
 void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) const
+{
+    info = getMatrixSet(name);
+}
+
+
+const GpkgMatrixSet& GeoPackage::getMatrixSet(std::string const& name) const
+{
+    auto iter = m_matrixSets.find(name);
+    if (iter != m_matrixSets.end())
+    {
+        ++m_matrixSetCacheHits;
+        return iter->second->info;
+    }
+
+    std::shared_ptr<CachedMatrixSet> entry(new CachedMatrixSet);
+    GpkgMatrixSet& info = entry->info;
+    queryMatrixSet(name, info);
+    entry->tmm.reset(new TileMath(info.getTmsetMinX(), info.getTmsetMinY(),
+                                  info.getTmsetMaxX(), info.getTmsetMaxY(),
+                                  info.getNumColsAtL0(), info.getNumRowsAtL0()));
+    entry->hasEmptyTiles = queryExtension(name, emptyTilesExtensionName());
+    entry->hasTileStats = doesTableExist(statsTableName(name));
+
+    m_matrixSets[name] = entry;
+    return info;
+}
+
+
+const TileMath& GeoPackage::getTileMath(std::string const& name) const
+{
+    getMatrixSet(name);
+    return *m_matrixSets[name]->tmm;
+}
+
+
+bool GeoPackage::hasEmptyTiles(std::string const& name) const
+{
+    getMatrixSet(name);
+    return m_matrixSets[name]->hasEmptyTiles;
+}
+
+
+bool GeoPackage::hasTileStats(std::string const& name) const
+{
+    getMatrixSet(name);
+    return m_matrixSets[name]->hasTileStats;
+}
+
+
+bool GeoPackage::queryExtension(std::string const& name, std::string const& extension) const
+{
+    const std::string sql(
+        "SELECT 1 FROM gpkg_extensions"
+        " WHERE table_name=? AND extension_name=?");
+
+    m_sqlite->query(sql, row{column(name), column(extension)});
+
+    return m_sqlite->get() != NULL;
+}
+
+
+void GeoPackage::clearMatrixSetCache(std::string const& name)
+{
+    m_matrixSets.erase(name);
+}
+
+
+void GeoPackage::clearMatrixSetCache()
+{
+    m_matrixSets.clear();
+}
+
+
+void GeoPackage::queryMatrixSet(std::string const& name, GpkgMatrixSet& info) const
 {
     if (!m_sqlite)
     {
@@ -204,13 +397,13 @@ void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) con
     double data_min_x, data_min_y, data_max_x, data_max_y;
     std::string description;
     {
-        std::ostringstream oss;
-        oss << "SELECT last_change, min_x, min_y, max_x, max_y, srs_id, description "
-            << "FROM gpkg_contents WHERE table_name='" << name << "'";
+        const std::string sql(
+            "SELECT last_change, min_x, min_y, max_x, max_y, srs_id, description "
+            "FROM gpkg_contents WHERE table_name=?");
 
         log()->get(LogLevel::Debug) << "SELECT for tile set" << std::endl;
 
-        m_sqlite->query(oss.str());
+        m_sqlite->query(sql, row{column(name)});
 
         // should get exactly one row back: if not, it's a programmer error
         const row* r = m_sqlite->get();
@@ -220,12 +413,12 @@ void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) con
             throw pdal_error("Requested matrix set does not exist: " + name);
         }
 
-        datetime = r->at(0).data;
-        data_min_x = doubleFromString(r->at(1).data);
-        data_min_y = doubleFromString(r->at(2).data);
-        data_max_x = doubleFromString(r->at(3).data);
-        data_max_y = doubleFromString(r->at(4).data);
-        srs_id = boost::lexical_cast<uint32_t>(r->at(5).data);
+        datetime = r->at(0).getText();
+        data_min_x = r->at(1).getDouble();
+        data_min_y = r->at(2).getDouble();
+        data_max_x = r->at(3).getDouble();
+        data_max_y = r->at(4).getDouble();
+        srs_id = r->at(5).getUInt32();
         description = r->at(6).data;
         assert(!m_sqlite->next());
     }
@@ -233,21 +426,21 @@ void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) con
     double tmset_min_x, tmset_min_y, tmset_max_x, tmset_max_y;
     {
         // tile extents, not data extents
-        std::ostringstream oss;
-        oss << "SELECT min_x, min_y, max_x, max_y "
-            << "FROM gpkg_pctile_matrix_set WHERE table_name='" << name << "'";
+        const std::string sql(
+            "SELECT min_x, min_y, max_x, max_y "
+            "FROM gpkg_pctile_matrix_set WHERE table_name=?");
 
         log()->get(LogLevel::Debug) << "SELECT for tile set" << std::endl;
 
-        m_sqlite->query(oss.str());
+        m_sqlite->query(sql, row{column(name)});
 
         // should get exactly one row back
         const row* r = m_sqlite->get();
         assert(r);
-        tmset_min_x = doubleFromString(r->at(0).data);
-        tmset_min_y = doubleFromString(r->at(1).data);
-        tmset_max_x = doubleFromString(r->at(2).data);
-        tmset_max_y = doubleFromString(r->at(3).data);
+        tmset_min_x = r->at(0).getDouble();
+        tmset_min_y = r->at(1).getDouble();
+        tmset_max_x = r->at(2).getDouble();
+        tmset_max_y = r->at(3).getDouble();
         assert(!m_sqlite->next());
     }
 
@@ -255,51 +448,51 @@ void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) con
 
     uint32_t maxLevel;
     {
-        std::ostringstream oss;
-        oss << "SELECT MAX(zoom_level) "
-            << "FROM gpkg_pctile_matrix WHERE table_name='" << name << "'";
+        const std::string sql(
+            "SELECT MAX(zoom_level) "
+            "FROM gpkg_pctile_matrix WHERE table_name=?");
 
-        m_sqlite->query(oss.str());
+        m_sqlite->query(sql, row{column(name)});
 
         // should get exactly one row back
         const row* r = m_sqlite->get();
         assert(r);
 
-        maxLevel = boost::lexical_cast<uint32_t>(r->at(0).data);
+        maxLevel = r->at(0).getUInt32();
         assert(!m_sqlite->next());
     }
 
     uint32_t numDimensions;
     {
-        std::ostringstream oss;
-        oss << "SELECT COUNT(table_name) "
-            << "FROM gpkg_pctile_dimension_set WHERE table_name='" << name << "'";
+        const std::string sql(
+            "SELECT COUNT(table_name) "
+            "FROM gpkg_pctile_dimension_set WHERE table_name=?");
 
-        m_sqlite->query(oss.str());
+        m_sqlite->query(sql, row{column(name)});
 
         // should get exactly one row back
         const row* r = m_sqlite->get();
         assert(r);
-        numDimensions = boost::lexical_cast<uint32_t>(r->at(0).data);
+        numDimensions = r->at(0).getUInt32();
         assert(numDimensions != 0);
         assert(!m_sqlite->next());
     }
 
     uint32_t numColsAtL0, numRowsAtL0;
     {
-        std::ostringstream oss;
-        oss << "SELECT matrix_width, matrix_height"
-            << " FROM gpkg_pctile_matrix"
-            << " WHERE table_name='" << name << "'"
-            << " AND zoom_level=0";
+        const std::string sql(
+            "SELECT matrix_width, matrix_height"
+            " FROM gpkg_pctile_matrix"
+            " WHERE table_name=?"
+            " AND zoom_level=0");
 
-        m_sqlite->query(oss.str());
+        m_sqlite->query(sql, row{column(name)});
 
         // should get exactly one row back
         const row* r = m_sqlite->get();
         assert(r);
-        numColsAtL0 = boost::lexical_cast<uint32_t>(r->at(0).data);
-        numRowsAtL0 = boost::lexical_cast<uint32_t>(r->at(1).data);
+        numColsAtL0 = r->at(0).getUInt32();
+        numRowsAtL0 = r->at(1).getUInt32();
         assert(!m_sqlite->next());
     }
     assert(numColsAtL0==2);
@@ -309,26 +502,98 @@ void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) con
     {
         // TODO: should be a JOIN, just one query
         
-        std::ostringstream oss1;
-        oss1 << "SELECT md_file_id FROM gpkg_metadata_reference"
-            << " WHERE table_name='" << name << "'";
+        const std::string sql(
+            "SELECT md_file_id FROM gpkg_metadata_reference"
+            " WHERE table_name=?");
 
-        m_sqlite->query(oss1.str());
+        m_sqlite->query(sql, row{column(name)});
 
         // should get exactly one row back
         const row* r = m_sqlite->get();
         assert(r);
-        fileId = boost::lexical_cast<uint32_t>(r->at(0).data);
+        fileId = r->at(0).getUInt32();
         assert(!m_sqlite->next());
     }
     
+    GpkgEncoding encoding = GpkgEncodingPacked;
+    {
+        const std::string sql(
+            "SELECT definition FROM gpkg_extensions"
+            " WHERE table_name=? AND extension_name=?");
+
+        m_sqlite->query(sql, row{column(name), column(ColumnarCodec::extensionName())});
+
+        // no row if the tiles are packed
+        const row* r = m_sqlite->get();
+        if (r)
+        {
+            if (r->at(0).data != std::to_string(ColumnarCodec::version))
+            {
+                e_readMatrixSet.stop();
+                throw pdal_error("Unsupported columnar tile version " +
+                                 r->at(0).data + " in matrix set: " + name);
+            }
+            encoding = GpkgEncodingColumnar;
+        }
+    }
+
+    GpkgTileFormat format(encoding);
+    {
+        const std::string sql(
+            "SELECT definition FROM gpkg_extensions"
+            " WHERE table_name=? AND extension_name=?");
+
+        m_sqlite->query(sql, row{column(name),
+                                 column(GpkgTileFormat::codecsExtensionName())});
+
+        // no row in older tables, which use the default
+        const row* r = m_sqlite->get();
+        if (r)
+        {
+            const std::string codecs = r->at(0).data;
+            try
+            {
+                format.setCodecs(GpkgCodec::parseList(codecs));
+            }
+            catch (const pdal_error& e)
+            {
+                e_readMatrixSet.stop();
+                throw pdal_error("Unsupported tile codecs \"" + codecs +
+                                 "\" in matrix set: " + name + ": " + e.what());
+            }
+        }
+    }
+    {
+        const std::string sql(
+            "SELECT definition FROM gpkg_extensions"
+            " WHERE table_name=? AND extension_name=?");
+
+        m_sqlite->query(sql, row{column(name),
+                                 column(GpkgTileFormat::quantizationExtensionName())});
+
+        // no row if the tiles aren't quantized
+        const row* r = m_sqlite->get();
+        if (r)
+        {
+            std::istringstream iss(r->at(0).data);
+            double scaleX, scaleY, scaleZ, offsetZ;
+            if (!(iss >> scaleX >> scaleY >> scaleZ >> offsetZ))
+            {
+                e_readMatrixSet.stop();
+                throw pdal_error("Bad quantization scales \"" + r->at(0).data +
+                                 "\" in matrix set: " + name);
+            }
+            format.setQuantization(scaleX, scaleY, scaleZ, offsetZ);
+        }
+    }
+
     std::string lasMetadata;
     {
-        std::ostringstream oss2;
-        oss2 << "SELECT metadata FROM gpkg_metadata"
-            << " WHERE id=" << fileId;
+        const std::string sql(
+            "SELECT metadata FROM gpkg_metadata"
+            " WHERE id=?");
 
-        m_sqlite->query(oss2.str());
+        m_sqlite->query(sql, row{column(fileId)});
 
         // should get exactly one row back
         const row* r = m_sqlite->get();
@@ -341,6 +606,7 @@ void GeoPackage::readMatrixSet(std::string const& name, GpkgMatrixSet& info) con
              data_min_x, data_min_y, data_max_x, data_max_y,
              tmset_min_x, tmset_min_y, tmset_max_x, tmset_max_y,
              numColsAtL0, numRowsAtL0, description, lasMetadata);
+    info.setTileFormat(format);
 
     readDimensions(info.getName(), info.getDimensionsRef());
     assert(info.getDimensions().size() == info.getNumDimensions());
@@ -408,24 +674,24 @@ void GeoPackage::readDimensions(std::string const& name, std::vector<GpkgDimensi
 
     dimensionsInfo.clear();
 
-    std::ostringstream oss;
-    oss << "SELECT ordinal_position, dimension_name, data_type, description, minimum, mean, maximum "
-        << "FROM gpkg_pctile_dimension_set WHERE table_name='" << name << "'";
+    const std::string sql(
+        "SELECT ordinal_position, dimension_name, data_type, description, minimum, mean, maximum "
+        "FROM gpkg_pctile_dimension_set WHERE table_name=?");
 
-    m_sqlite->query(oss.str());
+    m_sqlite->query(sql, row{column(name)});
 
     int i = 0;
     do {
         const row* r = m_sqlite->get();
         if (!r) break;
 
-        const uint32_t position = boost::lexical_cast<uint32_t>(r->at(0).data);
+        const uint32_t position = r->at(0).getUInt32();
         const std::string name = r->at(1).data;
         const std::string dataType = r->at(2).data;
         const std::string description = r->at(3).data;
-        const double minimum = doubleFromString(r->at(4).data);
-        const double mean = doubleFromString(r->at(5).data);
-        const double maximum = doubleFromString(r->at(6).data);
+        const double minimum = r->at(4).getDouble();
+        const double mean = r->at(5).getDouble();
+        const double maximum = r->at(6).getDouble();
 
         GpkgDimension info(name, position, dataType, description, minimum, mean, maximum);
 
@@ -441,8 +707,13 @@ void GeoPackage::readDimensions(std::string const& name, std::vector<GpkgDimensi
 void GeoPackage::dumpStats() const
 {
     childDumpStats();
+    if (m_sqlite)
+    {
+        m_sqlite->dumpStats();
+    }
     e_srsQueries.dump();
     e_readMatrixSet.dump();
+    std::cout << "    matrixSetCacheHits: " << m_matrixSetCacheHits << std::endl;
 }
 
 
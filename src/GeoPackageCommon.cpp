@@ -33,11 +33,156 @@
 ****************************************************************************/
 
 #include <rialto/GeoPackageCommon.hpp>
+#include "ColumnarCodec.hpp"
+#include "PointFilter.hpp"
+#include "TileCodec.hpp"
+#include "TileMath.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <pdal/util/Utils.hpp>
 
 #if WITH_LAZPERF
 #include <pdal/Compression.hpp>
+#endif
+
+// smaller LazPerf tiles are left uncompressed
+static const uint32_t MIN_LAZ_POINTS = 20;
+
+namespace
+{
+
+using namespace pdal;
+
+bool sameDims(const DimTypeList& a, const DimTypeList& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (size_t i=0; i<a.size(); i++)
+    {
+        if (a[i].m_id != b[i].m_id || a[i].m_type != b[i].m_type)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Sets just the view's dims from points packed per the tile's dims,
+// skipping over the rest.
+class FieldCopier
+{
+public:
+    FieldCopier(const DimTypeList& tileDims, const DimTypeList& viewDims) :
+        m_viewDims(viewDims),
+        m_tilePointSize(0),
+        m_viewPointSize(0)
+    {
+        std::vector<size_t> tileOffsets;
+        for (const DimType& dim: tileDims)
+        {
+            tileOffsets.push_back(m_tilePointSize);
+            m_tilePointSize += Dimension::size(dim.m_type);
+        }
+
+        for (const DimType& dim: viewDims)
+        {
+            size_t i = 0;
+            while (i < tileDims.size() && tileDims[i].m_id != dim.m_id)
+            {
+                ++i;
+            }
+            if (i == tileDims.size() || tileDims[i].m_type != dim.m_type)
+            {
+                throw pdal_error("dimension " + Dimension::name(dim.m_id) +
+                                 " is not in the tile data");
+            }
+            m_offsets.push_back(tileOffsets[i]);
+            m_sizes.push_back(Dimension::size(dim.m_type));
+            m_viewPointSize += m_sizes.back();
+        }
+    }
+
+    size_t tilePointSize() const { return m_tilePointSize; }
+    size_t viewPointSize() const { return m_viewPointSize; }
+
+    void copy(PointView& view, PointId idx, const char* point) const
+    {
+        for (size_t i=0; i<m_viewDims.size(); i++)
+        {
+            view.setField(m_viewDims[i].m_id, m_viewDims[i].m_type, idx,
+                          point + m_offsets[i]);
+        }
+    }
+
+    // packs the point per the view's dims instead
+    void pack(const char* point, char* out) const
+    {
+        for (size_t i=0; i<m_offsets.size(); i++)
+        {
+            std::memcpy(out, point + m_offsets[i], m_sizes[i]);
+            out += m_sizes[i];
+        }
+    }
+
+private:
+    const DimTypeList m_viewDims;
+    size_t m_tilePointSize;
+    size_t m_viewPointSize;
+    std::vector<size_t> m_offsets;
+    std::vector<size_t> m_sizes;
+};
+
+} // anonymous namespace
+
+#if WITH_LAZPERF
+namespace
+{
+
+// Like pdal's LazPerfBuf, but for decompressing only, and reading from
+// memory we don't own (such as a blob still held by SQLite), so that the
+// compressed bytes never need to be copied into a vector first.
+class LazPerfSpanBuf
+{
+public:
+    LazPerfSpanBuf(const char* data, size_t size) :
+        m_data(reinterpret_cast<const unsigned char*>(data)),
+        m_size(size),
+        m_idx(0)
+    {}
+
+    unsigned char getByte()
+    {
+        if (m_idx >= m_size)
+        {
+            throw pdal::pdal_error("LAZ tile data is truncated");
+        }
+        return m_data[m_idx++];
+    }
+
+    void getBytes(unsigned char* b, int len)
+    {
+        if (m_idx + len > m_size)
+        {
+            throw pdal::pdal_error("LAZ tile data is truncated");
+        }
+        std::copy(m_data + m_idx, m_data + m_idx + len, b);
+        m_idx += len;
+    }
+
+private:
+    const unsigned char* m_data;
+    const size_t m_size;
+    size_t m_idx;
+};
 
-static const int MIN_LAZ_POINTS = 20; // TODO
+} // anonymous namespace
 #endif
 
 namespace rialto
@@ -120,6 +265,32 @@ void GpkgMatrixSet::set(const std::string& datetime,
 }
 
 
+GpkgTileFormat GpkgMatrixSet::getTileFormat() const
+{
+    GpkgTileFormat format(m_tileFormat);
+    format.setTileMatrix(m_tmset_min_x, m_tmset_min_y, m_tmset_max_x, m_tmset_max_y,
+                         m_numColsAtL0, m_numRowsAtL0);
+    return format;
+}
+
+
+DimTypeList GpkgMatrixSet::getDimTypes() const
+{
+    DimTypeList dims(m_dimensions.size());
+    for (const GpkgDimension& dim: m_dimensions)
+    {
+        const uint32_t i = dim.getPosition();
+        if (i >= dims.size())
+        {
+            throw pdal_error("invalid position for dimension " + dim.getName());
+        }
+        dims[i] = DimType(Dimension::id(dim.getName()),
+                          Dimension::type(dim.getDataType()));
+    }
+    return dims;
+}
+
+
 uint32_t GpkgMatrixSet::getBytesPerPoint() const
 {
     uint32_t numBytes = 0;
@@ -179,24 +350,475 @@ uint32_t GpkgDimension::getNumBytes() const
 }
   
 
+GpkgCodec::GpkgCodec(GpkgCompression compression, int level) :
+    m_compression(compression),
+    m_level(level)
+{}
+
+
+GpkgCodec GpkgCodec::parse(const std::string& name)
+{
+    const std::string::size_type colon = name.find(':');
+    const std::string kind = Utils::trim(name.substr(0, colon));
+
+    if (kind == "none" && colon == std::string::npos)
+    {
+        return GpkgCodec(GpkgCompressionNone);
+    }
+    if (kind == "lazperf" && colon == std::string::npos)
+    {
+#if WITH_LAZPERF
+        return GpkgCodec(GpkgCompressionLazPerf);
+#else
+        throw pdal_error("codec lazperf is not built in");
+#endif
+    }
+    if (kind == "lz4" && colon == std::string::npos)
+    {
+        return GpkgCodec(GpkgCompressionLz4);
+    }
+    if (kind == "zstd")
+    {
+        int level = 3; // zstd's own default
+        if (colon != std::string::npos)
+        {
+            const std::string arg = Utils::trim(name.substr(colon + 1));
+            size_t end = 0;
+            try
+            {
+                level = std::stoi(arg, &end);
+            }
+            catch (const std::exception&)
+            {
+                end = 0;
+            }
+            if (arg.empty() || end != arg.size() || level < 1 || level > 22)
+            {
+                throw pdal_error("zstd level must be from 1 to 22: " + name);
+            }
+        }
+        return GpkgCodec(GpkgCompressionZstd, level);
+    }
+
+    throw pdal_error("unknown tile codec: " + name);
+}
+
+
+std::vector<GpkgCodec> GpkgCodec::parseList(const std::string& names)
+{
+    std::vector<GpkgCodec> codecs;
+    for (const std::string& name: Utils::split2(names, ','))
+    {
+        codecs.push_back(parse(name));
+    }
+    if (codecs.empty())
+    {
+        throw pdal_error("no tile codecs given");
+    }
+    return codecs;
+}
+
+
+std::string GpkgCodec::toList(const std::vector<GpkgCodec>& codecs)
+{
+    std::string names;
+    for (const GpkgCodec& codec: codecs)
+    {
+        names += (names.empty() ? "" : ",") + codec.getName();
+    }
+    return names;
+}
+
+
+std::vector<GpkgDimLimit> GpkgDimLimit::parseList(const std::string& text)
+{
+    std::vector<GpkgDimLimit> limits;
+    for (const std::string& item: Utils::split2(text, ','))
+    {
+        const std::string spec = Utils::trim(item);
+        if (spec.empty())
+        {
+            continue;
+        }
+
+        const std::string::size_type open = spec.find('[');
+        const std::string::size_type colon = spec.find(':');
+        if (open == std::string::npos || open == 0 ||
+            colon == std::string::npos || colon < open ||
+            spec.back() != ']')
+        {
+            throw pdal_error("dimension limit must be Name[min:max]: " + spec);
+        }
+
+        GpkgDimLimit limit;
+        limit.name = Utils::trim(spec.substr(0, open));
+        const std::string lo = Utils::trim(spec.substr(open + 1, colon - open - 1));
+        const std::string hi = Utils::trim(spec.substr(colon + 1, spec.size() - colon - 2));
+        try
+        {
+            size_t used = lo.size();
+            if (!lo.empty())
+            {
+                limit.minimum = std::stod(lo, &used);
+            }
+            if (used != lo.size())
+            {
+                throw std::invalid_argument(lo);
+            }
+            used = hi.size();
+            if (!hi.empty())
+            {
+                limit.maximum = std::stod(hi, &used);
+            }
+            if (used != hi.size())
+            {
+                throw std::invalid_argument(hi);
+            }
+        }
+        catch (const std::exception&)
+        {
+            throw pdal_error("dimension limit must be Name[min:max]: " + spec);
+        }
+        if (limit.minimum > limit.maximum)
+        {
+            throw pdal_error("dimension limit is empty: " + spec);
+        }
+
+        limits.push_back(limit);
+    }
+    return limits;
+}
+
+
+std::string GpkgCodec::getName() const
+{
+    switch (m_compression)
+    {
+        case GpkgCompressionNone: return "none";
+        case GpkgCompressionLazPerf: return "lazperf";
+        case GpkgCompressionZstd: return "zstd:" + std::to_string(m_level);
+        case GpkgCompressionLz4: return "lz4";
+    }
+    assert(0);
+    return "";
+}
+
+
+GpkgTileFormat::GpkgTileFormat(GpkgEncoding encoding) :
+    m_encoding(encoding),
+    m_scaleX(0.0),
+    m_scaleY(0.0),
+    m_scaleZ(0.0),
+    m_offsetZ(0.0)
+{
+#if WITH_LAZPERF
+    const bool lazPerf = (encoding == GpkgEncodingPacked);
+#else
+    const bool lazPerf = false;
+#endif
+    m_codecs.push_back(GpkgCodec(lazPerf ? GpkgCompressionLazPerf : GpkgCompressionNone));
+}
+
+
+void GpkgTileFormat::setCodecs(const std::vector<GpkgCodec>& codecs)
+{
+    if (codecs.empty())
+    {
+        throw pdal_error("no tile codecs given");
+    }
+    for (const GpkgCodec& codec: codecs)
+    {
+        if (codec.getCompression() == GpkgCompressionLazPerf &&
+            m_encoding != GpkgEncodingPacked)
+        {
+            throw pdal_error("codec lazperf needs the packed encoding");
+        }
+    }
+
+    m_codecs = codecs;
+}
+
+
+void GpkgTileFormat::setQuantization(double scaleX, double scaleY,
+                                     double scaleZ, double offsetZ)
+{
+    if (scaleX < 0.0 || scaleY < 0.0 || scaleZ < 0.0)
+    {
+        throw pdal_error("quantization scales must not be negative");
+    }
+
+    m_scaleX = scaleX;
+    m_scaleY = scaleY;
+    m_scaleZ = scaleZ;
+    m_offsetZ = offsetZ;
+}
+
+
+void GpkgTileFormat::setTileMatrix(double minx, double miny, double maxx, double maxy,
+                                   uint32_t numColsAtL0, uint32_t numRowsAtL0)
+{
+    m_tileMath.reset();
+    if (numColsAtL0 && numRowsAtL0)
+    {
+        m_tileMath.reset(new TileMath(minx, miny, maxx, maxy, numColsAtL0, numRowsAtL0));
+    }
+}
+
+
+double GpkgTileFormat::getScale(const DimType& dim) const
+{
+    if (dim.m_type != Dimension::Type::Double)
+    {
+        return 0.0;
+    }
+
+    switch (dim.m_id)
+    {
+        case Dimension::Id::X: return m_scaleX;
+        case Dimension::Id::Y: return m_scaleY;
+        case Dimension::Id::Z: return m_scaleZ;
+        default: return 0.0;
+    }
+}
+
+
+void GpkgTileFormat::getOrigin(uint32_t level, uint32_t column, uint32_t row,
+                               double& x, double& y) const
+{
+    if (!m_tileMath)
+    {
+        throw pdal_error("quantized tile format has no tile matrix");
+    }
+
+    double maxx, maxy;
+    m_tileMath->getTileBounds(column, row, level, x, y, maxx, maxy);
+}
+
+
+DimTypeList GpkgTileFormat::getStoredDims(const DimTypeList& dims) const
+{
+    DimTypeList stored(dims);
+    for (DimType& dim: stored)
+    {
+        if (getScale(dim) != 0.0)
+        {
+            dim.m_type = Dimension::Type::Signed32;
+        }
+    }
+    return stored;
+}
+
+
+void GpkgTileFormat::quantize(const DimTypeList& dims, uint32_t numPoints,
+                              uint32_t level, uint32_t column, uint32_t row,
+                              std::vector<char>& buf) const
+{
+    if (!isQuantized())
+    {
+        return;
+    }
+
+    double originX, originY;
+    getOrigin(level, column, row, originX, originY);
+
+    const DimTypeList stored = getStoredDims(dims);
+    size_t pointSize = 0, storedPointSize = 0;
+    for (size_t i=0; i<dims.size(); i++)
+    {
+        pointSize += Dimension::size(dims[i].m_type);
+        storedPointSize += Dimension::size(stored[i].m_type);
+    }
+    assert(buf.size() == numPoints * pointSize);
+
+    std::vector<char> out(numPoints * storedPointSize);
+    const char* p = buf.data();
+    char* q = out.data();
+    for (uint32_t i=0; i<numPoints; i++)
+    {
+        for (const DimType& dim: dims)
+        {
+            const size_t size = Dimension::size(dim.m_type);
+            const double scale = getScale(dim);
+            if (scale == 0.0)
+            {
+                std::memcpy(q, p, size);
+                p += size;
+                q += size;
+                continue;
+            }
+
+            const double origin = (dim.m_id == Dimension::Id::X) ? originX :
+                                  (dim.m_id == Dimension::Id::Y) ? originY : m_offsetZ;
+            double v;
+            std::memcpy(&v, p, sizeof(v));
+            const double steps = std::round((v - origin) / scale);
+            if (!(steps >= (std::numeric_limits<int32_t>::min)() &&
+                  steps <= (std::numeric_limits<int32_t>::max)()))
+            {
+                throw pdal_error("quantized " + Dimension::name(dim.m_id) +
+                                 " is out of range: its scale is too small");
+            }
+            const int32_t iv = (int32_t)steps;
+            std::memcpy(q, &iv, sizeof(iv));
+            p += sizeof(v);
+            q += sizeof(iv);
+        }
+    }
+
+    buf.swap(out);
+}
+
+
+// out[i] = offset + scale * in[i], kept to a plain loop over arrays so that
+// the compiler can vectorize it
+static void multiplyAdd(const int32_t* in, size_t n, double scale, double offset,
+                        double* out)
+{
+    for (size_t i=0; i<n; i++)
+    {
+        out[i] = offset + scale * in[i];
+    }
+}
+
+
+void GpkgTileFormat::dequantize(const DimTypeList& dims, uint32_t numPoints,
+                                uint32_t level, uint32_t column, uint32_t row,
+                                std::vector<char>& buf) const
+{
+    if (!isQuantized())
+    {
+        return;
+    }
+
+    double originX = 0.0, originY = 0.0;
+    bool needOrigin = false;
+    for (const DimType& dim: dims)
+    {
+        needOrigin = needOrigin ||
+            (getScale(dim) != 0.0 && dim.m_id != Dimension::Id::Z);
+    }
+    if (needOrigin)
+    {
+        getOrigin(level, column, row, originX, originY);
+    }
+
+    const DimTypeList stored = getStoredDims(dims);
+    size_t pointSize = 0, storedPointSize = 0;
+    for (size_t i=0; i<dims.size(); i++)
+    {
+        pointSize += Dimension::size(dims[i].m_type);
+        storedPointSize += Dimension::size(stored[i].m_type);
+    }
+    if (buf.size() != numPoints * storedPointSize)
+    {
+        throw pdal_error("quantized tile data has the wrong size");
+    }
+
+    std::vector<char> out(numPoints * pointSize);
+    std::vector<int32_t> steps;
+    std::vector<double> values;
+
+    // a column at a time
+    size_t offset = 0, storedOffset = 0;
+    for (const DimType& dim: dims)
+    {
+        const size_t size = Dimension::size(dim.m_type);
+        const double scale = getScale(dim);
+
+        const char* p = buf.data() + storedOffset;
+        char* q = out.data() + offset;
+
+        if (scale == 0.0)
+        {
+            for (uint32_t i=0; i<numPoints; i++)
+            {
+                std::memcpy(q, p, size);
+                p += storedPointSize;
+                q += pointSize;
+            }
+            offset += size;
+            storedOffset += size;
+            continue;
+        }
+
+        steps.resize(numPoints);
+        values.resize(numPoints);
+        for (uint32_t i=0; i<numPoints; i++)
+        {
+            std::memcpy(&steps[i], p, sizeof(int32_t));
+            p += storedPointSize;
+        }
+
+        const double origin = (dim.m_id == Dimension::Id::X) ? originX :
+                              (dim.m_id == Dimension::Id::Y) ? originY : m_offsetZ;
+        multiplyAdd(steps.data(), numPoints, scale, origin, values.data());
+
+        for (uint32_t i=0; i<numPoints; i++)
+        {
+            std::memcpy(q, &values[i], sizeof(double));
+            q += pointSize;
+        }
+        offset += sizeof(double);
+        storedOffset += sizeof(int32_t);
+    }
+
+    buf.swap(out);
+}
+
+
 GpkgTile::GpkgTile(PointView* view,
-                   uint32_t level, uint32_t column, uint32_t row, uint32_t mask) :
+                   uint32_t level, uint32_t column, uint32_t row, uint32_t mask,
+                   const GpkgTileFormat& format) :
     m_level(level),
     m_column(column),
     m_row(row),
     m_numPoints(0),
-    m_mask(mask)
+    m_mask(mask),
+    m_blobRef(0),
+    m_blobRefSize(0)
 {
     m_blob.clear();
 
     if (view)
     {
         m_numPoints = view->size();
-        importFromPV(*view, m_blob);
+
+        const uint32_t pointSize = view->pointSize();
+        m_blob.resize(pointSize * m_numPoints);
+
+        char* p = m_blob.data();
+        const DimTypeList& dtl = view->dimTypes();
+
+        for (size_t i=0; i<m_numPoints; ++i)
+        {
+            view->getPackedPoint(dtl, i, p);
+            p += pointSize;
+        }
+
+        encode(dtl, format);
     }
 }
 
 
+GpkgTile::GpkgTile(const DimTypeList& dims, std::vector<char>& packedPoints,
+                   uint32_t numPoints,
+                   uint32_t level, uint32_t column, uint32_t row, uint32_t mask,
+                   const GpkgTileFormat& format) :
+    m_level(level),
+    m_column(column),
+    m_row(row),
+    m_numPoints(numPoints),
+    m_mask(mask),
+    m_blobRef(0),
+    m_blobRefSize(0)
+{
+    m_blob.swap(packedPoints);
+    packedPoints.clear();
+
+    encode(dims, format);
+}
+
+
 void GpkgTile::set(uint32_t level,
                    uint32_t column,
                    uint32_t row,
@@ -210,59 +832,211 @@ void GpkgTile::set(uint32_t level,
     m_numPoints = numPoints;
     m_mask = mask;
     m_blob = blob;
+    m_blobRef = 0;
+    m_blobRefSize = 0;
+    m_minimums.clear();
+    m_maximums.clear();
 }
 
 
-void GpkgTile::importFromPV(const PointView& view,
-                         std::vector<char>& dest)
+void GpkgTile::set(uint32_t level,
+                   uint32_t column,
+                   uint32_t row,
+                   uint32_t numPoints,
+                   uint32_t mask,
+                   const char* blob,
+                   size_t blobSize)
 {
-    const uint32_t pointSize = view.pointSize();
-    const uint32_t numPoints = view.size();
-    const uint32_t bufLen = pointSize * numPoints;
+    m_level = level;
+    m_column = column;
+    m_row = row;
+    m_numPoints = numPoints;
+    m_mask = mask;
+    m_blob.clear();
+    m_blobRef = blob;
+    m_blobRefSize = blobSize;
+    m_minimums.clear();
+    m_maximums.clear();
+}
 
-    dest.resize(bufLen);
 
-    char* p = dest.data();
-    const DimTypeList& dtl = view.dimTypes();
+// turns the blob, holding the points packed per the dims, into the real
+// blob, in place
+void GpkgTile::encode(const DimTypeList& dims, const GpkgTileFormat& format)
+{
+    // a tile the decimation left with no points of its own is kept just for
+    // its mask, with an empty blob and no extents
+    if (m_numPoints == 0)
+    {
+        m_blob.clear();
+        m_minimums.clear();
+        m_maximums.clear();
+        return;
+    }
 
-    for (size_t i=0; i<numPoints; ++i)
+    // the extents, for the stats table, from the real values
+    m_minimums.assign(dims.size(), 0.0);
+    m_maximums.assign(dims.size(), 0.0);
+    std::vector<double> column;
+    for (size_t i=0; i<dims.size(); ++i)
     {
-        view.getPackedPoint(dtl, i, p);
-        p += pointSize;
+        PointFilter::getColumn(dims, dims[i].m_id, m_blob.data(), m_numPoints, column);
+        if (!column.empty())
+        {
+            const auto mm = std::minmax_element(column.begin(), column.end());
+            m_minimums[i] = *mm.first;
+            m_maximums[i] = *mm.second;
+        }
+    }
+
+    format.quantize(dims, m_numPoints, m_level, m_column, m_row, m_blob);
+    const DimTypeList stored = format.getStoredDims(dims);
+
+    if (format.getEncoding() == GpkgEncodingColumnar)
+    {
+        std::vector<char> tmp;
+        ColumnarCodec::encode(stored, m_numPoints, m_blob.data(), tmp);
+        m_blob.swap(tmp);
+    }
+
+    const GpkgCodec& codec = format.getCodec(m_level);
+    if (codec.isByteCodec())
+    {
+        std::vector<char> tmp;
+        TileCodec::compress(codec, m_blob.data(), m_blob.size(), tmp);
+        m_blob.swap(tmp);
     }
-    
 #if WITH_LAZPERF
-    if (numPoints > MIN_LAZ_POINTS)
+    else if (usesLazPerf(format))
     {
         std::vector<unsigned char> tmp;
-        compressPatch(view, dest, tmp);
-        std::vector<unsigned char>& r = tmp;
-        dest = (std::vector<char>&)tmp;
+        compressPatch(stored, m_numPoints, m_blob, tmp);
+        m_blob = (std::vector<char>&)tmp;
     }
 #endif
 }
 
 
+// src is left pointing at the blob, less any byte codec: the points, or
+// the columns, as laid out by the encoding. How big that can be is known
+// from the dims and the number of points, and a blob that says otherwise
+// isn't trusted.
+void GpkgTile::uncompress(const DimTypeList& dims, const GpkgTileFormat& format,
+                          std::vector<char>& buf,
+                          const char*& src, size_t& srcSize) const
+{
+    src = getBlobData();
+    srcSize = getBlobSize();
+
+    const GpkgCodec& codec = format.getCodec(m_level);
+    if (codec.isByteCodec())
+    {
+        const DimTypeList stored = format.getStoredDims(dims);
+        if (format.getEncoding() == GpkgEncodingColumnar)
+        {
+            TileCodec::decompress(codec, src, srcSize,
+                                  ColumnarCodec::maxEncodedSize(stored, m_numPoints),
+                                  false, buf);
+        }
+        else
+        {
+            size_t pointSize = 0;
+            for (const DimType& dim: stored)
+            {
+                pointSize += Dimension::size(dim.m_type);
+            }
+            TileCodec::decompress(codec, src, srcSize, m_numPoints * pointSize, true, buf);
+        }
+        src = buf.data();
+        srcSize = buf.size();
+    }
+}
+
+
+bool GpkgTile::usesLazPerf(const GpkgTileFormat& format) const
+{
+    return format.getCodec(m_level).getCompression() == GpkgCompressionLazPerf &&
+           m_numPoints > MIN_LAZ_POINTS;
+}
+
+
 // does an append to the PV (does not start at index 0)
-void GpkgTile::exportToPV(size_t numPoints, PointViewPtr view,
-                          const std::vector<char>& src)
+//
+// Packed points go straight from the source bytes into the view: we never
+// make a copy of the (decompressed) blob, unless it has to be dequantized.
+// Columnar ones must be put back together first, but only the view's own
+// columns are decoded. If the view has just some of the tile's dims, the
+// rest are skipped over.
+void GpkgTile::exportToPV(PointViewPtr view, const GpkgTileFormat& format,
+                          const DimTypeList& tileDims) const
 {
+    if (m_numPoints == 0)
+    {
+        return;
+    }
+
+    const DimTypeList& dtl = view->dimTypes();
+
+    const char* src = 0;
+    size_t srcSize = 0;
+    const DimTypeList* srcDims = &tileDims; // how src is packed
+
+    std::vector<char> raw, packed;
+    if (format.getEncoding() == GpkgEncodingColumnar)
+    {
+        uncompress(tileDims, format, raw, src, srcSize);
+        decodeColumns(tileDims, dtl, format, src, srcSize, packed);
+        src = packed.data();
+        srcSize = packed.size();
+        srcDims = &dtl;
+    }
+    else if (format.isQuantized())
+    {
+        decode(tileDims, packed, format);
+        src = packed.data();
+        srcSize = packed.size();
+    }
 #if WITH_LAZPERF
-    if (numPoints > MIN_LAZ_POINTS)
+    else if (usesLazPerf(format))
     {
-        std::vector<char> tmp;
-        const std::vector<char>& mv1 = src;
-        const std::vector<unsigned char>& mv2 = (const std::vector<unsigned char>&)mv1;
-        decompressPatch(numPoints, view, mv2, tmp);
-        *(std::vector<char>*)&src = tmp;
+        decompressPatch(m_numPoints, view, tileDims, getBlobData(), getBlobSize());
+        return;
     }
 #endif
-  
+    else
+    {
+        uncompress(tileDims, format, raw, src, srcSize);
+    }
+
+    exportToPV(view, *srcDims, src, srcSize, m_numPoints);
+}
+
+
+void GpkgTile::exportToPV(PointViewPtr view, const DimTypeList& srcDims,
+                          const char* src, size_t srcSize, uint32_t numPoints)
+{
+    const DimTypeList& dtl = view->dimTypes();
+
     PointId idx = view->size();
+
+    if (!sameDims(srcDims, dtl))
+    {
+        const FieldCopier copier(srcDims, dtl);
+        assert(srcSize == numPoints * copier.tilePointSize());
+
+        for (size_t i=0; i<numPoints; ++i)
+        {
+            copier.copy(*view, idx, src);
+            src += copier.tilePointSize();
+            ++idx;
+        }
+        return;
+    }
+  
     const uint32_t pointSize = view->pointSize();
+    assert(srcSize == numPoints * pointSize);
 
-    const char* p = src.data();
-    const DimTypeList& dtl = view->dimTypes();
+    const char* p = src;
 
     for (size_t i=0; i<numPoints; ++i)
     {
@@ -273,24 +1047,133 @@ void GpkgTile::exportToPV(size_t numPoints, PointViewPtr view,
 }
 
 
+void GpkgTile::decode(const DimTypeList& dims, std::vector<char>& packedPoints,
+                      const GpkgTileFormat& format) const
+{
+    if (m_numPoints == 0)
+    {
+        packedPoints.clear();
+        return;
+    }
+
+    const char* src = 0;
+    size_t srcSize = 0;
+    std::vector<char> raw;
+
+    if (format.getEncoding() == GpkgEncodingColumnar)
+    {
+        uncompress(dims, format, raw, src, srcSize);
+        decodeColumns(dims, dims, format, src, srcSize, packedPoints);
+        return;
+    }
+
+    const DimTypeList stored = format.getStoredDims(dims);
+
+#if WITH_LAZPERF
+    if (usesLazPerf(format))
+    {
+        LazPerfSpanBuf b(getBlobData(), getBlobSize());
+        LazPerfDecompressor<LazPerfSpanBuf> decompressor(b, stored);
+        const size_t pointSize = decompressor.pointSize();
+
+        packedPoints.resize(m_numPoints * pointSize);
+        char* q = packedPoints.data();
+        for (size_t i=0; i<m_numPoints; ++i)
+        {
+            decompressor.decompress(q, pointSize); // signed
+            q += pointSize;
+        }
+    }
+    else
+#endif
+    {
+        uncompress(dims, format, raw, src, srcSize);
+        packedPoints.assign(src, src + srcSize);
+    }
+
+    format.dequantize(dims, m_numPoints, m_level, m_column, m_row, packedPoints);
+}
+
+
+void GpkgTile::decode(const DimTypeList& tileDims, const DimTypeList& wanted,
+                      std::vector<char>& packedPoints,
+                      const GpkgTileFormat& format) const
+{
+    if (m_numPoints == 0)
+    {
+        packedPoints.clear();
+        return;
+    }
+
+    if (format.getEncoding() == GpkgEncodingColumnar)
+    {
+        const char* src = 0;
+        size_t srcSize = 0;
+        std::vector<char> raw;
+        uncompress(tileDims, format, raw, src, srcSize);
+        decodeColumns(tileDims, wanted, format, src, srcSize, packedPoints);
+        return;
+    }
+
+    decode(tileDims, packedPoints, format);
+    selectDims(tileDims, wanted, m_numPoints, packedPoints);
+}
+
+
+void GpkgTile::selectDims(const DimTypeList& dims, const DimTypeList& wanted,
+                          uint32_t numPoints, std::vector<char>& packedPoints)
+{
+    if (sameDims(dims, wanted))
+    {
+        return;
+    }
+
+    const FieldCopier copier(dims, wanted);
+    assert(packedPoints.size() == numPoints * copier.tilePointSize());
+
+    // in place, as the points only get smaller
+    const char* p = packedPoints.data();
+    char* q = packedPoints.data();
+    std::vector<char> point(copier.viewPointSize());
+    for (uint32_t i=0; i<numPoints; i++)
+    {
+        copier.pack(p, point.data());
+        std::memcpy(q, point.data(), point.size());
+        p += copier.tilePointSize();
+        q += point.size();
+    }
+    packedPoints.resize(numPoints * copier.viewPointSize());
+}
+
+
+// just the wanted columns, which are some of the tile's dims
+void GpkgTile::decodeColumns(const DimTypeList& tileDims, const DimTypeList& wanted,
+                             const GpkgTileFormat& format,
+                             const char* src, size_t srcSize,
+                             std::vector<char>& packedPoints) const
+{
+    assert(format.getEncoding() == GpkgEncodingColumnar);
+
+    ColumnarCodec::decode(format.getStoredDims(tileDims), format.getStoredDims(wanted),
+                          m_numPoints, src, srcSize, packedPoints);
+    format.dequantize(wanted, m_numPoints, m_level, m_column, m_row, packedPoints);
+}
+
+
 #if WITH_LAZPERF
-void GpkgTile::compressPatch(const PointView& view,
+void GpkgTile::compressPatch(const DimTypeList& dtl, uint32_t numPoints,
                           const std::vector<char>& inBuf,
                           std::vector<unsigned char>& outBuf)
 {
     outBuf.clear();
     
-    const uint32_t pointSize = view.pointSize();
-    const uint32_t numPoints = view.size();
-    const uint32_t buflen = pointSize * numPoints;
+    const uint32_t pointSize = inBuf.size() / numPoints;
 
     const char* p = inBuf.data();
-    const DimTypeList& dtl = view.dimTypes();
 
     LazPerfBuf b(outBuf);  // unsigned
 
     LazPerfCompressor<LazPerfBuf> compressor(b, dtl);
-    std::vector<char> tmpbuf(compressor.pointSize());
     assert(compressor.pointSize() == pointSize);/***/
     for (size_t idx=0; idx<numPoints; ++idx)
     {
@@ -301,24 +1184,30 @@ void GpkgTile::compressPatch(const PointView& view,
 }
 
 
+// does an append to the PV, decompressing one point at a time
 void GpkgTile::decompressPatch(size_t numPoints, PointViewPtr view,
-                            const std::vector<unsigned char>& inBuf,
-                            std::vector<char>& outBuf)
+                               const DimTypeList& tileDims,
+                               const char* inBuf, size_t inBufSize)
 {
-    outBuf.clear();
-    
-    const uint32_t pointSize = view->pointSize();
     const DimTypeList& dtl = view->dimTypes();
+    const FieldCopier copier(tileDims, dtl);
+
+    LazPerfSpanBuf b(inBuf, inBufSize);
+
+    LazPerfDecompressor<LazPerfSpanBuf> decompressor(b, tileDims);
+    const size_t pointSize = decompressor.pointSize();
+    assert(pointSize == copier.tilePointSize());
 
-    // need to remove const, to satisfy LazPerfBuf ctor
-    LazPerfBuf b2((std::vector<unsigned char>&)inBuf);  // unsigned
+    std::vector<char> tmpbuf(pointSize);
+    char* q = tmpbuf.data();
 
-    LazPerfDecompressor<LazPerfBuf> decompressor(b2, dtl);
-    assert(pointSize == decompressor.pointSize());
-    size_t outbufSize = decompressor.pointSize() * numPoints;
-    outBuf.resize(outbufSize);
-    char* q = outBuf.data();
-    decompressor.decompress(q, outbufSize); // signed
+    PointId idx = view->size();
+    for (size_t i=0; i<numPoints; ++i)
+    {
+        decompressor.decompress(q, pointSize); // signed
+        copier.copy(*view, idx, q);
+        ++idx;
+    }
 }
 #endif
 
@@ -355,6 +355,8 @@ void GeoPackageManager::dropMatrixSet(const std::string& matrixSetName)
 {
     // drops the matrix set table and all referencesto it  in the gpkg tables
     
+   clearMatrixSetCache(matrixSetName);
+
    std::vector<std::string> tables;
    tables.push_back("gpkg_contents");
    tables.push_back("gpkg_pctile_dimension_set");
@@ -373,6 +375,8 @@ void GeoPackageManager::dropMatrixSet(const std::string& matrixSetName)
     std::ostringstream oss;
     oss << "DROP TABLE IF EXISTS  " << matrixSetName;
     m_sqlite->execute(oss.str());    
+
+    m_sqlite->execute("DROP TABLE IF EXISTS " + statsTableName(matrixSetName));
 }
 
 } // namespace rialto
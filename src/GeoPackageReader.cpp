@@ -35,15 +35,25 @@
 #include <rialto/GeoPackageReader.hpp>
 
 #include <rialto/GeoPackageCommon.hpp>
+#include "PointFilter.hpp"
 #include "SQLiteCommon.hpp"
 #include "TileMath.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
 namespace rialto
 {
 
 GeoPackageReader::GeoPackageReader(const std::string& connection, LogPtr mylog) :
     GeoPackage(connection, mylog),
     m_srid(4326),
+    m_tileCursorWithPoints(false),
+    m_nextTileRange(0),
+    m_numTileIndexLookups(0),
     e_tilesRead("tilesRead"),
     e_tileTablesRead("tileTablesRead"),
     e_queries("queries"),
@@ -79,17 +89,42 @@ void GeoPackageReader::close()
 {
     log()->get(LogLevel::Debug) << "GeoPackageReader::close" << std::endl;
 
+    // must finalize the statement before the session goes away
+    m_tileCursor.reset();
+    m_tileRanges.clear();
+
     internalClose();
     //dumpStats();
 }
 
 
-void GeoPackageReader::setupLayout(const GpkgMatrixSet& tileTableInfo, PointLayoutPtr layout)
+void GeoPackageReader::setupLayout(const GpkgMatrixSet& tileTableInfo, PointLayoutPtr layout,
+                                   const std::vector<std::string>& names)
 {
+    for (const std::string& name: names)
+    {
+        bool found = false;
+        for (const GpkgDimension& dimInfo: tileTableInfo.getDimensions())
+        {
+            found = found || dimInfo.getName() == name;
+        }
+        if (!found)
+        {
+            throw pdal_error("RialtoDB: no dimension named " + name +
+                             " in tile set " + tileTableInfo.getName());
+        }
+    }
+
     for (uint32_t i=0; i<tileTableInfo.getNumDimensions(); i++)
     {
         const GpkgDimension& dimInfo = tileTableInfo.getDimensions()[i];
 
+        if (!names.empty() &&
+            std::find(names.begin(), names.end(), dimInfo.getName()) == names.end())
+        {
+            continue;
+        }
+
         const Dimension::Id::Enum nameId = Dimension::id(dimInfo.getName());
         const Dimension::Type::Enum typeId = Dimension::type(dimInfo.getDataType());
 
@@ -111,21 +146,21 @@ void GeoPackageReader::readTile(std::string const& name, uint32_t tileId, bool w
     oss << "SELECT zoom_level,tile_column,tile_row,num_points,child_mask"
         << (withPoints ? ",tile_data " : " ")
         << "FROM '" << name << "'"
-        << "WHERE id=" << tileId;
+        << "WHERE id=?";
 
     //log()->get(LogLevel::Debug) << "SELECT for tile" << std::endl;
 
-    m_sqlite->query(oss.str());
+    m_sqlite->query(oss.str(), row{column(tileId)});
 
     // should get exactly one row back
     const row* r = m_sqlite->get();
     assert(r);
 
-    const uint32_t level = boost::lexical_cast<uint32_t>(r->at(0).data);
-    const uint32_t column = boost::lexical_cast<uint32_t>(r->at(1).data);
-    const uint32_t row = boost::lexical_cast<uint32_t>(r->at(2).data);
-    const uint32_t numPoints = boost::lexical_cast<uint32_t>(r->at(3).data);
-    const uint32_t mask = boost::lexical_cast<uint32_t>(r->at(4).data);
+    const uint32_t level = r->at(0).getUInt32();
+    const uint32_t column = r->at(1).getUInt32();
+    const uint32_t row = r->at(2).getUInt32();
+    const uint32_t numPoints = r->at(3).getUInt32();
+    const uint32_t mask = r->at(4).getUInt32();
 
     if (withPoints)
     {
@@ -143,37 +178,6 @@ void GeoPackageReader::readTile(std::string const& name, uint32_t tileId, bool w
     assert(!m_sqlite->next());
 }
 
-void GeoPackageReader::getCountsAtLevel(std::string const& name, uint32_t level,
-                                        uint32_t& numTiles, uint32_t& numPoints) const
-{
-    if (!m_sqlite)
-    {
-        throw pdal_error("RialtoDB: invalid state (session does exist)");
-    }
-
-    std::ostringstream oss;
-    oss << "SELECT count(num_points),sum(num_points) FROM '" << name << "'"
-        << " WHERE zoom_level=" << level;
-
-    log()->get(LogLevel::Debug) << "SELECT for tile ids at level: " << level << std::endl;
-
-    m_sqlite->query(oss.str());
-
-    numTiles = 0;
-    numPoints = 0;
-    
-    do {
-        const row* r = m_sqlite->get();
-        if (!r) break;
-
-        numTiles += boost::lexical_cast<uint32_t>(r->at(0).data);
-        numPoints += boost::lexical_cast<uint32_t>(r->at(1).data);
-        
-        //log()->get(LogLevel::Debug) << "  got tile id=" << id << std::endl;
-    } while (m_sqlite->next());
-}
-
-
 void GeoPackageReader::readTileIdsAtLevel(std::string const& name, uint32_t level, std::vector<uint32_t>& ids) const
 {
     if (!m_sqlite)
@@ -185,21 +189,21 @@ void GeoPackageReader::readTileIdsAtLevel(std::string const& name, uint32_t leve
 
     std::ostringstream oss;
     oss << "SELECT id FROM '" << name << "'"
-        << " WHERE zoom_level=" << level;
+        << " WHERE zoom_level=?";
 
     log()->get(LogLevel::Debug) << "SELECT for tile ids at level: " << level << std::endl;
 
-    m_sqlite->query(oss.str());
+    std::unique_ptr<SQLiteCursor> cur = m_sqlite->cursor(oss.str(), row{column(level)});
 
-    do {
-        const row* r = m_sqlite->get();
-        if (!r) break;
+    while (cur->step())
+    {
+        const row* r = cur->get();
 
-        uint32_t id = boost::lexical_cast<uint32_t>(r->at(0).data);
+        uint32_t id = r->at(0).getUInt32();
 
         //log()->get(LogLevel::Debug) << "  got tile id=" << id << std::endl;
         ids.push_back(id);
-    } while (m_sqlite->next());
+    }
 }
 
 
@@ -217,16 +221,16 @@ uint32_t GeoPackageReader::queryForTileId(std::string const& name,
                                 << " for a tile id" << std::endl;
     std::ostringstream oss;
     oss << "SELECT id FROM '" << name << "'"
-        << " WHERE zoom_level=" << levelNum
-        << " AND tile_column = " << columnNum
-        << " AND tile_row <= " << rowNum;
+        << " WHERE zoom_level=?"
+        << " AND tile_column=?"
+        << " AND tile_row<=?";
 
-    m_sqlite->query(oss.str());
+    m_sqlite->query(oss.str(), row{column(levelNum), column(columnNum), column(rowNum)});
 
     const row* r = m_sqlite->get();
     if (!r) return -1;
 
-    uint32_t id = boost::lexical_cast<uint32_t>(r->at(0).data);
+    uint32_t id = r->at(0).getUInt32();
     log()->get(LogLevel::Debug) << "  got tile id=" << id << std::endl;
 
     return id;
@@ -254,12 +258,7 @@ void GeoPackageReader::queryForTileIds(std::string const& name,
     assert(minx <= maxx);
     assert(miny <= maxy);
 
-    GpkgMatrixSet info;
-    readMatrixSet(name, info); // TODO: should cache this
-
-    const TileMath tmm(info.getTmsetMinX(), info.getTmsetMinY(),
-                                          info.getTmsetMaxX(), info.getTmsetMaxY(),
-                                          info.getNumColsAtL0(), info.getNumRowsAtL0());
+    const TileMath& tmm = getTileMath(name);
     uint32_t mincol, minrow, maxcol, maxrow;
     // we use mincol/maxrow and maxcol/minrow because the tile matrix has (0,0) at upper-left
     tmm.getTileOfPoint(minx, miny, level, mincol, minrow);
@@ -273,19 +272,19 @@ void GeoPackageReader::queryForTileIds(std::string const& name,
 
     std::ostringstream oss;
     oss << "SELECT id FROM '" << name << "'"
-        << " WHERE zoom_level=" << level
-        << " AND tile_column >= " << mincol
-        << " AND tile_column <= " << maxcol
-        << " AND tile_row >= " << minrow
-        << " AND tile_row <= " << maxrow;
+        << " WHERE zoom_level=?"
+        << " AND tile_column>=? AND tile_column<=?"
+        << " AND tile_row>=? AND tile_row<=?";
 
-    m_sqlite->query(oss.str());
+    m_sqlite->query(oss.str(), row{column(level),
+                                   column(mincol), column(maxcol),
+                                   column(minrow), column(maxrow)});
 
     do {
         const row* r = m_sqlite->get();
         if (!r) break;
 
-        uint32_t id = boost::lexical_cast<uint32_t>(r->at(0).data);
+        uint32_t id = r->at(0).getUInt32();
         log()->get(LogLevel::Debug) << "  got tile id=" << id << std::endl;
         ids.push_back(id);
     } while (m_sqlite->next());
@@ -297,7 +296,9 @@ void GeoPackageReader::queryForTileIds(std::string const& name,
 void GeoPackageReader::queryForTiles_begin(std::string const& name,
                                    double minx, double miny,
                                    double maxx, double maxy,
-                                   uint32_t level)
+                                   uint32_t level,
+                                   bool withPoints,
+                                   bool finest)
 {
     if (!m_sqlite)
     {
@@ -312,40 +313,555 @@ void GeoPackageReader::queryForTiles_begin(std::string const& name,
     assert(minx <= maxx);
     assert(miny <= maxy);
 
-    GpkgMatrixSet info;
-    readMatrixSet(name, info); // TODO: should cache this
+    m_tileCursor.reset();
+    m_tileCursorWithPoints = withPoints;
+    m_tileQueryName = name;
 
-    const TileMath tmm(info.getTmsetMinX(), info.getTmsetMinY(),
-                                          info.getTmsetMaxX(), info.getTmsetMaxY(),
-                                          info.getNumColsAtL0(), info.getNumRowsAtL0());
-    uint32_t mincol, minrow, maxcol, maxrow;
-    // we use mincol/maxrow and maxcol/minrow because the tile matrix has (0,0) at upper-left
-    tmm.getTileOfPoint(minx, miny, level, mincol, maxrow);
-    tmm.getTileOfPoint(maxx, maxy, level, maxcol, minrow);
+    planTileQuery(name, minx, miny, maxx, maxy, level, finest, m_tileRanges);
+
+    log()->get(LogLevel::Debug) << "  reading " << m_tileRanges.size()
+                                << " blocks of tiles" << std::endl;
+
+    // position on the first row, so that _step() can be called right away
+    m_nextTileRange = 0;
+    openTileRanges();
+
+    e_tilesRead.stop();
+}
+
+
+void GeoPackageReader::queryForTilesLod_begin(std::string const& name,
+                                              double minx, double miny,
+                                              double maxx, double maxy,
+                                              uint32_t level,
+                                              const GpkgLod& lod,
+                                              bool withPoints)
+{
+    if (!m_sqlite)
+    {
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
+    }
+
+    e_tilesRead.start();
+
+    log()->get(LogLevel::Debug) << "Querying tile set " << name
+                                << " for the tiles of a view" << std::endl;
+
+    assert(minx <= maxx);
+    assert(miny <= maxy);
+
+    m_tileCursor.reset();
+    m_tileCursorWithPoints = withPoints;
+    m_tileQueryName = name;
+
+    planLodQuery(name, minx, miny, maxx, maxy, level, lod);
+
+    m_nextTileRange = 0;
+    openTileRanges();
+
+    e_tilesRead.stop();
+}
+
+
+// Works out the blocks of tiles to read, going down the tree from the
+// level 0 tiles in the box. A tile wholly inside the box stands for all of
+// its descendants at the level, which are then read as one block. A table
+// without its empty tiles can't be walked cheaply, so the level is read
+// as one block, unless finest needs the walk.
+void GeoPackageReader::planTileQuery(std::string const& name,
+                                     double minx, double miny,
+                                     double maxx, double maxy,
+                                     uint32_t level, bool finest,
+                                     std::vector<TileRange>& ranges) const
+{
+    ranges.clear();
+
+    const TileMath& tmm = getTileMath(name);
+
+    if (!finest && !hasEmptyTiles(name))
+    {
+        const TileRange range = getTileRange(tmm, minx, miny, maxx, maxy, level);
+        if (range.minCol <= range.maxCol)
+        {
+            ranges.push_back(range);
+        }
+        return;
+    }
+
+    std::vector<GpkgTile> tiles;
+    readTiles(name, getTileRange(tmm, minx, miny, maxx, maxy, 0),
+              [](uint32_t, uint32_t) { return true; }, tiles);
+
+    for (const GpkgTile& tile: tiles)
+    {
+        planTileQuery(name, tmm, minx, miny, maxx, maxy, level, finest,
+                      0, tile.getColumn(), tile.getRow(), tile.getMask(), ranges);
+    }
+}
+
+
+void GeoPackageReader::planTileQuery(std::string const& name, const TileMath& tmm,
+                                     double minx, double miny,
+                                     double maxx, double maxy,
+                                     uint32_t level, bool finest,
+                                     uint32_t tileLevel, uint32_t column, uint32_t row,
+                                     uint32_t mask, std::vector<TileRange>& ranges) const
+{
+    if (tileLevel == level || (finest && mask == 0))
+    {
+        ranges.push_back(TileRange{tileLevel, column, column, row, row});
+        return;
+    }
+
+    if (mask == 0)
+    {
+        return;
+    }
+
+    if (!finest)
+    {
+        double tileMinX, tileMinY, tileMaxX, tileMaxY;
+        tmm.getTileBounds(column, row, tileLevel, tileMinX, tileMinY, tileMaxX, tileMaxY);
+        if (tmm.rectContainsRect(minx, miny, maxx, maxy,
+                                 tileMinX, tileMinY, tileMaxX, tileMaxY))
+        {
+            const uint32_t n = 1u << (level - tileLevel);
+            ranges.push_back(TileRange{level,
+                                       column * n, column * n + n - 1,
+                                       row * n, row * n + n - 1});
+            return;
+        }
+    }
+
+    // the children in the box, as at the level of the query itself
+    const uint32_t childLevel = tileLevel + 1;
+    const TileRange box = getTileRange(tmm, minx, miny, maxx, maxy, childLevel);
+
+    auto inBox = [&](uint32_t c, uint32_t r)
+    {
+        return c >= box.minCol && c <= box.maxCol && r >= box.minRow && r <= box.maxRow;
+    };
+
+    std::vector<GpkgTile> children;
+    readTiles(name, TileRange{childLevel, column * 2, column * 2 + 1, row * 2, row * 2 + 1},
+              [&](uint32_t c, uint32_t r)
+    {
+        return (mask & TileMath::getMaskBit(TileMath::getQuadOfChild(c, r))) && inBox(c, r);
+    }, children);
+
+    for (const GpkgTile& child: children)
+    {
+        planTileQuery(name, tmm, minx, miny, maxx, maxy, level, finest,
+                      childLevel, child.getColumn(), child.getRow(), child.getMask(),
+                      ranges);
+    }
+}
+
+
+// Picks the tiles for the view, from the level 0 tiles in the box down:
+// the tile that looks the coarsest is replaced by its children in the box,
+// as long as the points stay within the budget, until none is coarser than
+// the gsd. A tile looks as coarse as the spacing of its points, less the
+// further it is from the center. The tiles are counted whole, even those
+// partly outside the box, so the points read never go over the budget,
+// unless the level 0 tiles already do.
+void GeoPackageReader::planLodQuery(std::string const& name,
+                                    double minx, double miny,
+                                    double maxx, double maxy,
+                                    uint32_t level, const GpkgLod& lod)
+{
+    m_tileRanges.clear();
+
+    const TileMath& tmm = getTileMath(name);
+
+    const double halfDiagonal = std::hypot(maxx - minx, maxy - miny) / 2.0;
+
+    auto coarseness = [&](const GpkgTile& tile)
+    {
+        if (tile.getNumPoints() == 0)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        const uint32_t l = tile.getLevel();
+        double spacing = std::sqrt(tmm.tileWidthAtLevel(l) * tmm.tileHeightAtLevel(l) /
+                                   tile.getNumPoints());
+
+        if (lod.hasCenter && halfDiagonal > 0.0)
+        {
+            double tileMinX, tileMinY, tileMaxX, tileMaxY;
+            tmm.getTileBounds(tile.getColumn(), tile.getRow(), l,
+                              tileMinX, tileMinY, tileMaxX, tileMaxY);
+            const double dx = std::max(0.0, std::max(tileMinX - lod.centerX,
+                                                     lod.centerX - tileMaxX));
+            const double dy = std::max(0.0, std::max(tileMinY - lod.centerY,
+                                                     lod.centerY - tileMaxY));
+            spacing /= 1.0 + std::hypot(dx, dy) / halfDiagonal;
+        }
+
+        return spacing;
+    };
+
+    std::vector<GpkgTile> tiles; // the ones picked, and those split
+    std::vector<bool> split;
+    std::priority_queue<std::pair<double, size_t>> queue;
+    uint64_t numPoints = 0;
+
+    auto add = [&](const GpkgTile& tile)
+    {
+        tiles.push_back(tile);
+        split.push_back(false);
+        numPoints += tile.getNumPoints();
+        if (tile.getMask() != 0 && tile.getLevel() < level)
+        {
+            queue.push(std::make_pair(coarseness(tile), tiles.size() - 1));
+        }
+    };
+
+    std::vector<GpkgTile> children;
+    readTiles(name, getTileRange(tmm, minx, miny, maxx, maxy, 0),
+              [](uint32_t, uint32_t) { return true; }, children);
+    for (const GpkgTile& tile: children)
+    {
+        add(tile);
+    }
+
+    while (!queue.empty())
+    {
+        const size_t i = queue.top().second;
+        if (lod.gsd > 0.0 && queue.top().first <= lod.gsd)
+        {
+            break;
+        }
+        queue.pop();
+
+        const uint32_t column = tiles[i].getColumn();
+        const uint32_t row = tiles[i].getRow();
+        const uint32_t mask = tiles[i].getMask();
+        const uint32_t childLevel = tiles[i].getLevel() + 1;
+        const TileRange box = getTileRange(tmm, minx, miny, maxx, maxy, childLevel);
+
+        readTiles(name, TileRange{childLevel, column * 2, column * 2 + 1, row * 2, row * 2 + 1},
+                  [&](uint32_t c, uint32_t r)
+        {
+            return (mask & TileMath::getMaskBit(TileMath::getQuadOfChild(c, r))) &&
+                   c >= box.minCol && c <= box.maxCol && r >= box.minRow && r <= box.maxRow;
+        }, children);
+
+        uint64_t numChildPoints = 0;
+        for (const GpkgTile& child: children)
+        {
+            numChildPoints += child.getNumPoints();
+        }
+
+        // a smaller tile further down the queue may still fit
+        if (lod.pointBudget != 0 &&
+            numPoints - tiles[i].getNumPoints() + numChildPoints > lod.pointBudget)
+        {
+            continue;
+        }
+
+        split[i] = true;
+        numPoints -= tiles[i].getNumPoints();
+        for (const GpkgTile& child: children)
+        {
+            add(child);
+        }
+    }
+
+    for (size_t i=0; i<tiles.size(); i++)
+    {
+        if (!split[i])
+        {
+            const GpkgTile& tile = tiles[i];
+            m_tileRanges.push_back(TileRange{tile.getLevel(),
+                                             tile.getColumn(), tile.getColumn(),
+                                             tile.getRow(), tile.getRow()});
+        }
+    }
+
+    log()->get(LogLevel::Debug) << "  picked " << m_tileRanges.size()
+                                << " tiles, of " << numPoints << " points" << std::endl;
+}
+
+
+// the tiles at the level with any part in the box, as by
+// TileMath::getTileOfPoint, but kept to the matrix; none if the box is
+// outside it
+GeoPackageReader::TileRange GeoPackageReader::getTileRange(const TileMath& tmm,
+                                                           double minx, double miny,
+                                                           double maxx, double maxy,
+                                                           uint32_t level)
+{
+    TileRange range;
+    range.level = level;
+
+    if (maxx < tmm.minX() || minx >= tmm.maxX() || maxy < tmm.minY() || miny >= tmm.maxY())
+    {
+        range.minCol = range.minRow = 1;
+        range.maxCol = range.maxRow = 0;
+        return range;
+    }
+
+    const double w = tmm.tileWidthAtLevel(level);
+    const double h = tmm.tileHeightAtLevel(level);
+    auto clamp = [](double v, uint32_t n)
+    {
+        return v < 0.0 ? 0u : (v >= n ? n - 1 : (uint32_t)v);
+    };
+
+    // rows go down from the top
+    const uint32_t numCols = tmm.numColsAtLevel(level);
+    const uint32_t numRows = tmm.numRowsAtLevel(level);
+    range.minCol = clamp(std::floor((minx - tmm.minX()) / w), numCols);
+    range.maxCol = clamp(std::floor((maxx - tmm.minX()) / w), numCols);
+    range.minRow = clamp(std::ceil((tmm.maxY() - maxy) / h) - 1.0, numRows);
+    range.maxRow = clamp(std::ceil((tmm.maxY() - miny) / h) - 1.0, numRows);
+    return range;
+}
 
-    assert(mincol <= maxcol);
-    assert(minrow <= maxrow);
 
+// The tiles in the range that are wanted and have any points at or below
+// them. A tile left with no points of its own by the decimation is in the
+// table, with its mask, so the walk can go on past it; in a table without
+// such tiles, it is made up here, with the mask found from the max level.
+void GeoPackageReader::readTiles(std::string const& name, const TileRange& range,
+                                 const std::function<bool (uint32_t, uint32_t)>& wanted,
+                                 std::vector<GpkgTile>& tiles) const
+{
+    tiles.clear();
+
+    std::vector<std::pair<uint32_t, uint32_t>> positions;
+    for (uint32_t c=range.minCol; c<=range.maxCol && range.minCol<=range.maxCol; c++)
+    {
+        for (uint32_t r=range.minRow; r<=range.maxRow; r++)
+        {
+            if (wanted(c, r))
+            {
+                positions.push_back(std::make_pair(c, r));
+            }
+        }
+    }
+    if (positions.empty())
+    {
+        return;
+    }
+
+    std::vector<GpkgTile> found;
+    readTileIndex(name, range, found);
+
+    const bool complete = hasEmptyTiles(name) ||
+                          range.level == getMatrixSet(name).getMaxLevel();
+
+    for (const auto& pos: positions)
+    {
+        auto it = std::find_if(found.begin(), found.end(), [&](const GpkgTile& tile)
+        {
+            return tile.getColumn() == pos.first && tile.getRow() == pos.second;
+        });
+        if (it != found.end())
+        {
+            tiles.push_back(*it);
+            continue;
+        }
+
+        if (!complete)
+        {
+            const uint32_t mask = queryChildMask(name, range.level, pos.first, pos.second);
+            if (mask)
+            {
+                tiles.emplace_back();
+                tiles.back().set(range.level, pos.first, pos.second, 0, mask,
+                                 std::vector<char>());
+            }
+        }
+    }
+}
+
+
+// the mask of a tile that isn't in the table, from which of its quarters
+// have any points at the max level, where every point is
+uint32_t GeoPackageReader::queryChildMask(std::string const& name,
+                                          uint32_t level, uint32_t column, uint32_t row) const
+{
+    const uint32_t maxLevel = getMatrixSet(name).getMaxLevel();
+    assert(level < maxLevel);
+
+    const std::string sql =
+        "SELECT 1 FROM '" + name + "'"
+        " WHERE zoom_level=?"
+        " AND tile_column>=? AND tile_column<=?"
+        " AND tile_row>=? AND tile_row<=?"
+        " LIMIT 1";
+
+    // each child covers span x span tiles at the max level
+    const uint32_t span = 1u << (maxLevel - level - 1);
+
+    uint32_t mask = 0;
+    for (uint32_t south=0; south<2; ++south)
+    {
+        for (uint32_t east=0; east<2; ++east)
+        {
+            const uint32_t childCol = column * 2 + east;
+            const uint32_t childRow = row * 2 + south;
+            const uint32_t minCol = childCol * span;
+            const uint32_t minRow = childRow * span;
+
+            m_sqlite->query(sql, rialto::row{rialto::column(maxLevel),
+                                             rialto::column(minCol),
+                                             rialto::column(minCol + span - 1),
+                                             rialto::column(minRow),
+                                             rialto::column(minRow + span - 1)});
+            ++m_numTileIndexLookups;
+            if (m_sqlite->get())
+            {
+                mask |= TileMath::getMaskBit(TileMath::getQuadOfChild(childCol, childRow));
+            }
+        }
+    }
+
+    return mask;
+}
+
+
+// the tiles in the range, without their points
+void GeoPackageReader::readTileIndex(std::string const& name, const TileRange& range,
+                                     std::vector<GpkgTile>& tiles) const
+{
     std::ostringstream oss;
-    oss << "SELECT zoom_level,tile_column,tile_row,num_points,child_mask,tile_data"
+    oss << "SELECT tile_column,tile_row,num_points,child_mask"
         << " FROM '" << name << "'"
-        << " WHERE zoom_level=" << level
-        << " AND tile_column >= " << mincol
-        << " AND tile_column <= " << maxcol
-        << " AND tile_row >= " << minrow
-        << " AND tile_row <= " << maxrow;
+        << " WHERE zoom_level=?"
+        << " AND tile_column>=? AND tile_column<=?"
+        << " AND tile_row>=? AND tile_row<=?";
+
+    m_sqlite->query(oss.str(), rialto::row{rialto::column(range.level),
+                                           rialto::column(range.minCol),
+                                           rialto::column(range.maxCol),
+                                           rialto::column(range.minRow),
+                                           rialto::column(range.maxRow)});
+    ++m_numTileIndexLookups;
+
+    tiles.clear();
+    do {
+        const rialto::row* r = m_sqlite->get();
+        if (!r) break;
 
-    m_sqlite->query(oss.str());
+        tiles.emplace_back();
+        tiles.back().set(range.level, r->at(0).getUInt32(), r->at(1).getUInt32(),
+                         r->at(2).getUInt32(), r->at(3).getUInt32(),
+                         std::vector<char>());
+    } while (m_sqlite->next());
+}
 
-    e_tilesRead.stop();
+
+// opens the cursor on the next block of tiles that has any, and positions
+// it on the first; false once there are none left
+bool GeoPackageReader::openTileRanges()
+{
+    m_tileCursor.reset();
+
+    // a tile goes if its stats put it outside a limit; a tile without
+    // stats is kept
+    const bool useLimits = !m_limits.empty() && m_limitsName == m_tileQueryName &&
+        hasTileStats(m_tileQueryName);
+
+    std::ostringstream oss;
+    oss << "SELECT t.zoom_level,t.tile_column,t.tile_row,t.num_points,t.child_mask"
+        << (m_tileCursorWithPoints ? ",t.tile_data" : "")
+        << " FROM '" << m_tileQueryName << "' t";
+    if (useLimits)
+    {
+        oss << " LEFT JOIN '" << statsTableName(m_tileQueryName) << "' s"
+            << " ON s.zoom_level=t.zoom_level"
+            << " AND s.tile_column=t.tile_column AND s.tile_row=t.tile_row";
+    }
+    oss << " WHERE t.zoom_level=?"
+        << " AND t.tile_column>=? AND t.tile_column<=?"
+        << " AND t.tile_row>=? AND t.tile_row<=?";
+
+    row limitParams;
+    if (useLimits)
+    {
+        oss << " AND (s.zoom_level IS NULL OR (1";
+        for (const auto& limit: m_limits)
+        {
+            if (std::isfinite(limit.second.minimum))
+            {
+                oss << " AND s.max_" << limit.first << ">=?";
+                limitParams.push_back(column(limit.second.minimum));
+            }
+            if (std::isfinite(limit.second.maximum))
+            {
+                oss << " AND s.min_" << limit.first << "<=?";
+                limitParams.push_back(column(limit.second.maximum));
+            }
+        }
+        oss << "))";
+    }
+    const std::string sql = oss.str();
+
+    while (m_nextTileRange < m_tileRanges.size())
+    {
+        const TileRange& range = m_tileRanges[m_nextTileRange++];
+
+        row params{column(range.level),
+                   column(range.minCol), column(range.maxCol),
+                   column(range.minRow), column(range.maxRow)};
+        params.insert(params.end(), limitParams.begin(), limitParams.end());
+
+        m_tileCursor = m_sqlite->cursor(sql, params);
+        m_tileCursor->borrowBlobs(true);
+
+        if (m_tileCursor->step())
+        {
+            return true;
+        }
+
+        m_tileCursor.reset();
+    }
+
+    return false;
+}
+
+
+void GeoPackageReader::setDimLimits(std::string const& name,
+                                    const std::vector<GpkgDimLimit>& limits)
+{
+    m_limitsName = name;
+    m_limits.clear();
+
+    if (limits.empty())
+    {
+        return;
+    }
+
+    const std::vector<GpkgDimension>& dims = getMatrixSet(name).getDimensions();
+    for (const GpkgDimLimit& limit: limits)
+    {
+        auto it = std::find_if(dims.begin(), dims.end(), [&](const GpkgDimension& dim)
+        {
+            return dim.getName() == limit.name;
+        });
+        if (it == dims.end())
+        {
+            throw pdal_error("RialtoDB: no dimension " + limit.name + " in tile set " + name);
+        }
+        m_limits.push_back(std::make_pair(it->getPosition(), limit));
+    }
 }
 
 
 bool GeoPackageReader::queryForTiles_step(GpkgTile& info)
 {
+    if (!m_tileCursor)
+    {
+        return false;
+    }
+
     e_tilesRead.start();
 
-    const row* r = m_sqlite->get();
+    const row* r = m_tileCursor->get();
 
     if (!r)
     {
@@ -353,16 +869,25 @@ bool GeoPackageReader::queryForTiles_step(GpkgTile& info)
         return false;
     }
 
-    const uint32_t level = boost::lexical_cast<uint32_t>(r->at(0).data);
-    const uint32_t column = boost::lexical_cast<uint32_t>(r->at(1).data);
-    const uint32_t row = boost::lexical_cast<uint32_t>(r->at(2).data);
-    const uint32_t numPoints = boost::lexical_cast<uint32_t>(r->at(3).data);
-    const uint32_t mask = boost::lexical_cast<uint32_t>(r->at(4).data);
+    const uint32_t level = r->at(0).getUInt32();
+    const uint32_t column = r->at(1).getUInt32();
+    const uint32_t row = r->at(2).getUInt32();
+    const uint32_t numPoints = r->at(3).getUInt32();
+    const uint32_t mask = r->at(4).getUInt32();
 
-    // this query always reads the points
-    const std::vector<char>& v = (const std::vector<char>&)(r->at(5).blobBuf);
+    if (!m_tileCursorWithPoints)
+    {
+        info.set(level, column, row, numPoints, mask, std::vector<char>());
+        e_tilesRead.stop();
+        return true;
+    }
 
-    info.set(level, column, row, numPoints, mask, v);
+    // the blob is not copied: the tile points at SQLite's own memory, which
+    // is only good until the next call to queryForTiles_next()
+    const rialto::column& blobCol = r->at(5);
+    info.set(level, column, row, numPoints, mask,
+             reinterpret_cast<const char*>(blobCol.getBlobData()),
+             blobCol.blobLen);
 
     e_tilesRead.stop();
 
@@ -374,10 +899,208 @@ bool GeoPackageReader::queryForTiles_step(GpkgTile& info)
 
 bool GeoPackageReader::queryForTiles_next()
 {
-    return m_sqlite->next();
+    if (!m_tileCursor)
+    {
+        return false;
+    }
+
+    if (m_tileCursor->step())
+    {
+        return true;
+    }
+
+    // done with this block: release the statement, and go on to the next
+    return openTileRanges();
+}
+
+
+
+void GeoPackageReader::querySummary(std::string const& name,
+                                    double minx, double miny,
+                                    double maxx, double maxy,
+                                    uint32_t level, bool approximate,
+                                    GpkgSummary& summary)
+{
+    if (!m_sqlite)
+    {
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
+    }
+
+    assert(minx <= maxx);
+    assert(miny <= maxy);
+
+    e_queries.start();
+
+    const GpkgMatrixSet& matrixSet = getMatrixSet(name);
+    const TileMath& tmm = getTileMath(name);
+    const DimTypeList dims = matrixSet.getDimTypes();
+    const GpkgTileFormat format = matrixSet.getTileFormat();
+
+    summary = GpkgSummary();
+    summary.exact = !approximate;
+    summary.names.resize(dims.size());
+    for (const GpkgDimension& dim: matrixSet.getDimensions())
+    {
+        summary.names[dim.getPosition()] = dim.getName();
+    }
+    summary.minimums.assign(dims.size(), std::numeric_limits<double>::infinity());
+    summary.maximums.assign(dims.size(), -std::numeric_limits<double>::infinity());
+
+    auto merge = [&](size_t i, double minimum, double maximum)
+    {
+        summary.minimums[i] = std::min(summary.minimums[i], minimum);
+        summary.maximums[i] = std::max(summary.maximums[i], maximum);
+    };
+
+    // the tiles with points of their own, found as a tile query would
+    std::vector<TileRange> ranges;
+    planTileQuery(name, minx, miny, maxx, maxy, level, false, ranges);
+    std::vector<GpkgTile> tiles;
+    for (const TileRange& range: ranges)
+    {
+        std::vector<GpkgTile> found;
+        readTileIndex(name, range, found);
+        tiles.insert(tiles.end(), found.begin(), found.end());
+    }
+
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<double>> stats;
+    if (hasTileStats(name))
+    {
+        readTileStats(name, getTileRange(tmm, minx, miny, maxx, maxy, level),
+                      dims.size(), stats);
+    }
+
+    std::vector<char> packed;
+    std::vector<double> x, y, column;
+    std::vector<uint32_t> indexes;
+
+    for (const GpkgTile& tile: tiles)
+    {
+        const uint32_t numPoints = tile.getNumPoints();
+        if (numPoints == 0)
+        {
+            continue;
+        }
+
+        double tileMinX, tileMinY, tileMaxX, tileMaxY;
+        tmm.getTileBounds(tile.getColumn(), tile.getRow(), level,
+                          tileMinX, tileMinY, tileMaxX, tileMaxY);
+        const bool inside = tmm.rectContainsRect(minx, miny, maxx, maxy,
+                                                 tileMinX, tileMinY, tileMaxX, tileMaxY);
+
+        // counted without its points
+        if (inside || approximate)
+        {
+            double fraction = 1.0;
+            if (!inside)
+            {
+                const double w = std::min(maxx, tileMaxX) - std::max(minx, tileMinX);
+                const double h = std::min(maxy, tileMaxY) - std::max(miny, tileMinY);
+                fraction = std::max(w, 0.0) * std::max(h, 0.0) /
+                    ((tileMaxX - tileMinX) * (tileMaxY - tileMinY));
+            }
+            summary.numPoints += (uint64_t)std::llround(numPoints * fraction);
+
+            auto it = stats.find(std::make_pair(tile.getColumn(), tile.getRow()));
+            if (it != stats.end())
+            {
+                for (size_t i=0; i<dims.size(); ++i)
+                {
+                    merge(i, it->second[2*i], it->second[2*i+1]);
+                }
+                ++summary.numTilesCounted;
+                continue;
+            }
+        }
+
+        GpkgTile full;
+        if (!readTile(name, level, tile.getColumn(), tile.getRow(), full))
+        {
+            e_queries.stop();
+            throw pdal_error("RialtoDB: tile went missing while reading");
+        }
+        full.decode(dims, packed, format);
+        ++summary.numTilesDecoded;
+
+        indexes.resize(numPoints);
+        size_t count = numPoints;
+        if (inside || approximate)
+        {
+            for (uint32_t i=0; i<numPoints; ++i)
+            {
+                indexes[i] = i;
+            }
+        }
+        else
+        {
+            PointFilter::getColumn(dims, Dimension::Id::X, packed.data(), numPoints, x);
+            PointFilter::getColumn(dims, Dimension::Id::Y, packed.data(), numPoints, y);
+            count = PointFilter::selectInBox(x.data(), y.data(), numPoints,
+                                             minx, miny, maxx, maxy, indexes.data());
+            summary.numPoints += count;
+        }
+
+        for (size_t i=0; i<dims.size() && count; ++i)
+        {
+            PointFilter::getColumn(dims, dims[i].m_id, packed.data(), numPoints, column);
+            double minimum = column[indexes[0]];
+            double maximum = minimum;
+            for (size_t k=1; k<count; ++k)
+            {
+                minimum = std::min(minimum, column[indexes[k]]);
+                maximum = std::max(maximum, column[indexes[k]]);
+            }
+            merge(i, minimum, maximum);
+        }
+    }
+
+    e_queries.stop();
 }
 
 
+// the stats rows of the tiles in the range, by (column,row), as min and
+// max of each dim in turn
+void GeoPackageReader::readTileStats(std::string const& name, const TileRange& range,
+    size_t numDims,
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<double>>& stats) const
+{
+    stats.clear();
+    if (range.minCol > range.maxCol)
+    {
+        return;
+    }
+
+    std::ostringstream oss;
+    oss << "SELECT tile_column,tile_row";
+    for (size_t i=0; i<numDims; ++i)
+    {
+        oss << ",min_" << i << ",max_" << i;
+    }
+    oss << " FROM '" << statsTableName(name) << "'"
+        << " WHERE zoom_level=?"
+        << " AND tile_column>=? AND tile_column<=?"
+        << " AND tile_row>=? AND tile_row<=?";
+
+    m_sqlite->query(oss.str(), rialto::row{rialto::column(range.level),
+                                           rialto::column(range.minCol),
+                                           rialto::column(range.maxCol),
+                                           rialto::column(range.minRow),
+                                           rialto::column(range.maxRow)});
+
+    do {
+        const rialto::row* r = m_sqlite->get();
+        if (!r) break;
+
+        std::vector<double>& values =
+            stats[std::make_pair(r->at(0).getUInt32(), r->at(1).getUInt32())];
+        values.resize(2 * numDims);
+        for (size_t i=0; i<2*numDims; ++i)
+        {
+            values[i] = r->at(2 + i).getDouble();
+        }
+    } while (m_sqlite->next());
+}
+
 
 void GeoPackageReader::childDumpStats() const
 {
@@ -399,6 +1122,8 @@ void GeoPackageReader::childDumpStats() const
     }
 
     std::cout << std::endl;
+
+    std::cout << "    tileIndexLookups: " << m_numTileIndexLookups << std::endl;
 }
 
 
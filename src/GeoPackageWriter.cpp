@@ -35,6 +35,7 @@
 #include <rialto/GeoPackageWriter.hpp>
 #include <rialto/GeoPackageCommon.hpp>
 
+#include "ColumnarCodec.hpp"
 #include "SQLiteCommon.hpp"
 #include "WritableTileCommon.hpp"
 #include "TileMath.hpp"
@@ -42,6 +43,47 @@
 namespace rialto
 {
 
+static std::string tileInsertSql(const std::string& tileTableName)
+{
+    return "INSERT INTO " + tileTableName +
+        " (zoom_level, tile_column, tile_row, tile_data, num_points, child_mask)"
+        " VALUES (?, ?, ?, ?, ?, ?)";
+}
+
+
+// the blob column refers to the tile's own buffer, so the tile must outlive
+// the insert; a tile with no points of its own has an empty one
+static void tileRow(const GpkgTile& data, row& r)
+{
+    const uint32_t buflen = data.getBlobSize();
+    const char* buf = data.getBlobData();
+    assert(buf || !buflen);
+    assert(buflen || !data.getNumPoints());
+
+    r.clear();
+    r.reserve(6);
+    r.push_back(column(data.getLevel()));
+    r.push_back(column(data.getColumn()));
+    r.push_back(column(data.getRow()));
+    r.push_back(blob(buf, (size_t)buflen));
+    r.push_back(column(data.getNumPoints()));
+    r.push_back(column(data.getMask()));
+}
+
+
+static std::string statsInsertSql(const std::string& statsTableName, size_t numDims)
+{
+    std::string names = "zoom_level, tile_column, tile_row";
+    std::string values = "?, ?, ?";
+    for (size_t i=0; i<numDims; ++i)
+    {
+        names += ", min_" + std::to_string(i) + ", max_" + std::to_string(i);
+        values += ", ?, ?";
+    }
+    return "INSERT OR REPLACE INTO " + statsTableName +
+        " (" + names + ") VALUES (" + values + ")";
+}
+
 
 GeoPackageWriter::GeoPackageWriter(const std::string& connection, LogPtr mylog) :
     GeoPackage(connection, mylog),
@@ -126,6 +168,48 @@ void GeoPackageWriter::createTableGpkgPctile(const std::string& table_name)
 }
 
 
+void GeoPackageWriter::createTableTileStats(const GpkgMatrixSet& data)
+{
+    const std::string table_name = statsTableName(data.getName());
+    if (m_sqlite->doesTableExist(table_name))
+    {
+        throw pdal_error("RialtoDB: invalid state (table '" + table_name + "' already exists)");
+    }
+
+    std::string sql =
+        "CREATE TABLE " + table_name + "("
+        "zoom_level INTEGER NOT NULL,"
+        "tile_column INTEGER NOT NULL,"
+        "tile_row INTEGER NOT NULL,";
+    for (uint32_t i=0; i<data.getNumDimensions(); ++i)
+    {
+        sql += "min_" + std::to_string(i) + " REAL NOT NULL,"
+               "max_" + std::to_string(i) + " REAL NOT NULL,";
+    }
+    sql += "PRIMARY KEY(zoom_level, tile_column, tile_row)"
+           ")";
+
+    m_sqlite->execute(sql);
+
+    const std::string data_sql =
+        "INSERT INTO gpkg_extensions "
+        "(table_name, column_name, extension_name, definition, scope) "
+        "VALUES (?, ?, ?, ?, ?)";
+
+    records rs;
+    row r;
+
+    r.push_back(column(data.getName()));
+    r.push_back(column("NULL"));
+    r.push_back(column(statsExtensionName()));
+    r.push_back(column(table_name));
+    r.push_back(column("read-write"));
+    rs.push_back(r);
+
+    m_sqlite->insert(data_sql, rs);
+}
+
+
 void GeoPackageWriter::writeTileTable(const GpkgMatrixSet& data)
 {
     if (!m_sqlite)
@@ -137,9 +221,99 @@ void GeoPackageWriter::writeTileTable(const GpkgMatrixSet& data)
 
     e_tileTablesWritten.start();
 
+    clearMatrixSetCache(data.getName());
+
     assert(!m_sqlite->doesTableExist(data.getName()));
     createTableGpkgPctile(data.getName());
     assert(m_sqlite->doesTableExist(data.getName()));
+    createTableTileStats(data);
+
+    // so readers can tell this table from those with only the tiles
+    // that have points
+    {
+        const std::string sql =
+            "INSERT INTO gpkg_extensions "
+            "(table_name, column_name, extension_name, definition, scope) "
+            "VALUES (?, ?, ?, ?, ?)";
+
+        records rs;
+        row r;
+
+        r.push_back(column(data.getName()));
+        r.push_back(column("NULL"));
+        r.push_back(column(emptyTilesExtensionName()));
+        r.push_back(column("num_points=0"));
+        r.push_back(column("read-write"));
+        rs.push_back(r);
+
+        m_sqlite->insert(sql, rs);
+    }
+
+    const GpkgTileFormat format(data.getTileFormat());
+
+    if (format.getEncoding() == GpkgEncodingColumnar)
+    {
+        const std::string sql =
+            "INSERT INTO gpkg_extensions "
+            "(table_name, column_name, extension_name, definition, scope) "
+            "VALUES (?, ?, ?, ?, ?)";
+
+        records rs;
+        row r;
+
+        r.push_back(column(data.getName()));
+        r.push_back(column("tile_data"));
+        r.push_back(column(ColumnarCodec::extensionName()));
+        r.push_back(column(std::to_string(ColumnarCodec::version)));
+        r.push_back(column("read-write"));
+        rs.push_back(r);
+
+        m_sqlite->insert(sql, rs);
+    }
+
+    {
+        const std::string sql =
+            "INSERT INTO gpkg_extensions "
+            "(table_name, column_name, extension_name, definition, scope) "
+            "VALUES (?, ?, ?, ?, ?)";
+
+        records rs;
+        row r;
+
+        r.push_back(column(data.getName()));
+        r.push_back(column("tile_data"));
+        r.push_back(column(GpkgTileFormat::codecsExtensionName()));
+        r.push_back(column(GpkgCodec::toList(format.getCodecs())));
+        r.push_back(column("read-write"));
+        rs.push_back(r);
+
+        m_sqlite->insert(sql, rs);
+    }
+
+    if (format.isQuantized())
+    {
+        const std::string sql =
+            "INSERT INTO gpkg_extensions "
+            "(table_name, column_name, extension_name, definition, scope) "
+            "VALUES (?, ?, ?, ?, ?)";
+
+        std::ostringstream oss;
+        oss << std::setprecision(FP_STRING_PRECISION)
+            << format.getScaleX() << " " << format.getScaleY() << " "
+            << format.getScaleZ() << " " << format.getOffsetZ();
+
+        records rs;
+        row r;
+
+        r.push_back(column(data.getName()));
+        r.push_back(column("tile_data"));
+        r.push_back(column(GpkgTileFormat::quantizationExtensionName()));
+        r.push_back(column(oss.str()));
+        r.push_back(column("read-write"));
+        rs.push_back(r);
+
+        m_sqlite->insert(sql, rs);
+    }
 
     const uint32_t srs_id = querySrsId(data.getWkt());
 
@@ -241,8 +415,12 @@ void GeoPackageWriter::updateDimensionStats(const std::string& tableName,
         throw pdal_error("RialtoDB: invalid state (session does exist)");
     }
 
+    clearMatrixSetCache(tableName);
+
     std::ostringstream oss;
-    oss << "UPDATE gpkg_pctile_dimension_set SET"
+    // full precision, since appending picks the stats up from here
+    oss << std::setprecision(FP_STRING_PRECISION)
+        << "UPDATE gpkg_pctile_dimension_set SET"
         << " minimum=" << min << ","
         << " mean=" << mean << ","
         << " maximum=" << max
@@ -373,34 +551,127 @@ void GeoPackageWriter::writeTile(const std::string& tileTableName, const GpkgTil
 
     e_tilesWritten.start();
 
-    const uint32_t buflen = data.getBlob().size();
-    const char* buf = data.getBlob().data();
-    assert(buf);
-    assert(buflen);
+    {
+        records rs(1);
+        tileRow(data, rs[0]);
+
+        m_sqlite->insert(tileInsertSql(tileTableName), rs);
+    }
 
+    writeTileStats(tileTableName, &data, 1);
+
+    e_tilesWritten.stop();
+
+    m_numPointsWritten += data.getNumPoints();
+}
+
+
+void GeoPackageWriter::writeTiles(const std::string& tileTableName,
+                                  const std::vector<GpkgTile>& tiles)
+{
+    if (!m_sqlite)
     {
-        const std::string sql =
-            "INSERT INTO " + tileTableName +
-            " (zoom_level, tile_column, tile_row, tile_data, num_points, child_mask)"
-            " VALUES (?, ?, ?, ?, ?, ?)";
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
+    }
 
-        records rs;
-        row r;
+    e_tilesWritten.start();
 
-        r.push_back(column(data.getLevel()));
-        r.push_back(column(data.getColumn()));
-        r.push_back(column(data.getRow()));
-        r.push_back(blob(buf, (size_t)buflen));
-        r.push_back(column(data.getNumPoints()));
-        r.push_back(column(data.getMask()));
-        rs.push_back(r);
+    records rs(tiles.size());
+    for (size_t i=0; i<tiles.size(); ++i)
+    {
+        tileRow(tiles[i], rs[i]);
+        m_numPointsWritten += tiles[i].getNumPoints();
+    }
 
-        m_sqlite->insert(sql, rs);
+    m_sqlite->insert(tileInsertSql(tileTableName), rs);
+
+    writeTileStats(tileTableName, tiles.data(), tiles.size());
+
+    e_tilesWritten.stop();
+}
+
+
+// existing tiles are updated in place, by their position
+void GeoPackageWriter::updateTiles(const std::string& tileTableName,
+                                   const std::vector<GpkgTile>& tiles)
+{
+    if (!m_sqlite)
+    {
+        throw pdal_error("RialtoDB: invalid state (session does exist)");
     }
 
+    e_tilesWritten.start();
+
+    const std::string sql =
+        "UPDATE " + tileTableName +
+        " SET tile_data=?, num_points=?, child_mask=?"
+        " WHERE zoom_level=? AND tile_column=? AND tile_row=?";
+
+    records rs(tiles.size());
+    for (size_t i=0; i<tiles.size(); ++i)
+    {
+        const GpkgTile& tile = tiles[i];
+        row& r = rs[i];
+        r.reserve(6);
+        r.push_back(blob(tile.getBlobData(), tile.getBlobSize()));
+        r.push_back(column(tile.getNumPoints()));
+        r.push_back(column(tile.getMask()));
+        r.push_back(column(tile.getLevel()));
+        r.push_back(column(tile.getColumn()));
+        r.push_back(column(tile.getRow()));
+    }
+
+    m_sqlite->insert(sql, rs);
+
+    writeTileStats(tileTableName, tiles.data(), tiles.size());
+
     e_tilesWritten.stop();
+}
 
-    m_numPointsWritten += data.getNumPoints();
+
+// for the tiles whose points were just encoded; a tile only read back, to
+// change its mask, keeps its row
+void GeoPackageWriter::writeTileStats(const std::string& tileTableName,
+                                      const GpkgTile* tiles, size_t numTiles)
+{
+    // tables written before there were stats have none
+    if (!hasTileStats(tileTableName))
+    {
+        return;
+    }
+    const std::string statsTable = statsTableName(tileTableName);
+
+    records rs;
+    size_t numDims = 0;
+    for (size_t t=0; t<numTiles; ++t)
+    {
+        const GpkgTile& tile = tiles[t];
+        const std::vector<double>& minimums = tile.getMinimums();
+        const std::vector<double>& maximums = tile.getMaximums();
+        if (minimums.empty())
+        {
+            continue;
+        }
+        assert(numDims == 0 || numDims == minimums.size());
+        numDims = minimums.size();
+
+        row r;
+        r.reserve(3 + 2 * numDims);
+        r.push_back(column(tile.getLevel()));
+        r.push_back(column(tile.getColumn()));
+        r.push_back(column(tile.getRow()));
+        for (size_t i=0; i<numDims; ++i)
+        {
+            r.push_back(column(minimums[i]));
+            r.push_back(column(maximums[i]));
+        }
+        rs.push_back(r);
+    }
+
+    if (!rs.empty())
+    {
+        m_sqlite->insert(statsInsertSql(statsTable, numDims), rs);
+    }
 }
 
 
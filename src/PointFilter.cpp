@@ -0,0 +1,237 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "PointFilter.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RIALTO_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace rialto
+{
+
+
+namespace
+{
+
+template<typename T>
+void getValues(const char* p, size_t pointSize, size_t numPoints, double* out)
+{
+    for (size_t i=0; i<numPoints; i++)
+    {
+        T v;
+        std::memcpy(&v, p, sizeof(T));
+        out[i] = (double)v;
+        p += pointSize;
+    }
+}
+
+// from the point at index first on
+size_t selectInBoxFrom(const double* x, const double* y, size_t first, size_t numPoints,
+                       double minx, double miny, double maxx, double maxy,
+                       uint32_t* indexes)
+{
+    // branch-free, so that the compiler can keep it tight
+    size_t count = 0;
+    for (size_t i=first; i<numPoints; i++)
+    {
+        indexes[count] = (uint32_t)i;
+        count += (x[i] >= minx) & (x[i] <= maxx) & (y[i] >= miny) & (y[i] <= maxy);
+    }
+    return count;
+}
+
+#if RIALTO_AVX2
+// for each mask of four points in or out, the positions of those in
+alignas(16) const int32_t s_positions[16][4] =
+{
+    {0,0,0,0}, {0,0,0,0}, {1,0,0,0}, {0,1,0,0},
+    {2,0,0,0}, {0,2,0,0}, {1,2,0,0}, {0,1,2,0},
+    {3,0,0,0}, {0,3,0,0}, {1,3,0,0}, {0,1,3,0},
+    {2,3,0,0}, {0,2,3,0}, {1,2,3,0}, {0,1,2,3}
+};
+
+__attribute__((target("avx2")))
+size_t selectInBoxAvx2(const double* x, const double* y, size_t numPoints,
+                       double minx, double miny, double maxx, double maxy,
+                       uint32_t* indexes)
+{
+    const __m256d vMinX = _mm256_set1_pd(minx);
+    const __m256d vMinY = _mm256_set1_pd(miny);
+    const __m256d vMaxX = _mm256_set1_pd(maxx);
+    const __m256d vMaxY = _mm256_set1_pd(maxy);
+
+    size_t count = 0;
+    size_t i = 0;
+    for ( ; i + 4 <= numPoints; i += 4)
+    {
+        const __m256d vx = _mm256_loadu_pd(x + i);
+        const __m256d vy = _mm256_loadu_pd(y + i);
+
+        __m256d in = _mm256_and_pd(_mm256_cmp_pd(vx, vMinX, _CMP_GE_OQ),
+                                   _mm256_cmp_pd(vx, vMaxX, _CMP_LE_OQ));
+        in = _mm256_and_pd(in, _mm256_cmp_pd(vy, vMinY, _CMP_GE_OQ));
+        in = _mm256_and_pd(in, _mm256_cmp_pd(vy, vMaxY, _CMP_LE_OQ));
+
+        // always stores four, which fit as count <= i
+        const int mask = _mm256_movemask_pd(in);
+        const __m128i positions =
+            _mm_load_si128((const __m128i*)s_positions[mask]);
+        _mm_storeu_si128((__m128i*)(indexes + count),
+                         _mm_add_epi32(positions, _mm_set1_epi32((int32_t)i)));
+        count += __builtin_popcount(mask);
+    }
+
+    return count + selectInBoxFrom(x, y, i, numPoints, minx, miny, maxx, maxy,
+                                   indexes + count);
+}
+#endif
+
+} // anonymous namespace
+
+
+void PointFilter::getColumn(const DimTypeList& dims, Dimension::Id::Enum id,
+                            const char* points, size_t numPoints,
+                            std::vector<double>& column)
+{
+    size_t pointSize = 0;
+    size_t offset = 0;
+    Dimension::Type::Enum type = Dimension::Type::None;
+    for (const DimType& dim: dims)
+    {
+        if (dim.m_id == id)
+        {
+            offset = pointSize;
+            type = dim.m_type;
+        }
+        pointSize += Dimension::size(dim.m_type);
+    }
+
+    column.resize(numPoints);
+    const char* p = points + offset;
+    double* out = column.data();
+
+    switch (type)
+    {
+        case Dimension::Type::Double:
+            getValues<double>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Float:
+            getValues<float>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Signed8:
+            getValues<int8_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Unsigned8:
+            getValues<uint8_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Signed16:
+            getValues<int16_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Unsigned16:
+            getValues<uint16_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Signed32:
+            getValues<int32_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Unsigned32:
+            getValues<uint32_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Signed64:
+            getValues<int64_t>(p, pointSize, numPoints, out);
+            break;
+        case Dimension::Type::Unsigned64:
+            getValues<uint64_t>(p, pointSize, numPoints, out);
+            break;
+        default:
+            throw pdal_error("PointFilter: dimension " + Dimension::name(id) +
+                             " is not in the points");
+    }
+}
+
+
+size_t PointFilter::selectInBox(const double* x, const double* y, size_t numPoints,
+                                double minx, double miny, double maxx, double maxy,
+                                uint32_t* indexes)
+{
+#if RIALTO_AVX2
+    static const bool avx2 = hasAvx2();
+    if (avx2)
+    {
+        return selectInBoxAvx2(x, y, numPoints, minx, miny, maxx, maxy, indexes);
+    }
+#endif
+    return selectInBoxScalar(x, y, numPoints, minx, miny, maxx, maxy, indexes);
+}
+
+
+size_t PointFilter::selectInBoxScalar(const double* x, const double* y, size_t numPoints,
+                                      double minx, double miny, double maxx, double maxy,
+                                      uint32_t* indexes)
+{
+    return selectInBoxFrom(x, y, 0, numPoints, minx, miny, maxx, maxy, indexes);
+}
+
+
+bool PointFilter::hasAvx2()
+{
+#if RIALTO_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+
+void PointFilter::compact(std::vector<char>& points, size_t pointSize,
+                          const uint32_t* indexes, size_t count)
+{
+    char* q = points.data();
+    for (size_t i=0; i<count; i++)
+    {
+        const char* p = points.data() + indexes[i] * pointSize;
+        if (p != q)
+        {
+            std::memcpy(q, p, pointSize);
+        }
+        q += pointSize;
+    }
+    points.resize(count * pointSize);
+}
+
+
+} // namespace rialto
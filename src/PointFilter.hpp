@@ -0,0 +1,75 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#pragma once
+
+#include <rialto/GeoPackageCommon.hpp>
+
+namespace rialto
+{
+    using namespace pdal;
+
+
+// Picks out the points of a decoded tile that lie in a box, working on
+// the X and Y columns pulled out of the packed points. The box test runs
+// four points at a time with AVX2 where the CPU has it.
+class PointFilter
+{
+public:
+    // the values of the dimension, as doubles, of each of the packed points;
+    // throws if the dimension isn't there
+    static void getColumn(const DimTypeList& dims, Dimension::Id::Enum id,
+                          const char* points, size_t numPoints,
+                          std::vector<double>& column);
+
+    // writes the indexes of the points in the box, edges included, and
+    // returns how many there are; indexes must have room for numPoints
+    static size_t selectInBox(const double* x, const double* y, size_t numPoints,
+                              double minx, double miny, double maxx, double maxy,
+                              uint32_t* indexes);
+
+    // likewise, without SIMD
+    static size_t selectInBoxScalar(const double* x, const double* y, size_t numPoints,
+                                    double minx, double miny, double maxx, double maxy,
+                                    uint32_t* indexes);
+
+    static bool hasAvx2();
+
+    // keeps just the indexed points, in order, in place
+    static void compact(std::vector<char>& points, size_t pointSize,
+                        const uint32_t* indexes, size_t count);
+};
+
+
+} // namespace rialto
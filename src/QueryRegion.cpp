@@ -0,0 +1,468 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "QueryRegion.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+#include <pdal/util/Utils.hpp>
+
+namespace rialto
+{
+
+namespace
+{
+
+// just enough WKT for the rings of polygons
+class WktParser
+{
+public:
+    WktParser(const std::string& text) : m_text(text), m_pos(0) {}
+
+    std::string keyword()
+    {
+        skipSpace();
+        std::string word;
+        while (m_pos < m_text.size() && std::isalpha((unsigned char)m_text[m_pos]))
+        {
+            word += (char)std::toupper((unsigned char)m_text[m_pos++]);
+        }
+        return word;
+    }
+
+    // the rings of a polygon: ((x y, ...), (x y, ...))
+    std::vector<std::vector<std::pair<double, double>>> polygon()
+    {
+        std::vector<std::vector<std::pair<double, double>>> rings;
+        expect('(');
+        do {
+            rings.push_back(ring());
+        } while (accept(','));
+        expect(')');
+        return rings;
+    }
+
+    bool accept(char c)
+    {
+        skipSpace();
+        if (m_pos < m_text.size() && m_text[m_pos] == c)
+        {
+            ++m_pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c))
+        {
+            fail();
+        }
+    }
+
+    bool atEnd()
+    {
+        skipSpace();
+        return m_pos == m_text.size();
+    }
+
+    void fail() const
+    {
+        throw pdal_error("bad polygon WKT: " + m_text);
+    }
+
+private:
+    std::vector<std::pair<double, double>> ring()
+    {
+        std::vector<std::pair<double, double>> points;
+        expect('(');
+        do {
+            const double x = number();
+            const double y = number();
+            // any Z or M
+            skipSpace();
+            while (m_pos < m_text.size() && m_text[m_pos] != ',' && m_text[m_pos] != ')')
+            {
+                number();
+                skipSpace();
+            }
+            points.push_back(std::make_pair(x, y));
+        } while (accept(','));
+        expect(')');
+        return points;
+    }
+
+    double number()
+    {
+        skipSpace();
+        const char* start = m_text.c_str() + m_pos;
+        char* end = NULL;
+        const double value = std::strtod(start, &end);
+        if (end == start)
+        {
+            fail();
+        }
+        m_pos += end - start;
+        return value;
+    }
+
+    void skipSpace()
+    {
+        while (m_pos < m_text.size() && std::isspace((unsigned char)m_text[m_pos]))
+        {
+            ++m_pos;
+        }
+    }
+
+    const std::string& m_text;
+    size_t m_pos;
+};
+
+} // anonymous namespace
+
+
+QueryRegion QueryRegion::fromWkt(const std::string& wkt)
+{
+    QueryRegion region;
+    WktParser parser(wkt);
+
+    const std::string type = parser.keyword();
+    std::string dims = parser.keyword();
+    if (!dims.empty() && dims != "Z" && dims != "M" && dims != "ZM")
+    {
+        parser.fail();
+    }
+
+    if (type == "POLYGON")
+    {
+        region.addPolygon(parser.polygon());
+    }
+    else if (type == "MULTIPOLYGON")
+    {
+        parser.expect('(');
+        do {
+            region.addPolygon(parser.polygon());
+        } while (parser.accept(','));
+        parser.expect(')');
+    }
+    else
+    {
+        parser.fail();
+    }
+
+    if (!parser.atEnd())
+    {
+        parser.fail();
+    }
+    return region;
+}
+
+
+QueryRegion QueryRegion::fromBoxes(const std::string& text)
+{
+    QueryRegion region;
+    for (const std::string& box: Utils::split2(text, ';'))
+    {
+        if (Utils::trim(box).empty())
+        {
+            continue;
+        }
+
+        const std::vector<std::string> values = Utils::split2(box, ',');
+        double v[4];
+        try
+        {
+            if (values.size() != 4)
+            {
+                throw std::invalid_argument(box);
+            }
+            for (size_t i=0; i<4; ++i)
+            {
+                const std::string value = Utils::trim(values[i]);
+                size_t used = 0;
+                v[i] = std::stod(value, &used);
+                if (used != value.size())
+                {
+                    throw std::invalid_argument(value);
+                }
+            }
+        }
+        catch (const std::exception&)
+        {
+            throw pdal_error("box must be minx,miny,maxx,maxy: " + box);
+        }
+        if (v[0] > v[2] || v[1] > v[3])
+        {
+            throw pdal_error("box is empty: " + box);
+        }
+        region.addBox(v[0], v[1], v[2], v[3]);
+    }
+    return region;
+}
+
+
+void QueryRegion::addBox(double minx, double miny, double maxx, double maxy)
+{
+    Polygon polygon;
+    polygon.minx = minx;
+    polygon.miny = miny;
+    polygon.maxx = maxx;
+    polygon.maxy = maxy;
+    m_polygons.push_back(polygon);
+}
+
+
+void QueryRegion::addPolygon(const std::vector<Ring>& rings)
+{
+    Polygon polygon;
+    polygon.minx = polygon.miny = std::numeric_limits<double>::max();
+    polygon.maxx = polygon.maxy = std::numeric_limits<double>::lowest();
+
+    for (Ring ring: rings)
+    {
+        if (ring.front() != ring.back())
+        {
+            ring.push_back(ring.front());
+        }
+        if (ring.size() < 4)
+        {
+            throw pdal_error("polygon ring needs at least three points");
+        }
+        for (const auto& p: ring)
+        {
+            polygon.minx = std::min(polygon.minx, p.first);
+            polygon.miny = std::min(polygon.miny, p.second);
+            polygon.maxx = std::max(polygon.maxx, p.first);
+            polygon.maxy = std::max(polygon.maxy, p.second);
+        }
+        polygon.rings.push_back(ring);
+    }
+
+    m_polygons.push_back(polygon);
+}
+
+
+void QueryRegion::getBounds(double& minx, double& miny, double& maxx, double& maxy) const
+{
+    minx = miny = std::numeric_limits<double>::max();
+    maxx = maxy = std::numeric_limits<double>::lowest();
+    for (const Polygon& polygon: m_polygons)
+    {
+        minx = std::min(minx, polygon.minx);
+        miny = std::min(miny, polygon.miny);
+        maxx = std::max(maxx, polygon.maxx);
+        maxy = std::max(maxy, polygon.maxy);
+    }
+}
+
+
+QueryRegion::Place QueryRegion::classify(double minx, double miny,
+                                         double maxx, double maxy) const
+{
+    bool outside = true;
+    for (const Polygon& polygon: m_polygons)
+    {
+        const Place place = classify(polygon, minx, miny, maxx, maxy);
+        if (place == Inside)
+        {
+            return Inside;
+        }
+        outside = outside && (place == Outside);
+    }
+    return outside ? Outside : Straddles;
+}
+
+
+QueryRegion::Place QueryRegion::classify(const Polygon& polygon,
+                                         double minx, double miny,
+                                         double maxx, double maxy)
+{
+    if (maxx < polygon.minx || minx > polygon.maxx ||
+        maxy < polygon.miny || miny > polygon.maxy)
+    {
+        return Outside;
+    }
+
+    if (polygon.rings.empty())
+    {
+        const bool inside = minx >= polygon.minx && maxx <= polygon.maxx &&
+                            miny >= polygon.miny && maxy <= polygon.maxy;
+        return inside ? Inside : Straddles;
+    }
+
+    // with no edge across it, the rectangle is all in or all out, as its
+    // center is
+    for (const Ring& ring: polygon.rings)
+    {
+        for (size_t k=0; k+1<ring.size(); ++k)
+        {
+            if (edgeTouchesRect(ring[k].first, ring[k].second,
+                                ring[k+1].first, ring[k+1].second,
+                                minx, miny, maxx, maxy))
+            {
+                return Straddles;
+            }
+        }
+    }
+
+    const double x = (minx + maxx) / 2.0;
+    const double y = (miny + maxy) / 2.0;
+    double sign;
+    testPoints(polygon, &x, &y, 1, &sign);
+    return sign < 0.0 ? Inside : Outside;
+}
+
+
+// clips the segment to the rectangle (Liang-Barsky), edges included
+bool QueryRegion::edgeTouchesRect(double x0, double y0, double x1, double y1,
+                                  double minx, double miny, double maxx, double maxy)
+{
+    const double dx = x1 - x0;
+    const double dy = y1 - y0;
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { x0 - minx, maxx - x0, y0 - miny, maxy - y0 };
+
+    double t0 = 0.0;
+    double t1 = 1.0;
+    for (int k=0; k<4; ++k)
+    {
+        if (p[k] == 0.0)
+        {
+            if (q[k] < 0.0)
+            {
+                return false;
+            }
+            continue;
+        }
+        const double t = q[k] / p[k];
+        if (p[k] < 0.0)
+        {
+            if (t > t1) return false;
+            t0 = std::max(t0, t);
+        }
+        else
+        {
+            if (t < t0) return false;
+            t1 = std::min(t1, t);
+        }
+    }
+    return true;
+}
+
+
+// The loop over the points has no branches, so that the compiler can run
+// it several points at a time. Each point keeps its count of crossings as
+// the sign of a double, flipped at each one, which vectorizes where a flag
+// of another width wouldn't.
+void QueryRegion::testPoints(const Polygon& polygon, const double* x, const double* y,
+                             size_t numPoints, double* sign)
+{
+    if (polygon.rings.empty())
+    {
+        const double minx = polygon.minx, miny = polygon.miny;
+        const double maxx = polygon.maxx, maxy = polygon.maxy;
+        for (size_t i=0; i<numPoints; ++i)
+        {
+            const bool in = (x[i] >= minx) & (x[i] <= maxx) & (y[i] >= miny) & (y[i] <= maxy);
+            sign[i] = in ? -1.0 : 1.0;
+        }
+        return;
+    }
+
+    std::fill(sign, sign + numPoints, 1.0);
+
+    for (const Ring& ring: polygon.rings)
+    {
+        for (size_t k=0; k+1<ring.size(); ++k)
+        {
+            const double x0 = ring[k].first, y0 = ring[k].second;
+            const double x1 = ring[k+1].first, y1 = ring[k+1].second;
+            if (y0 == y1)
+            {
+                continue; // never crossed
+            }
+            const double slope = (x1 - x0) / (y1 - y0);
+
+            for (size_t i=0; i<numPoints; ++i)
+            {
+                const double yi = y[i];
+                const bool crosses = ((yi >= y0) != (yi >= y1)) &
+                                     (x[i] < x0 + (yi - y0) * slope);
+                sign[i] = crosses ? -sign[i] : sign[i];
+            }
+        }
+    }
+}
+
+
+size_t QueryRegion::selectInside(const double* x, const double* y, size_t numPoints,
+                                 uint32_t* indexes, size_t count) const
+{
+    // negative if in any of them
+    std::vector<double> inside(numPoints, 1.0);
+    std::vector<double> inPolygon(numPoints);
+    for (const Polygon& polygon: m_polygons)
+    {
+        testPoints(polygon, x, y, numPoints, inPolygon.data());
+        for (size_t i=0; i<numPoints; ++i)
+        {
+            inside[i] = std::min(inside[i], inPolygon[i]);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i=0; i<count; ++i)
+    {
+        if (inside[indexes[i]] < 0.0)
+        {
+            indexes[kept++] = indexes[i];
+        }
+    }
+    return kept;
+}
+
+
+bool QueryRegion::contains(double x, double y) const
+{
+    uint32_t index = 0;
+    return selectInside(&x, &y, 1, &index, 1) == 1;
+}
+
+
+} // namespace rialto
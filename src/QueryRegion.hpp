@@ -0,0 +1,111 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#pragma once
+
+#include <rialto/GeoPackageCommon.hpp>
+
+namespace rialto
+{
+    using namespace pdal;
+
+
+// An area to read the points of, more closely than a box: polygons, each
+// an outer ring and any holes, and boxes. A point is in the region if it
+// is in any of them, edges included as far as the test can tell.
+class QueryRegion
+{
+public:
+    // where a tile lies, against the region
+    enum Place
+    {
+        Outside,
+        Inside,
+        Straddles
+    };
+
+    QueryRegion() {}
+
+    // the polygons of a WKT POLYGON or MULTIPOLYGON; any Z is dropped;
+    // throws if the text is not one
+    static QueryRegion fromWkt(const std::string& wkt);
+
+    // the boxes of a list of "minx,miny,maxx,maxy", split by ';'; throws if
+    // the text is not one
+    static QueryRegion fromBoxes(const std::string& text);
+
+    void addBox(double minx, double miny, double maxx, double maxy);
+
+    bool empty() const { return m_polygons.empty(); }
+
+    // the box around all of it
+    void getBounds(double& minx, double& miny, double& maxx, double& maxy) const;
+
+    // how a rectangle, such as a tile, lies against the region: Inside and
+    // Outside are sure, Straddles may be either in part
+    Place classify(double minx, double miny, double maxx, double maxy) const;
+
+    // keeps, in place, the indexes of the points in the region, and returns
+    // how many there are
+    size_t selectInside(const double* x, const double* y, size_t numPoints,
+                        uint32_t* indexes, size_t count) const;
+
+    bool contains(double x, double y) const;
+
+private:
+    typedef std::vector<std::pair<double, double>> Ring; // closed
+
+    // a box is kept as just its bounds, so its edges are in it for sure
+    struct Polygon
+    {
+        std::vector<Ring> rings; // the outer one first; none for a box
+        double minx, miny, maxx, maxy;
+    };
+
+    void addPolygon(const std::vector<Ring>& rings);
+
+    // sets sign[i] negative if the point is in the polygon, else positive,
+    // by the crossing number, one edge at a time over all the points
+    static void testPoints(const Polygon&, const double* x, const double* y,
+                           size_t numPoints, double* sign);
+    static Place classify(const Polygon&,
+                          double minx, double miny, double maxx, double maxy);
+    static bool edgeTouchesRect(double x0, double y0, double x1, double y1,
+                                double minx, double miny, double maxx, double maxy);
+
+    std::vector<Polygon> m_polygons;
+};
+
+
+} // namespace rialto
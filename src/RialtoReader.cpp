@@ -36,10 +36,24 @@
 #include <rialto/GeoPackageReader.hpp>
 #include <rialto/GeoPackageCommon.hpp>
 #include "WritableTileCommon.hpp"
+#include "PointFilter.hpp"
+#include "QueryRegion.hpp"
+#include "TileCache.hpp"
 #include "TileMath.hpp"
 
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+
 
 static PluginInfo const s_info = PluginInfo(
     "readers.rialto",
@@ -48,16 +62,149 @@ static PluginInfo const s_info = PluginInfo(
 
 //CREATE_SHARED_PLUGIN(1, 0, rialto::RialtoReader, Reader, s_info)
 
+// tiles allowed out at once, being decoded or waiting to be taken, per
+// decoding thread
+static const size_t s_tilesInFlightPerThread = 4;
+
 namespace rialto
 {
 
 
+namespace
+{
+
+// Decodes tiles on a pool of threads, as the calling thread submits them,
+// and hands back their points in the order submitted. The caller keeps the
+// number out (submitted, not yet taken) within bounds. An exception from a
+// decoder is rethrown by take().
+class DecodePipeline
+{
+public:
+    typedef std::function<void (const RialtoReader::TileJob&, std::vector<char>&)> DecodeFn;
+
+    DecodePipeline(uint32_t numThreads, DecodeFn decode) :
+        m_decode(decode),
+        m_numSubmitted(0),
+        m_numTaken(0),
+        m_stopped(false)
+    {
+        for (uint32_t i=0; i<numThreads; i++)
+        {
+            m_threads.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~DecodePipeline()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_all();
+
+        for (auto& t: m_threads)
+        {
+            t.join();
+        }
+    }
+
+    size_t numOut() const { return m_numSubmitted - m_numTaken; }
+
+    void submit(RialtoReader::TileJob&& job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_todo.emplace_back(m_numSubmitted++, std::move(job));
+        }
+        m_cv.notify_all();
+    }
+
+    // returns false once all the tiles submitted have been taken
+    bool take(std::vector<char>& points)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_numTaken == m_numSubmitted)
+        {
+            return false;
+        }
+
+        m_cv.wait(lock, [this]() { return m_err || m_done.count(m_numTaken); });
+        if (m_err)
+        {
+            std::rethrow_exception(m_err);
+        }
+
+        auto it = m_done.find(m_numTaken);
+        points.swap(it->second);
+        m_done.erase(it);
+        ++m_numTaken;
+        return true;
+    }
+
+private:
+    void work()
+    {
+        for (;;)
+        {
+            std::pair<size_t, RialtoReader::TileJob> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]() { return m_stopped || !m_todo.empty(); });
+                if (m_stopped)
+                {
+                    return;
+                }
+                job = std::move(m_todo.front());
+                m_todo.pop_front();
+            }
+
+            try
+            {
+                std::vector<char> points;
+                m_decode(job.second, points);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.emplace(job.first, std::move(points));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_err)
+                {
+                    m_err = std::current_exception();
+                }
+                m_stopped = true;
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    DecodeFn m_decode;
+    size_t m_numSubmitted; // only touched by the calling thread
+    size_t m_numTaken; // likewise
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<size_t, RialtoReader::TileJob>> m_todo;
+    std::map<size_t, std::vector<char>> m_done; // decoded, not yet taken
+    bool m_stopped;
+    std::exception_ptr m_err;
+    std::vector<std::thread> m_threads;
+};
+
+
+} // anonymous namespace
+
+
 std::string RialtoReader::getName() const { return s_info.name; }
 
 
 RialtoReader::RialtoReader() :
     Reader(),
-    m_gpkg(NULL)
+    m_gpkg(NULL),
+    m_uniformOrder(false),
+    m_numThreads(1),
+    m_cacheSize(0)
 {}
 
 
@@ -83,10 +230,18 @@ void RialtoReader::initialize()
         m_matrixSet = std::unique_ptr<GpkgMatrixSet>(new GpkgMatrixSet());
 
         m_gpkg->readMatrixSet(m_dataset, *m_matrixSet);
+        m_tileDims = m_matrixSet->getDimTypes();
+        m_tileFormat = m_matrixSet->getTileFormat();
         
         const SpatialReference srs(m_matrixSet->getWkt());
         setSpatialReference(srs);
     }
+
+    m_cache.reset();
+    if (m_cacheSize)
+    {
+        m_cache = TileCache::forFile(m_filename, m_cacheSize);
+    }
 }
 
 
@@ -117,8 +272,125 @@ void RialtoReader::processOptions(const Options& options)
     }
     
     m_queryBox = options.getValueOrDefault<BOX3D>("bounds", BOX3D());
+
+    // a closer area than the bounds: the points in a WKT polygon, or in any
+    // of a list of boxes, "minx,miny,maxx,maxy;..."
+    const std::string polygon = options.getValueOrDefault<std::string>("polygon", "");
+    const std::string boxes = options.getValueOrDefault<std::string>("boxes", "");
+    m_region.reset();
+    if (!polygon.empty() && !boxes.empty())
+    {
+        throw pdal_error("RialtoReader: only one of polygon and boxes may be set");
+    }
+    try
+    {
+        if (!polygon.empty())
+        {
+            m_region.reset(new QueryRegion(QueryRegion::fromWkt(polygon)));
+        }
+        else if (!boxes.empty())
+        {
+            m_region.reset(new QueryRegion(QueryRegion::fromBoxes(boxes)));
+        }
+    }
+    catch (const pdal_error& e)
+    {
+        throw pdal_error(std::string("RialtoReader: ") + e.what());
+    }
+    if (m_region && m_region->empty())
+    {
+        m_region.reset();
+    }
     m_queryLevel = options.getValueOrDefault<uint32_t>("level", 0xffff);
 
+    // instead of a level, the detail to view the bounds at: at most so many
+    // points, or points this far apart, or both, with more of them towards
+    // the center if given
+    m_lod = GpkgLod();
+    m_lod.pointBudget = options.getValueOrDefault<uint64_t>("point_budget", 0);
+    m_lod.gsd = options.getValueOrDefault<double>("gsd", 0.0);
+    if (m_lod.gsd < 0.0)
+    {
+        throw pdal_error("RialtoReader: gsd must not be negative");
+    }
+    const std::string center = options.getValueOrDefault<std::string>("view_center", "");
+    if (!center.empty())
+    {
+        const std::vector<std::string> xy = Utils::split2(center, ',');
+        try
+        {
+            if (xy.size() != 2)
+            {
+                throw std::invalid_argument(center);
+            }
+            m_lod.centerX = std::stod(xy[0]);
+            m_lod.centerY = std::stod(xy[1]);
+        }
+        catch (const std::exception&)
+        {
+            throw pdal_error("RialtoReader: view_center must be x,y: " + center);
+        }
+        m_lod.hasCenter = true;
+    }
+
+    // the order to read the tiles in, which matters when reading just some
+    // of the points (see sortUniformly)
+    const std::string order = options.getValueOrDefault<std::string>("tile_order", "index");
+    if (order != "index" && order != "uniform")
+    {
+        throw pdal_error("RialtoReader: tile_order must be index or uniform");
+    }
+    m_uniformOrder = (order == "uniform");
+
+    // the ranges the points' values must be in; tiles with none in them are
+    // skipped without being read, if the tile set has stats
+    try
+    {
+        m_limits = GpkgDimLimit::parseList(
+            options.getValueOrDefault<std::string>("limits", ""));
+    }
+    catch (const pdal_error& e)
+    {
+        throw pdal_error(std::string("RialtoReader: ") + e.what());
+    }
+
+    m_numThreads = options.getValueOrDefault<uint32_t>("threads", 1);
+    if (m_numThreads == 0)
+    {
+        throw pdal_error("RialtoReader: threads must be at least 1");
+    }
+
+    // MB of decoded tiles to keep, shared with the file's other readers
+    m_cacheSize = options.getValueOrDefault<uint64_t>("cache_size", 0) * 1024 * 1024;
+
+    // X and Y are always read, for the bounds check, as are the limited dims
+    m_dimensionNames.clear();
+    const std::string names = options.getValueOrDefault<std::string>("dimensions", "");
+    for (const std::string& name: Utils::split2(names, ','))
+    {
+        const std::string trimmed = Utils::trim(name);
+        if (!trimmed.empty())
+        {
+            m_dimensionNames.push_back(trimmed);
+        }
+    }
+    if (!m_dimensionNames.empty())
+    {
+        std::vector<std::string> needed = { "X", "Y" };
+        for (const GpkgDimLimit& limit: m_limits)
+        {
+            needed.push_back(limit.name);
+        }
+        for (const std::string& name: needed)
+        {
+            if (std::find(m_dimensionNames.begin(), m_dimensionNames.end(), name) ==
+                m_dimensionNames.end())
+            {
+                m_dimensionNames.push_back(name);
+            }
+        }
+    }
+
     log()->get(LogLevel::Debug) << "process options: bounds=" << m_queryBox << std::endl;
 }
 
@@ -127,7 +399,7 @@ void RialtoReader::addDimensions(PointLayoutPtr layout)
 {
     log()->get(LogLevel::Debug) << "RialtoReader::addDimensions()" << std::endl;
 
-    m_gpkg->setupLayout(*m_matrixSet, layout);
+    m_gpkg->setupLayout(*m_matrixSet, layout, m_dimensionNames);
 }
 
 
@@ -139,7 +411,12 @@ void RialtoReader::ready(PointTableRef table)
 
 void RialtoReader::setQueryParams()
 {
-    if (m_queryBox.empty())
+    if (m_queryBox.empty() && m_region)
+    {
+        m_region->getBounds(m_queryBox.minx, m_queryBox.miny,
+                            m_queryBox.maxx, m_queryBox.maxy);
+    }
+    else if (m_queryBox.empty())
     {
         m_queryBox.minx = m_matrixSet->getDataMinX();
         m_queryBox.miny = m_matrixSet->getDataMinY();
@@ -158,78 +435,485 @@ void RialtoReader::setQueryParams()
 }
 
 
-point_count_t RialtoReader::read(PointViewPtr view, point_count_t /*not used*/)
+// reads at most count points, or all of them if count is 0
+point_count_t RialtoReader::read(PointViewPtr view, point_count_t count)
 {
-    // TODO: okay to ignore point count parameter?
-    
     log()->get(LogLevel::Debug) << "RialtoReader::read()" << std::endl;
 
-    const TileMath tmm(m_matrixSet->getTmsetMinX(), m_matrixSet->getTmsetMinY(),
-                       m_matrixSet->getTmsetMaxX(), m_matrixSet->getTmsetMaxY(),
-                       m_matrixSet->getNumColsAtL0(), m_matrixSet->getNumRowsAtL0());
+    const TileMath& tmm = m_gpkg->getTileMath(m_dataset);
 
     setQueryParams();
-    
-    const double qMinX = m_queryBox.minx;
-    const double qMinY = m_queryBox.miny;
-    const double qMaxX = m_queryBox.maxx;
-    const double qMaxY = m_queryBox.maxy;
 
-    const uint32_t level = m_queryLevel;
+    const point_count_t start = view->size();
+    const point_count_t maxCount = std::numeric_limits<point_count_t>::max();
+    const point_count_t end =
+        (count == 0 || count > maxCount - start) ? maxCount : start + count;
 
-    m_gpkg->queryForTiles_begin(m_dataset, qMinX, qMinY, qMaxX, qMaxY, level);
+    if (m_numThreads > 1)
+    {
+        readParallel(tmm, view, end);
+        return view->size() - start;
+    }
+
+    // with a cache, or to take the tiles in another order, only the tile
+    // index is queried here, and the points are read tile by tile afterwards
+    const bool indexFirst = m_cache || m_uniformOrder;
+    beginTileQuery(!indexFirst);
 
     GpkgTile info;
+    std::vector<GpkgTile> tiles;
 
     do {
+        // no more tiles are read once there are enough points
+        if (view->size() >= end) break;
+
         bool ok = m_gpkg->queryForTiles_step(info);
         if (!ok) break;
 
-        doQuery(tmm, info, view, qMinX, qMinY, qMaxX, qMaxY);
+        if (tileOutsideRegion(tmm, info))
+        {
+            continue;
+        }
+
+        if (indexFirst)
+        {
+            tiles.push_back(info);
+            continue;
+        }
+
+        doQuery(tmm, info, NULL, view, end - view->size());
         
         log()->get(LogLevel::Debug) << "  resulting view now has "
             << view->size() << " points" << std::endl;
     } while (m_gpkg->queryForTiles_next());
 
-    return view->size();
+    if (m_uniformOrder)
+    {
+        sortUniformly(tiles);
+    }
+
+    for (const GpkgTile& tile: tiles)
+    {
+        if (view->size() >= end) break;
+
+        if (m_cache)
+        {
+            const TileCache::Points points = getCachedPoints(tile);
+            doQuery(tmm, tile, points ? points->data() : NULL, view, end - view->size());
+            continue;
+        }
+
+        if (tile.getNumPoints() == 0)
+        {
+            continue;
+        }
+        GpkgTile full;
+        if (!m_gpkg->readTile(m_dataset, tile.getLevel(), tile.getColumn(), tile.getRow(),
+                              full))
+        {
+            throw pdal_error("RialtoReader: tile went missing while reading");
+        }
+        doQuery(tmm, full, NULL, view, end - view->size());
+    }
+
+    if (m_cache)
+    {
+        log()->get(LogLevel::Debug) << "  tile cache: "
+            << m_cache->getHits() << " hits, "
+            << m_cache->getMisses() << " misses, "
+            << m_cache->getEvictions() << " evictions, "
+            << m_cache->getBytes() << " bytes" << std::endl;
+    }
+
+    return view->size() - start;
 }
 
 
+// Puts the tiles in an order where those first are spread out over the
+// box: by their Morton keys, at the deepest level of any of them, with the
+// bits reversed, so that the next tile is in another quadrant than the
+// last, and so on down. A read that stops early then has a sample of the
+// whole box, not of one corner of it.
+void RialtoReader::sortUniformly(std::vector<GpkgTile>& tiles) const
+{
+    const TileMath& tmm = m_gpkg->getTileMath(m_dataset);
+
+    uint32_t level = 0;
+    for (const GpkgTile& tile: tiles)
+    {
+        level = std::max(level, tile.getLevel());
+    }
+
+    std::vector<std::pair<std::pair<uint64_t, uint64_t>, size_t>> keys;
+    keys.reserve(tiles.size());
+    for (size_t i=0; i<tiles.size(); i++)
+    {
+        const GpkgTile& tile = tiles[i];
+        const uint32_t d = level - tile.getLevel();
+        const uint64_t key = tmm.getMortonKey(tile.getColumn() << d, tile.getRow() << d,
+                                              level);
+
+        const uint64_t root = level ? (key >> (2 * level)) : key;
+        uint64_t reversed = 0;
+        for (uint32_t b=0; b<2*level; b++)
+        {
+            reversed = (reversed << 1) | ((key >> b) & 1);
+        }
+        keys.push_back(std::make_pair(std::make_pair(reversed, root), i));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<GpkgTile> sorted;
+    sorted.reserve(tiles.size());
+    for (const auto& key: keys)
+    {
+        sorted.push_back(tiles[key.second]);
+    }
+    tiles.swap(sorted);
+}
+
+
+// the tiles of the level in the box, or with a level of detail, those to
+// view the box with, going no deeper than the level
+void RialtoReader::beginTileQuery(bool withPoints)
+{
+    m_gpkg->setDimLimits(m_dataset, m_limits);
+
+    if (m_lod.isSet())
+    {
+        m_gpkg->queryForTilesLod_begin(m_dataset,
+                                       m_queryBox.minx, m_queryBox.miny,
+                                       m_queryBox.maxx, m_queryBox.maxy,
+                                       m_queryLevel, m_lod, withPoints);
+        return;
+    }
+
+    m_gpkg->queryForTiles_begin(m_dataset,
+                                m_queryBox.minx, m_queryBox.miny,
+                                m_queryBox.maxx, m_queryBox.maxy,
+                                m_queryLevel, withPoints);
+}
+
+
+// Reads the tiles on this thread, and decodes and filters them on the
+// others, so that the points come out as from read() on its own. The
+// decoders only ever touch buffers: the view is filled in here.
+void RialtoReader::readParallel(const TileMath& tmm, PointViewPtr view, point_count_t end)
+{
+    const DimTypeList dtl = view->dimTypes();
+
+    auto decode = [&](const TileJob& job, std::vector<char>& points)
+    {
+        const GpkgTile& tile = job.tile;
+
+        if (job.points)
+        {
+            decodeTile(tile, job.points->data(), dtl, points);
+        }
+        else if (m_cache)
+        {
+            std::shared_ptr<std::vector<char>> decoded(new std::vector<char>);
+            tile.decode(m_tileDims, *decoded, m_tileFormat);
+            m_cache->put(m_dataset, tile.getLevel(), tile.getColumn(), tile.getRow(),
+                         decoded);
+            decodeTile(tile, decoded->data(), dtl, points);
+        }
+        else
+        {
+            decodeTile(tile, NULL, dtl, points);
+        }
+
+        if (!tileInsideQuery(tmm, tile) || !m_limits.empty())
+        {
+            filterPoints(dtl, tile.getNumPoints(), points);
+        }
+    };
+
+    // as in read(), with a cache or another order the tile index is read first
+    const bool indexFirst = m_cache || m_uniformOrder;
+    beginTileQuery(!indexFirst);
+
+    GpkgTile info;
+    std::vector<GpkgTile> tiles;
+
+    DecodePipeline pipeline(m_numThreads, decode);
+    const size_t capacity = m_numThreads * s_tilesInFlightPerThread;
+    std::vector<char> points;
+
+    auto submit = [&](TileJob&& job)
+    {
+        while (pipeline.numOut() >= capacity && view->size() < end)
+        {
+            pipeline.take(points);
+            appendPoints(view, dtl, points, end - view->size());
+        }
+        pipeline.submit(std::move(job));
+    };
+
+    do {
+        // the tiles still out are let go once there are enough points
+        if (view->size() >= end) break;
+
+        bool ok = m_gpkg->queryForTiles_step(info);
+        if (!ok) break;
+
+        if (info.getNumPoints() == 0 || tileOutsideRegion(tmm, info))
+        {
+            continue;
+        }
+
+        if (indexFirst)
+        {
+            tiles.push_back(info);
+            continue;
+        }
+
+        // the blob is only good until the next step, so the job gets a copy
+        TileJob job;
+        job.tile.set(info.getLevel(), info.getColumn(), info.getRow(),
+                     info.getNumPoints(), info.getMask(),
+                     std::vector<char>(info.getBlobData(),
+                                       info.getBlobData() + info.getBlobSize()));
+        submit(std::move(job));
+    } while (m_gpkg->queryForTiles_next());
+
+    if (m_uniformOrder)
+    {
+        sortUniformly(tiles);
+    }
+
+    for (const GpkgTile& tile: tiles)
+    {
+        if (view->size() >= end) break;
+
+        TileJob job;
+        if (m_cache)
+        {
+            job.points = m_cache->get(m_dataset, tile.getLevel(), tile.getColumn(),
+                                      tile.getRow());
+        }
+        if (job.points)
+        {
+            job.tile = tile;
+        }
+        else if (!m_gpkg->readTile(m_dataset, tile.getLevel(), tile.getColumn(),
+                                   tile.getRow(), job.tile))
+        {
+            throw pdal_error("RialtoReader: tile went missing while reading");
+        }
+        submit(std::move(job));
+    }
+
+    while (view->size() < end && pipeline.take(points))
+    {
+        appendPoints(view, dtl, points, end - view->size());
+    }
+}
+
+
+// the tile's points, decoded, from the cache or else read and put there;
+// NULL for an empty tile
+TileCache::Points RialtoReader::getCachedPoints(const GpkgTile& tile)
+{
+    if (tile.getNumPoints() == 0)
+    {
+        return TileCache::Points();
+    }
+
+    const uint32_t level = tile.getLevel();
+    const uint32_t column = tile.getColumn();
+    const uint32_t row = tile.getRow();
+
+    TileCache::Points points = m_cache->get(m_dataset, level, column, row);
+    if (points)
+    {
+        return points;
+    }
+
+    GpkgTile full;
+    if (!m_gpkg->readTile(m_dataset, level, column, row, full))
+    {
+        throw pdal_error("RialtoReader: tile went missing while reading");
+    }
+
+    std::shared_ptr<std::vector<char>> decoded(new std::vector<char>);
+    full.decode(m_tileDims, *decoded, m_tileFormat);
+    m_cache->put(m_dataset, level, column, row, decoded);
+
+    return decoded;
+}
+
+
+// points, if not NULL, are the tile's, already decoded; adds no more than
+// maxPoints to the view
 void RialtoReader::doQuery(const TileMath& tmm,
                            const GpkgTile& tile,
+                           const char* points,
                            PointViewPtr view,
-                           double qMinX, double qMinY, double qMaxX, double qMaxY)
+                           point_count_t maxPoints)
 {
     const uint32_t level = tile.getLevel();
     const uint32_t column = tile.getColumn();
     const uint32_t row = tile.getRow();
     const uint32_t numPoints = tile.getNumPoints();
-    
-    // if this tile is entirely inside the query box, then
-    // we won't need to check each point
-    double tileMinX, tileMinY, tileMaxX, tileMaxY;
-    tmm.getTileBounds(column, row, level,
-                      tileMinX, tileMinY, tileMaxX, tileMaxY);
-    const bool tileEntirelyInsideQueryBox =
-        tmm.rectContainsRect(qMinX, qMinY, qMaxX, qMaxY,
-                             tileMinX, tileMinY, tileMaxX, tileMaxY);
 
     log()->get(LogLevel::Debug) << "  intersecting tile "
         << "(" << level << "," << column << "," << row << ")" 
         << " contains " << numPoints << " points" << std::endl;
 
-    PointViewPtr tempView = view->makeNew();
+    if (numPoints == 0)
+    {
+        return;
+    }
 
-    GpkgTile::exportToPV(numPoints, tempView, tile.getBlob());
+    // if this tile is entirely inside the query, and there are no limits,
+    // then we won't need to check each point
+    const bool checkPoints = !tileInsideQuery(tmm, tile) || !m_limits.empty();
+    if (!checkPoints && numPoints <= maxPoints)
+    {
+        exportTile(tile, points, view);
+        return;
+    }
+
+    const DimTypeList dtl = view->dimTypes();
 
-    for (uint32_t i=0; i<tempView->size(); i++) {
-        const double x = tempView->getFieldAs<double>(Dimension::Id::X, i);
-        const double y = tempView->getFieldAs<double>(Dimension::Id::Y, i);
-        if (tileEntirelyInsideQueryBox || (x >= qMinX && x <= qMaxX && y >= qMinY && y <= qMaxY))
+    std::vector<char> packed;
+    decodeTile(tile, points, dtl, packed);
+    if (checkPoints)
+    {
+        filterPoints(dtl, numPoints, packed);
+    }
+    appendPoints(view, dtl, packed, maxPoints);
+}
+
+
+// all of the tile is in the box, and in the region, if any
+bool RialtoReader::tileInsideQuery(const TileMath& tmm, const GpkgTile& tile) const
+{
+    double tileMinX, tileMinY, tileMaxX, tileMaxY;
+    tmm.getTileBounds(tile.getColumn(), tile.getRow(), tile.getLevel(),
+                      tileMinX, tileMinY, tileMaxX, tileMaxY);
+    if (!tmm.rectContainsRect(m_queryBox.minx, m_queryBox.miny,
+                              m_queryBox.maxx, m_queryBox.maxy,
+                              tileMinX, tileMinY, tileMaxX, tileMaxY))
+    {
+        return false;
+    }
+    return !m_region ||
+        m_region->classify(tileMinX, tileMinY, tileMaxX, tileMaxY) == QueryRegion::Inside;
+}
+
+
+// none of the tile is in the region, so it needn't be read
+bool RialtoReader::tileOutsideRegion(const TileMath& tmm, const GpkgTile& tile) const
+{
+    if (!m_region)
+    {
+        return false;
+    }
+    double tileMinX, tileMinY, tileMaxX, tileMaxY;
+    tmm.getTileBounds(tile.getColumn(), tile.getRow(), tile.getLevel(),
+                      tileMinX, tileMinY, tileMaxX, tileMaxY);
+    return m_region->classify(tileMinX, tileMinY, tileMaxX, tileMaxY) == QueryRegion::Outside;
+}
+
+
+// the tile's points packed per dims; points, if not NULL, are the tile's,
+// already decoded
+void RialtoReader::decodeTile(const GpkgTile& tile, const char* points,
+                              const DimTypeList& dims,
+                              std::vector<char>& packed) const
+{
+    if (!points)
+    {
+        tile.decode(m_tileDims, dims, packed, m_tileFormat);
+        return;
+    }
+
+    size_t pointSize = 0;
+    for (const DimType& dim: m_tileDims)
+    {
+        pointSize += Dimension::size(dim.m_type);
+    }
+    packed.assign(points, points + pointSize * tile.getNumPoints());
+    GpkgTile::selectDims(m_tileDims, dims, tile.getNumPoints(), packed);
+}
+
+
+// drops, in place, the packed points outside the query box, the region, or
+// the limits
+void RialtoReader::filterPoints(const DimTypeList& dims, uint32_t numPoints,
+                                std::vector<char>& packed) const
+{
+    std::vector<double> x, y;
+    PointFilter::getColumn(dims, Dimension::Id::X, packed.data(), numPoints, x);
+    PointFilter::getColumn(dims, Dimension::Id::Y, packed.data(), numPoints, y);
+
+    std::vector<uint32_t> indexes(numPoints);
+    size_t count = PointFilter::selectInBox(x.data(), y.data(), numPoints,
+                                            m_queryBox.minx, m_queryBox.miny,
+                                            m_queryBox.maxx, m_queryBox.maxy,
+                                            indexes.data());
+    if (m_region)
+    {
+        count = m_region->selectInside(x.data(), y.data(), numPoints, indexes.data(), count);
+    }
+
+    std::vector<double> values;
+    for (const GpkgDimLimit& limit: m_limits)
+    {
+        PointFilter::getColumn(dims, Dimension::id(limit.name), packed.data(),
+                               numPoints, values);
+        size_t kept = 0;
+        for (size_t i=0; i<count; ++i)
+        {
+            if (limit.contains(values[indexes[i]]))
+            {
+                indexes[kept++] = indexes[i];
+            }
+        }
+        count = kept;
+    }
+
+    PointFilter::compact(packed, numPoints ? packed.size() / numPoints : 0,
+                         indexes.data(), count);
+}
+
+
+// the first maxPoints of them, at most
+void RialtoReader::appendPoints(PointViewPtr view, const DimTypeList& dims,
+                                const std::vector<char>& packed,
+                                point_count_t maxPoints)
+{
+    const size_t pointSize = view->pointSize();
+    const size_t numPoints = std::min<point_count_t>(packed.size() / pointSize, maxPoints);
+
+    PointId idx = view->size();
+    for (const char* p = packed.data(); p < packed.data() + numPoints * pointSize; p += pointSize)
+    {
+        view->setPackedPoint(dims, idx, p);
+        ++idx;
+    }
+}
+
+
+
+void RialtoReader::exportTile(const GpkgTile& tile, const char* points,
+                              PointViewPtr view) const
+{
+    if (points)
+    {
+        size_t pointSize = 0;
+        for (const DimType& dim: m_tileDims)
         {
-            view->appendPoint(*tempView, i);
+            pointSize += Dimension::size(dim.m_type);
         }
+        GpkgTile::exportToPV(view, m_tileDims, points,
+                             pointSize * tile.getNumPoints(), tile.getNumPoints());
+        return;
     }
+
+    tile.exportToPV(view, m_tileFormat, m_tileDims);
 }
 
 
@@ -35,10 +35,21 @@
 #include <rialto/RialtoWriter.hpp>
 #include <rialto/GeoPackageWriter.hpp>
 #include <rialto/GeoPackageCommon.hpp>
+#include "ExternalTileSet.hpp"
+#include "TileCache.hpp"
 #include "WritableTileCommon.hpp"
 
 #include <boost/filesystem.hpp>
 
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
 
 static PluginInfo const s_info = PluginInfo(
     "writers.rialto",
@@ -47,10 +58,157 @@ static PluginInfo const s_info = PluginInfo(
 
 //CREATE_SHARED_PLUGIN(1, 0, rialto::RialtoWriter, Writer, s_info)
 
+// encoded tiles allowed ahead of the writer, per encoding thread
+static const size_t s_tilesInFlightPerThread = 4;
+
 namespace rialto
 {
 
 
+namespace
+{
+
+double millisSince(std::chrono::steady_clock::time_point start)
+{
+    const std::chrono::duration<double, std::milli> d =
+        std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+
+// Encodes tiles on a pool of threads, for the calling thread to take and
+// write. At most capacity tiles are out at once, being encoded or waiting
+// to be taken, so the encoders can't run further ahead of the writer than
+// that. If ordered, the tiles are taken in order of their numbers;
+// otherwise, as soon as each is ready. An exception from an encoder is
+// rethrown by take().
+class EncodePipeline
+{
+public:
+    typedef std::function<GpkgTile (size_t)> EncodeFn;
+
+    EncodePipeline(size_t numTiles, uint32_t numThreads, size_t capacity,
+                   bool ordered, EncodeFn encode, const Event& encodeEvent) :
+        m_numTiles(numTiles),
+        m_capacity(capacity),
+        m_ordered(ordered),
+        m_encode(encode),
+        m_encodeEvent(encodeEvent),
+        m_next(0),
+        m_numTaken(0),
+        m_stopped(false)
+    {
+        assert(capacity > 0);
+        for (uint32_t i=0; i<numThreads; i++)
+        {
+            m_threads.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~EncodePipeline()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_all();
+
+        for (auto& t: m_threads)
+        {
+            t.join();
+        }
+    }
+
+    // returns false once all the tiles have been taken
+    bool take(GpkgTile& tile)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_numTaken == m_numTiles)
+        {
+            return false;
+        }
+
+        m_cv.wait(lock, [this]() { return m_err || isReady(); });
+        if (m_err)
+        {
+            std::rethrow_exception(m_err);
+        }
+
+        auto it = m_ordered ? m_done.find(m_numTaken) : m_done.begin();
+        tile = std::move(it->second);
+        m_done.erase(it);
+        ++m_numTaken;
+
+        lock.unlock();
+        m_cv.notify_all();
+        return true;
+    }
+
+private:
+    bool isReady() const
+    {
+        return m_ordered ? m_done.count(m_numTaken) != 0 : !m_done.empty();
+    }
+
+    void work()
+    {
+        for (;;)
+        {
+            size_t idx;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]()
+                    { return m_stopped || m_next == m_numTiles ||
+                             m_next - m_numTaken < m_capacity; });
+                if (m_stopped || m_next == m_numTiles)
+                {
+                    return;
+                }
+                idx = m_next++;
+            }
+
+            try
+            {
+                const auto start = std::chrono::steady_clock::now();
+                GpkgTile tile = m_encode(idx);
+                const double millis = millisSince(start);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.emplace(idx, std::move(tile));
+                m_encodeEvent.add(millis);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_err)
+                {
+                    m_err = std::current_exception();
+                }
+                m_stopped = true;
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    const size_t m_numTiles;
+    const size_t m_capacity;
+    const bool m_ordered;
+    EncodeFn m_encode;
+    const Event& m_encodeEvent;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::map<size_t, GpkgTile> m_done; // encoded, not yet taken
+    size_t m_next; // the next tile to encode
+    size_t m_numTaken;
+    bool m_stopped;
+    std::exception_ptr m_err;
+    std::vector<std::thread> m_threads;
+};
+
+} // anonymous namespace
+
+
 void RialtoWriter::ready(PointTableRef table)
 {
     log()->get(LogLevel::Debug) << "RialtoWriter::localStart()" << std::endl;
@@ -62,7 +220,8 @@ void RialtoWriter::ready(PointTableRef table)
         m_gpkg = new GeoPackageWriter(m_filename, log());
         m_gpkg->open();
 
-        if (m_gpkg->doesTableExist(m_dataset))
+        m_appending = m_gpkg->doesTableExist(m_dataset);
+        if (m_appending && !m_append)
         {
             throw pdal_error("point cloud table already exists in database: " + m_dataset);
         }
@@ -96,17 +255,100 @@ void RialtoWriter::ready(PointTableRef table)
 
     initStats(table.layout());
 
+    m_dimTypes = table.layout()->dimTypes();
+    m_packedPoint.resize(table.layout()->pointSize());
+    m_written = false;
+    m_firstSeq = 0;
+
+    if (m_appending)
+    {
+        startAppend();
+
+        // only the external build can carry on from the existing points
+        m_externalSet = createExternalSet(m_maxMemory ? m_maxMemory : m_streamMemory);
+        return;
+    }
+
     // write tile matrix set table
     {
-        const GpkgMatrixSet info(m_dataset, table.layout(), m_timestamp, srs,
-                                 m_numColsAtL0, m_numRowsAtL0, m_description,
-                                 lasMetadata, m_maxLevel);
+        GpkgMatrixSet info(m_dataset, table.layout(), m_timestamp, srs,
+                           m_numColsAtL0, m_numRowsAtL0, m_description,
+                           lasMetadata, m_maxLevel);
+        info.setTileFormat(m_tileFormat);
 
         m_gpkg->writeTileTable(info);
+
+        // quantizing goes by the tile matrix the readers will see
+        m_tileFormat = info.getTileFormat();
+    }
+
+    if (m_maxMemory)
+    {
+        m_externalSet = createExternalSet(m_maxMemory);
     }
 }
 
 
+// Checks that the new points fit the existing tile set, and picks up its
+// point count and dimension stats where they left off.
+void RialtoWriter::startAppend()
+{
+    GpkgMatrixSet info;
+    m_gpkg->readMatrixSet(m_dataset, info);
+
+    if (info.getMaxLevel() != m_maxLevel ||
+        info.getNumColsAtL0() != m_numColsAtL0 ||
+        info.getNumRowsAtL0() != m_numRowsAtL0 ||
+        info.getTmsetMinX() != m_tms_minx ||
+        info.getTmsetMinY() != m_tms_miny ||
+        info.getTmsetMaxX() != m_tms_maxx ||
+        info.getTmsetMaxY() != m_tms_maxy)
+    {
+        throw pdal_error("RialtoWriter: tile matrix does not match existing table: " + m_dataset);
+    }
+
+    // a tile that isn't there yet must have no old children, which only
+    // holds if every tile over an old point has its row
+    if (!m_gpkg->hasEmptyTiles(m_dataset))
+    {
+        throw pdal_error("RialtoWriter: can't append to a table written without "
+                         "its empty tiles: " + m_dataset);
+    }
+
+    const std::vector<GpkgDimension>& dims = info.getDimensions();
+    if (dims.size() != m_dimTypes.size())
+    {
+        throw pdal_error("RialtoWriter: dimensions do not match existing table: " + m_dataset);
+    }
+    for (const GpkgDimension& dim: dims)
+    {
+        const uint32_t i = dim.getPosition();
+        if (i >= m_dimTypes.size() ||
+            dim.getName() != Dimension::name(m_dimTypes[i].m_id) ||
+            dim.getDataType() != Dimension::interpretationName(m_dimTypes[i].m_type))
+        {
+            throw pdal_error("RialtoWriter: dimensions do not match existing table: " + m_dataset);
+        }
+    }
+
+    uint32_t numTiles;
+    m_gpkg->getCountsAtLevel(m_dataset, m_maxLevel, numTiles, m_numPoints);
+
+    for (const GpkgDimension& dim: dims)
+    {
+        const Dimension::Id::Enum id = m_dimTypes[dim.getPosition()].m_id;
+        m_mins[id] = dim.getMinimum();
+        m_maxes[id] = dim.getMaximum();
+        m_means[id] = dim.getMean() * m_numPoints;
+    }
+
+    m_firstSeq = m_numPoints;
+
+    // the new tiles must match the old ones
+    m_tileFormat = info.getTileFormat();
+}
+
+
 void RialtoWriter::initStats(PointLayoutPtr layout)
 {
     for (auto i: layout->dims())
@@ -134,11 +376,65 @@ void RialtoWriter::collectStats(PointView* pv)
     m_numPoints += pv->size();
 }
 
+void RialtoWriter::collectStats(const PointRef& point)
+{
+    for (const DimType& dt: m_dimTypes)
+    {
+        const double v = point.getFieldAs<double>(dt.m_id);
+        m_mins[dt.m_id] = std::min(m_mins[dt.m_id], v);
+        m_maxes[dt.m_id] = std::max(m_maxes[dt.m_id], v);
+        m_means[dt.m_id] += v;
+    }
+    ++m_numPoints;
+}
+
+
+// For streaming: the points go into the external build as they arrive,
+// held in memory up to the budget and spilled to temporary files past it.
+// Any point still to come may fall in any tile, so no tile is made until
+// done(), unless the points are sorted: then each subtree is built and
+// written as soon as the points move on past it.
+bool RialtoWriter::processOne(PointRef& point)
+{
+    if (!m_externalSet)
+    {
+        m_externalSet = createExternalSet(m_maxMemory ? m_maxMemory : m_streamMemory);
+    }
+
+    const double x = point.getFieldAs<double>(Dimension::Id::X);
+    const double y = point.getFieldAs<double>(Dimension::Id::Y);
+    point.getPackedData(m_dimTypes, m_packedPoint.data());
+    m_externalSet->add(x, y, m_packedPoint.data());
+
+    collectStats(point);
+
+    return true;
+}
+
 
 void RialtoWriter::write(const PointViewPtr inView)
 {
-    // TODO: doesn't support being called more than once, e.g.
-    // for a set of PointViews
+    if (m_externalSet)
+    {
+        for (PointId idx=0; idx<inView->size(); ++idx)
+        {
+            const double x = inView->getFieldAs<double>(Dimension::Id::X, idx);
+            const double y = inView->getFieldAs<double>(Dimension::Id::Y, idx);
+            inView->getPackedPoint(m_dimTypes, idx, m_packedPoint.data());
+            m_externalSet->add(x, y, m_packedPoint.data());
+        }
+
+        collectStats(inView.get());
+        return;
+    }
+
+    // the in-memory builders make the whole tree at once
+    if (m_written)
+    {
+        throw pdal_error("RialtoWriter: only one point view can be written "
+                         "unless max_memory is set");
+    }
+    m_written = true;
                   
     WritableTileSet tileSet(m_maxLevel, 
                             m_tms_minx, m_tms_miny, m_tms_maxx, m_tms_maxy,
@@ -146,38 +442,229 @@ void RialtoWriter::write(const PointViewPtr inView)
                             log());
 
     PointViewSet outViews;
-    tileSet.build(inView, &outViews);
+    if (m_builder == "morton")
+    {
+        tileSet.buildMorton(inView, &outViews, m_numThreads);
+    }
+    else
+    {
+        tileSet.build(inView, &outViews, m_numThreads);
+    }
 
-    m_gpkg->beginTransaction();
-    
     writeAllTiles(tileSet);
-    
-    m_gpkg->commitTransaction();
 }
 
 
-void RialtoWriter::writeAllTiles(WritableTileSet& tileSet)
+ExternalTileSet* RialtoWriter::createExternalSet(uint64_t maxMemory)
+{
+    ExternalTileSet* tileSet =
+        new ExternalTileSet(m_maxLevel,
+                            m_tms_minx, m_tms_miny, m_tms_maxx, m_tms_maxy,
+                            m_numColsAtL0, m_numRowsAtL0,
+                            m_dimTypes, maxMemory, m_tempDir, log());
+
+    tileSet->setTileFormat(m_tileFormat);
+    tileSet->setFirstSeq(m_firstSeq);
+    if (m_sorted)
+    {
+        tileSet->setSortedSink([this](GpkgTile& tile) { addExternalTile(tile); });
+    }
+
+    return tileSet;
+}
+
+
+// builds the rest of the tiles from the points given to the external set,
+// writing each batch out as soon as it is ready
+void RialtoWriter::writeExternal()
 {
-    const int numTiles = tileSet.getTiles().size();
+    m_externalSet->finish([this](GpkgTile& tile) { addExternalTile(tile); });
+
+    writeTiles(m_externalBatch);
+}
+
+
+void RialtoWriter::addExternalTile(GpkgTile& tile)
+{
+    m_externalBatch.push_back(std::move(tile));
+    if (m_batchSize && m_externalBatch.size() >= m_batchSize)
+    {
+        writeTiles(m_externalBatch);
+    }
+}
 
-    HeartBeat hb(numTiles, 50, 100);
 
+// With more than one thread, the tiles are encoded on a pool of threads
+// while this one writes them out.
+void RialtoWriter::writeAllTiles(WritableTileSet& tileSet)
+{
+    // the ones with points at or below them, even those the decimation
+    // left with no points of their own, for their masks: a reader walks
+    // down through them
+    std::vector<WritableTile*> tiles;
     for (auto tile: tileSet.getTiles())
     {
         assert(tile != NULL);
         PointView* pv = tile->getPointView().get();
-        if (pv)
+        if (tile->getMask() || (pv && pv->size() > 0))
+        {
+            tiles.push_back(tile);
+        }
+
+        if (pv && tile->getLevel() == m_maxLevel)
         {
-            writeTile(pv, tile->getLevel(), tile->getColumn(), tile->getRow(), tile->getMask());
+            collectStats(pv);
+        }
+    }
 
-            if (tile->getLevel() == m_maxLevel)
+    auto encode = [&](size_t i)
+    {
+        WritableTile* tile = tiles[i];
+        return GpkgTile(tile->getPointView().get(), tile->getLevel(),
+                        tile->getColumn(), tile->getRow(), tile->getMask(),
+                        m_tileFormat);
+    };
+
+    HeartBeat hb(tiles.size(), 50, 100);
+
+    std::vector<GpkgTile> batch;
+    batch.reserve(m_batchSize ? m_batchSize : tiles.size());
+
+    auto add = [&](GpkgTile& tile)
+    {
+        batch.push_back(std::move(tile));
+        if (m_batchSize && batch.size() >= m_batchSize)
+        {
+            writeTiles(batch);
+        }
+        hb.beat();
+    };
+
+    if (m_numThreads > 1)
+    {
+        EncodePipeline pipeline(tiles.size(), m_numThreads,
+                                s_tilesInFlightPerThread * m_numThreads,
+                                m_ordered, encode, e_encode);
+        GpkgTile tile;
+        for (;;)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const bool ok = pipeline.take(tile);
+            e_encodeWait.add(millisSince(start));
+            if (!ok)
             {
-                collectStats(pv);
+                break;
             }
+            add(tile);
         }
-        
-        hb.beat();
     }
+    else
+    {
+        for (size_t i=0; i<tiles.size(); i++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            GpkgTile tile = encode(i);
+            e_encode.add(millisSince(start));
+            add(tile);
+        }
+    }
+
+    writeTiles(batch);
+}
+
+
+// writes the tiles as one transaction, and empties the list
+void RialtoWriter::writeTiles(std::vector<GpkgTile>& tiles)
+{
+    if (tiles.empty())
+    {
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    m_gpkg->beginTransaction();
+
+    // the tiles already there are read in the same transaction
+    std::vector<GpkgTile> updates;
+    if (m_appending)
+    {
+        mergeTiles(tiles, updates);
+    }
+
+    if (!tiles.empty())
+    {
+        m_gpkg->writeTiles(m_dataset, tiles);
+    }
+    if (!updates.empty())
+    {
+        m_gpkg->updateTiles(m_dataset, updates);
+    }
+    m_gpkg->commitTransaction();
+
+    e_tilesWritten.add(millisSince(start));
+
+    tiles.clear();
+}
+
+
+// For appending: each tile that is already in the table is merged with it,
+// its new points going after the old ones, and moved to updates. Tiles
+// with no new points are only kept if they add to the mask. A tile that
+// isn't there yet has no old children, as every tile over a point is
+// stored, with or without points of its own.
+void RialtoWriter::mergeTiles(std::vector<GpkgTile>& tiles,
+                              std::vector<GpkgTile>& updates)
+{
+    // the ones already there, all read at once
+    std::vector<GpkgTile> found;
+    m_gpkg->readTilesAt(m_dataset, tiles, found);
+    std::map<std::tuple<uint32_t, uint32_t, uint32_t>, GpkgTile*> olds;
+    for (GpkgTile& tile: found)
+    {
+        olds[std::make_tuple(tile.getLevel(), tile.getColumn(), tile.getRow())] = &tile;
+    }
+
+    std::vector<GpkgTile> inserts;
+    std::vector<char> oldPoints;
+    std::vector<char> newPoints;
+
+    for (GpkgTile& tile: tiles)
+    {
+        const uint32_t level = tile.getLevel();
+        const uint32_t column = tile.getColumn();
+        const uint32_t row = tile.getRow();
+
+        auto iter = olds.find(std::make_tuple(level, column, row));
+        if (iter == olds.end())
+        {
+            inserts.push_back(std::move(tile));
+            continue;
+        }
+        GpkgTile& old = *iter->second;
+
+        const uint32_t mask = old.getMask() | tile.getMask();
+
+        if (tile.getNumPoints() == 0)
+        {
+            if (mask != old.getMask())
+            {
+                old.set(level, column, row, old.getNumPoints(), mask, old.getBlob());
+                updates.push_back(old);
+            }
+            continue;
+        }
+
+        old.decode(m_dimTypes, oldPoints, m_tileFormat);
+        tile.decode(m_dimTypes, newPoints, m_tileFormat);
+        oldPoints.insert(oldPoints.end(), newPoints.begin(), newPoints.end());
+
+        updates.emplace_back(m_dimTypes, oldPoints,
+                             old.getNumPoints() + tile.getNumPoints(),
+                             level, column, row, mask, m_tileFormat);
+    }
+
+    tiles.swap(inserts);
 }
 
 
@@ -185,11 +672,21 @@ void RialtoWriter::done(PointTableRef table)
 {  
     log()->get(LogLevel::Debug) << "RialtoWriter::localFinish()" << std::endl;
 
+    if (m_externalSet)
+    {
+        writeExternal();
+        delete m_externalSet;
+        m_externalSet = NULL;
+    }
+
     updateDimensionStats(table.layout());
 
     m_gpkg->close();
     delete m_gpkg;
     m_gpkg = NULL;
+
+    // readers in this process may have the old tiles
+    TileCache::invalidate(m_filename);
 }
 
 
@@ -211,6 +708,50 @@ void RialtoWriter::processOptions(const Options& options)
     m_tms_miny = options.getValueOrThrow<double>("tms_miny");
     m_tms_maxx = options.getValueOrThrow<double>("tms_maxx");
     m_tms_maxy = options.getValueOrThrow<double>("tms_maxy");
+    m_batchSize = options.getValueOrDefault<uint32_t>("batch_size", 1000);
+    m_numThreads = options.getValueOrDefault<uint32_t>("threads", 1);
+    m_builder = options.getValueOrDefault<std::string>("builder", "tree");
+    m_maxMemory = options.getValueOrDefault<uint64_t>("max_memory", 0) * 1024 * 1024;
+    m_streamMemory = options.getValueOrDefault<uint64_t>("stream_memory", 1024) * 1024 * 1024;
+    m_sorted = options.getValueOrDefault<bool>("sorted", false);
+    m_tempDir = options.getValueOrDefault<std::string>("tempdir", "");
+    m_append = options.getValueOrDefault<bool>("append", false);
+    m_ordered = options.getValueOrDefault<bool>("ordered", true);
+
+    const std::string encoding = options.getValueOrDefault<std::string>("encoding", "packed");
+    if (encoding == "packed")
+    {
+        m_tileFormat = GpkgTileFormat(GpkgEncodingPacked);
+    }
+    else if (encoding == "columnar")
+    {
+        m_tileFormat = GpkgTileFormat(GpkgEncodingColumnar);
+    }
+    else
+    {
+        throw pdal_error("RialtoWriter: encoding must be 'packed' or 'columnar'");
+    }
+
+    const double scaleX = options.getValueOrDefault<double>("scale_x", 0.0);
+    const double scaleY = options.getValueOrDefault<double>("scale_y", 0.0);
+    const double scaleZ = options.getValueOrDefault<double>("scale_z", 0.0);
+    const double offsetZ = options.getValueOrDefault<double>("offset_z", 0.0);
+    if (scaleX < 0.0 || scaleY < 0.0 || scaleZ < 0.0)
+    {
+        throw pdal_error("RialtoWriter: scale_x, scale_y and scale_z must not be negative");
+    }
+    if ((scaleX == 0.0) != (scaleY == 0.0))
+    {
+        throw pdal_error("RialtoWriter: scale_x and scale_y must be set together");
+    }
+    m_tileFormat.setQuantization(scaleX, scaleY, scaleZ, offsetZ);
+
+    // per level, the last for the rest; when appending, the table's own
+    const std::string compression = options.getValueOrDefault<std::string>("compression", "");
+    if (!compression.empty())
+    {
+        m_tileFormat.setCodecs(GpkgCodec::parseList(compression));
+    }
 
     if (m_tms_minx >= m_tms_maxx || m_tms_miny >= m_tms_maxy)
     {
@@ -222,6 +763,21 @@ void RialtoWriter::processOptions(const Options& options)
         throw pdal_error("TilerFilter: invalid matrix dimensions");
     }
 
+    if (m_numThreads == 0)
+    {
+        throw pdal_error("RialtoWriter: threads must be at least 1");
+    }
+
+    if (m_streamMemory == 0)
+    {
+        throw pdal_error("RialtoWriter: stream_memory must be at least 1");
+    }
+
+    if (m_builder != "tree" && m_builder != "morton")
+    {
+        throw pdal_error("RialtoWriter: builder must be 'tree' or 'morton'");
+    }
+
     if (m_dataset == "")
     {
         m_dataset = boost::filesystem::path(m_filename).stem().string() + "_tiles";
@@ -229,20 +785,20 @@ void RialtoWriter::processOptions(const Options& options)
 }
 
 
-Options RialtoWriter::getDefaultOptions()
+void RialtoWriter::dumpStats() const
 {
-    Options options;
-    return options;
+    std::cout << "RialtoWriter stats" << std::endl;
+
+    e_encode.dump();
+    e_encodeWait.dump();
+    e_tilesWritten.dump();
 }
 
 
-void RialtoWriter::writeTile(PointView* view, uint32_t level, uint32_t col, uint32_t row, uint32_t mask)
+Options RialtoWriter::getDefaultOptions()
 {
-    if (view && view->size() > 0)
-    {
-        const GpkgTile tile(view, level, col, row, mask);
-        m_gpkg->writeTile(m_dataset, tile);
-    }
+    Options options;
+    return options;
 }
 
 
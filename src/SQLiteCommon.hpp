@@ -37,6 +37,9 @@
 #include <sqlite3.h>
 
 #include <iomanip> // std::setprecision
+#include <list>
+
+#include <rialto/Event.hpp>
 
 namespace rialto
 {
@@ -44,48 +47,279 @@ namespace rialto
 // TODO: is 20 a good number?
 #define FP_STRING_PRECISION 20
 
+// A single value, bound to or read from a statement in its native SQLite
+// storage class (one of the SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT,
+// SQLITE_BLOB or SQLITE_NULL codes): numbers are never formatted into
+// strings, so doubles round-trip exactly and no heap string is made
+// for them.
 class column
 {
 public:
 
-    column() : null(true), blobBuf(0), blobLen(0){};
-    column(std::string v) : null(false), blobBuf(0), blobLen(0)
+    column() : type(SQLITE_NULL), integer(0), real(0.0), null(true), blobBuf(0), blobLen(0), blobRef(0) {};
+    column(std::string v) : type(SQLITE_TEXT), integer(0), real(0.0), null(false), blobBuf(0), blobLen(0), blobRef(0)
     {
         data = v;
     }
-    column(double v) : null(false), blobBuf(0), blobLen(0)
+    column(double v) : type(SQLITE_FLOAT), integer(0), real(v), null(false), blobBuf(0), blobLen(0), blobRef(0)
+    {
+    }
+    column(uint32_t v) : type(SQLITE_INTEGER), integer(v), real(0.0), null(false), blobBuf(0), blobLen(0), blobRef(0)
     {
-        std::ostringstream ss;
-        ss << std::setprecision(FP_STRING_PRECISION) << v;
-        data = ss.str();
     }
-    column(uint32_t v) : null(false), blobBuf(0), blobLen(0)
+    column(int64_t v) : type(SQLITE_INTEGER), integer(v), real(0.0), null(false), blobBuf(0), blobLen(0), blobRef(0)
+    {
+    }
+
+    // the blob's bytes, wherever they live (see blobRef)
+    const uint8_t* getBlobData() const
+    {
+        if (blobRef) return blobRef;
+        return blobLen ? &blobBuf.front() : 0;
+    }
+
+    // These convert from the stored class if need be, following SQLite's
+    // own rules (NULL is zero, text is parsed as a number).
+    int64_t getInt64() const
+    {
+        switch (type)
+        {
+            case SQLITE_INTEGER: return integer;
+            case SQLITE_FLOAT: return static_cast<int64_t>(real);
+            case SQLITE_TEXT: return strtoll(data.c_str(), NULL, 10);
+            default: return 0;
+        }
+    }
+
+    uint32_t getUInt32() const
     {
-        data = boost::lexical_cast<std::string>(v);
+        return static_cast<uint32_t>(getInt64());
     }
 
+    double getDouble() const
+    {
+        switch (type)
+        {
+            case SQLITE_INTEGER: return static_cast<double>(integer);
+            case SQLITE_FLOAT: return real;
+            case SQLITE_TEXT: return strtod(data.c_str(), NULL);
+            default: return 0.0;
+        }
+    }
+
+    std::string getText() const
+    {
+        switch (type)
+        {
+            case SQLITE_INTEGER:
+                return boost::lexical_cast<std::string>(integer);
+            case SQLITE_FLOAT:
+            {
+                std::ostringstream ss;
+                ss << std::setprecision(FP_STRING_PRECISION) << real;
+                return ss.str();
+            }
+            case SQLITE_TEXT: return data;
+            default: return std::string();
+        }
+    }
+
+    int type;
+    int64_t integer;
+    double real;
     std::string data;
     bool null;
     std::vector<uint8_t> blobBuf;
     std::size_t blobLen;
+
+    // if set, the blob's bytes are not in blobBuf but are owned by someone
+    // else, e.g. a cursor borrowing SQLite's own copy (see
+    // SQLiteCursor::borrowBlobs)
+    const uint8_t* blobRef;
 };
 
+// Does not copy the buffer: it must stay alive until the row has been
+// inserted.
 class blob : public column
 {
 public:
     blob(const char* buffer, std::size_t size) : column()
     {
-        blobBuf.resize(size);
-        std::copy(buffer, buffer+size, blobBuf.begin());
+        blobRef = reinterpret_cast<const uint8_t*>(buffer);
         blobLen = size;
         null = false;
-
+        type = SQLITE_BLOB;
     }
 };
 
 typedef std::vector<column> row;
 typedef std::vector<row> records;
 
+class SQLite;
+
+
+// A forward-only cursor over the rows of a live query statement.
+//
+// Rows are pulled from SQLite one at a time as step() is called, so only
+// the current row is ever held in memory. The row returned by get() is
+// only valid until the next call to step().
+//
+// By default a blob column is copied into the row. If borrowBlobs() is
+// set, the row instead points at SQLite's own copy of the blob (see
+// column::blobRef), which is likewise only valid until the next step().
+//
+// The cursor holds its statement until destroyed, at which point the
+// statement goes back to the session's statement cache; it must not outlive
+// the SQLite session that created it.
+//
+// Usage example:
+//   std::unique_ptr<SQLiteCursor> cur = sqlite.cursor("SELECT * from TABLE");
+//   while (cur->step())
+//   {
+//       const row* r = cur->get();
+//       column const& c = r->at(0); // get 1st column of this row
+//       ... use c.getInt64(), c.data, etc ...
+//   }
+//
+class SQLiteCursor
+{
+public:
+    SQLiteCursor(SQLite& owner, std::string const& sql, sqlite3_stmt* statement)
+        : m_owner(owner)
+        , m_sql(sql)
+        , m_statement(statement)
+        , m_numCols(sqlite3_column_count(statement))
+        , m_haveRow(false)
+        , m_done(false)
+        , m_borrowBlobs(false)
+    {
+        assert(m_statement);
+        m_row.resize(m_numCols);
+    }
+
+    ~SQLiteCursor();
+
+    // advance to the next row
+    //
+    // returns false (and leaves get() returning NULL) once the result set
+    // is exhausted
+    bool step()
+    {
+        m_haveRow = false;
+
+        if (m_done)
+        {
+            return false;
+        }
+
+        const int status = sqlite3_step(m_statement);
+
+        if (status == SQLITE_DONE)
+        {
+            m_done = true;
+            return false;
+        }
+
+        if (status != SQLITE_ROW)
+        {
+            m_done = true;
+            error("sqlite3_step (cursor)");
+        }
+
+        for (int v = 0; v < m_numCols; ++v)
+        {
+            readColumn(v, m_row[v]);
+        }
+
+        m_haveRow = true;
+        return true;
+    }
+
+    // the current row, or NULL if not positioned on a row
+    const row* get() const
+    {
+        return m_haveRow ? &m_row : 0;
+    }
+
+    // don't copy blobs out of SQLite, just point at them
+    void borrowBlobs(bool borrow) { m_borrowBlobs = borrow; }
+
+    sqlite3_stmt* statement() const { return m_statement; }
+
+private:
+    SQLite& m_owner;
+    const std::string m_sql;
+    sqlite3_stmt* m_statement;
+    const int m_numCols;
+    row m_row;
+    bool m_haveRow;
+    bool m_done;
+    bool m_borrowBlobs;
+
+    // reuses the column's buffers, so stepping over many rows of the same
+    // shape does not reallocate
+    void readColumn(int v, column& c) const
+    {
+        const int type = sqlite3_column_type(m_statement, v);
+
+        c.type = type;
+        c.data.clear();
+        c.blobLen = 0;
+        c.blobRef = 0;
+        c.null = false;
+
+        switch (type)
+        {
+            case SQLITE_INTEGER:
+                c.integer = sqlite3_column_int64(m_statement, v);
+                break;
+            case SQLITE_FLOAT:
+                c.real = sqlite3_column_double(m_statement, v);
+                break;
+            case SQLITE_BLOB:
+            {
+                const int len = sqlite3_column_bytes(m_statement, v);
+                const uint8_t* buf = (const uint8_t*) sqlite3_column_blob(m_statement, v);
+                if (m_borrowBlobs)
+                {
+                    c.blobRef = buf;
+                }
+                else
+                {
+                    c.blobBuf.assign(buf, buf+len);
+                }
+                c.blobLen = len;
+                break;
+            }
+            case SQLITE_TEXT:
+            {
+                char const* buf =
+                    reinterpret_cast<char const*>(sqlite3_column_text(m_statement, v));
+                c.data = buf ? buf : "";
+                break;
+            }
+            default:
+                c.type = SQLITE_NULL;
+                c.null = true;
+                break;
+        }
+    }
+
+    void error(std::string const& userMssg) const
+    {
+        char const* sqlMssg = sqlite3_errmsg(sqlite3_db_handle(m_statement));
+
+        std::ostringstream ss;
+        ss << "sqlite error: " << userMssg << std::endl
+           << sqlMssg;
+        throw pdal_error(ss.str());
+    }
+
+    SQLiteCursor& operator=(const SQLiteCursor&); // not implemented
+    SQLiteCursor(const SQLiteCursor&); // not implemented
+};
+
+
 class SQLite
 {
 public:
@@ -95,6 +329,9 @@ public:
         , m_session(0)
         , m_statement(0)
         , m_position(-1)
+        , m_stmtCacheSize(32)
+        , e_stmtPrepares("stmtPrepares")
+        , e_stmtCacheHits("stmtCacheHits")
     {
         m_log->get(LogLevel::Debug3) << "Setting up config " << std::endl;
         sqlite3_shutdown();
@@ -106,6 +343,12 @@ public:
 
     ~SQLite()
     {
+        for (auto& entry: m_stmtLru)
+        {
+            sqlite3_finalize(entry.second);
+        }
+        m_stmtLru.clear();
+        m_stmtIndex.clear();
 
         if (m_session)
         {
@@ -183,8 +426,29 @@ public:
         execute("COMMIT", "Unable to commit transaction");
     }
 
+    // Prepares an SQL query statement and returns a cursor over its rows,
+    // without stepping it. Use this for queries whose results may be large
+    // (e.g. tile blobs), so that rows are consumed as they are produced.
+    //
+    // If given, the params are bound to the statement's '?' placeholders.
+    std::unique_ptr<SQLiteCursor> cursor(std::string const& sql,
+                                         row const& params=row())
+    {
+        m_log->get(LogLevel::Debug3) << "Cursor for '" << sql << "'" << std::endl;
+
+        HeldStatement stmt(*this, sql);
+
+        // the params may not outlive this call, so have SQLite copy them
+        bindRow(stmt.get(), params, 0, SQLITE_TRANSIENT);
+
+        std::unique_ptr<SQLiteCursor> cur(new SQLiteCursor(*this, sql, stmt.get()));
+        stmt.handOff(); // the cursor gives it back now
+        return cur;
+    }
+
     // Executes an SQL query statement and provides the returned rows via
-    // an iterator.
+    // an iterator. All the rows are read into memory before this returns,
+    // so use cursor() instead for anything big.
     //
     // Usage example:
     //   query("SELECT * from TABLE");
@@ -193,109 +457,43 @@ public:
     //       const row* r = get();
     //       if (!r) break ; // no more rows
     //       column const& c = r->at(0); // get 1st column of this row
-    //       ... use c.data ...
+    //       ... use c.getInt64(), c.data, etc ...
     //     } while (next());
     //
-    void query(std::string const& query)
+    void query(std::string const& query, row const& params=row())
     {
         m_position = 0;
         m_columns.clear();
+        m_types.clear();
         m_data.clear();
-        assert(!m_statement);
-        
-        int status;
-        
-        m_log->get(LogLevel::Debug3) << "Querying '" << query.c_str() <<"'"<< std::endl;
 
-        char const* tail = 0; // unused;
-        status = sqlite3_prepare_v2(m_session,
-                                    query.c_str(),
-                                    static_cast<int>(query.size()),
-                                    &m_statement,
-                                    &tail);
-        if (status != SQLITE_OK)
-        {
-            error("sqlite3_prepare_v2 (query)");
-        }
+        m_log->get(LogLevel::Debug3) << "Querying '" << query.c_str() <<"'"<< std::endl;
 
-        int numCols = -1;
+        std::unique_ptr<SQLiteCursor> cur = cursor(query, params);
+        sqlite3_stmt* statement = cur->statement();
 
-        while (status != SQLITE_DONE)
+        while (cur->step())
         {
-            status = sqlite3_step(m_statement);
-
-            if (SQLITE_ROW == status)
+            // only need to set the column info once
+            if (m_columns.empty())
             {
-                // only need to set the number of columns once
-                if (-1 == numCols)
-                {
-                    numCols = sqlite3_column_count(m_statement);
-                }
-
-                row r;
+                const int numCols = sqlite3_column_count(statement);
                 for (int v = 0; v < numCols; ++v)
                 {
-
-                    if (m_columns.size() != static_cast<std::vector<std::string>::size_type > (numCols))
+                    std::string ccolumnName = Utils::toupper(std::string(sqlite3_column_name(statement, v)));
+                    const char* coltype = sqlite3_column_decltype(statement, v);
+                    if (!coltype)
                     {
-                        std::string ccolumnName = Utils::toupper(std::string(sqlite3_column_name(m_statement, v)));
-                        const char* coltype = sqlite3_column_decltype(m_statement, v);
-                        if (!coltype)
-                        {
-                            coltype = "unknown";
-                        }
-                        std::string ccolumnType = Utils::toupper(std::string(coltype));
-                        m_columns.insert(std::pair<std::string, int32_t>(ccolumnName, v));
-                        m_types.push_back(ccolumnType);
+                        coltype = "unknown";
                     }
-
-                    column c;
-
-                    if (sqlite3_column_type(m_statement, v) == SQLITE_BLOB)
-                    {
-                        int len = sqlite3_column_bytes(m_statement, v);
-                        const char* buf = (const char*) sqlite3_column_blob(m_statement, v);
-                        c.blobLen = len;
-                        c.blobBuf.resize(len);
-                        std::copy(buf, buf+len, c.blobBuf.begin());
-                    } else if (sqlite3_column_type(m_statement, v) == SQLITE_NULL)
-                    {
-                        c.null = true;
-                    } else
-                    {
-                        char const* buf =
-                            reinterpret_cast<char const*>(sqlite3_column_text(m_statement, v));
-
-                        if (0 == buf)
-                        {
-                            c.null = true;
-                            buf = "";
-                        }
-                        c.data = buf;
-                    }
-
-
-                    r.push_back(c);
+                    std::string ccolumnType = Utils::toupper(std::string(coltype));
+                    m_columns.insert(std::pair<std::string, int32_t>(ccolumnName, v));
+                    m_types.push_back(ccolumnType);
                 }
-                m_data.push_back(r);
             }
-            else if (status == SQLITE_DONE)
-            {
-                // ok
-            }
-            else
-            {
-                error("sqlite3_step");
-            }
-        }
 
-        status = sqlite3_finalize(m_statement);
-        if (status != SQLITE_OK)
-        {
-            error("sqlite3_finalize");
+            m_data.push_back(*cur->get());
         }
-        
-        m_statement = NULL;
     }
 
     bool next()
@@ -331,75 +529,46 @@ public:
         return (int64_t)sqlite3_last_insert_rowid(m_session);
     }
 
+    // Runs the statement once for each row of values. The statement is
+    // prepared only once (and is cached for later calls with the same SQL),
+    // so batching many rows into one call is much cheaper than many calls.
     void insert(std::string const& statement, records const& rs)
     {
         int status;
-        
+
         records::size_type rows = rs.size();
 
-        assert(!m_statement);
-        status = sqlite3_prepare_v2(m_session,
-                                    statement.c_str(),
-                                    static_cast<int>(statement.size()),
-                                    &m_statement,
-                                    0);
-        if (status != SQLITE_OK)
-        {
-            error("sqlite3_prepare_v2 (insert)");
-        }
-        
+        HeldStatement stmt(*this, statement);
+
         m_log->get(LogLevel::Debug3) << "Inserting '" << statement << "'"<<
             std::endl;
 
         for (records::size_type r = 0; r < rows; ++r)
         {
-            int const totalPositions = static_cast<int>(rs[0].size());
-            for (int pos = 0; pos <= totalPositions-1; ++pos)
-            {
-                const column& c = rs[r][pos];
-                if (c.null)
-                {
-                    status = sqlite3_bind_null(m_statement, pos+1);
-                }
-                else if (c.blobLen != 0)
-                {
-                    status = sqlite3_bind_blob(m_statement, pos+1,
-                                               &(c.blobBuf.front()),
-                                               static_cast<int>(c.blobLen),
-                                               SQLITE_STATIC);
-                }
-                else
-                {
-                    status = sqlite3_bind_text(m_statement, pos+1,
-                                               c.data.c_str(),
-                                               static_cast<int>(c.data.length()),
-                                               SQLITE_STATIC);
-                }
-
-                if (SQLITE_OK != status)
-                {
-                    std::ostringstream oss;
-                    oss << "sqlite3_bind_*: row=" << r
-                        <<", position=" << pos;
-                    error(oss.str());
-                }
-            }
+            bindRow(stmt.get(), rs[r], r, SQLITE_STATIC);
 
-            status = sqlite3_step(m_statement);
+            status = sqlite3_step(stmt.get());
 
             if (status != SQLITE_DONE && status != SQLITE_ROW)
             {
                 error("sqlite3_step");
             }
+
+            sqlite3_reset(stmt.get());
         }
-        
-        status = sqlite3_finalize(m_statement);
-        if (status != SQLITE_OK)
-        {
-            error("sqlite3_finalize");
-        }
+    }
 
-        m_statement = NULL;        
+    // max number of idle prepared statements kept around
+    void setStatementCacheSize(std::size_t size)
+    {
+        m_stmtCacheSize = size;
+        trimStatementCache();
+    }
+
+    void dumpStats() const
+    {
+        e_stmtPrepares.dump();
+        e_stmtCacheHits.dump();
     }
 
     bool loadSpatialite(const std::string& module_name="")
@@ -509,6 +678,172 @@ private:
     std::map<std::string, int32_t> m_columns;
     std::vector<std::string> m_types;
 
+    // LRU list of idle prepared statements, most recently used first,
+    // and an index into it by SQL text
+    typedef std::list<std::pair<std::string, sqlite3_stmt*> > StatementList;
+    StatementList m_stmtLru;
+    std::map<std::string, StatementList::iterator> m_stmtIndex;
+    std::size_t m_stmtCacheSize;
+
+    Event e_stmtPrepares;
+    Event e_stmtCacheHits;
+
+    friend class SQLiteCursor;
+
+    // A statement from acquire(), released when this goes out of scope,
+    // so that a bind or step which throws doesn't lose it
+    class HeldStatement
+    {
+    public:
+        HeldStatement(SQLite& owner, std::string const& sql)
+            : m_owner(owner)
+            , m_sql(sql)
+            , m_statement(owner.acquire(sql))
+        {}
+
+        ~HeldStatement()
+        {
+            if (m_statement)
+            {
+                m_owner.release(m_sql, m_statement);
+            }
+        }
+
+        sqlite3_stmt* get() const { return m_statement; }
+
+        // for when something else will release it
+        void handOff() { m_statement = 0; }
+
+    private:
+        SQLite& m_owner;
+        std::string const& m_sql;
+        sqlite3_stmt* m_statement;
+
+        HeldStatement& operator=(const HeldStatement&); // not implemented
+        HeldStatement(const HeldStatement&); // not implemented
+    };
+
+    // Returns a prepared statement for the SQL, from the cache if possible.
+    // The statement is taken out of the cache until it is released, so two
+    // live users of the same SQL each get their own statement.
+    sqlite3_stmt* acquire(std::string const& sql)
+    {
+        if (!m_session)
+        {
+            throw pdal_error("Session not opened!");
+        }
+
+        auto iter = m_stmtIndex.find(sql);
+        if (iter != m_stmtIndex.end())
+        {
+            e_stmtCacheHits.start();
+            sqlite3_stmt* stmt = iter->second->second;
+            m_stmtLru.erase(iter->second);
+            m_stmtIndex.erase(iter);
+            e_stmtCacheHits.stop();
+            return stmt;
+        }
+
+        e_stmtPrepares.start();
+        sqlite3_stmt* stmt = 0;
+        const int status = sqlite3_prepare_v2(m_session,
+                                              sql.c_str(),
+                                              static_cast<int>(sql.size()),
+                                              &stmt,
+                                              0);
+        e_stmtPrepares.stop();
+        if (status != SQLITE_OK)
+        {
+            std::ostringstream oss;
+            oss << "sqlite3_prepare_v2" << std::endl
+                << "SQL: \"" << sql << "\"";
+            error(oss.str());
+        }
+
+        return stmt;
+    }
+
+    // Resets the statement and returns it to the cache, evicting the least
+    // recently used statements if the cache is full.
+    void release(std::string const& sql, sqlite3_stmt* stmt)
+    {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        if (m_stmtIndex.count(sql) || m_stmtCacheSize == 0)
+        {
+            // already have an idle one of these
+            sqlite3_finalize(stmt);
+            return;
+        }
+
+        m_stmtLru.push_front(std::make_pair(sql, stmt));
+        m_stmtIndex[sql] = m_stmtLru.begin();
+
+        trimStatementCache();
+    }
+
+    void trimStatementCache()
+    {
+        while (m_stmtLru.size() > m_stmtCacheSize)
+        {
+            m_stmtIndex.erase(m_stmtLru.back().first);
+            sqlite3_finalize(m_stmtLru.back().second);
+            m_stmtLru.pop_back();
+        }
+    }
+
+    void bindRow(sqlite3_stmt* stmt, row const& r, records::size_type rowNum,
+                 sqlite3_destructor_type lifetime)
+    {
+        int status;
+
+        int const totalPositions = static_cast<int>(r.size());
+        for (int pos = 0; pos <= totalPositions-1; ++pos)
+        {
+            const column& c = r[pos];
+            switch (c.type)
+            {
+                case SQLITE_INTEGER:
+                    status = sqlite3_bind_int64(stmt, pos+1, c.integer);
+                    break;
+                case SQLITE_FLOAT:
+                    status = sqlite3_bind_double(stmt, pos+1, c.real);
+                    break;
+                case SQLITE_BLOB:
+                    if (c.blobLen == 0)
+                    {
+                        status = sqlite3_bind_zeroblob(stmt, pos+1, 0);
+                    }
+                    else
+                    {
+                        status = sqlite3_bind_blob(stmt, pos+1,
+                                                   c.getBlobData(),
+                                                   static_cast<int>(c.blobLen),
+                                                   lifetime);
+                    }
+                    break;
+                case SQLITE_TEXT:
+                    status = sqlite3_bind_text(stmt, pos+1,
+                                               c.data.c_str(),
+                                               static_cast<int>(c.data.length()),
+                                               lifetime);
+                    break;
+                default:
+                    status = sqlite3_bind_null(stmt, pos+1);
+                    break;
+            }
+
+            if (SQLITE_OK != status)
+            {
+                std::ostringstream oss;
+                oss << "sqlite3_bind_*: row=" << rowNum
+                    <<", position=" << pos;
+                error(oss.str());
+            }
+        }
+    }
+
     void error(std::string const& userMssg)
     {
         char const* sqlMssg = sqlite3_errmsg(m_session);
@@ -520,4 +855,10 @@ private:
     }
 };
 
+inline SQLiteCursor::~SQLiteCursor()
+{
+    m_owner.release(m_sql, m_statement);
+}
+
+
 } // namepsace rialto
@@ -0,0 +1,224 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "TileCache.hpp"
+
+namespace rialto
+{
+
+namespace
+{
+
+std::mutex s_cachesMutex;
+std::map<std::string, std::weak_ptr<TileCache>> s_caches; // by absolute path
+
+} // anonymous namespace
+
+
+TileCache::TileCache(uint64_t maxBytes) :
+    m_maxBytes(maxBytes),
+    m_bytes(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{}
+
+
+std::shared_ptr<TileCache> TileCache::forFile(const std::string& filename,
+                                              uint64_t maxBytes)
+{
+    const std::string path = FileUtils::toAbsolutePath(filename);
+
+    std::lock_guard<std::mutex> lock(s_cachesMutex);
+
+    std::shared_ptr<TileCache> cache = s_caches[path].lock();
+    if (cache)
+    {
+        if (maxBytes > cache->getMaxBytes())
+        {
+            cache->setMaxBytes(maxBytes);
+        }
+    }
+    else
+    {
+        cache = std::make_shared<TileCache>(maxBytes);
+        s_caches[path] = cache;
+    }
+
+    return cache;
+}
+
+
+void TileCache::invalidate(const std::string& filename)
+{
+    const std::string path = FileUtils::toAbsolutePath(filename);
+
+    std::lock_guard<std::mutex> lock(s_cachesMutex);
+
+    auto iter = s_caches.find(path);
+    if (iter == s_caches.end())
+    {
+        return;
+    }
+
+    std::shared_ptr<TileCache> cache = iter->second.lock();
+    if (cache)
+    {
+        cache->clear();
+    }
+    else
+    {
+        s_caches.erase(iter);
+    }
+}
+
+
+TileCache::Points TileCache::get(const std::string& dataset,
+                                 uint32_t level, uint32_t column, uint32_t row)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto iter = m_index.find(Key(dataset, level, column, row));
+    if (iter == m_index.end())
+    {
+        ++m_misses;
+        return Points();
+    }
+
+    ++m_hits;
+    m_lru.splice(m_lru.begin(), m_lru, iter->second);
+    return iter->second->second;
+}
+
+
+void TileCache::put(const std::string& dataset,
+                    uint32_t level, uint32_t column, uint32_t row,
+                    const Points& points)
+{
+    assert(points);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (points->size() > m_maxBytes)
+    {
+        return;
+    }
+
+    const Key key(dataset, level, column, row);
+    auto iter = m_index.find(key);
+    if (iter != m_index.end())
+    {
+        // another reader got here first
+        m_bytes -= iter->second->second->size();
+        m_lru.erase(iter->second);
+        m_index.erase(iter);
+    }
+
+    m_lru.push_front(std::make_pair(key, points));
+    m_index[key] = m_lru.begin();
+    m_bytes += points->size();
+
+    evict();
+}
+
+
+void TileCache::evict()
+{
+    while (m_bytes > m_maxBytes)
+    {
+        assert(!m_lru.empty());
+        const auto& last = m_lru.back();
+        m_bytes -= last.second->size();
+        m_index.erase(last.first);
+        m_lru.pop_back();
+        ++m_evictions;
+    }
+}
+
+
+void TileCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_lru.clear();
+    m_index.clear();
+    m_bytes = 0;
+}
+
+
+void TileCache::setMaxBytes(uint64_t maxBytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_maxBytes = maxBytes;
+    evict();
+}
+
+
+uint64_t TileCache::getMaxBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_maxBytes;
+}
+
+
+uint64_t TileCache::getBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+}
+
+
+uint64_t TileCache::getHits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+
+uint64_t TileCache::getMisses() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+
+uint64_t TileCache::getEvictions() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_evictions;
+}
+
+
+} // namespace rialto
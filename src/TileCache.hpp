@@ -0,0 +1,105 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#pragma once
+
+#include <pdal/pdal.hpp>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace rialto
+{
+    using namespace pdal;
+
+
+// Decoded tiles, kept up to a byte budget, dropping the least recently
+// used ones first. One cache is shared by all the readers of a file in
+// the process, so all its methods are thread-safe.
+class TileCache
+{
+public:
+    // a tile's points, packed per all the dims of its tile set
+    typedef std::shared_ptr<const std::vector<char>> Points;
+
+    TileCache(uint64_t maxBytes);
+
+    // the file's cache, made the first time it is asked for; it grows to
+    // the largest budget asked for
+    static std::shared_ptr<TileCache> forFile(const std::string& filename,
+                                              uint64_t maxBytes);
+
+    // empties the file's cache, if it has one: call after writing to it
+    static void invalidate(const std::string& filename);
+
+    // NULL if not cached
+    Points get(const std::string& dataset, uint32_t level, uint32_t column, uint32_t row);
+
+    // tiles bigger than the whole budget are not kept
+    void put(const std::string& dataset, uint32_t level, uint32_t column, uint32_t row,
+             const Points& points);
+
+    void clear();
+    void setMaxBytes(uint64_t maxBytes);
+
+    uint64_t getMaxBytes() const;
+    uint64_t getBytes() const;
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+    uint64_t getEvictions() const;
+
+private:
+    typedef std::tuple<std::string, uint32_t, uint32_t, uint32_t> Key;
+    typedef std::list<std::pair<Key, Points>> Lru; // most recent first
+
+    void evict(); // down to the budget; lock held
+
+    mutable std::mutex m_mutex;
+    Lru m_lru;
+    std::map<Key, Lru::iterator> m_index;
+    uint64_t m_maxBytes;
+    uint64_t m_bytes;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
+
+    TileCache& operator=(const TileCache&); // not implemented
+    TileCache(const TileCache&); // not implemented
+};
+
+
+} // namespace rialto
@@ -0,0 +1,154 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "TileCodec.hpp"
+
+#include <limits>
+
+#include <lz4.h>
+#include <zstd.h>
+
+namespace rialto
+{
+
+
+void TileCodec::compress(const GpkgCodec& codec, const char* src, size_t srcSize,
+                         std::vector<char>& blob)
+{
+    if (srcSize > (std::numeric_limits<uint32_t>::max)())
+    {
+        throw pdal_error("tile is too big to compress");
+    }
+    const uint32_t size = (uint32_t)srcSize;
+
+    size_t bound = 0;
+    switch (codec.getCompression())
+    {
+        case GpkgCompressionZstd:
+            bound = ZSTD_compressBound(srcSize);
+            break;
+        case GpkgCompressionLz4:
+            bound = LZ4_compressBound((int)srcSize);
+            break;
+        default:
+            throw pdal_error("not a byte codec: " + codec.getName());
+    }
+
+    blob.resize(sizeof(size) + bound);
+    for (size_t i=0; i<sizeof(size); i++)
+    {
+        blob[i] = (char)(size >> (8 * i));
+    }
+    char* dest = blob.data() + sizeof(size);
+
+    size_t n = 0;
+    if (codec.getCompression() == GpkgCompressionZstd)
+    {
+        n = ZSTD_compress(dest, bound, src, srcSize, codec.getLevel());
+        if (ZSTD_isError(n))
+        {
+            throw pdal_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+        }
+    }
+    else
+    {
+        const int r = LZ4_compress_default(src, dest, (int)srcSize, (int)bound);
+        if (r <= 0)
+        {
+            throw pdal_error("lz4: compression failed");
+        }
+        n = r;
+    }
+
+    blob.resize(sizeof(size) + n);
+}
+
+
+void TileCodec::decompress(const GpkgCodec& codec, const char* blob, size_t blobSize,
+                           size_t expectedSize, bool exact, std::vector<char>& dest)
+{
+    uint32_t size;
+    if (blobSize < sizeof(size))
+    {
+        throw pdal_error("compressed tile data is truncated");
+    }
+    size = 0;
+    for (size_t i=0; i<sizeof(size); i++)
+    {
+        size |= (uint32_t)(unsigned char)blob[i] << (8 * i);
+    }
+    blob += sizeof(size);
+    blobSize -= sizeof(size);
+
+    if (exact ? size != expectedSize : size > expectedSize)
+    {
+        throw pdal_error("compressed tile data has the wrong size for its points");
+    }
+
+    dest.resize(size);
+
+    size_t n = 0;
+    switch (codec.getCompression())
+    {
+        case GpkgCompressionZstd:
+        {
+            n = ZSTD_decompress(dest.data(), size, blob, blobSize);
+            if (ZSTD_isError(n))
+            {
+                throw pdal_error(std::string("zstd: ") + ZSTD_getErrorName(n));
+            }
+            break;
+        }
+        case GpkgCompressionLz4:
+        {
+            const int r = LZ4_decompress_safe(blob, dest.data(), (int)blobSize, (int)size);
+            if (r < 0)
+            {
+                throw pdal_error("lz4: compressed tile data is corrupt");
+            }
+            n = r;
+            break;
+        }
+        default:
+            throw pdal_error("not a byte codec: " + codec.getName());
+    }
+
+    if (n != size)
+    {
+        throw pdal_error("compressed tile data has the wrong size");
+    }
+}
+
+
+} // namespace rialto
@@ -194,6 +194,82 @@ public:
         return QuadNE;
     }
 
+    // which quadrant of its parent a tile is
+    static Quad getQuadOfChild(uint32_t childCol, uint32_t childRow)
+    {
+        const bool east = childCol & 1;
+        const bool south = childRow & 1;
+        if (south)
+        {
+            return east ? QuadSE : QuadSW;
+        }
+        return east ? QuadNE : QuadNW;
+    }
+
+    // the bit for a quadrant in its parent's child mask
+    static uint32_t getMaskBit(Quad q)
+    {
+        switch (q)
+        {
+            case QuadSW: return 1;
+            case QuadSE: return 2;
+            case QuadNE: return 4;
+            case QuadNW: return 8;
+        }
+        assert(0);
+        return 0;
+    }
+
+    // The Morton (Z-order) key of a tile: the number of its level 0
+    // ancestor, followed by the bits of its column and row interleaved,
+    // one pair per level. The key of a tile's parent is its key shifted
+    // right by two, so all the descendants of a tile, at any level, share
+    // the tile's key as a prefix, and sorting by key puts them together.
+    //
+    // The key needs 2*level bits plus enough for the level 0 tile number,
+    // which must fit in 64.
+    uint64_t getMortonKey(uint32_t col, uint32_t row, uint32_t level) const
+    {
+        const uint32_t mask = ipow2(level) - 1;
+        const uint64_t root = (uint64_t)(col >> level) * m_nr0 + (row >> level);
+        return (root << (2 * level)) | interleave(col & mask, row & mask);
+    }
+
+    // the number of bits needed to hold the keys of the tiles at a level
+    uint32_t getMortonKeyBits(uint32_t level) const
+    {
+        const uint64_t numRoots = (uint64_t)m_nc0 * m_nr0;
+        uint32_t numBits = 2 * level;
+        while ((((uint64_t)1) << (numBits - 2 * level)) < numRoots)
+        {
+            ++numBits;
+        }
+        return numBits;
+    }
+
+    void getTileOfMortonKey(uint64_t key, uint32_t level,
+                            uint32_t& col, uint32_t& row) const
+    {
+        const uint64_t root = key >> (2 * level);
+        const uint64_t bits = key & ((((uint64_t)1) << (2 * level)) - 1);
+        uint32_t c, r;
+        deinterleave(bits, c, r);
+        col = ((uint32_t)(root / m_nr0) << level) | c;
+        row = ((uint32_t)(root % m_nr0) << level) | r;
+    }
+
+    // bit i of col goes to bit 2i+1, bit i of row to bit 2i
+    static uint64_t interleave(uint32_t col, uint32_t row)
+    {
+        return (spread(col) << 1) | spread(row);
+    }
+
+    static void deinterleave(uint64_t v, uint32_t& col, uint32_t& row)
+    {
+        col = unspread(v >> 1);
+        row = unspread(v);
+    }
+
     // return true iff rect1 completely contains rect2
     static bool rectContainsRect(double minx1, double miny1,
                                  double maxx1, double maxy1,
@@ -213,6 +289,30 @@ private:
       return 1u << n;
     }
 
+    // puts bit i of v at bit 2i
+    static uint64_t spread(uint32_t v)
+    {
+        uint64_t x = v;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+        x = (x | (x << 8))  & 0x00FF00FF00FF00FFull;
+        x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x << 2))  & 0x3333333333333333ull;
+        x = (x | (x << 1))  & 0x5555555555555555ull;
+        return x;
+    }
+
+    // the inverse of spread(), ignoring the odd bits
+    static uint32_t unspread(uint64_t x)
+    {
+        x &= 0x5555555555555555ull;
+        x = (x | (x >> 1))  & 0x3333333333333333ull;
+        x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x >> 4))  & 0x00FF00FF00FF00FFull;
+        x = (x | (x >> 8))  & 0x0000FFFF0000FFFFull;
+        x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+        return (uint32_t)x;
+    }
+
     static bool contains(double minx, double miny,
                          double maxx, double maxy,
                          double x, double y)
@@ -36,10 +36,61 @@
 #include "TileMath.hpp"
 #include <rialto/Event.hpp>
 
+#include <algorithm>
+#include <exception>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
 namespace rialto
 {
 
 
+// Runs fn(i) for each i in [0, numItems) on numThreads threads. Items are
+// handed out in order, one at a time, to whichever thread is free next. If
+// any fn throws, the (first) exception is rethrown here once all threads
+// have stopped.
+template <typename F>
+static void parallelFor(uint32_t numThreads, size_t numItems, F fn)
+{
+    std::atomic<size_t> next(0);
+    std::exception_ptr err;
+    std::mutex errMutex;
+
+    auto worker = [&]()
+    {
+        try
+        {
+            for (size_t i = next++; i < numItems; i = next++)
+            {
+                fn(i);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errMutex);
+            if (!err) err = std::current_exception();
+            next = numItems;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t=0; t<numThreads; t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    for (auto& t: threads)
+    {
+        t.join();
+    }
+
+    if (err)
+    {
+        std::rethrow_exception(err);
+    }
+}
+
+
 WritableTileSet::WritableTileSet(
         uint32_t maxLevel,
         double minx, double miny,
@@ -88,63 +139,491 @@ WritableTileSet::~WritableTileSet()
 }
 
 
-void WritableTileSet::build(PointViewPtr sourceView, PointViewSet* outputSet)
+void WritableTileSet::build(PointViewPtr sourceView, PointViewSet* outputSet,
+                            uint32_t numThreads)
 {
     m_sourceView = sourceView;
     m_outputSet = outputSet;
 
+    if (numThreads > 1 && m_maxLevel > 0)
+    {
+        buildParallel(numThreads);
+    }
+    else
+    {
+        buildSerial();
+    }
+
+    setMasks();
+}
+
+
+void WritableTileSet::setMasks()
+{
     const uint32_t numCols = m_tmm->numColsAtLevel(0);
     const uint32_t numRows = m_tmm->numRowsAtLevel(0);
 
-    const uint32_t numPoints = sourceView->size();
+    for (uint32_t c=0; c<numCols; c++)
+    {
+        for (uint32_t r=0; r<numRows; r++)
+        {
+            WritableTile* tile = m_roots[c][r];
+            tile->setMask();
+        }
+    }
+}
+
+
+WritableTile* WritableTileSet::getRoot(double x, double y) const
+{
+    assert(m_tmm->matrixContains(x,y));
+
+    const uint32_t numCols = m_tmm->numColsAtLevel(0);
+    const uint32_t numRows = m_tmm->numRowsAtLevel(0);
+
+    // TODO: we could optimize this, since the tile bounds are constant
+    // throughout the points loop
+    for (uint32_t c=0; c<numCols; c++)
+    {
+        for (uint32_t r=0; r<numRows; r++)
+        {
+            if (m_tmm->tileContains(c, r, 0, x, y))
+            {
+                return m_roots[c][r];
+            }
+        }
+    }
+
+    assert(0);
+    return NULL;
+}
+
+
+void WritableTileSet::buildSerial()
+{
+    const uint32_t numPoints = m_sourceView->size();
     HeartBeat hb(numPoints, 0, 50);
     
     for (PointId idx = 0; idx < numPoints; ++idx)
     {
-        const double x = sourceView->getFieldAs<double>(Dimension::Id::X, idx);
-        const double y = sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
+        const double x = m_sourceView->getFieldAs<double>(Dimension::Id::X, idx);
+        const double y = m_sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
 
-        assert(m_tmm->matrixContains(x,y));
+        WritableTile* tile = getRoot(x, y);
+        tile->add(m_sourceView, idx, x, y);
+        
+        hb.beat();
+    }
+}
 
-        // TODO: we could optimize this, since the tile bounds are constant
-        // throughout the points loop
-        bool added = false;
-        for (uint32_t c=0; c<numCols; c++)
+
+// Pick the split level for a parallel build: the shallowest level at which
+// the points fall into enough tiles to keep all the threads busy. We only
+// look at a sample of the points, since this is just a heuristic.
+uint32_t WritableTileSet::getSplitLevel(uint32_t numThreads) const
+{
+    const uint32_t numPoints = m_sourceView->size();
+    const uint32_t stride = std::max(numPoints / (64 * 1024), 1u);
+    const size_t wanted = 4 * numThreads;
+
+    for (uint32_t level=1; level<m_maxLevel; level++)
+    {
+        std::set<std::pair<uint32_t, uint32_t>> tiles;
+        for (PointId idx = 0; idx < numPoints; idx += stride)
         {
-            for (uint32_t r=0; r<numRows; r++)
+            const double x = m_sourceView->getFieldAs<double>(Dimension::Id::X, idx);
+            const double y = m_sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
+            uint32_t c, r;
+            m_tmm->getTileOfPoint(x, y, level, c, r);
+            tiles.insert(std::make_pair(c, r));
+        }
+        if (tiles.size() >= wanted)
+        {
+            return level;
+        }
+    }
+
+    return m_maxLevel;
+}
+
+
+// The parallel build works in three steps.
+//
+// 1. In parallel, find the tile at the split level S that each point
+//    falls in, by making the same descent that add() would.
+//
+// 2. Serially, put the points into one bucket per level-S tile, and build
+//    the tree above level S. Only two kinds of points matter above S: those
+//    that are kept by the decimation at some level < S, and the first point
+//    of each bucket, which is the one that creates the tiles on its path.
+//    Any other point only passes through tiles that already exist.
+//
+// 3. In parallel, build each level-S subtree from its bucket. The subtrees
+//    are disjoint, and each bucket is in point order, so each tile gets the
+//    same points in the same order as with a serial build. The buckets are
+//    handed out largest first, to balance the load.
+//
+// Finally, the tiles list is sorted back into the order a serial build
+// would have created the tiles in.
+void WritableTileSet::buildParallel(uint32_t numThreads)
+{
+    const uint32_t numPoints = m_sourceView->size();
+    const uint32_t splitLevel = getSplitLevel(numThreads);
+
+    m_log->get(LogLevel::Debug) << "building tiles with " << numThreads
+        << " threads, split at level " << splitLevel << std::endl;
+
+    // step 1
+    std::vector<uint64_t> keys(numPoints);
+    {
+        static const uint32_t chunkSize = 64 * 1024;
+        const size_t numChunks = (numPoints + chunkSize - 1) / chunkSize;
+
+        parallelFor(numThreads, numChunks, [&](size_t chunk)
+        {
+            const PointId first = chunk * chunkSize;
+            const PointId last = std::min<PointId>(first + chunkSize, numPoints);
+            for (PointId idx = first; idx < last; ++idx)
             {
-                if (m_tmm->tileContains(c, r, 0, x, y))
+                const double x = m_sourceView->getFieldAs<double>(Dimension::Id::X, idx);
+                const double y = m_sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
+
+                const WritableTile* root = getRoot(x, y);
+                uint32_t c = root->getColumn();
+                uint32_t r = root->getRow();
+                for (uint32_t level=0; level<splitLevel; level++)
                 {
-                  WritableTile* tile = m_roots[c][r];
-                    tile->add(m_sourceView, idx, x, y);
-                    added = true;
-                    break;
+                    const TileMath::Quad q = m_tmm->getQuadrant(c, r, level, x, y);
+                    uint32_t childCol, childRow;
+                    m_tmm->getChildOfTile(c, r, q, childCol, childRow);
+                    c = childCol;
+                    r = childRow;
                 }
+                keys[idx] = ((uint64_t)c << 32) | r;
             }
-            if (added)
+        });
+    }
+
+    // step 2
+    struct Bucket
+    {
+        Bucket() : tile(NULL) {}
+        WritableTile* tile;
+        std::vector<uint32_t> points;
+    };
+    std::vector<Bucket> buckets;
+    {
+        const uint64_t upperSkip = std::pow(4, m_maxLevel - splitLevel + 1);
+
+        std::unordered_map<uint64_t, size_t> bucketOfKey;
+        uint64_t lastKey = 0;
+        size_t lastBucket = (size_t)-1;
+
+        for (PointId idx = 0; idx < numPoints; ++idx)
+        {
+            const uint64_t key = keys[idx];
+
+            bool isFirst = false;
+            if (lastBucket == (size_t)-1 || key != lastKey)
+            {
+                auto iter = bucketOfKey.find(key);
+                if (iter == bucketOfKey.end())
+                {
+                    lastBucket = buckets.size();
+                    bucketOfKey[key] = lastBucket;
+                    buckets.push_back(Bucket());
+                    isFirst = true;
+                }
+                else
+                {
+                    lastBucket = iter->second;
+                }
+                lastKey = key;
+            }
+
+            Bucket& bucket = buckets[lastBucket];
+            bucket.points.push_back(idx);
+
+            if (isFirst || idx % upperSkip == 0)
             {
-                break;
+                const double x = m_sourceView->getFieldAs<double>(Dimension::Id::X, idx);
+                const double y = m_sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
+                WritableTile* tile = getRoot(x, y)->descend(m_sourceView, idx, x, y, splitLevel);
+                assert(!bucket.tile || bucket.tile == tile);
+                bucket.tile = tile;
             }
         }
-        assert(added);
-        
-        hb.beat();
     }
+    keys.clear();
+    keys.shrink_to_fit();
 
-    for (uint32_t c=0; c<numCols; c++)
+    std::sort(buckets.begin(), buckets.end(), [](const Bucket& a, const Bucket& b)
+        { return a.points.size() > b.points.size(); });
+
+    // step 3
     {
-        for (uint32_t r=0; r<numRows; r++)
+        HeartBeat hb(buckets.size(), 0, 50);
+        std::mutex hbMutex;
+
+        parallelFor(numThreads, buckets.size(), [&](size_t i)
         {
-            WritableTile* tile = m_roots[c][r];
-            tile->setMask();
+            const Bucket& bucket = buckets[i];
+            for (uint32_t idx: bucket.points)
+            {
+                const double x = m_sourceView->getFieldAs<double>(Dimension::Id::X, idx);
+                const double y = m_sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
+                bucket.tile->add(m_sourceView, idx, x, y);
+            }
+
+            std::lock_guard<std::mutex> lock(hbMutex);
+            hb.beat();
+        });
+    }
+
+    sortTiles();
+}
+
+
+// a serial build creates the roots first, and after that each point
+// creates the missing tiles along its path, top down
+void WritableTileSet::sortTiles()
+{
+    std::stable_sort(m_allTiles.begin(), m_allTiles.end(),
+        [](const WritableTile* a, const WritableTile* b)
+        {
+            if (a->getFirstPoint() != b->getFirstPoint())
+                return a->getFirstPoint() < b->getFirstPoint();
+            return a->getLevel() < b->getLevel();
+        });
+}
+
+
+// Stable LSD radix sort, 8 bits at a time. Passes in which all the keys
+// have the same digit are skipped.
+void radixSort(std::vector<KeyedPoint>& points, uint32_t numBits)
+{
+    std::vector<KeyedPoint> tmp(points.size());
+
+    for (uint32_t shift=0; shift<numBits; shift+=8)
+    {
+        size_t counts[257] = {0};
+        for (const KeyedPoint& p: points)
+        {
+            ++counts[((p.key >> shift) & 0xff) + 1];
+        }
+        if (std::find(counts + 1, counts + 257, points.size()) != counts + 257)
+        {
+            continue;
+        }
+
+        for (int i=0; i<256; i++)
+        {
+            counts[i+1] += counts[i];
+        }
+        for (const KeyedPoint& p: points)
+        {
+            tmp[counts[(p.key >> shift) & 0xff]++] = p;
+        }
+        points.swap(tmp);
+    }
+}
+
+
+void getParentTiles(const std::vector<uint64_t>& childKeys, std::vector<KeyedTile>& parents)
+{
+    parents.clear();
+
+    for (uint32_t i=0; i<childKeys.size(); )
+    {
+        KeyedTile parent = { childKeys[i] >> 2, 0, i, i };
+        for (; parent.end < childKeys.size() && (childKeys[parent.end] >> 2) == parent.key;
+             ++parent.end)
+        {
+            const uint32_t bits = childKeys[parent.end] & 0x3;
+            parent.mask |= TileMath::getMaskBit(TileMath::getQuadOfChild(bits >> 1, bits & 0x1));
         }
+        parents.push_back(parent);
+        i = parent.end;
     }
 }
 
 
+// The tiles are found bottom up, from the sorted keys, and then made top
+// down, each under its parent. A tile is created by the lowest numbered
+// point below it, as in a serial build, and the tiles are put in the
+// order that build would have made them.
+//
+// The max level tiles get all their points, in order, since the sort is
+// stable. The upper levels only keep every fourth point (or fewer): at
+// each one, those points are sorted again, by their keys there, and
+// handed out to the tiles in the same way.
+void WritableTileSet::buildMorton(PointViewPtr sourceView, PointViewSet* outputSet,
+                                  uint32_t numThreads)
+{
+    m_sourceView = sourceView;
+    m_outputSet = outputSet;
+
+    const uint32_t numPoints = sourceView->size();
+    const uint32_t maxCol = m_tmm->numColsAtLevel(m_maxLevel) - 1;
+    const uint32_t maxRow = m_tmm->numRowsAtLevel(m_maxLevel) - 1;
+
+    const uint32_t numBits = m_tmm->getMortonKeyBits(m_maxLevel);
+    if (numBits > 64)
+    {
+        throw pdal_error("WritableTileSet: max level too large for Morton keys");
+    }
+
+    auto keyOf = [&](PointId idx)
+    {
+        const double x = m_sourceView->getFieldAs<double>(Dimension::Id::X, idx);
+        const double y = m_sourceView->getFieldAs<double>(Dimension::Id::Y, idx);
+        assert(m_tmm->matrixContains(x,y));
+
+        uint32_t c, r;
+        m_tmm->getTileOfPoint(x, y, m_maxLevel, c, r);
+        // guard against rounding at the far edges
+        c = std::min(c, maxCol);
+        r = std::min(r, maxRow);
+        return m_tmm->getMortonKey(c, r, m_maxLevel);
+    };
+
+    HeartBeat hb(numPoints, 0, 50);
+
+    std::vector<KeyedPoint> points(numPoints);
+    {
+        static const uint32_t chunkSize = 64 * 1024;
+        const size_t numChunks = (numPoints + chunkSize - 1) / chunkSize;
+
+        parallelFor(numThreads, numChunks, [&](size_t chunk)
+        {
+            const PointId first = chunk * chunkSize;
+            const PointId last = std::min<PointId>(first + chunkSize, numPoints);
+            for (PointId idx = first; idx < last; ++idx)
+            {
+                points[idx].key = keyOf(idx);
+                points[idx].idx = idx;
+            }
+        });
+    }
+
+    // the points for the levels above the max, in order
+    std::vector<KeyedPoint> upper;
+    for (uint32_t idx=0; m_maxLevel > 0 && idx < numPoints; idx += 4)
+    {
+        upper.push_back(points[idx]);
+    }
+
+    radixSort(points, numBits);
+
+    // the tiles of each level, bottom up, and the point each is created by;
+    // at the max level, each one's [begin, end) is its run of points
+    std::vector<std::vector<KeyedTile>> tiles(m_maxLevel + 1);
+    std::vector<std::vector<PointId>> firstPoints(m_maxLevel + 1);
+    for (uint32_t i=0; i<numPoints; )
+    {
+        KeyedTile tile = { points[i].key, 0, i, i };
+        while (tile.end < numPoints && points[tile.end].key == tile.key)
+        {
+            ++tile.end;
+        }
+        tiles[m_maxLevel].push_back(tile);
+        firstPoints[m_maxLevel].push_back(points[i].idx);
+        i = tile.end;
+    }
+
+    std::vector<uint64_t> keys;
+    for (uint32_t level = m_maxLevel; level-- > 0; )
+    {
+        keys.clear();
+        for (const KeyedTile& child: tiles[level + 1])
+        {
+            keys.push_back(child.key);
+        }
+        getParentTiles(keys, tiles[level]);
+
+        const std::vector<PointId>& below = firstPoints[level + 1];
+        for (const KeyedTile& tile: tiles[level])
+        {
+            firstPoints[level].push_back(
+                *std::min_element(below.begin() + tile.begin, below.begin() + tile.end));
+        }
+    }
+    keys.clear();
+    keys.shrink_to_fit();
+
+    std::vector<std::vector<WritableTile*>> made(m_maxLevel + 1);
+    const uint32_t numRows = m_tmm->numRowsAtLevel(0);
+    for (const KeyedTile& tile: tiles[0])
+    {
+        WritableTile* root = m_roots[tile.key / numRows][tile.key % numRows];
+        root->setMask(tile.mask);
+        made[0].push_back(root);
+    }
+    for (uint32_t level=1; level<=m_maxLevel; level++)
+    {
+        const std::vector<KeyedTile>& parents = tiles[level - 1];
+        for (size_t p=0; p<parents.size(); p++)
+        {
+            for (uint32_t c=parents[p].begin; c<parents[p].end; c++)
+            {
+                const KeyedTile& tile = tiles[level][c];
+                const uint32_t bits = tile.key & 0x3;
+                WritableTile* child = made[level - 1][p]->getChild(
+                    TileMath::getQuadOfChild(bits >> 1, bits & 0x1), firstPoints[level][c]);
+                child->setMask(tile.mask);
+                made[level].push_back(child);
+            }
+        }
+    }
+    firstPoints.clear();
+
+    for (size_t t=0; t<made[m_maxLevel].size(); t++)
+    {
+        const KeyedTile& tile = tiles[m_maxLevel][t];
+        for (uint32_t i=tile.begin; i<tile.end; i++)
+        {
+            made[m_maxLevel][t]->addHere(m_sourceView, points[i].idx);
+            hb.beat();
+        }
+    }
+    points.clear();
+    points.shrink_to_fit();
+
+    std::vector<KeyedPoint> here;
+    for (uint32_t level = m_maxLevel; level-- > 0; )
+    {
+        const uint32_t shift = 2 * (m_maxLevel - level);
+        const uint64_t skip = ((uint64_t)1) << shift;
+
+        upper.erase(std::remove_if(upper.begin(), upper.end(),
+            [&](const KeyedPoint& p) { return p.idx % skip != 0; }), upper.end());
+
+        here = upper;
+        for (KeyedPoint& p: here)
+        {
+            p.key >>= shift;
+        }
+        radixSort(here, numBits - shift);
+
+        size_t t = 0;
+        for (const KeyedPoint& p: here)
+        {
+            while (tiles[level][t].key != p.key)
+            {
+                ++t;
+            }
+            made[level][t]->addHere(m_sourceView, p.idx);
+        }
+    }
+
+    sortTiles();
+}
+
 
 PointViewPtr WritableTileSet::createPointView()
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
     PointViewPtr p = m_sourceView->makeNew();
     m_outputSet->insert(p);
 
@@ -152,10 +631,19 @@ PointViewPtr WritableTileSet::createPointView()
 }
 
 
+void WritableTileSet::addTile(WritableTile* tile)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_allTiles.push_back(tile);
+}
+
+
 WritableTile::WritableTile(WritableTileSet& tileSet,
         uint32_t level,
         uint32_t column,
-        uint32_t row) :
+        uint32_t row,
+        PointId firstPoint) :
     m_pointView(NULL),
     m_level(level),
     m_column(column),
@@ -163,7 +651,8 @@ WritableTile::WritableTile(WritableTileSet& tileSet,
     m_mask(0),
     m_tileSet(tileSet),
     m_children(NULL),
-    m_skip(0)
+    m_skip(0),
+    m_firstPoint(firstPoint)
 {
     m_id = tileSet.newTileId();
 
@@ -241,6 +730,31 @@ void WritableTile::setMask()
 //
 // If we're not a leaf tile, add the node to one of our child tiles.
 void WritableTile::add(PointViewPtr sourcePointView, PointId pointNumber, double x, double y)
+{
+    addHere(sourcePointView, pointNumber);
+
+    if (m_level == m_tileSet.getMaxLevel()) return;
+
+    WritableTile* child = getChild(pointNumber, x, y);
+    child->add(sourcePointView, pointNumber, x, y);
+}
+
+
+WritableTile* WritableTile::descend(PointViewPtr sourcePointView, PointId pointNumber,
+                                    double x, double y, uint32_t level)
+{
+    assert(level <= m_tileSet.getMaxLevel());
+
+    if (m_level == level) return this;
+
+    addHere(sourcePointView, pointNumber);
+
+    WritableTile* child = getChild(pointNumber, x, y);
+    return child->descend(sourcePointView, pointNumber, x, y, level);
+}
+
+
+void WritableTile::addHere(PointViewPtr sourcePointView, PointId pointNumber)
 {
     //log()->get(LogLevel::Debug5) << "-- -- " << pointNumber
         //<< " " << m_skip
@@ -256,8 +770,25 @@ void WritableTile::add(PointViewPtr sourcePointView, PointId pointNumber, double
 
         m_pointView->appendPoint(*sourcePointView, pointNumber);
     }
+}
 
-    if (m_level == m_tileSet.getMaxLevel()) return;
+
+// returns the child the point falls in, creating it if need be
+WritableTile* WritableTile::getChild(PointId pointNumber, double x, double y)
+{
+    //log()->get(LogLevel::Debug5) << "which=" << q << "\n";
+
+    const TileMath& tmm = m_tileSet.tmm();
+    const TileMath::Quad q = tmm.getQuadrant(m_column, m_row, m_level, x, y);
+
+    return getChild(q, pointNumber);
+}
+
+
+WritableTile* WritableTile::getChild(uint32_t quad, PointId firstPoint)
+{
+    assert(quad < 4);
+    assert(m_level < m_tileSet.getMaxLevel());
 
     if (!m_children)
     {
@@ -268,20 +799,17 @@ void WritableTile::add(PointViewPtr sourcePointView, PointId pointNumber, double
         m_children[3] = NULL;
     }
 
-    //log()->get(LogLevel::Debug5) << "which=" << q << "\n";
-
-    const TileMath& tmm = m_tileSet.tmm();
-    const TileMath::Quad q = tmm.getQuadrant(m_column, m_row, m_level, x, y);
-
-    if (!m_children[q])
+    if (!m_children[quad])
     {
         uint32_t childCol, childRow;
-        tmm.getChildOfTile(m_column, m_row, q, childCol, childRow);
-        m_children[q] = new WritableTile(m_tileSet, m_level+1, childCol, childRow);
-        m_tileSet.getTilesRef().push_back(m_children[q]);
+        m_tileSet.tmm().getChildOfTile(m_column, m_row, (TileMath::Quad)quad,
+                                       childCol, childRow);
+        m_children[quad] = new WritableTile(m_tileSet, m_level+1, childCol, childRow,
+                                           firstPoint);
+        m_tileSet.addTile(m_children[quad]);
     }
 
-    m_children[q]->add(sourcePointView, pointNumber, x, y);
+    return m_children[quad];
 }
 
 } // namespace rialto
@@ -37,6 +37,9 @@
 #include <pdal/pdal.hpp>
 #include <pdal/pdal_types.hpp>
 
+#include <atomic>
+#include <mutex>
+
 namespace rialto
 {
     using namespace pdal;
@@ -45,6 +48,35 @@ namespace rialto
 class WritableTile;
 class TileMath;
 
+
+// a point, and the Morton key of its tile (see TileMath::getMortonKey)
+struct KeyedPoint
+{
+    uint64_t key;
+    uint32_t idx;
+};
+
+// sorts the points by the low numBits bits of their keys, keeping points
+// with equal keys in their original order
+void radixSort(std::vector<KeyedPoint>& points, uint32_t numBits);
+
+// a tile, by its Morton key at its level, with the mask of its children,
+// which are [begin, end) of the tiles at the level below
+struct KeyedTile
+{
+    uint64_t key;
+    uint32_t mask;
+    uint32_t begin;
+    uint32_t end;
+};
+
+// For building the tiles bottom up: the tiles of a level, from the sorted
+// keys of the tiles at the level below. Each run of keys with the same
+// key >> 2 has one parent, and the two low bits of each key give its bit
+// in the parent's mask. The parents come out sorted too.
+void getParentTiles(const std::vector<uint64_t>& childKeys, std::vector<KeyedTile>& parents);
+
+
 // the tile set holds all the tiles that make up the tile matrix
 class WritableTileSet
 {
@@ -56,14 +88,33 @@ class WritableTileSet
               LogPtr log);
       ~WritableTileSet();
 
-      void build(PointViewPtr sourceView, PointViewSet* outputSet);
+      // With numThreads > 1, the subtrees below some split level are built
+      // concurrently. The resulting tiles (their points, in order, and their
+      // masks), and the order of getTiles(), are the same as for a serial
+      // build.
+      void build(PointViewPtr sourceView, PointViewSet* outputSet,
+                 uint32_t numThreads=1);
+
+      // Builds the tiles bottom up: the points are sorted by the Morton key
+      // of their tile at the max level, after which each tile's points are
+      // a contiguous run of the sorted list, and the tiles of each level
+      // above, with their masks, come from the runs of the keys below (see
+      // getParentTiles). The tiles, their points, and the order of
+      // getTiles() are those of build(), except that a point lying within
+      // rounding error of a tile edge may land in the neighboring tile,
+      // since its key is computed directly at the max level rather than by
+      // descending. The threads are only used to compute the keys.
+      void buildMorton(PointViewPtr sourceView, PointViewSet* outputSet,
+                       uint32_t numThreads=1);
 
       uint32_t getMaxLevel() const { return m_maxLevel; }
 
+      // these three are safe to call from the build threads
       PointViewPtr createPointView();
-      LogPtr log() { return m_log; }
+      uint32_t newTileId() { return m_tileId++; }
+      void addTile(WritableTile* tile);
 
-      uint32_t newTileId() { uint32_t t = m_tileId; ++m_tileId; return t; }
+      LogPtr log() { return m_log; }
 
       const TileMath& tmm() const { return *m_tmm; }
 
@@ -71,14 +122,22 @@ class WritableTileSet
       std::vector<WritableTile*>& getTilesRef() { return m_allTiles; }
 
   private:
+      WritableTile* getRoot(double x, double y) const;
+      void buildSerial();
+      void buildParallel(uint32_t numThreads);
+      void setMasks();
+      void sortTiles();
+      uint32_t getSplitLevel(uint32_t numThreads) const;
+
       PointViewPtr m_sourceView;
       PointViewSet* m_outputSet;
       uint32_t m_maxLevel;
       LogPtr m_log;
       WritableTile*** m_roots;
-      uint32_t m_tileId;
+      std::atomic<uint32_t> m_tileId;
       std::unique_ptr<TileMath> m_tmm;
       std::vector<WritableTile*> m_allTiles;
+      std::mutex m_mutex;
 };
 
 
@@ -90,11 +149,19 @@ class WritableTileSet
 class WritableTile
 {
 public:
-    WritableTile(WritableTileSet& tileSet, uint32_t level, uint32_t column, uint32_t row);
+    WritableTile(WritableTileSet& tileSet, uint32_t level, uint32_t column, uint32_t row,
+                 PointId firstPoint=0);
     ~WritableTile();
 
     void add(PointViewPtr pointView, PointId pointNumber, double lon, double lat);
+
+    // Like add(), but stops at the given level: returns the tile at that
+    // level which the point falls in, without adding the point to it.
+    WritableTile* descend(PointViewPtr pointView, PointId pointNumber,
+                          double lon, double lat, uint32_t level);
+
     void setMask();
+    void setMask(uint32_t mask) { m_mask = mask; }
 
     PointViewPtr getPointView() { return m_pointView; }
     uint32_t getLevel() const { return m_level; }
@@ -102,9 +169,21 @@ public:
     uint32_t getRow() const { return m_row; }
     uint32_t getMask() const { return m_mask; }
 
+    // the point which caused this tile to be created
+    PointId getFirstPoint() const { return m_firstPoint; }
+
+    // for builders that already know which tile a point goes in: adds the
+    // point to just this tile, if it survives decimation at this level
+    void addHere(PointViewPtr sourcePointView, PointId pointNumber);
+
+    // returns the child in the given quadrant (a TileMath::Quad), creating
+    // it if need be
+    WritableTile* getChild(uint32_t quad, PointId firstPoint);
+
 private:
     LogPtr log() { return m_tileSet.log(); }
     char* getPointData(const PointView& buf, PointId& idx) const;
+    WritableTile* getChild(PointId pointNumber, double x, double y);
     
     PointViewPtr m_pointView;
     uint32_t m_level;
@@ -115,6 +194,7 @@ private:
     WritableTileSet& m_tileSet;
     WritableTile** m_children;
     uint64_t m_skip;
+    PointId m_firstPoint;
 };
 
 } // namespace rialto
@@ -0,0 +1,238 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "../src/ColumnarCodec.hpp"
+#include <rialto/Event.hpp>
+#include <rialto/GeoPackageCommon.hpp>
+
+#include "gtest/gtest.h"
+
+using namespace pdal;
+using namespace rialto;
+
+
+// a tile's worth of points much like lidar: close together, with a few
+// small integer dims
+static void makePoints(const DimTypeList& dims, uint32_t numPoints,
+                       std::vector<char>& packed)
+{
+    Utils::random_seed(17);
+
+    size_t pointSize = 0;
+    for (const DimType& dim: dims)
+    {
+        pointSize += Dimension::size(dim.m_type);
+    }
+    packed.resize(numPoints * pointSize);
+
+    char* p = packed.data();
+    for (uint32_t i=0; i<numPoints; i++)
+    {
+        for (const DimType& dim: dims)
+        {
+            const double v = Utils::random(0.0, 1.0);
+            switch (dim.m_id)
+            {
+                case Dimension::Id::X:
+                {
+                    const double x = 10.0 + 0.01 * v;
+                    std::memcpy(p, &x, sizeof(x));
+                    break;
+                }
+                case Dimension::Id::Y:
+                {
+                    const double y = 45.0 + 0.01 * v;
+                    std::memcpy(p, &y, sizeof(y));
+                    break;
+                }
+                case Dimension::Id::Z:
+                {
+                    const double z = 100.0 + 20.0 * v;
+                    std::memcpy(p, &z, sizeof(z));
+                    break;
+                }
+                case Dimension::Id::GpsTime:
+                {
+                    const double t = 500000.0 + i * 0.00001;
+                    std::memcpy(p, &t, sizeof(t));
+                    break;
+                }
+                case Dimension::Id::Intensity:
+                {
+                    const uint16_t intensity = (uint16_t)(v * 4000.0);
+                    std::memcpy(p, &intensity, sizeof(intensity));
+                    break;
+                }
+                default:
+                {
+                    // signed, to check the sign flip
+                    const int8_t c = (int8_t)(v * 8.0) - 4;
+                    std::memcpy(p, &c, sizeof(c));
+                    break;
+                }
+            }
+            p += Dimension::size(dim.m_type);
+        }
+    }
+}
+
+
+static DimTypeList makeDims()
+{
+    DimTypeList dims;
+    dims.push_back(DimType(Dimension::Id::X, Dimension::Type::Double));
+    dims.push_back(DimType(Dimension::Id::Y, Dimension::Type::Double));
+    dims.push_back(DimType(Dimension::Id::Z, Dimension::Type::Double));
+    dims.push_back(DimType(Dimension::Id::Intensity, Dimension::Type::Unsigned16));
+    dims.push_back(DimType(Dimension::Id::GpsTime, Dimension::Type::Double));
+    dims.push_back(DimType(Dimension::Id::Classification, Dimension::Type::Signed8));
+    return dims;
+}
+
+
+TEST(ColumnarCodecTest, testRoundTrip)
+{
+    const DimTypeList dims = makeDims();
+
+    for (uint32_t numPoints: { 0, 1, 2, 3, 1000 })
+    {
+        std::vector<char> packed, blob, actual;
+        makePoints(dims, numPoints, packed);
+
+        ColumnarCodec::encode(dims, numPoints, packed.data(), blob);
+        ColumnarCodec::decode(dims, dims, numPoints, blob.data(), blob.size(), actual);
+        EXPECT_TRUE(actual == packed);
+
+        if (numPoints > 100)
+        {
+            EXPECT_LT(blob.size(), packed.size());
+        }
+    }
+}
+
+
+TEST(ColumnarCodecTest, testSomeDimensions)
+{
+    static const uint32_t numPoints = 1000;
+
+    const DimTypeList dims = makeDims();
+    std::vector<char> packed, blob, actual;
+    makePoints(dims, numPoints, packed);
+    ColumnarCodec::encode(dims, numPoints, packed.data(), blob);
+
+    // Z and X, out of their order in the blob
+    DimTypeList wanted;
+    wanted.push_back(dims[2]);
+    wanted.push_back(dims[0]);
+    ColumnarCodec::decode(dims, wanted, numPoints, blob.data(), blob.size(), actual);
+    ASSERT_EQ(actual.size(), numPoints * 16u);
+
+    const size_t pointSize = packed.size() / numPoints;
+    for (uint32_t i=0; i<numPoints; i++)
+    {
+        EXPECT_EQ(0, std::memcmp(&actual[i * 16], &packed[i * pointSize + 16], 8));
+        EXPECT_EQ(0, std::memcmp(&actual[i * 16 + 8], &packed[i * pointSize], 8));
+    }
+
+    DimTypeList missing;
+    missing.push_back(DimType(Dimension::Id::Red, Dimension::Type::Unsigned16));
+    EXPECT_THROW(ColumnarCodec::decode(dims, missing, numPoints, blob.data(), blob.size(), actual),
+                 pdal_error);
+}
+
+
+TEST(ColumnarCodecTest, testBadData)
+{
+    static const uint32_t numPoints = 100;
+
+    const DimTypeList dims = makeDims();
+    std::vector<char> packed, blob, actual;
+    makePoints(dims, numPoints, packed);
+    ColumnarCodec::encode(dims, numPoints, packed.data(), blob);
+
+    EXPECT_THROW(ColumnarCodec::decode(dims, dims, numPoints, blob.data(), blob.size() - 1, actual),
+                 pdal_error);
+
+    std::vector<char> badVersion(blob);
+    badVersion[0] = ColumnarCodec::version + 1;
+    EXPECT_THROW(ColumnarCodec::decode(dims, dims, numPoints, badVersion.data(), badVersion.size(), actual),
+                 pdal_error);
+
+    DimTypeList fewerDims(dims.begin(), dims.end() - 1);
+    EXPECT_THROW(ColumnarCodec::decode(fewerDims, fewerDims, numPoints, blob.data(), blob.size(), actual),
+                 pdal_error);
+}
+
+
+// compares the tile sizes, and the time to decode them, of the two
+// encodings (the packed one being LAZ-compressed, if built with LazPerf)
+TEST(ColumnarCodecTest, codecPerf)
+{
+    static const uint32_t numPoints = 5000;
+    static const int numTiles = 200;
+
+    const DimTypeList dims = makeDims();
+    std::vector<char> packed;
+    makePoints(dims, numPoints, packed);
+
+    const GpkgEncoding encodings[2] = { GpkgEncodingPacked, GpkgEncodingColumnar };
+    const char* names[2] = { "packed", "columnar" };
+
+    for (int i=0; i<2; i++)
+    {
+        Event e_encode(std::string("* encode ") + names[i]);
+        Event e_decode(std::string("* decode ") + names[i]);
+
+        std::vector<char> points(packed);
+        e_encode.start();
+        const GpkgTile tile(dims, points, numPoints, 0, 0, 0, 0, encodings[i]);
+        e_encode.stop();
+
+        std::vector<char> actual;
+        e_decode.start();
+        for (int j=0; j<numTiles; j++)
+        {
+            tile.decode(dims, actual, encodings[i]);
+        }
+        e_decode.stop();
+
+        EXPECT_TRUE(actual == packed);
+
+        std::cout << "ColumnarCodecTest: " << names[i] << " tile is "
+                  << tile.getBlobSize() << " of " << packed.size()
+                  << " bytes" << std::endl;
+        e_encode.dump();
+        e_decode.dump();
+    }
+}
@@ -0,0 +1,198 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "../src/PointFilter.hpp"
+#include <rialto/Event.hpp>
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace pdal;
+using namespace rialto;
+
+
+static void makeXY(uint32_t numPoints, std::vector<double>& x, std::vector<double>& y)
+{
+    Utils::random_seed(17);
+
+    x.resize(numPoints);
+    y.resize(numPoints);
+    for (uint32_t i=0; i<numPoints; i++)
+    {
+        x[i] = Utils::random(0.0, 100.0);
+        y[i] = Utils::random(0.0, 100.0);
+    }
+}
+
+
+TEST(PointFilterTest, testSelectInBox)
+{
+    // odd-sized, so that the SIMD path has a tail
+    static const uint32_t NUM_POINTS = 1003;
+
+    std::vector<double> x, y;
+    makeXY(NUM_POINTS, x, y);
+
+    // points on the edges are in the box
+    x[0] = 25.0; y[0] = 50.0;
+    x[1] = 75.0; y[1] = 75.0;
+    x[2] = 24.999; y[2] = 50.0;
+    x[NUM_POINTS-1] = 50.0; y[NUM_POINTS-1] = 50.0;
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i=0; i<NUM_POINTS; i++)
+    {
+        if (x[i] >= 25.0 && x[i] <= 75.0 && y[i] >= 40.0 && y[i] <= 75.0)
+        {
+            expected.push_back(i);
+        }
+    }
+    EXPECT_EQ(0u, expected[0]);
+    EXPECT_EQ(1u, expected[1]);
+    EXPECT_NE(2u, expected[2]);
+    EXPECT_EQ(NUM_POINTS-1, expected.back());
+
+    std::vector<uint32_t> indexes(NUM_POINTS);
+
+    size_t count = PointFilter::selectInBoxScalar(x.data(), y.data(), NUM_POINTS,
+                                                  25.0, 40.0, 75.0, 75.0, indexes.data());
+    indexes.resize(count);
+    EXPECT_TRUE(expected == indexes);
+
+    indexes.assign(NUM_POINTS, 0);
+    count = PointFilter::selectInBox(x.data(), y.data(), NUM_POINTS,
+                                     25.0, 40.0, 75.0, 75.0, indexes.data());
+    indexes.resize(count);
+    EXPECT_TRUE(expected == indexes);
+
+    // none, and fewer points than one SIMD step
+    count = PointFilter::selectInBox(x.data(), y.data(), NUM_POINTS,
+                                     200.0, 200.0, 300.0, 300.0, indexes.data());
+    EXPECT_EQ(0u, count);
+    count = PointFilter::selectInBox(x.data(), y.data(), 2,
+                                     25.0, 40.0, 75.0, 75.0, indexes.data());
+    EXPECT_EQ(2u, count);
+}
+
+
+TEST(PointFilterTest, testColumns)
+{
+    static const uint32_t NUM_POINTS = 10;
+
+    DimTypeList dims;
+    dims.push_back(DimType(Dimension::Id::X, Dimension::Type::Double));
+    dims.push_back(DimType(Dimension::Id::Y, Dimension::Type::Signed32));
+    dims.push_back(DimType(Dimension::Id::Intensity, Dimension::Type::Unsigned16));
+    const size_t pointSize = 8 + 4 + 2;
+
+    std::vector<char> packed(NUM_POINTS * pointSize);
+    for (uint32_t i=0; i<NUM_POINTS; i++)
+    {
+        const double x = i * 1.5;
+        const int32_t y = -(int32_t)i;
+        const uint16_t intensity = (uint16_t)(i * 100);
+        char* p = packed.data() + i * pointSize;
+        memcpy(p, &x, 8);
+        memcpy(p + 8, &y, 4);
+        memcpy(p + 12, &intensity, 2);
+    }
+
+    std::vector<double> x, y, intensity;
+    PointFilter::getColumn(dims, Dimension::Id::X, packed.data(), NUM_POINTS, x);
+    PointFilter::getColumn(dims, Dimension::Id::Y, packed.data(), NUM_POINTS, y);
+    PointFilter::getColumn(dims, Dimension::Id::Intensity, packed.data(), NUM_POINTS,
+                           intensity);
+    for (uint32_t i=0; i<NUM_POINTS; i++)
+    {
+        EXPECT_EQ(i * 1.5, x[i]);
+        EXPECT_EQ(-(double)i, y[i]);
+        EXPECT_EQ(i * 100.0, intensity[i]);
+    }
+
+    EXPECT_THROW(PointFilter::getColumn(dims, Dimension::Id::Z, packed.data(),
+                                        NUM_POINTS, x), pdal_error);
+
+    // keep the odd points
+    std::vector<uint32_t> indexes;
+    for (uint32_t i=1; i<NUM_POINTS; i+=2)
+    {
+        indexes.push_back(i);
+    }
+    PointFilter::compact(packed, pointSize, indexes.data(), indexes.size());
+    EXPECT_EQ(indexes.size() * pointSize, packed.size());
+
+    PointFilter::getColumn(dims, Dimension::Id::X, packed.data(), indexes.size(), x);
+    for (size_t i=0; i<indexes.size(); i++)
+    {
+        EXPECT_EQ(indexes[i] * 1.5, x[i]);
+    }
+}
+
+
+TEST(PointFilterTest, testPerf)
+{
+    static const uint32_t NUM_POINTS = 1000 * 1000;
+    static const int NUM_PASSES = 20;
+
+    std::vector<double> x, y;
+    makeXY(NUM_POINTS, x, y);
+    std::vector<uint32_t> indexes(NUM_POINTS);
+
+    // about half the points in the box
+    auto run = [&](bool simd, size_t& count)
+    {
+        clock_t start = Event::timerStart();
+        for (int i=0; i<NUM_PASSES; i++)
+        {
+            count = simd ?
+                PointFilter::selectInBox(x.data(), y.data(), NUM_POINTS,
+                                         10.0, 10.0, 80.0, 80.0, indexes.data()) :
+                PointFilter::selectInBoxScalar(x.data(), y.data(), NUM_POINTS,
+                                               10.0, 10.0, 80.0, 80.0, indexes.data());
+        }
+        const double millis = Event::timerStop(start);
+        return NUM_PASSES * (double)NUM_POINTS / (std::max(millis, 1.0) / 1000.0);
+    };
+
+    size_t scalarCount = 0, simdCount = 0;
+    const double scalarRate = run(false, scalarCount);
+    const double simdRate = run(true, simdCount);
+    EXPECT_EQ(scalarCount, simdCount);
+
+    printf("* selectInBoxScalar: %.0f points/sec\n", scalarRate);
+    printf("* selectInBox:       %.0f points/sec (%s)\n", simdRate,
+           PointFilter::hasAvx2() ? "avx2" : "scalar");
+}
@@ -0,0 +1,144 @@
+/******************************************************************************
+* Copyright (c) 2015, RadiantBlue Technologies, Inc.
+*
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following
+* conditions are met:
+*
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in
+*       the documentation and/or other materials provided
+*       with the distribution.
+*     * Neither the name of Hobu, Inc. or Flaxen Geo Consulting nor the
+*       names of its contributors may be used to endorse or promote
+*       products derived from this software without specific prior
+*       written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+* FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+* COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+* AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+* OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+* OF SUCH DAMAGE.
+****************************************************************************/
+
+#include "../src/QueryRegion.hpp"
+
+#include "gtest/gtest.h"
+
+using namespace pdal;
+using namespace rialto;
+
+
+TEST(QueryRegionTest, testPolygon)
+{
+    // a square with a square hole
+    const QueryRegion region = QueryRegion::fromWkt(
+        "POLYGON ((0 0, 10 0, 10 10, 0 10, 0 0), (4 4, 6 4, 6 6, 4 6, 4 4))");
+    EXPECT_FALSE(region.empty());
+
+    double minx, miny, maxx, maxy;
+    region.getBounds(minx, miny, maxx, maxy);
+    EXPECT_EQ(0.0, minx);
+    EXPECT_EQ(0.0, miny);
+    EXPECT_EQ(10.0, maxx);
+    EXPECT_EQ(10.0, maxy);
+
+    EXPECT_TRUE(region.contains(1.0, 1.0));
+    EXPECT_TRUE(region.contains(9.5, 5.0));
+    EXPECT_FALSE(region.contains(5.0, 5.0));
+    EXPECT_FALSE(region.contains(11.0, 5.0));
+
+    EXPECT_EQ(QueryRegion::Inside, region.classify(1.0, 1.0, 2.0, 2.0));
+    EXPECT_EQ(QueryRegion::Outside, region.classify(4.5, 4.5, 5.5, 5.5));
+    EXPECT_EQ(QueryRegion::Outside, region.classify(20.0, 20.0, 30.0, 30.0));
+    EXPECT_EQ(QueryRegion::Straddles, region.classify(-1.0, -1.0, 1.0, 1.0));
+    EXPECT_EQ(QueryRegion::Straddles, region.classify(3.0, 3.0, 7.0, 7.0));
+    EXPECT_EQ(QueryRegion::Straddles, region.classify(-5.0, -5.0, 15.0, 15.0));
+
+    // a triangle, and a square away from it, with Zs
+    const QueryRegion multi = QueryRegion::fromWkt(
+        "MULTIPOLYGON Z (((0 0 1, 4 0 1, 0 4 1)), ((10 10 1, 12 10 1, 12 12 1, 10 12 1)))");
+    EXPECT_TRUE(multi.contains(1.0, 1.0));
+    EXPECT_FALSE(multi.contains(3.0, 3.0));
+    EXPECT_TRUE(multi.contains(11.0, 11.0));
+    EXPECT_FALSE(multi.contains(8.0, 8.0));
+
+    for (const std::string bad: { "POINT (1 2)", "POLYGON ((0 0, 1 1))",
+                                  "POLYGON ((0 0, 1 0, 1 1)", "POLYGON ((0 0, 1 0, 1 1)) x",
+                                  "POLYGON ((a 0, 1 0, 1 1))" })
+    {
+        EXPECT_THROW(QueryRegion::fromWkt(bad), pdal_error);
+    }
+}
+
+
+TEST(QueryRegionTest, testBoxes)
+{
+    const QueryRegion region = QueryRegion::fromBoxes("0,0,1,1; 5,5,6,6");
+
+    // the edges are in
+    EXPECT_TRUE(region.contains(1.0, 1.0));
+    EXPECT_TRUE(region.contains(5.0, 6.0));
+    EXPECT_FALSE(region.contains(3.0, 3.0));
+
+    EXPECT_EQ(QueryRegion::Inside, region.classify(0.2, 0.2, 0.8, 0.8));
+    EXPECT_EQ(QueryRegion::Outside, region.classify(2.0, 2.0, 3.0, 3.0));
+    EXPECT_EQ(QueryRegion::Straddles, region.classify(0.5, 0.5, 5.5, 5.5));
+
+    for (const std::string bad: { "1,2,3", "1,2,0,4", "a,b,c,d" })
+    {
+        EXPECT_THROW(QueryRegion::fromBoxes(bad), pdal_error);
+    }
+}
+
+
+TEST(QueryRegionTest, testSelectInside)
+{
+    static const uint32_t NUM_POINTS = 1003;
+
+    Utils::random_seed(17);
+
+    std::vector<double> x(NUM_POINTS), y(NUM_POINTS);
+    for (uint32_t i=0; i<NUM_POINTS; i++)
+    {
+        x[i] = Utils::random(-1.0, 11.0);
+        y[i] = Utils::random(-1.0, 11.0);
+    }
+
+    QueryRegion region = QueryRegion::fromWkt("POLYGON ((0 0, 10 0, 0 10, 0 0))");
+    region.addBox(8.0, 8.0, 9.0, 9.0);
+
+    // every other point, as if some were taken out already
+    std::vector<uint32_t> indexes;
+    for (uint32_t i=0; i<NUM_POINTS; i+=2)
+    {
+        indexes.push_back(i);
+    }
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i: indexes)
+    {
+        const bool inTriangle = x[i] > 0.0 && y[i] > 0.0 && x[i] + y[i] < 10.0;
+        const bool inBox = x[i] >= 8.0 && x[i] <= 9.0 && y[i] >= 8.0 && y[i] <= 9.0;
+        if (inTriangle || inBox)
+        {
+            expected.push_back(i);
+        }
+    }
+
+    const size_t count = region.selectInside(x.data(), y.data(), NUM_POINTS,
+                                             indexes.data(), indexes.size());
+    indexes.resize(count);
+    EXPECT_EQ(expected, indexes);
+}
@@ -34,6 +34,13 @@
 
 #include "RialtoTest.hpp"
 #include <rialto/RialtoReader.hpp>
+#include "../src/SQLiteCommon.hpp"
+#include "../src/TileCache.hpp"
+#include "../src/TileMath.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <set>
 
 using namespace pdal;
 using namespace rialto;
@@ -116,3 +123,1063 @@ TEST(RialtoReaderTest, test)
       EXPECT_EQ(view->size(), 1u);
   }
 }
+
+
+TEST(RialtoReaderTest, testDimensions)
+{
+    static const uint32_t NUM_POINTS = 1000;
+
+    const std::string filename(Support::temppath("rialto5.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        RialtoTest::createDatabase(table, inputView, filename, 3);
+        delete[] actualData;
+    }
+
+    // (x,y) -> z, from reading all the dims
+    std::map<std::pair<double, double>, double> expected;
+    {
+        RialtoReader reader;
+        Options options;
+        options.add("filename", filename);
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        PointViewPtr view = *viewSet.begin();
+        EXPECT_EQ(3u, table.layout()->dims().size());
+        EXPECT_EQ(NUM_POINTS, view->size());
+
+        for (PointId i=0; i<view->size(); i++)
+        {
+            const double x = view->getFieldAs<double>(Dimension::Id::X, i);
+            const double y = view->getFieldAs<double>(Dimension::Id::Y, i);
+            expected[std::make_pair(x, y)] = view->getFieldAs<double>(Dimension::Id::Z, i);
+        }
+    }
+
+    // X and Y are read even when not asked for
+    for (const std::string dims: { "X,Y", "Z" })
+    {
+        RialtoReader reader;
+        Options options;
+        options.add("filename", filename);
+        options.add("dimensions", dims);
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        PointViewPtr view = *viewSet.begin();
+        EXPECT_EQ(NUM_POINTS, view->size());
+
+        const bool hasZ = (dims == "Z");
+        EXPECT_EQ(hasZ ? 3u : 2u, table.layout()->dims().size());
+        EXPECT_EQ(hasZ, table.layout()->hasDim(Dimension::Id::Z));
+
+        for (PointId i=0; i<view->size(); i++)
+        {
+            const double x = view->getFieldAs<double>(Dimension::Id::X, i);
+            const double y = view->getFieldAs<double>(Dimension::Id::Y, i);
+            auto it = expected.find(std::make_pair(x, y));
+            ASSERT_TRUE(it != expected.end());
+            if (hasZ)
+            {
+                EXPECT_EQ(it->second, view->getFieldAs<double>(Dimension::Id::Z, i));
+            }
+        }
+    }
+
+    {
+        RialtoReader reader;
+        Options options;
+        options.add("filename", filename);
+        options.add("dimensions", "X,Y,Intensity");
+        reader.setOptions(options);
+
+        PointTable table;
+        EXPECT_THROW(reader.prepare(table), pdal_error);
+    }
+
+    FileUtils::deleteFile(filename);
+}
+
+
+// the matrix set is read once per connection, until it is written to
+TEST(RialtoReaderTest, testMatrixSetCache)
+{
+    const std::string filename(Support::temppath("rialto6.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, 1000);
+        RialtoTest::createDatabase(table, inputView, filename, 3);
+        delete[] actualData;
+    }
+
+    LogPtr log(new Log("rialtoreadertest", "stdout"));
+
+    {
+        GeoPackageReader db(filename, log);
+        db.open();
+
+        std::vector<std::string> names;
+        db.readMatrixSetNames(names);
+        ASSERT_EQ(1u, names.size());
+
+        const GpkgMatrixSet& info = db.getMatrixSet(names[0]);
+        EXPECT_EQ(&info, &db.getMatrixSet(names[0]));
+        EXPECT_EQ(&db.getTileMath(names[0]), &db.getTileMath(names[0]));
+
+        GpkgMatrixSet copy;
+        db.readMatrixSet(names[0], copy);
+        EXPECT_EQ(info.getNumDimensions(), copy.getNumDimensions());
+        EXPECT_EQ(info.getDataMaxX(), copy.getDataMaxX());
+
+        std::vector<uint32_t> ids;
+        db.queryForTileIds(names[0], -180.0, -90.0, 180.0, 90.0, 3, ids);
+        EXPECT_FALSE(ids.empty());
+
+        // tiles by position, all at once, as one at a time
+        std::vector<GpkgTile> positions;
+        for (uint32_t id: ids)
+        {
+            GpkgTile tile;
+            db.readTile(names[0], id, false, tile);
+            positions.push_back(tile);
+        }
+        positions.push_back(GpkgTile());
+        positions.back().set(3, 1000, 1000, 0, 0, std::vector<char>()); // off the matrix
+        std::vector<GpkgTile> found;
+        db.readTilesAt(names[0], positions, found);
+        size_t numThere = 0;
+        for (const GpkgTile& position: positions)
+        {
+            GpkgTile tile;
+            if (!db.readTile(names[0], position.getLevel(), position.getColumn(),
+                             position.getRow(), tile))
+            {
+                continue;
+            }
+            ++numThere;
+            auto iter = std::find_if(found.begin(), found.end(), [&](const GpkgTile& t)
+            {
+                return t.getColumn() == tile.getColumn() && t.getRow() == tile.getRow();
+            });
+            ASSERT_TRUE(iter != found.end());
+            EXPECT_EQ(tile.getNumPoints(), iter->getNumPoints());
+            EXPECT_EQ(tile.getMask(), iter->getMask());
+            EXPECT_TRUE(tile.getBlob() == iter->getBlob());
+        }
+        EXPECT_EQ(numThere, found.size());
+        EXPECT_EQ(ids.size(), numThere);
+
+        db.close();
+    }
+
+    {
+        GeoPackageWriter db(filename, log);
+        db.open();
+
+        std::vector<std::string> names;
+        db.readMatrixSetNames(names);
+        const double oldMax = db.getMatrixSet(names[0]).getDimensions()[2].getMaximum();
+
+        db.updateDimensionStats(names[0], "Z", 0.0, 1.0, oldMax + 1.0);
+        EXPECT_EQ(oldMax + 1.0, db.getMatrixSet(names[0]).getDimensions()[2].getMaximum());
+
+        db.close();
+    }
+
+    FileUtils::deleteFile(filename);
+}
+
+
+// the tiles found by going down the tree are those in the box at the level
+TEST(RialtoReaderTest, testTileQuery)
+{
+    static const uint32_t NUM_POINTS = 2000;
+    static const uint32_t MAX_LEVEL = 6;
+
+    const std::string filename(Support::temppath("rialto9.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    // all the points in a small part of the world
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS, false);
+        RialtoTest::createDatabase(table, inputView, filename, MAX_LEVEL);
+        delete[] actualData;
+    }
+
+    LogPtr log(new Log("rialtoreadertest", "stdout"));
+
+    GeoPackageReader db(filename, log);
+    db.open();
+
+    std::vector<std::string> names;
+    db.readMatrixSetNames(names);
+    const std::string& name = names[0];
+
+    typedef std::vector<std::vector<uint32_t>> TileList;
+
+    auto query = [&](double minx, double miny, double maxx, double maxy,
+                     uint32_t level, bool finest)
+    {
+        TileList tiles;
+        db.queryForTiles_begin(name, minx, miny, maxx, maxy, level, false, finest);
+        do {
+            GpkgTile info;
+            if (!db.queryForTiles_step(info)) break;
+            tiles.push_back({ info.getLevel(), info.getColumn(), info.getRow() });
+        } while (db.queryForTiles_next());
+        std::sort(tiles.begin(), tiles.end());
+        return tiles;
+    };
+
+    auto expected = [&](double minx, double miny, double maxx, double maxy,
+                        uint32_t level)
+    {
+        std::vector<uint32_t> ids;
+        db.queryForTileIds(name, minx, miny, maxx, maxy, level, ids);
+
+        TileList tiles;
+        for (uint32_t id: ids)
+        {
+            GpkgTile info;
+            db.readTile(name, id, false, info);
+            tiles.push_back({ info.getLevel(), info.getColumn(), info.getRow() });
+        }
+        std::sort(tiles.begin(), tiles.end());
+        return tiles;
+    };
+
+    const BOX3D boxes[4] = {
+        BOX3D(-179.0, -89.0, 0.0, 179.0, 89.0, 0.0),   // everything
+        BOX3D(20.0, 20.0, 0.0, 30.0, 30.0, 0.0),       // inside the data
+        BOX3D(0.0, 0.0, 0.0, 25.0, 25.0, 0.0),         // straddling its edge
+        BOX3D(-100.0, -50.0, 0.0, -10.0, -5.0, 0.0)    // nowhere near it
+    };
+
+    for (const BOX3D& box: boxes)
+    {
+        for (uint32_t level=0; level<=MAX_LEVEL; level++)
+        {
+            const TileList tiles = query(box.minx, box.miny, box.maxx, box.maxy,
+                                         level, false);
+            EXPECT_TRUE(expected(box.minx, box.miny, box.maxx, box.maxy, level) == tiles);
+        }
+
+        // all the branches go down to the max level
+        EXPECT_TRUE(query(box.minx, box.miny, box.maxx, box.maxy, MAX_LEVEL, true) ==
+                    query(box.minx, box.miny, box.maxx, box.maxy, MAX_LEVEL, false));
+    }
+
+    EXPECT_TRUE(query(boxes[3].minx, boxes[3].miny, boxes[3].maxx, boxes[3].maxy,
+                      MAX_LEVEL, false).empty());
+    EXPECT_FALSE(query(boxes[1].minx, boxes[1].miny, boxes[1].maxx, boxes[1].maxy,
+                       MAX_LEVEL, false).empty());
+
+    db.close();
+
+    FileUtils::deleteFile(filename);
+}
+
+// a table written before the tiles with no points of their own were stored
+// reads as one with them, less those tiles
+TEST(RialtoReaderTest, testTableWithoutEmptyTiles)
+{
+    static const uint32_t NUM_POINTS = 2000;
+    static const uint32_t MAX_LEVEL = 6;
+
+    const std::string filename(Support::temppath("rialto15.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        RialtoTest::createDatabase(table, inputView, filename, MAX_LEVEL);
+        delete[] actualData;
+    }
+
+    LogPtr log(new Log("rialtoreadertest", "stdout"));
+
+    typedef std::vector<std::vector<uint32_t>> TileList;
+
+    const BOX3D boxes[3] = {
+        BOX3D(-179.0, -89.0, 0.0, 179.0, 89.0, 0.0),
+        BOX3D(20.0, 20.0, 0.0, 30.0, 30.0, 0.0),
+        BOX3D(-100.0, -50.0, 0.0, -10.0, -5.0, 0.0)
+    };
+
+    // the tiles with points, from each kind of query
+    auto queryAll = [&](std::vector<TileList>& results, std::vector<uint64_t>& counts)
+    {
+        GeoPackageReader db(filename, log);
+        db.open();
+
+        std::vector<std::string> names;
+        db.readMatrixSetNames(names);
+        const std::string& name = names[0];
+
+        auto collect = [&]()
+        {
+            TileList tiles;
+            do {
+                GpkgTile info;
+                if (!db.queryForTiles_step(info)) break;
+                if (info.getNumPoints() > 0)
+                {
+                    tiles.push_back({ info.getLevel(), info.getColumn(), info.getRow() });
+                }
+            } while (db.queryForTiles_next());
+            std::sort(tiles.begin(), tiles.end());
+            return tiles;
+        };
+
+        GpkgLod lod;
+        lod.pointBudget = NUM_POINTS / 4;
+
+        for (const BOX3D& box: boxes)
+        {
+            for (uint32_t level=0; level<=MAX_LEVEL; level++)
+            {
+                db.queryForTiles_begin(name, box.minx, box.miny, box.maxx, box.maxy,
+                                       level, false);
+                results.push_back(collect());
+                db.queryForTiles_begin(name, box.minx, box.miny, box.maxx, box.maxy,
+                                       level, false, true);
+                results.push_back(collect());
+            }
+
+            db.queryForTilesLod_begin(name, box.minx, box.miny, box.maxx, box.maxy,
+                                      MAX_LEVEL, lod, false);
+            results.push_back(collect());
+
+            GpkgSummary summary;
+            db.querySummary(name, box.minx, box.miny, box.maxx, box.maxy,
+                            MAX_LEVEL, false, summary);
+            counts.push_back(summary.numPoints);
+        }
+
+        db.close();
+    };
+
+    std::vector<TileList> expected;
+    std::vector<uint64_t> expectedCounts;
+    queryAll(expected, expectedCounts);
+    EXPECT_EQ(NUM_POINTS, expectedCounts[0]);
+
+    // as the writer used to leave it
+    {
+        GeoPackageReader db(filename, log);
+        db.open();
+        std::vector<std::string> names;
+        db.readMatrixSetNames(names);
+        db.close();
+
+        SQLite sqlite(filename, log);
+        sqlite.connect(true);
+        sqlite.query("SELECT count(*) FROM '" + names[0] + "' WHERE num_points=0");
+        EXPECT_LT(0u, sqlite.get()->at(0).getUInt32());
+        sqlite.execute("DELETE FROM '" + names[0] + "' WHERE num_points=0");
+        sqlite.execute("DELETE FROM gpkg_extensions WHERE extension_name='" +
+                       GeoPackage::emptyTilesExtensionName() + "'");
+    }
+
+    std::vector<TileList> actual;
+    std::vector<uint64_t> actualCounts;
+    queryAll(actual, actualCounts);
+    EXPECT_TRUE(expected == actual);
+    EXPECT_TRUE(expectedCounts == actualCounts);
+
+    FileUtils::deleteFile(filename);
+}
+
+
+
+TEST(RialtoReaderTest, testTileCacheLru)
+{
+    TileCache cache(100);
+
+    auto points = [](size_t n) {
+        return TileCache::Points(new std::vector<char>(n));
+    };
+
+    cache.put("a", 0, 0, 0, points(40));
+    cache.put("a", 1, 0, 0, points(40));
+    EXPECT_TRUE(cache.get("a", 0, 0, 0) != NULL); // now the most recent
+    EXPECT_TRUE(cache.get("b", 0, 0, 0) == NULL);
+
+    cache.put("a", 1, 1, 0, points(40));
+    EXPECT_EQ(1u, cache.getEvictions());
+    EXPECT_EQ(80u, cache.getBytes());
+    EXPECT_TRUE(cache.get("a", 1, 0, 0) == NULL);
+    EXPECT_TRUE(cache.get("a", 0, 0, 0) != NULL);
+
+    cache.put("a", 2, 0, 0, points(101)); // too big to keep
+    EXPECT_TRUE(cache.get("a", 2, 0, 0) == NULL);
+    EXPECT_EQ(80u, cache.getBytes());
+
+    EXPECT_EQ(2u, cache.getHits());
+    EXPECT_EQ(3u, cache.getMisses());
+
+    cache.setMaxBytes(40);
+    EXPECT_EQ(2u, cache.getEvictions());
+    EXPECT_EQ(40u, cache.getBytes());
+}
+
+
+// repeated and overlapping queries, by one reader or several, must get
+// their tiles from the cache, and the same points as without it
+TEST(RialtoReaderTest, testTileCache)
+{
+    static const uint32_t NUM_POINTS = 1000;
+
+    const std::string filename(Support::temppath("rialto7.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        RialtoTest::createDatabase(table, inputView, filename, 3);
+        delete[] actualData;
+    }
+
+    auto query = [&](RialtoReader& reader, const BOX3D& bounds, uint32_t cacheSize)
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add("bounds", bounds);
+        options.add("cache_size", cacheSize);
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        PointViewPtr view = *viewSet.begin();
+
+        std::vector<std::vector<double>> points;
+        for (PointId i=0; i<view->size(); i++)
+        {
+            points.push_back({
+                view->getFieldAs<double>(Dimension::Id::X, i),
+                view->getFieldAs<double>(Dimension::Id::Y, i),
+                view->getFieldAs<double>(Dimension::Id::Z, i) });
+        }
+        std::sort(points.begin(), points.end());
+        return points;
+    };
+
+    const BOX3D boxes[2] = {
+        BOX3D(12.3, 12.4, 0.0, 30.0, 30.0, 0.0),
+        BOX3D(20.0, 20.0, 0.0, 45.6, 45.7, 0.0)
+    };
+
+    std::vector<std::vector<double>> expected[2];
+    for (int i=0; i<2; i++)
+    {
+        RialtoReader reader;
+        expected[i] = query(reader, boxes[i], 0);
+        EXPECT_FALSE(expected[i].empty());
+    }
+
+    RialtoReader reader;
+    EXPECT_TRUE(expected[0] == query(reader, boxes[0], 16));
+
+    std::shared_ptr<TileCache> cache = TileCache::forFile(filename, 0);
+    EXPECT_EQ(0u, cache->getHits());
+    const uint64_t misses = cache->getMisses();
+    EXPECT_LT(0u, misses);
+    EXPECT_LT(0u, cache->getBytes());
+
+    EXPECT_TRUE(expected[0] == query(reader, boxes[0], 16));
+    EXPECT_EQ(misses, cache->getHits());
+    EXPECT_EQ(misses, cache->getMisses());
+
+    // another reader of the file shares the cache
+    RialtoReader other;
+    EXPECT_TRUE(expected[1] == query(other, boxes[1], 16));
+    EXPECT_LT(misses, cache->getHits());
+    EXPECT_EQ(0u, cache->getEvictions());
+
+    FileUtils::deleteFile(filename);
+}
+
+
+TEST(RialtoReaderTest, testThreads)
+{
+    static const uint32_t NUM_POINTS = 1000;
+
+    const std::string filename(Support::temppath("rialto8.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        RialtoTest::createDatabase(table, inputView, filename, 3);
+        delete[] actualData;
+    }
+
+    // unsorted, as the points should come out in the same order
+    auto query = [&](uint32_t numThreads, uint32_t cacheSize)
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add("bounds", BOX3D(12.3, 12.4, 0.0, 45.6, 45.7, 0.0));
+        options.add("threads", numThreads);
+        options.add("cache_size", cacheSize);
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        PointViewPtr view = *viewSet.begin();
+
+        std::vector<std::vector<double>> points;
+        for (PointId i=0; i<view->size(); i++)
+        {
+            points.push_back({
+                view->getFieldAs<double>(Dimension::Id::X, i),
+                view->getFieldAs<double>(Dimension::Id::Y, i),
+                view->getFieldAs<double>(Dimension::Id::Z, i) });
+        }
+        return points;
+    };
+
+    const std::vector<std::vector<double>> expected = query(1, 0);
+    EXPECT_FALSE(expected.empty());
+
+    EXPECT_TRUE(expected == query(4, 0));
+
+    // decoded once into the cache, then from it
+    EXPECT_TRUE(expected == query(4, 16));
+    EXPECT_TRUE(expected == query(4, 16));
+    EXPECT_TRUE(expected == query(1, 16));
+
+    FileUtils::deleteFile(filename);
+}
+
+
+TEST(RialtoReaderTest, testLevelOfDetail)
+{
+    static const uint32_t NUM_POINTS = 4000;
+    static const uint32_t MAX_LEVEL = 5;
+
+    const std::string filename(Support::temppath("rialto10.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        RialtoTest::createDatabase(table, inputView, filename, MAX_LEVEL);
+        delete[] actualData;
+    }
+
+    auto count = [&](const Options& lod)
+    {
+        Options options(lod);
+        options.add("filename", filename);
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        return (*viewSet.begin())->size();
+    };
+
+    const point_count_t numAll = count(Options());
+    EXPECT_EQ(NUM_POINTS, numAll);
+
+    Options level0;
+    level0.add("level", 0);
+    const point_count_t numLevel0 = count(level0);
+    EXPECT_LT(0u, numLevel0);
+
+    // the budget bounds the points
+    point_count_t last = numLevel0;
+    for (uint64_t budget: { 300, 1000, 3000 })
+    {
+        Options options;
+        options.add("point_budget", budget);
+        const point_count_t num = count(options);
+        EXPECT_LE(num, budget);
+        EXPECT_LE(last, num);
+        last = num;
+    }
+
+    {
+        Options options;
+        options.add("point_budget", 1000 * 1000);
+        EXPECT_EQ(numAll, count(options));
+    }
+
+    // about as far apart as the level 0 tiles are wide (a tile with no
+    // points is split regardless), and as close as can be
+    {
+        Options options;
+        options.add("gsd", 1000.0);
+        const point_count_t num = count(options);
+        EXPECT_LE(numLevel0, num);
+        EXPECT_GT(numAll, num);
+    }
+    {
+        Options options;
+        options.add("gsd", 0.000001);
+        EXPECT_EQ(numAll, count(options));
+    }
+
+    // the tiles are finer at the center than at the far corner
+    {
+        LogPtr log(new Log("rialtoreadertest", "stdout"));
+        GeoPackageReader db(filename, log);
+        db.open();
+
+        std::vector<std::string> names;
+        db.readMatrixSetNames(names);
+        const TileMath& tmm = db.getTileMath(names[0]);
+
+        GpkgLod lod;
+        lod.pointBudget = 1000;
+        lod.hasCenter = true;
+        lod.centerX = -150.0;
+        lod.centerY = -70.0;
+
+        uint64_t numPoints = 0;
+        uint32_t centerLevel = 0, cornerLevel = 0;
+        db.queryForTilesLod_begin(names[0], -179.0, -89.0, 179.0, 89.0, MAX_LEVEL, lod, false);
+        do {
+            GpkgTile info;
+            if (!db.queryForTiles_step(info)) break;
+            numPoints += info.getNumPoints();
+            if (tmm.tileContains(info.getColumn(), info.getRow(), info.getLevel(),
+                                 lod.centerX, lod.centerY))
+            {
+                centerLevel = info.getLevel();
+            }
+            if (tmm.tileContains(info.getColumn(), info.getRow(), info.getLevel(),
+                                 150.0, 70.0))
+            {
+                cornerLevel = info.getLevel();
+            }
+        } while (db.queryForTiles_next());
+
+        EXPECT_LE(numPoints, lod.pointBudget);
+        EXPECT_LT(cornerLevel, centerLevel);
+
+        db.close();
+    }
+
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add("point_budget", 1000);
+        options.add("view_center", "1.0;2.0");
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        EXPECT_THROW(reader.prepare(table), pdal_error);
+    }
+
+    FileUtils::deleteFile(filename);
+}
+
+
+TEST(RialtoReaderTest, testCount)
+{
+    static const uint32_t NUM_POINTS = 2000;
+
+    const std::string filename(Support::temppath("rialto11.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        RialtoTest::createDatabase(table, inputView, filename, 4);
+        delete[] actualData;
+    }
+
+    auto query = [&](uint32_t count, const std::string& order, uint32_t numThreads)
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add("count", count);
+        options.add("tile_order", order);
+        options.add("threads", numThreads);
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        PointViewPtr view = *viewSet.begin();
+
+        std::vector<std::pair<double, double>> points;
+        for (PointId i=0; i<view->size(); i++)
+        {
+            points.push_back(std::make_pair(
+                view->getFieldAs<double>(Dimension::Id::X, i),
+                view->getFieldAs<double>(Dimension::Id::Y, i)));
+        }
+        return points;
+    };
+
+    EXPECT_EQ(NUM_POINTS, query(NUM_POINTS * 2, "index", 1).size());
+
+    const std::vector<std::pair<double, double>> first = query(200, "index", 1);
+    EXPECT_EQ(200u, first.size());
+    EXPECT_TRUE(first == query(200, "index", 4));
+
+    // the first tiles are all in the west, while a sample is everywhere
+    auto numQuadrants = [](const std::vector<std::pair<double, double>>& points)
+    {
+        std::set<int> quadrants;
+        for (const auto& p: points)
+        {
+            quadrants.insert((p.first < 0.0 ? 0 : 1) + (p.second < 0.0 ? 0 : 2));
+        }
+        return quadrants.size();
+    };
+    EXPECT_GT(4u, numQuadrants(first));
+
+    const std::vector<std::pair<double, double>> sample = query(200, "uniform", 1);
+    EXPECT_EQ(200u, sample.size());
+    EXPECT_EQ(4u, numQuadrants(sample));
+    EXPECT_TRUE(sample == query(200, "uniform", 4));
+
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add("tile_order", "random");
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        EXPECT_THROW(reader.prepare(table), pdal_error);
+    }
+
+    FileUtils::deleteFile(filename);
+}
+
+
+TEST(RialtoReaderTest, testLimits)
+{
+    static const uint32_t NUM_POINTS = 2000;
+    static const uint32_t MAX_LEVEL = 4;
+
+    const std::string filename(Support::temppath("rialto12.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    // Z goes up from west to east, so a limit on it keeps a band of tiles
+    uint32_t numInLimits = 0;
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        for (PointId i=0; i<NUM_POINTS; i++)
+        {
+            const double z = inputView->getFieldAs<double>(Dimension::Id::X, i);
+            inputView->setField(Dimension::Id::Z, i, z);
+            if (z >= -150.0 && z <= -100.0)
+            {
+                ++numInLimits;
+            }
+        }
+        RialtoTest::createDatabase(table, inputView, filename, MAX_LEVEL);
+        delete[] actualData;
+    }
+
+    LogPtr log(new Log("rialtoreadertest", "stdout"));
+    {
+        GeoPackageReader db(filename, log);
+        db.open();
+
+        std::vector<std::string> names;
+        db.readMatrixSetNames(names);
+        const std::string& name = names[0];
+        EXPECT_TRUE(db.doesTableExist(GeoPackage::statsTableName(name)));
+        EXPECT_TRUE(db.hasTileStats(name));
+
+        auto numTiles = [&](const std::string& limits)
+        {
+            db.setDimLimits(name, GpkgDimLimit::parseList(limits));
+            db.queryForTiles_begin(name, -180.0, -90.0, 180.0, 90.0, MAX_LEVEL, false);
+
+            uint32_t num = 0;
+            GpkgTile tile;
+            while (db.queryForTiles_step(tile))
+            {
+                ++num;
+                db.queryForTiles_next();
+            }
+            return num;
+        };
+
+        const uint32_t all = numTiles("");
+        const uint32_t some = numTiles("Z[-150:-100]");
+        EXPECT_LT(0u, some);
+        EXPECT_GT(all / 2, some);
+        EXPECT_EQ(all, numTiles("Z[:]"));
+        EXPECT_EQ(0u, numTiles("Z[500:]"));
+
+        EXPECT_THROW(db.setDimLimits(name, GpkgDimLimit::parseList("Red[1:2]")), pdal_error);
+
+        db.close();
+    }
+
+    auto query = [&](const std::string& limits)
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add("limits", limits);
+        options.add("dimensions", "Z");
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        return *viewSet.begin();
+    };
+
+    PointViewPtr view = query("Z[-150:-100]");
+    EXPECT_EQ(numInLimits, view->size());
+    for (PointId i=0; i<view->size(); i++)
+    {
+        const double z = view->getFieldAs<double>(Dimension::Id::Z, i);
+        EXPECT_TRUE(z >= -150.0 && z <= -100.0);
+    }
+
+    EXPECT_EQ(NUM_POINTS, query("")->size());
+
+    for (const std::string bad: { "Z", "Z[1:2", "Z[a:2]", "Z[2:1]", "[1:2]" })
+    {
+        EXPECT_THROW(GpkgDimLimit::parseList(bad), pdal_error);
+    }
+
+    FileUtils::deleteFile(filename);
+}
+
+
+TEST(RialtoReaderTest, testRegion)
+{
+    static const uint32_t NUM_POINTS = 2000;
+
+    const std::string filename(Support::temppath("rialto13.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    std::vector<std::pair<double, double>> input;
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        for (uint32_t i=0; i<NUM_POINTS; i++)
+        {
+            input.push_back(std::make_pair(actualData[i].x, actualData[i].y));
+        }
+        RialtoTest::createDatabase(table, inputView, filename, 4);
+        delete[] actualData;
+    }
+
+    auto query = [&](const std::string& option, const std::string& value, uint32_t numThreads)
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add(option, value);
+        options.add("threads", numThreads);
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet viewSet = reader.execute(table);
+        PointViewPtr view = *viewSet.begin();
+
+        std::multiset<std::pair<double, double>> points;
+        for (PointId i=0; i<view->size(); i++)
+        {
+            points.insert(std::make_pair(
+                view->getFieldAs<double>(Dimension::Id::X, i),
+                view->getFieldAs<double>(Dimension::Id::Y, i)));
+        }
+        return points;
+    };
+
+    auto expect = [&](const std::function<bool (double, double)>& inside)
+    {
+        std::multiset<std::pair<double, double>> points;
+        for (const auto& p: input)
+        {
+            if (inside(p.first, p.second))
+            {
+                points.insert(p);
+            }
+        }
+        return points;
+    };
+
+    // a triangle over the equator, with a hole
+    const std::string wkt = "POLYGON ((-170 -80, 170 -80, 0 80, -170 -80),"
+                            " (-10 -10, 10 -10, 10 10, -10 10, -10 -10))";
+    const auto inTriangle = expect([](double x, double y)
+    {
+        const bool inHole = x > -10.0 && x < 10.0 && y > -10.0 && y < 10.0;
+        return y > -80.0 && (y - -80.0) < (x - -170.0) * (160.0 / 170.0) &&
+               (y - -80.0) < (170.0 - x) * (160.0 / 170.0) && !inHole;
+    });
+    EXPECT_LT(0u, inTriangle.size());
+    EXPECT_GT(NUM_POINTS, inTriangle.size());
+    EXPECT_TRUE(inTriangle == query("polygon", wkt, 1));
+    EXPECT_TRUE(inTriangle == query("polygon", wkt, 4));
+
+    const auto inBoxes = expect([](double x, double y)
+    {
+        return (x >= -100.0 && x <= -50.0 && y >= 0.0 && y <= 45.0) ||
+               (x >= 120.0 && x <= 175.0 && y >= -60.0 && y <= -10.0);
+    });
+    EXPECT_LT(0u, inBoxes.size());
+    EXPECT_TRUE(inBoxes == query("boxes", "-100,0,-50,45; 120,-60,175,-10", 1));
+
+    for (const auto& bad: { std::make_pair("polygon", "POLYGON ((0 0, 1 1))"),
+                            std::make_pair("boxes", "1,2,3") })
+    {
+        Options options;
+        options.add("filename", filename);
+        options.add(bad.first, bad.second);
+
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        EXPECT_THROW(reader.prepare(table), pdal_error);
+    }
+
+    FileUtils::deleteFile(filename);
+}
+
+
+TEST(RialtoReaderTest, testSummary)
+{
+    static const uint32_t NUM_POINTS = 2000;
+    static const uint32_t MAX_LEVEL = 4;
+
+    const std::string filename(Support::temppath("rialto14.gpkg"));
+    FileUtils::deleteFile(filename);
+
+    std::vector<RialtoTest::Data> input(NUM_POINTS);
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS);
+        std::copy(actualData, actualData + NUM_POINTS, input.begin());
+        RialtoTest::createDatabase(table, inputView, filename, MAX_LEVEL);
+        delete[] actualData;
+    }
+
+    LogPtr log(new Log("rialtoreadertest", "stdout"));
+
+    GeoPackageReader db(filename, log);
+    db.open();
+
+    std::vector<std::string> names;
+    db.readMatrixSetNames(names);
+    const std::string& name = names[0];
+
+    uint32_t numTiles, numPoints;
+    db.getCountsAtLevel(name, MAX_LEVEL, numTiles, numPoints);
+
+    // the whole matrix: every tile is counted from the index
+    {
+        GpkgSummary summary;
+        db.querySummary(name, -180.0, -90.0, 180.0, 90.0, MAX_LEVEL, false, summary);
+        EXPECT_TRUE(summary.exact);
+        EXPECT_EQ(NUM_POINTS, summary.numPoints);
+        EXPECT_EQ(numTiles, summary.numTilesCounted);
+        EXPECT_EQ(0u, summary.numTilesDecoded);
+        EXPECT_EQ(summary.names[2], "Z");
+        EXPECT_EQ(0.0, summary.minimums[2]);
+        EXPECT_EQ(NUM_POINTS - 1.0, summary.maximums[2]);
+    }
+
+    // a box across tiles: only those on its edges are decoded
+    const double minx = -100.0, miny = -30.0, maxx = 50.0, maxy = 60.0;
+    uint64_t expected = 0;
+    double minz = std::numeric_limits<double>::max();
+    double maxz = std::numeric_limits<double>::lowest();
+    for (const RialtoTest::Data& d: input)
+    {
+        if (d.x >= minx && d.x <= maxx && d.y >= miny && d.y <= maxy)
+        {
+            ++expected;
+            minz = std::min(minz, d.z);
+            maxz = std::max(maxz, d.z);
+        }
+    }
+    {
+        GpkgSummary summary;
+        db.querySummary(name, minx, miny, maxx, maxy, MAX_LEVEL, false, summary);
+        EXPECT_EQ(expected, summary.numPoints);
+        EXPECT_LT(0u, summary.numTilesCounted);
+        EXPECT_LT(0u, summary.numTilesDecoded);
+        EXPECT_GT(numTiles, summary.numTilesCounted + summary.numTilesDecoded);
+        EXPECT_EQ(minz, summary.minimums[2]);
+        EXPECT_EQ(maxz, summary.maximums[2]);
+        EXPECT_LE(minx, summary.minimums[0]);
+        EXPECT_GE(maxx, summary.maximums[0]);
+    }
+    {
+        GpkgSummary summary;
+        db.querySummary(name, minx, miny, maxx, maxy, MAX_LEVEL, true, summary);
+        EXPECT_FALSE(summary.exact);
+        EXPECT_EQ(0u, summary.numTilesDecoded);
+        EXPECT_NEAR((double)expected, (double)summary.numPoints, expected * 0.2);
+        EXPECT_GE(minz, summary.minimums[2]);
+        EXPECT_LE(maxz, summary.maximums[2]);
+    }
+
+    // a summary taken in the middle of a tile query leaves the query be
+    for (int withSummary=0; withSummary<2; withSummary++)
+    {
+        uint32_t numRead = 0;
+        db.queryForTiles_begin(name, -180.0, -90.0, 180.0, 90.0, MAX_LEVEL, false);
+        do {
+            GpkgTile info;
+            if (!db.queryForTiles_step(info)) break;
+            if (withSummary && numRead == 1)
+            {
+                GpkgSummary summary;
+                db.querySummary(name, minx, miny, maxx, maxy, MAX_LEVEL, false, summary);
+                EXPECT_EQ(expected, summary.numPoints);
+            }
+            ++numRead;
+        } while (db.queryForTiles_next());
+        EXPECT_EQ(numTiles, numRead);
+    }
+
+    db.close();
+
+    FileUtils::deleteFile(filename);
+}
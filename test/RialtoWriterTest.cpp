@@ -33,12 +33,18 @@
 ****************************************************************************/
 
 #include "RialtoTest.hpp"
+#include <pdal/BufferReader.hpp>
 #include <pdal/CropFilter.hpp>
+#include <pdal/FauxReader.hpp>
 #include <pdal/LasReader.hpp>
 #include <rialto/RialtoReader.hpp>
 #include <rialto/RialtoWriter.hpp>
+#include "../src/ExternalTileSet.hpp"
+#include "../src/SQLiteCommon.hpp"
 #include "../src/TileMath.hpp"
+#include "../src/WritableTileCommon.hpp"
 #include <rialto/Event.hpp>
+#include <cstring>
 
 using namespace pdal;
 using namespace rialto;
@@ -99,12 +105,13 @@ void verifyDatabase(const std::string& filename, RialtoTest::Data* actualData)
     EXPECT_NEAR(dimensionsInfo[2].getMean(), 38.5, 0.00000001);
     EXPECT_DOUBLE_EQ(dimensionsInfo[2].getMaximum(), 77.0);
 
+    // the tiles the decimation left with no points are there too
     std::vector<uint32_t> tilesAt0;
     db.readTileIdsAtLevel(names[0], 0, tilesAt0);
-    EXPECT_EQ(tilesAt0.size(), 1u);
+    EXPECT_EQ(tilesAt0.size(), 2u);
     std::vector<uint32_t> tilesAt1;
     db.readTileIdsAtLevel(names[0], 1, tilesAt1);
-    EXPECT_EQ(tilesAt1.size(), 2u);
+    EXPECT_EQ(tilesAt1.size(), 8u);
     std::vector<uint32_t> tilesAt2;
     db.readTileIdsAtLevel(names[0], 2, tilesAt2);
     EXPECT_EQ(tilesAt2.size(), 8u);
@@ -114,10 +121,24 @@ void verifyDatabase(const std::string& filename, RialtoTest::Data* actualData)
 
     GpkgTile tileInfo;
 
-    db.readTile(names[0], tilesAt0[0], true, tileInfo);
-    RialtoTest::verifyPointFromBuffer(tileInfo, actualData[0]);
-
     for (int i=0; i<2; i++)
+    {
+        db.readTile(names[0], tilesAt0[i], true, tileInfo);
+        const uint32_t col = tileInfo.getColumn();
+
+        if (col == 1)
+        {
+            EXPECT_EQ(0u, tileInfo.getNumPoints());
+            EXPECT_EQ(0u, tileInfo.getBlobSize());
+            EXPECT_EQ(15u, tileInfo.getMask());
+            continue;
+        }
+        EXPECT_EQ(0u, col);
+
+        RialtoTest::verifyPointFromBuffer(tileInfo, actualData[0]);
+    }
+
+    for (int i=0; i<8; i++)
     {
         db.readTile(names[0], tilesAt1[i], true, tileInfo);
         const uint32_t col = tileInfo.getColumn();
@@ -126,7 +147,12 @@ void verifyDatabase(const std::string& filename, RialtoTest::Data* actualData)
         int idx = -1;
         if (col==0 && row==0) idx = 0;
         if (col==2 && row==0) idx = 4;
-        EXPECT_NE(idx, -1);
+        if (idx == -1)
+        {
+            EXPECT_EQ(0u, tileInfo.getNumPoints());
+            EXPECT_NE(0u, tileInfo.getMask());
+            continue;
+        }
         
         RialtoTest::verifyPointFromBuffer(tileInfo, actualData[idx]);
     }
@@ -195,6 +221,889 @@ TEST(RialtoWriterTest, testPointToTile)
 }
 
 
+static void compareTileSets(const WritableTileSet& expectedSet,
+                            const WritableTileSet& actualSet)
+{
+    const std::vector<WritableTile*>& expectedTiles = expectedSet.getTiles();
+    const std::vector<WritableTile*>& actualTiles = actualSet.getTiles();
+    ASSERT_EQ(expectedTiles.size(), actualTiles.size());
+
+    for (size_t i=0; i<expectedTiles.size(); i++)
+    {
+        WritableTile* a = expectedTiles[i];
+        WritableTile* b = actualTiles[i];
+        EXPECT_EQ(a->getLevel(), b->getLevel());
+        EXPECT_EQ(a->getColumn(), b->getColumn());
+        EXPECT_EQ(a->getRow(), b->getRow());
+        EXPECT_EQ(a->getMask(), b->getMask());
+
+        PointViewPtr av = a->getPointView();
+        PointViewPtr bv = b->getPointView();
+        ASSERT_EQ(av == NULL, bv == NULL);
+        if (!av) continue;
+        ASSERT_EQ(av->size(), bv->size());
+        for (PointId j=0; j<av->size(); j++)
+        {
+            EXPECT_EQ(av->getFieldAs<double>(Dimension::Id::Z, j),
+                      bv->getFieldAs<double>(Dimension::Id::Z, j));
+        }
+    }
+}
+
+
+// the threaded and Morton builds must make exactly the same tiles as the
+// serial one
+TEST(RialtoWriterTest, testBuilders)
+{
+    static const uint32_t NUM_POINTS = 20000;
+    static const uint32_t maxLevel = 8;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    for (int global=0; global<2; global++)
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS, global);
+
+        WritableTileSet serialSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1, log);
+        PointViewSet serialViews;
+        serialSet.build(inputView, &serialViews, 1);
+
+        WritableTileSet threadedSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1, log);
+        PointViewSet threadedViews;
+        threadedSet.build(inputView, &threadedViews, 4);
+        compareTileSets(serialSet, threadedSet);
+
+        WritableTileSet mortonSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1, log);
+        PointViewSet mortonViews;
+        mortonSet.buildMorton(inputView, &mortonViews);
+        compareTileSets(serialSet, mortonSet);
+
+        delete[] actualData;
+    }
+}
+
+
+// the external build must make the same tiles as the Morton one, however
+// little memory it is given
+TEST(RialtoWriterTest, testExternalBuilder)
+{
+    static const uint32_t NUM_POINTS = 20000;
+    static const uint32_t maxLevel = 8;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    for (int global=0; global<2; global++)
+    {
+        PointTable table;
+        PointViewPtr inputView(new PointView(table));
+        RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS, global);
+
+        WritableTileSet mortonSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1, log);
+        PointViewSet mortonViews;
+        mortonSet.buildMorton(inputView, &mortonViews);
+
+        std::map<std::string, GpkgTile> expected;
+        for (auto tile: mortonSet.getTiles())
+        {
+            PointView* pv = tile->getPointView().get();
+            if (!tile->getMask() && !(pv && pv->size() > 0))
+            {
+                continue; // a root with nothing in it
+            }
+            GpkgTile t(pv, tile->getLevel(), tile->getColumn(), tile->getRow(),
+                       tile->getMask());
+            std::ostringstream oss;
+            oss << t.getLevel() << "/" << t.getColumn() << "/" << t.getRow();
+            expected[oss.str()] = t;
+        }
+
+        const DimTypeList dtl = inputView->dimTypes();
+        std::vector<char> buf(inputView->pointSize());
+
+        // enough for everything; a few hundred points; a few dozen
+        const uint64_t budgets[] = { 1024 * 1024 * 1024, 20000, 2000 };
+        for (uint64_t budget: budgets)
+        {
+            ExternalTileSet tileSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1,
+                                    dtl, budget, "", log);
+            for (PointId idx=0; idx<inputView->size(); ++idx)
+            {
+                inputView->getPackedPoint(dtl, idx, buf.data());
+                tileSet.add(inputView->getFieldAs<double>(Dimension::Id::X, idx),
+                            inputView->getFieldAs<double>(Dimension::Id::Y, idx),
+                            buf.data());
+            }
+
+            size_t numTiles = 0;
+            tileSet.finish([&](GpkgTile& t)
+            {
+                std::ostringstream oss;
+                oss << t.getLevel() << "/" << t.getColumn() << "/" << t.getRow();
+                ASSERT_EQ(expected.count(oss.str()), 1u);
+                const GpkgTile& e = expected[oss.str()];
+                EXPECT_EQ(e.getMask(), t.getMask());
+                EXPECT_EQ(e.getNumPoints(), t.getNumPoints());
+                EXPECT_TRUE(e.getBlob() == t.getBlob());
+                ++numTiles;
+            });
+            EXPECT_EQ(expected.size(), numTiles);
+        }
+
+        delete[] actualData;
+    }
+}
+
+
+// points in Morton order make the same tiles whether or not the build is
+// told so, but when it is, most come out while the points are being added
+TEST(RialtoWriterTest, testExternalBuilderSorted)
+{
+    static const uint32_t NUM_POINTS = 20000;
+    static const uint32_t maxLevel = 8;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    PointTable table;
+    PointViewPtr inputView(new PointView(table));
+    RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, inputView, NUM_POINTS, true);
+
+    const TileMath tmm(-180.0, -90.0, 180.0, 90.0, 2, 1);
+    std::vector<std::pair<uint64_t, PointId>> order;
+    for (PointId idx=0; idx<inputView->size(); ++idx)
+    {
+        uint32_t c, r;
+        tmm.getTileOfPoint(inputView->getFieldAs<double>(Dimension::Id::X, idx),
+                           inputView->getFieldAs<double>(Dimension::Id::Y, idx),
+                           maxLevel, c, r);
+        order.push_back(std::make_pair(tmm.getMortonKey(c, r, maxLevel), idx));
+    }
+    std::sort(order.begin(), order.end());
+
+    const DimTypeList dtl = inputView->dimTypes();
+    std::vector<char> buf(inputView->pointSize());
+
+    typedef std::map<std::string, std::pair<uint32_t, std::vector<char>>> TileMap;
+
+    auto build = [&](bool sorted, uint64_t budget, size_t& numEarly)
+    {
+        TileMap tiles;
+        auto sink = [&](GpkgTile& t)
+        {
+            std::ostringstream oss;
+            oss << t.getLevel() << "/" << t.getColumn() << "/" << t.getRow();
+            EXPECT_EQ(0u, tiles.count(oss.str()));
+            tiles[oss.str()] = std::make_pair(t.getMask(), t.getBlob());
+        };
+
+        ExternalTileSet tileSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1,
+                                dtl, budget, "", log);
+        if (sorted)
+        {
+            tileSet.setSortedSink(sink);
+        }
+        for (const auto& it: order)
+        {
+            inputView->getPackedPoint(dtl, it.second, buf.data());
+            tileSet.add(inputView->getFieldAs<double>(Dimension::Id::X, it.second),
+                        inputView->getFieldAs<double>(Dimension::Id::Y, it.second),
+                        buf.data());
+        }
+        numEarly = tiles.size();
+        tileSet.finish(sink);
+        return tiles;
+    };
+
+    size_t numEarly;
+    const TileMap expected = build(false, 1024 * 1024 * 1024, numEarly);
+    EXPECT_EQ(0u, numEarly);
+
+    for (uint64_t budget: { (uint64_t)1024 * 1024 * 1024, (uint64_t)2000 })
+    {
+        EXPECT_TRUE(expected == build(true, budget, numEarly));
+        EXPECT_LT(expected.size() / 2, numEarly);
+    }
+
+    // a point can't go back to a subtree already built
+    {
+        ExternalTileSet tileSet(maxLevel, -180.0, -90.0, 180.0, 90.0, 2, 1,
+                                dtl, 1024 * 1024, "", log);
+        tileSet.setSortedSink([](GpkgTile&) {});
+        auto add = [&](PointId idx)
+        {
+            inputView->getPackedPoint(dtl, idx, buf.data());
+            tileSet.add(inputView->getFieldAs<double>(Dimension::Id::X, idx),
+                        inputView->getFieldAs<double>(Dimension::Id::Y, idx),
+                        buf.data());
+        };
+        add(order.front().second);
+        add(order.back().second);
+        EXPECT_THROW(add(order.front().second), pdal_error);
+    }
+
+    delete[] actualData;
+}
+
+
+// streaming the points through must make the same tiles as reading them
+// all in first
+TEST(RialtoWriterTest, testStreaming)
+{
+    static const uint32_t maxLevel = 6;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    const std::string filenames[2] = {
+        Support::temppath("rialto_batch.gpkg"),
+        Support::temppath("rialto_stream.gpkg")
+    };
+
+    for (int stream=0; stream<2; stream++)
+    {
+        const std::string& filename = filenames[stream];
+        FileUtils::deleteFile(filename);
+        {
+            GeoPackageManager db(filename, log);
+            db.open();
+            db.close();
+        }
+
+        Options readerOptions;
+        readerOptions.add("mode", "ramp");
+        readerOptions.add("count", 10000);
+        readerOptions.add("bounds", BOX3D(-170.0, -80.0, 0.0, 170.0, 80.0, 100.0));
+        FauxReader reader;
+        reader.setOptions(readerOptions);
+        reader.setSpatialReference(SpatialReference("EPSG:4326"));
+
+        Options writerOptions;
+        writerOptions.add("filename", filename);
+        writerOptions.add("dataset", "tiles");
+        writerOptions.add("numColsAtL0", 2);
+        writerOptions.add("numRowsAtL0", 1);
+        writerOptions.add("timestamp", "");
+        writerOptions.add("description", "");
+        writerOptions.add("maxLevel", maxLevel);
+        writerOptions.add("tms_minx", -180.0);
+        writerOptions.add("tms_miny", -90.0);
+        writerOptions.add("tms_maxx", 180.0);
+        writerOptions.add("tms_maxy", 90.0);
+        writerOptions.add("builder", "morton");
+        RialtoWriter writer;
+        writer.setOptions(writerOptions);
+        writer.setInput(reader);
+
+        if (stream)
+        {
+            FixedPointTable table(1000);
+            writer.prepare(table);
+            writer.execute(table);
+        }
+        else
+        {
+            PointTable table;
+            writer.prepare(table);
+            writer.execute(table);
+        }
+    }
+
+    GeoPackageReader batchDb(filenames[0], log);
+    batchDb.open();
+    GeoPackageReader streamDb(filenames[1], log);
+    streamDb.open();
+
+    for (uint32_t level=0; level<=maxLevel; level++)
+    {
+        uint32_t batchTiles, batchPoints, streamTiles, streamPoints;
+        batchDb.getCountsAtLevel("tiles", level, batchTiles, batchPoints);
+        streamDb.getCountsAtLevel("tiles", level, streamTiles, streamPoints);
+        EXPECT_EQ(batchTiles, streamTiles);
+        EXPECT_EQ(batchPoints, streamPoints);
+    }
+
+    batchDb.close();
+    streamDb.close();
+
+    FileUtils::deleteFile(filenames[0]);
+    FileUtils::deleteFile(filenames[1]);
+}
+
+
+static void writeView(PointTable& table, PointViewPtr view,
+                      const std::string& filename, uint32_t maxLevel, bool append,
+                      uint32_t numThreads=1, bool ordered=true,
+                      const std::string& encoding="packed",
+                      double scaleXY=0.0, double scaleZ=0.0,
+                      const std::string& compression="")
+{
+    BufferReader reader;
+    reader.addView(view);
+    reader.setSpatialReference(SpatialReference("EPSG:4326"));
+
+    Options writerOptions;
+    writerOptions.add("filename", filename);
+    writerOptions.add("dataset", "tiles");
+    writerOptions.add("numColsAtL0", 2);
+    writerOptions.add("numRowsAtL0", 1);
+    writerOptions.add("timestamp", "");
+    writerOptions.add("description", "");
+    writerOptions.add("maxLevel", maxLevel);
+    writerOptions.add("tms_minx", -180.0);
+    writerOptions.add("tms_miny", -90.0);
+    writerOptions.add("tms_maxx", 180.0);
+    writerOptions.add("tms_maxy", 90.0);
+    writerOptions.add("builder", "morton");
+    writerOptions.add("append", append);
+    writerOptions.add("threads", numThreads);
+    writerOptions.add("ordered", ordered);
+    writerOptions.add("encoding", encoding);
+    writerOptions.add("scale_x", scaleXY);
+    writerOptions.add("scale_y", scaleXY);
+    writerOptions.add("scale_z", scaleZ);
+    writerOptions.add("compression", compression);
+    RialtoWriter writer;
+    writer.setOptions(writerOptions);
+    writer.setInput(reader);
+
+    writer.prepare(table);
+    writer.execute(table);
+}
+
+
+// writing the points in two goes, appending the second, must make the same
+// tiles and stats as writing them all at once
+TEST(RialtoWriterTest, testAppend)
+{
+    static const uint32_t NUM_POINTS = 10000;
+    static const uint32_t maxLevel = 6;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    const std::string wholeName(Support::temppath("rialto_whole.gpkg"));
+    const std::string partsName(Support::temppath("rialto_parts.gpkg"));
+    for (auto filename: { wholeName, partsName })
+    {
+        FileUtils::deleteFile(filename);
+        GeoPackageManager db(filename, log);
+        db.open();
+        db.close();
+    }
+
+    PointTable table;
+    PointViewPtr allView(new PointView(table));
+    RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, allView, NUM_POINTS, true);
+
+    PointViewPtr firstView = allView->makeNew();
+    PointViewPtr secondView = allView->makeNew();
+    for (PointId i=0; i<NUM_POINTS; i++)
+    {
+        (i < NUM_POINTS / 2 ? firstView : secondView)->appendPoint(*allView, i);
+    }
+
+    writeView(table, allView, wholeName, maxLevel, false);
+    writeView(table, firstView, partsName, maxLevel, true);
+    writeView(table, secondView, partsName, maxLevel, true);
+
+    // the table must exist already unless appending
+    EXPECT_THROW(writeView(table, secondView, partsName, maxLevel, false), pdal_error);
+
+    GeoPackageReader wholeDb(wholeName, log);
+    wholeDb.open();
+    GeoPackageReader partsDb(partsName, log);
+    partsDb.open();
+
+    for (uint32_t level=0; level<=maxLevel; level++)
+    {
+        // (column,row) -> (mask,points)
+        std::map<std::pair<uint32_t, uint32_t>, std::pair<uint32_t, uint32_t>> tiles[2];
+
+        GeoPackageReader* dbs[2] = { &wholeDb, &partsDb };
+        for (int i=0; i<2; i++)
+        {
+            std::vector<uint32_t> ids;
+            dbs[i]->readTileIdsAtLevel("tiles", level, ids);
+            for (uint32_t id: ids)
+            {
+                GpkgTile tile;
+                dbs[i]->readTile("tiles", id, false, tile);
+                tiles[i][std::make_pair(tile.getColumn(), tile.getRow())] =
+                    std::make_pair(tile.getMask(), tile.getNumPoints());
+            }
+        }
+
+        EXPECT_TRUE(tiles[0] == tiles[1]);
+    }
+
+    GpkgMatrixSet wholeInfo, partsInfo;
+    wholeDb.readMatrixSet("tiles", wholeInfo);
+    partsDb.readMatrixSet("tiles", partsInfo);
+    const std::vector<GpkgDimension>& wholeDims = wholeInfo.getDimensions();
+    const std::vector<GpkgDimension>& partsDims = partsInfo.getDimensions();
+    ASSERT_EQ(wholeDims.size(), partsDims.size());
+    for (size_t i=0; i<wholeDims.size(); i++)
+    {
+        EXPECT_DOUBLE_EQ(wholeDims[i].getMinimum(), partsDims[i].getMinimum());
+        EXPECT_NEAR(wholeDims[i].getMean(), partsDims[i].getMean(), 0.0001);
+        EXPECT_DOUBLE_EQ(wholeDims[i].getMaximum(), partsDims[i].getMaximum());
+    }
+
+    wholeDb.close();
+    partsDb.close();
+
+    // a table written before the empty tiles were stored can't be appended
+    // to, as the masks over its old points aren't known
+    {
+        SQLite sqlite(partsName, log);
+        sqlite.connect(true);
+        sqlite.execute("DELETE FROM gpkg_extensions WHERE extension_name='" +
+                       GeoPackage::emptyTilesExtensionName() + "'");
+    }
+    EXPECT_THROW(writeView(table, secondView, partsName, maxLevel, true), pdal_error);
+
+    FileUtils::deleteFile(wholeName);
+    FileUtils::deleteFile(partsName);
+
+    delete[] actualData;
+}
+
+
+// encoding on several threads must write the same tiles, in the same
+// order unless asked not to keep it
+TEST(RialtoWriterTest, testParallelEncoding)
+{
+    static const uint32_t NUM_POINTS = 10000;
+    static const uint32_t maxLevel = 6;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    const std::string filenames[3] = {
+        Support::temppath("rialto_serial.gpkg"),
+        Support::temppath("rialto_ordered.gpkg"),
+        Support::temppath("rialto_unordered.gpkg")
+    };
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+        GeoPackageManager db(filename, log);
+        db.open();
+        db.close();
+    }
+
+    PointTable table;
+    PointViewPtr view(new PointView(table));
+    RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, view, NUM_POINTS, true);
+
+    writeView(table, view, filenames[0], maxLevel, false);
+    writeView(table, view, filenames[1], maxLevel, false, 4, true);
+    writeView(table, view, filenames[2], maxLevel, false, 4, false);
+
+    // (level,column,row,mask,points) and blob, in the order written
+    typedef std::pair<std::vector<uint32_t>, std::vector<char>> TileSig;
+    std::vector<TileSig> tiles[3];
+
+    for (int i=0; i<3; i++)
+    {
+        GeoPackageReader db(filenames[i], log);
+        db.open();
+
+        for (uint32_t level=0; level<=maxLevel; level++)
+        {
+            std::vector<uint32_t> ids;
+            db.readTileIdsAtLevel("tiles", level, ids);
+            std::sort(ids.begin(), ids.end());
+            for (uint32_t id: ids)
+            {
+                GpkgTile tile;
+                db.readTile("tiles", id, true, tile);
+                std::vector<uint32_t> info = { tile.getLevel(), tile.getColumn(),
+                                               tile.getRow(), tile.getMask(),
+                                               tile.getNumPoints() };
+                tiles[i].push_back(TileSig(info, tile.getBlob()));
+            }
+        }
+
+        db.close();
+    }
+
+    EXPECT_FALSE(tiles[0].empty());
+    EXPECT_TRUE(tiles[0] == tiles[1]);
+
+    EXPECT_EQ(tiles[0].size(), tiles[2].size());
+    std::sort(tiles[0].begin(), tiles[0].end());
+    std::sort(tiles[2].begin(), tiles[2].end());
+    EXPECT_TRUE(tiles[0] == tiles[2]);
+
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+    }
+
+    delete[] actualData;
+}
+
+
+// the columnar tiles must read back the same as the packed ones, and
+// appending must keep to the table's encoding
+TEST(RialtoWriterTest, testColumnar)
+{
+    static const uint32_t NUM_POINTS = 10000;
+    static const uint32_t maxLevel = 5;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    const std::string filenames[2] = {
+        Support::temppath("rialto_packed.gpkg"),
+        Support::temppath("rialto_columnar.gpkg")
+    };
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+        GeoPackageManager db(filename, log);
+        db.open();
+        db.close();
+    }
+
+    PointTable table;
+    PointViewPtr allView(new PointView(table));
+    RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, allView, NUM_POINTS, true);
+
+    PointViewPtr firstView = allView->makeNew();
+    PointViewPtr secondView = allView->makeNew();
+    for (PointId i=0; i<NUM_POINTS; i++)
+    {
+        (i < NUM_POINTS / 2 ? firstView : secondView)->appendPoint(*allView, i);
+    }
+
+    writeView(table, allView, filenames[0], maxLevel, false);
+    writeView(table, firstView, filenames[1], maxLevel, false, 1, true, "columnar");
+    writeView(table, secondView, filenames[1], maxLevel, true);
+
+    {
+        GeoPackageReader db(filenames[1], log);
+        db.open();
+        GpkgMatrixSet info;
+        db.readMatrixSet("tiles", info);
+        EXPECT_EQ(GpkgEncodingColumnar, info.getEncoding());
+        db.close();
+    }
+
+    std::vector<std::vector<double>> points[2];
+    for (int i=0; i<2; i++)
+    {
+        Options options;
+        options.add("filename", filenames[i]);
+        options.add("dataset", "tiles");
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet views = reader.execute(table);
+        ASSERT_EQ(views.size(), 1u);
+        PointViewPtr view = *views.begin();
+        EXPECT_EQ(view->size(), NUM_POINTS);
+
+        for (PointId j=0; j<view->size(); j++)
+        {
+            points[i].push_back({
+                view->getFieldAs<double>(Dimension::Id::X, j),
+                view->getFieldAs<double>(Dimension::Id::Y, j),
+                view->getFieldAs<double>(Dimension::Id::Z, j) });
+        }
+        std::sort(points[i].begin(), points[i].end());
+    }
+    EXPECT_TRUE(points[0] == points[1]);
+
+    // just some of the columns
+    {
+        Options options;
+        options.add("filename", filenames[1]);
+        options.add("dataset", "tiles");
+        options.add("dimensions", "X,Y");
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet views = reader.execute(table);
+        PointViewPtr view = *views.begin();
+        EXPECT_EQ(2u, table.layout()->dims().size());
+        ASSERT_EQ(view->size(), NUM_POINTS);
+
+        std::vector<std::pair<double, double>> xys;
+        for (PointId j=0; j<view->size(); j++)
+        {
+            xys.push_back(std::make_pair(view->getFieldAs<double>(Dimension::Id::X, j),
+                                         view->getFieldAs<double>(Dimension::Id::Y, j)));
+        }
+        std::sort(xys.begin(), xys.end());
+        for (size_t j=0; j<xys.size(); j++)
+        {
+            EXPECT_EQ(points[0][j][0], xys[j].first);
+            EXPECT_EQ(points[0][j][1], xys[j].second);
+        }
+    }
+
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+    }
+
+    delete[] actualData;
+}
+
+
+// the quantized tiles must read back to within half a step of the points,
+// in fewer bytes, and appending must keep to the table's scales
+TEST(RialtoWriterTest, testQuantized)
+{
+    static const uint32_t NUM_POINTS = 10000;
+    static const uint32_t maxLevel = 5;
+    static const double scaleXY = 1.0e-7;
+    static const double scaleZ = 0.01;
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    const std::string filenames[3] = {
+        Support::temppath("rialto_unquantized.gpkg"),
+        Support::temppath("rialto_quantized.gpkg"),
+        Support::temppath("rialto_quantized_columnar.gpkg")
+    };
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+        GeoPackageManager db(filename, log);
+        db.open();
+        db.close();
+    }
+
+    PointTable table;
+    PointViewPtr allView(new PointView(table));
+    RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, allView, NUM_POINTS, true);
+
+    PointViewPtr firstView = allView->makeNew();
+    PointViewPtr secondView = allView->makeNew();
+    for (PointId i=0; i<NUM_POINTS; i++)
+    {
+        (i < NUM_POINTS / 2 ? firstView : secondView)->appendPoint(*allView, i);
+    }
+
+    writeView(table, allView, filenames[0], maxLevel, false);
+    writeView(table, allView, filenames[1], maxLevel, false, 1, true, "packed",
+              scaleXY, scaleZ);
+    writeView(table, firstView, filenames[2], maxLevel, false, 1, true, "columnar",
+              scaleXY, scaleZ);
+    writeView(table, secondView, filenames[2], maxLevel, true);
+
+    size_t blobBytes[3] = { 0, 0, 0 };
+    for (int i=0; i<3; i++)
+    {
+        GeoPackageReader db(filenames[i], log);
+        db.open();
+
+        GpkgMatrixSet info;
+        db.readMatrixSet("tiles", info);
+        const GpkgTileFormat format(info.getTileFormat());
+        EXPECT_EQ(i != 0, format.isQuantized());
+        if (i != 0)
+        {
+            EXPECT_DOUBLE_EQ(scaleXY, format.getScaleX());
+            EXPECT_DOUBLE_EQ(scaleXY, format.getScaleY());
+            EXPECT_DOUBLE_EQ(scaleZ, format.getScaleZ());
+        }
+
+        for (uint32_t level=0; level<=maxLevel; level++)
+        {
+            std::vector<uint32_t> ids;
+            db.readTileIdsAtLevel("tiles", level, ids);
+            for (uint32_t id: ids)
+            {
+                GpkgTile tile;
+                db.readTile("tiles", id, true, tile);
+                blobBytes[i] += tile.getBlobSize();
+            }
+        }
+
+        db.close();
+    }
+    EXPECT_LT(blobBytes[1], blobBytes[0]);
+
+    std::vector<std::vector<double>> points[3];
+    for (int i=0; i<3; i++)
+    {
+        Options options;
+        options.add("filename", filenames[i]);
+        options.add("dataset", "tiles");
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet views = reader.execute(table);
+        ASSERT_EQ(views.size(), 1u);
+        PointViewPtr view = *views.begin();
+        ASSERT_EQ(view->size(), NUM_POINTS);
+
+        for (PointId j=0; j<view->size(); j++)
+        {
+            points[i].push_back({
+                view->getFieldAs<double>(Dimension::Id::X, j),
+                view->getFieldAs<double>(Dimension::Id::Y, j),
+                view->getFieldAs<double>(Dimension::Id::Z, j) });
+        }
+        std::sort(points[i].begin(), points[i].end());
+    }
+
+    for (int i=1; i<3; i++)
+    {
+        for (uint32_t j=0; j<NUM_POINTS; j++)
+        {
+            EXPECT_NEAR(points[0][j][0], points[i][j][0], scaleXY * 0.5 + 1.0e-9);
+            EXPECT_NEAR(points[0][j][1], points[i][j][1], scaleXY * 0.5 + 1.0e-9);
+            EXPECT_NEAR(points[0][j][2], points[i][j][2], scaleZ * 0.5 + 1.0e-9);
+        }
+    }
+
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+    }
+
+    delete[] actualData;
+}
+
+
+// the tiles must read back the same whatever the codec of their level, and
+// appending must keep to the table's codecs
+TEST(RialtoWriterTest, testCompression)
+{
+    static const uint32_t NUM_POINTS = 10000;
+    static const uint32_t maxLevel = 5;
+
+    EXPECT_EQ("zstd:3", GpkgCodec::parse("zstd").getName());
+    EXPECT_EQ("lz4,zstd:19", GpkgCodec::toList(GpkgCodec::parseList("lz4, zstd:19")));
+    EXPECT_THROW(GpkgCodec::parse("gzip"), pdal_error);
+    EXPECT_THROW(GpkgCodec::parse("zstd:0"), pdal_error);
+    EXPECT_THROW(GpkgCodec::parse("zstd:fast"), pdal_error);
+    EXPECT_THROW(GpkgCodec::parse("lz4:1"), pdal_error);
+    EXPECT_THROW(GpkgCodec::parseList(""), pdal_error);
+    {
+        GpkgTileFormat format(GpkgEncodingColumnar);
+        EXPECT_EQ(GpkgCompressionNone, format.getCodec(0).getCompression());
+        EXPECT_THROW(format.setCodecs({ GpkgCodec(GpkgCompressionLazPerf) }), pdal_error);
+    }
+
+    LogPtr log(new Log("rialtowritertest", "stdout"));
+
+    const std::string filenames[3] = {
+        Support::temppath("rialto_none.gpkg"),
+        Support::temppath("rialto_lz4_zstd.gpkg"),
+        Support::temppath("rialto_columnar_zstd.gpkg")
+    };
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+        GeoPackageManager db(filename, log);
+        db.open();
+        db.close();
+    }
+
+    PointTable table;
+    PointViewPtr allView(new PointView(table));
+    RialtoTest::Data* actualData = RialtoTest::randomDataInit(table, allView, NUM_POINTS, true);
+
+    PointViewPtr firstView = allView->makeNew();
+    PointViewPtr secondView = allView->makeNew();
+    for (PointId i=0; i<NUM_POINTS; i++)
+    {
+        (i < NUM_POINTS / 2 ? firstView : secondView)->appendPoint(*allView, i);
+    }
+
+    writeView(table, allView, filenames[0], maxLevel, false, 1, true, "packed",
+              0.0, 0.0, "none");
+    writeView(table, firstView, filenames[1], maxLevel, false, 1, true, "packed",
+              0.0, 0.0, "lz4,lz4,zstd:19");
+    writeView(table, secondView, filenames[1], maxLevel, true);
+    writeView(table, allView, filenames[2], maxLevel, false, 1, true, "columnar",
+              1.0e-7, 0.01, "zstd");
+
+    const std::string expectedCodecs[3] = { "none", "lz4,lz4,zstd:19", "zstd:3" };
+    for (int i=0; i<3; i++)
+    {
+        GeoPackageReader db(filenames[i], log);
+        db.open();
+        GpkgMatrixSet info;
+        db.readMatrixSet("tiles", info);
+        const GpkgTileFormat format(info.getTileFormat());
+        EXPECT_EQ(expectedCodecs[i], GpkgCodec::toList(format.getCodecs()));
+        if (i != 0)
+        {
+            EXPECT_EQ(GpkgCompressionZstd, format.getCodec(maxLevel).getCompression());
+
+            // a tile whose size prefix doesn't fit its points is refused
+            std::vector<uint32_t> ids;
+            db.readTileIdsAtLevel("tiles", maxLevel, ids);
+            ASSERT_FALSE(ids.empty());
+            GpkgTile tile;
+            db.readTile("tiles", ids[0], true, tile);
+            ASSERT_LT(0u, tile.getNumPoints());
+            std::vector<char> blob(tile.getBlobData(), tile.getBlobData() + tile.getBlobSize());
+            std::vector<char> packed;
+            for (uint32_t size: { 0xffffffffu, 1u })
+            {
+                std::memcpy(blob.data(), &size, sizeof(size));
+                GpkgTile bad;
+                bad.set(tile.getLevel(), tile.getColumn(), tile.getRow(),
+                        tile.getNumPoints(), tile.getMask(), blob);
+                EXPECT_THROW(bad.decode(info.getDimTypes(), packed, format), pdal_error);
+            }
+        }
+        db.close();
+    }
+
+    std::vector<std::vector<double>> points[3];
+    for (int i=0; i<3; i++)
+    {
+        Options options;
+        options.add("filename", filenames[i]);
+        options.add("dataset", "tiles");
+        RialtoReader reader;
+        reader.setOptions(options);
+
+        PointTable table;
+        reader.prepare(table);
+        PointViewSet views = reader.execute(table);
+        ASSERT_EQ(views.size(), 1u);
+        PointViewPtr view = *views.begin();
+        ASSERT_EQ(view->size(), NUM_POINTS);
+
+        for (PointId j=0; j<view->size(); j++)
+        {
+            points[i].push_back({
+                view->getFieldAs<double>(Dimension::Id::X, j),
+                view->getFieldAs<double>(Dimension::Id::Y, j),
+                view->getFieldAs<double>(Dimension::Id::Z, j) });
+        }
+        std::sort(points[i].begin(), points[i].end());
+    }
+    EXPECT_TRUE(points[0] == points[1]);
+    for (uint32_t j=0; j<NUM_POINTS; j++)
+    {
+        EXPECT_NEAR(points[0][j][0], points[2][j][0], 0.5e-7 + 1.0e-9);
+        EXPECT_NEAR(points[0][j][1], points[2][j][1], 0.5e-7 + 1.0e-9);
+        EXPECT_NEAR(points[0][j][2], points[2][j][2], 0.005 + 1.0e-9);
+    }
+
+    for (auto filename: filenames)
+    {
+        FileUtils::deleteFile(filename);
+    }
+
+    delete[] actualData;
+}
+
+
 TEST(RialtoWriterTest, testWriter)
 {
     const std::string filename(Support::temppath("rialto2.gpkg"));
@@ -232,17 +1141,21 @@ TEST(RialtoWriterTest, testWriter)
         {
             std::vector<uint32_t> ids;
 
+            // the tiles are numbered in the order the build made them,
+            // those with no points of their own included
             db.queryForTileIds(tileTableName, 0.1, 0.1, 179.9, 89.9, 0, ids);
-            EXPECT_EQ(ids.size(), 0u);
+            EXPECT_EQ(ids.size(), 1u);
+            EXPECT_EQ(ids[0], 2u);
 
             db.queryForTileIds(tileTableName, 0.1, 0.1, 179.9, 89.9, 1, ids);
-            EXPECT_EQ(ids.size(), 1u);
-            EXPECT_EQ(ids[0], 7u);
+            EXPECT_EQ(ids.size(), 2u);
+            EXPECT_EQ(ids[0], 11u);
+            EXPECT_EQ(ids[1], 13u);
 
             db.queryForTileIds(tileTableName, 0.1, 0.1, 179.9, 89.9, 2, ids);
             EXPECT_EQ(ids.size(), 2u);
-            EXPECT_EQ(ids[0], 8u);
-            EXPECT_EQ(ids[1], 9u);
+            EXPECT_EQ(ids[0], 12u);
+            EXPECT_EQ(ids[1], 14u);
         }
 
         db.close();
@@ -697,6 +1610,72 @@ TEST(RialtoWriterTest, writePerf)
     e_write.dump();
 
     FileUtils::deleteFile(filename);
+
+    // compare tile-at-a-time inserts with bulk inserts of the same tiles
+    {
+        static const uint32_t NUM_TILES = 20 * K;
+        static const uint32_t tileLevel = 7; // 256x128 tiles
+
+        LogPtr log(new Log("rialtowritertest", "stdout"));
+
+        PointTable table;
+        PointViewPtr tileView(new PointView(table));
+        RialtoTest::Data* tileData = RialtoTest::randomDataInit(table, tileView, 100, false);
+
+        std::vector<GpkgTile> tiles;
+        tiles.reserve(NUM_TILES);
+        for (uint32_t i=0; i<NUM_TILES; i++)
+        {
+            tiles.emplace_back(tileView.get(), tileLevel, i % 256, i / 256, 0);
+        }
+
+        GeoPackageWriter gpkg(filename, log);
+        gpkg.open();
+
+        const GpkgMatrixSet single("single", table.layout(), "now",
+                                   SpatialReference("EPSG:4326"), 2, 1,
+                                   "", "", tileLevel);
+        const GpkgMatrixSet bulk("bulk", table.layout(), "now",
+                                 SpatialReference("EPSG:4326"), 2, 1,
+                                 "", "", tileLevel);
+        gpkg.writeTileTable(single);
+        gpkg.writeTileTable(bulk);
+
+        clock_t start = Event::timerStart();
+        gpkg.beginTransaction();
+        for (auto& tile: tiles)
+        {
+            gpkg.writeTile("single", tile);
+        }
+        gpkg.commitTransaction();
+        const double singleMillis = Event::timerStop(start);
+
+        start = Event::timerStart();
+        gpkg.beginTransaction();
+        gpkg.writeTiles("bulk", tiles);
+        gpkg.commitTransaction();
+        const double bulkMillis = Event::timerStop(start);
+
+        gpkg.close();
+
+        printf("* writeTile:  %u tiles, %.0f tiles/sec\n", NUM_TILES,
+               NUM_TILES / (std::max(singleMillis, 1.0) / 1000.0));
+        printf("* writeTiles: %u tiles, %.0f tiles/sec\n", NUM_TILES,
+               NUM_TILES / (std::max(bulkMillis, 1.0) / 1000.0));
+
+        GeoPackageReader reader(filename, log);
+        reader.open();
+        uint32_t numTiles, numPoints;
+        reader.getCountsAtLevel("single", tileLevel, numTiles, numPoints);
+        EXPECT_EQ(NUM_TILES, numTiles);
+        reader.getCountsAtLevel("bulk", tileLevel, numTiles, numPoints);
+        EXPECT_EQ(NUM_TILES, numTiles);
+        reader.close();
+
+        delete[] tileData;
+
+        FileUtils::deleteFile(filename);
+    }
 }
 
 
@@ -325,3 +325,56 @@ TEST(TilerTest, test_tiler_matrix_rect_contains_rect)
     // A completely contains B only along y-axis
     EXPECT_FALSE(TileMath::rectContainsRect(1.4, 1.0, 1.6, 2.0, 1.0, 1.4, 2.0, 1.6));
 }
+
+
+TEST(TilerTest, test_tiler_morton_keys)
+{
+    // 4326
+    const TileMath tmm(-180.0, -90.0, 180.0, 90.0, 2, 1);
+
+    EXPECT_EQ(0u, TileMath::interleave(0, 0));
+    EXPECT_EQ(1u, TileMath::interleave(0, 1));
+    EXPECT_EQ(2u, TileMath::interleave(1, 0));
+    EXPECT_EQ(0xFFFFFFFFFFFFFFFFull, TileMath::interleave(0xFFFFFFFF, 0xFFFFFFFF));
+    EXPECT_EQ(0xAAAAAAAAAAAAAAAAull, TileMath::interleave(0xFFFFFFFF, 0));
+
+    uint32_t c, r;
+    TileMath::deinterleave(TileMath::interleave(0x12345678, 0x9abcdef0), c, r);
+    EXPECT_EQ(0x12345678u, c);
+    EXPECT_EQ(0x9abcdef0u, r);
+
+    // level 0: just the tile number
+    EXPECT_EQ(0u, tmm.getMortonKey(0, 0, 0));
+    EXPECT_EQ(1u, tmm.getMortonKey(1, 0, 0));
+
+    for (uint32_t level=0; level<=15; level++)
+    {
+        const uint32_t numCols = tmm.numColsAtLevel(level);
+        const uint32_t numRows = tmm.numRowsAtLevel(level);
+        for (uint32_t i=0; i<100; i++)
+        {
+            const uint32_t col = (i * 7919u) % numCols;
+            const uint32_t row = (i * 104729u) % numRows;
+
+            const uint64_t key = tmm.getMortonKey(col, row, level);
+            tmm.getTileOfMortonKey(key, level, c, r);
+            EXPECT_EQ(col, c);
+            EXPECT_EQ(row, r);
+
+            // the parent's key is a prefix of the child's
+            if (level > 0)
+            {
+                uint32_t pc, pr;
+                tmm.getParentOfTile(col, row, pc, pr);
+                EXPECT_EQ(tmm.getMortonKey(pc, pr, level-1), key >> 2);
+            }
+        }
+    }
+
+    // each child knows which quadrant it is
+    for (int q=0; q<4; q++)
+    {
+        tmm.getChildOfTile(3, 5, (TileMath::Quad)q, c, r);
+        EXPECT_EQ(q, TileMath::getQuadOfChild(c, r));
+    }
+}
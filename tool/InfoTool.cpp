@@ -37,6 +37,7 @@
 
 #include <iomanip>
 
+#include <rialto/Event.hpp>
 #include <rialto/GeoPackageCommon.hpp>
 #include <rialto/GeoPackageManager.hpp>
 #include <rialto/GeoPackageReader.hpp>
@@ -56,7 +57,9 @@ using namespace rialto;
 
 InfoTool::InfoTool() :
     Tool(),
-    m_tileInfo(false)
+    m_tileInfo(false),
+    m_summary(false),
+    m_approximate(false)
 {}
 
 
@@ -66,9 +69,13 @@ InfoTool::~InfoTool()
 
 void InfoTool::printUsage() const
 {
-    printf("Usage: $ rialto_info [-h/--help] [--tile level col row] filename\n");
+    printf("Usage: $ rialto_info [-h/--help] [--tile level col row]\n");
+    printf("           [--summary minx miny maxx maxy [--approximate]] filename\n");
     printf("where:\n");
     printf("  'filename' can be .las, .laz, or .gpkg\n");
+    printf("  --summary gives the count and ranges of the points in the box,\n");
+    printf("    from the tile index, decoding only the tiles across its edges\n");
+    printf("  --approximate decodes none, counting those by area instead\n");
 }
 
 
@@ -119,6 +126,25 @@ void InfoTool::printRialtoReader(const RialtoReader& reader) const
       << ", " << matrixSet.getNumRowsAtL0()
       << std::endl;
 
+    std::cout << "Tile encoding: "
+      << (matrixSet.getEncoding() == GpkgEncodingColumnar ? "columnar" : "packed")
+      << std::endl;
+
+    const GpkgTileFormat format(matrixSet.getTileFormat());
+    std::cout << "Tile compression (by level): "
+      << GpkgCodec::toList(format.getCodecs())
+      << std::endl;
+
+    if (format.isQuantized())
+    {
+        std::cout << "Quantization (scale x, y, z; offset z): "
+          << format.getScaleX()
+          << ", " << format.getScaleY()
+          << ", " << format.getScaleZ()
+          << "; " << format.getOffsetZ()
+          << std::endl;
+    }
+
     std::cout << "Dimensions: (position, name, type, min, mean, max)" << std::endl;
     for (auto dim: dims)
     {
@@ -176,6 +202,49 @@ void InfoTool::printRialtoReader(const RialtoReader& reader) const
         printf("                maxx, maxy: %f, %f\n", maxx, maxy);
 
   }
+
+    if (m_summary)
+    {
+        printSummary(matrixSet);
+    }
+}
+
+
+void InfoTool::printSummary(const GpkgMatrixSet& matrixSet) const
+{
+    LogPtr log(new Log("rialto_info", "stdout"));
+    GeoPackageReader db(m_inputName, log);
+    db.open();
+
+    const clock_t start = Event::timerStart();
+    GpkgSummary summary;
+    db.querySummary(matrixSet.getName(),
+                    m_summaryMinX, m_summaryMinY, m_summaryMaxX, m_summaryMaxY,
+                    matrixSet.getMaxLevel(), m_approximate, summary);
+    const double millis = Event::timerStop(start);
+
+    db.close();
+
+    std::cout << "Summary of box (minx, miny, maxx, maxy): "
+      << m_summaryMinX << ", " << m_summaryMinY << ", "
+      << m_summaryMaxX << ", " << m_summaryMaxY
+      << (summary.exact ? "" : " (approximate)")
+      << std::endl;
+    std::cout << "  Summary points: " << summary.numPoints << std::endl;
+    std::cout << "  Tiles (counted, decoded): "
+      << summary.numTilesCounted << ", " << summary.numTilesDecoded << std::endl;
+    if (summary.numPoints)
+    {
+        std::cout << "  Dimensions: (name, min, max)" << std::endl;
+        for (size_t i=0; i<summary.names.size(); i++)
+        {
+            std::cout << "    " << summary.names[i]
+              << ", " << summary.minimums[i]
+              << ", " << summary.maximums[i]
+              << std::endl;
+        }
+    }
+    std::cout << "  Time (ms): " << millis << std::endl;
 }
 
 
@@ -234,6 +303,18 @@ bool InfoTool::l_processOptions(int argc, char* argv[])
             m_tileColumn = atoi(argv[++i]);
             m_tileRow = atoi(argv[++i]);
         }
+        else if (streq(argv[i], "--summary"))
+        {
+            m_summary = true;
+            m_summaryMinX = atof(argv[++i]);
+            m_summaryMinY = atof(argv[++i]);
+            m_summaryMaxX = atof(argv[++i]);
+            m_summaryMaxY = atof(argv[++i]);
+        }
+        else if (streq(argv[i], "--approximate"))
+        {
+            m_approximate = true;
+        }
         m_inputName = std::string(argv[i]);
 
         ++i;
@@ -43,6 +43,7 @@ using namespace pdal;
 
 namespace rialto
 {
+    class GpkgMatrixSet;
     class RialtoReader;
 }
 using namespace rialto;
@@ -63,9 +64,16 @@ private:
     void printReader(const pdal::Stage&) const;
     void printLasReader(const pdal::LasReader&) const;
     void printRialtoReader(const rialto::RialtoReader&) const;
+    void printSummary(const rialto::GpkgMatrixSet&) const;
     
     bool m_tileInfo;
     uint32_t m_tileLevel;
     uint32_t m_tileColumn;
     uint32_t m_tileRow;
+    bool m_summary;
+    bool m_approximate;
+    double m_summaryMinX;
+    double m_summaryMinY;
+    double m_summaryMaxX;
+    double m_summaryMaxY;
 };
@@ -167,7 +167,8 @@ Stage* Tool::createReader(const std::string& name, FileType type)
 }
 
 
-Stage* Tool::createWriter(const std::string& fileName, FileType type, uint32_t maxLevel)
+Stage* Tool::createWriter(const std::string& fileName, FileType type, uint32_t maxLevel,
+                          uint32_t numThreads, uint32_t maxMemory, bool sorted)
 {
     FileUtils::deleteFile(fileName);
 
@@ -203,6 +204,9 @@ Stage* Tool::createWriter(const std::string& fileName, FileType type, uint32_t m
             opts.add("tms_miny", -90.0);
             opts.add("tms_maxx", 180.0);
             opts.add("tms_maxy", 90.0);
+            opts.add("threads", numThreads);
+            opts.add("max_memory", maxMemory);
+            opts.add("sorted", sorted);
             writer = new rialto::RialtoWriter();
             break;
         default:
@@ -66,7 +66,9 @@ protected:
     Stage* createReprojector();
     static FileType inferType(const std::string&);
     static Stage* createReader(const std::string& name, FileType type);
-    static Stage* createWriter(const std::string& name, FileType type, uint32_t maxLevel);
+    static Stage* createWriter(const std::string& name, FileType type, uint32_t maxLevel,
+                               uint32_t numThreads=1, uint32_t maxMemory=0,
+                               bool sorted=false);
 
     static void verify(Stage* readerExpected, Stage* readerActual);
 
@@ -54,6 +54,10 @@ TranslateTool::TranslateTool() :
     m_outputType(TypeInvalid),
     m_doVerify(false),
     m_maxLevel(15),
+    m_numThreads(1),
+    m_maxMemory(0),
+    m_doStream(false),
+    m_isSorted(false),
     m_doReprojection(true)
 {
 }
@@ -71,7 +75,11 @@ void TranslateTool::printSettings() const
     printf("Reprojection: %s\n", m_doReprojection ? "true" : "false");
     if (m_outputType == TypeRialto) {
         printf("Max level:    %d\n", m_maxLevel);
+        printf("Threads:      %d\n", m_numThreads);
+        printf("Max memory:   %d MB\n", m_maxMemory);
     }
+    printf("Streaming:    %s\n", m_doStream ? "true" : "false");
+    printf("Sorted:       %s\n", m_isSorted ? "true" : "false");
 }
 
 
@@ -85,7 +93,8 @@ void TranslateTool::run()
     {
         filter = createReprojector();
     }
-    pdal::Stage* writer = createWriter(m_outputName, m_outputType, m_maxLevel);
+    pdal::Stage* writer = createWriter(m_outputName, m_outputType, m_maxLevel, m_numThreads,
+                                       m_maxMemory, m_isSorted);
 
     if (filter)
     {
@@ -97,16 +106,26 @@ void TranslateTool::run()
         writer->setInput(*reader);        
     }
 
-    pdal::PointTable table;
-    writer->prepare(table);
-    PointViewSet pvs = writer->execute(table);
-    
-    uint32_t cnt = 0;
-    for (auto pv: pvs) {
-        cnt += pv->size();
+    if (m_doStream)
+    {
+        // the points go through the pipeline a buffer at a time
+        pdal::FixedPointTable table(10000);
+        writer->prepare(table);
+        writer->execute(table);
+    }
+    else
+    {
+        pdal::PointTable table;
+        writer->prepare(table);
+        PointViewSet pvs = writer->execute(table);
+
+        uint32_t cnt = 0;
+        for (auto pv: pvs) {
+            cnt += pv->size();
+        }
+
+        printf("Points processed: %u\n", cnt);
     }
-    
-    printf("Points processed: %u\n", cnt);
 
     delete writer;
     delete filter;
@@ -137,12 +156,26 @@ void TranslateTool::printUsage() const
     printf("           -o outfile\n");
     printf("           [-m|--maxlevel number]\n");
     printf("           [-n|--noreproj]\n");
+    printf("           [-s|--stream]\n");
+    printf("           [--sorted]\n");
+    printf("           [-t|--threads number]\n");
+    printf("           [--maxmemory number]\n");
     printf("           [-v|-verify]\n");
     printf("where:\n");
     printf("  -i: supports .las, .laz, or .gpkg\n");
     printf("  -o: supports .las, .laz, or .gpkg\n");
     printf("  -n | --noreproj: do not reproject to EPSG:4326\n");
     printf("  -m | --maxlevel: set the maximum resolution level (default: 15)\n");
+    printf("  -s | --stream: stream the points through, rather than reading them all first;\n");
+    printf("               unless --sorted, the tiles are only built after all the points\n");
+    printf("               are read, with the points over --maxmemory (default: 1024) MB\n");
+    printf("               kept in temporary files\n");
+    printf("  --sorted: the points come in Morton order of their tiles at the max level,\n");
+    printf("               so each part of the tree is built and written as soon as the\n");
+    printf("               points have gone past it\n");
+    printf("  -t | --threads: number of threads for building tiles (default: 1)\n");
+    printf("  --maxmemory: build the tiles within this many MB, using temporary files;\n");
+    printf("               the points of any one tile at the max level must fit\n");
     printf("  -v | --verify: run verification step\n");
 }
 
@@ -174,6 +207,32 @@ bool TranslateTool::l_processOptions(int argc, char* argv[])
         {
             m_maxLevel = atoi(argv[++i]);
         }
+        else if (streq(argv[i], "--threads") || streq(argv[i], "-t") )
+        {
+            const int n = atoi(argv[++i]);
+            if (n < 1)
+            {
+                error("invalid thread count", argv[i]);
+            }
+            m_numThreads = n;
+        }
+        else if (streq(argv[i], "--maxmemory"))
+        {
+            const int n = atoi(argv[++i]);
+            if (n < 1)
+            {
+                error("invalid memory size", argv[i]);
+            }
+            m_maxMemory = n;
+        }
+        else if (streq(argv[i], "--stream") || streq(argv[i], "-s"))
+        {
+            m_doStream = true;
+        }
+        else if (streq(argv[i], "--sorted"))
+        {
+            m_isSorted = true;
+        }
         else if (streq(argv[i], "--verify") || streq(argv[i], "-v"))
         {
             m_doVerify = true;
@@ -59,5 +59,9 @@ private:
 
     bool m_doVerify;
     uint32_t m_maxLevel;
+    uint32_t m_numThreads;
+    uint32_t m_maxMemory; // MB
+    bool m_doStream;
+    bool m_isSorted;
     bool m_doReprojection;
 };
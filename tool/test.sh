@@ -74,3 +74,7 @@ tester "verify generated geopackage for --maxlevel" \
 tester "check if translate --verify works for las to gpkg" \
     "$xlat -i $datadir/serp-small.las -o $tmpdir/a.gpkg --verify" \
     "Points processed: 326511"
+
+tester "check if info --summary counts the points in a box" \
+    "$info --summary -180 -90 180 90 $tmpdir/a.gpkg" \
+    "Summary points: 326511"